@@ -36,23 +36,47 @@ struct request {
 	struct buffer_head * bh;
 	struct buffer_head * bhtail;
 	struct request * next;
+	unsigned long start;	/* jiffies when queued */
 };
 
 /*
- * This is used in the elevator algorithm: Note that
- * reads always go before writes. This is natural: reads
- * are much more time-critical than writes.
+ * This is used in the elevator algorithm. Reads and writes are
+ * sorted together: the deadline scheduler takes care of getting
+ * reads through in time.
  */
 #define IN_ORDER(s1,s2) \
-((s1)->cmd < (s2)->cmd || ((s1)->cmd == (s2)->cmd && \
 ((s1)->dev < (s2)->dev || (((s1)->dev == (s2)->dev && \
-(s1)->sector < (s2)->sector)))))
+(s1)->sector < (s2)->sector)))
+
+struct blk_dev_struct;
+
+/*
+ * An I/O scheduler decides where a new request goes in a queue. The
+ * first request of a queue is (or is about to be) worked on by the
+ * driver and is never moved: add_request() is only called for a queue
+ * that isn't empty, and dispatch() (if there is one) may choose the
+ * request that is started after the first one.
+ */
+struct elevator {
+	const char * name;
+	void (*add_request)(struct blk_dev_struct * dev, struct request * req);
+	void (*dispatch)(struct blk_dev_struct * dev);
+};
 
 struct blk_dev_struct {
 	void (*request_fn)(void);
 	struct request * current_request;
+	struct elevator * elevator;
+	unsigned int max_sectors;	/* largest merged request, 0 = no merging */
+	int plugged;			/* requests held back, see plug_device() */
+	struct blk_dev_struct * plug_next;
 };
 
+extern struct elevator elevator_noop;
+extern struct elevator elevator_deadline;
+extern struct request * blk_next_request(struct request * req);
+extern void blk_request_done(struct request * req);
+
 
 struct sec_size {
 	unsigned block_size;
@@ -274,12 +298,10 @@ static void end_request(int uptodate)
 		}
 	}
 	DEVICE_OFF(req->dev);
-	CURRENT = req->next;
+	CURRENT = blk_next_request(req);
 	if ((p = req->waiting) != NULL) {
 		req->waiting = NULL;
-		p->state = TASK_RUNNING;
-		if (p->counter > current->counter)
-			need_resched = 1;
+		wake_up_process(p);
 	}
 	req->dev = -1;
 	wake_up(&wait_for_request);
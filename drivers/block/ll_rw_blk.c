@@ -74,6 +74,65 @@ int * blk_size[MAX_BLKDEV] = { NULL, NULL, };
  */
 int * blksize_size[MAX_BLKDEV] = { NULL, NULL, };
 
+/*
+ * Queue plugging. A burst of requests to an idle device is held in the
+ * queue instead of starting the first one on its own, so that the rest
+ * can be sorted and merged behind it. The queue is unplugged as soon as
+ * somebody has to wait for it (run_disk_queues() from __wait_on_buffer()
+ * and before sleeping on a free request), or else by plug_timer after
+ * PLUG_DELAY ticks, so that read-ahead and write-behind get going too.
+ */
+#define PLUG_DELAY	1
+
+static struct blk_dev_struct * plug_list = NULL;
+static struct timer_list plug_timer;
+static int plug_timer_armed = 0;
+
+/* interrupts must be disabled */
+static void plug_device(struct blk_dev_struct * dev)
+{
+	if (dev->current_request || dev->plugged)
+		return;
+	dev->plugged = 1;
+	dev->plug_next = plug_list;
+	plug_list = dev;
+	if (!plug_timer_armed) {
+		plug_timer_armed = 1;
+		plug_timer.expires = PLUG_DELAY;
+		add_timer(&plug_timer);
+	}
+}
+
+/*
+ * Start the drivers of all plugged queues.
+ */
+void run_disk_queues(void)
+{
+	struct blk_dev_struct * dev;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	while ((dev = plug_list) != NULL) {
+		plug_list = dev->plug_next;
+		dev->plug_next = NULL;
+		dev->plugged = 0;
+		if (dev->current_request)
+			(dev->request_fn)();
+	}
+	if (plug_timer_armed) {
+		plug_timer_armed = 0;
+		del_timer(&plug_timer);
+	}
+	restore_flags(flags);
+}
+
+static void plug_timeout(unsigned long unused)
+{
+	plug_timer_armed = 0;
+	run_disk_queues();
+}
+
 /*
  * look for a free request in the first N entries.
  * NOTE: interrupts must be disabled on the way in, and will still
@@ -114,8 +173,14 @@ static inline struct request * get_request_wait(int n, int dev)
 {
 	register struct request *req;
 
-	while ((req = get_request(n, dev)) == NULL)
+	while ((req = get_request(n, dev)) == NULL) {
+		if (plug_list) {
+			run_disk_queues();
+			cli();
+			continue;
+		}
 		sleep_on(&wait_for_request);
+	}
 	return req;
 }
 
@@ -145,44 +210,197 @@ void set_device_ro(int dev,int flag)
 }
 
 /*
- * add-request adds a request to the linked list.
- * It disables interrupts so that it can muck with the
- * request-lists in peace.
+ * Per-queue statistics, for /proc/iostats.
+ */
+static struct blk_queue_stats {
+	unsigned long requests;		/* requests queued */
+	unsigned long merges;		/* buffers and requests merged */
+	unsigned long expired;		/* requests moved up by their deadline */
+	unsigned long done;		/* requests completed */
+	unsigned long wait;		/* total time from queueing to completion */
+	unsigned long max_wait;
+	int max_depth;
+} queue_stats[MAX_BLKDEV];
+
+/*
+ * The noop scheduler: first come, first served. For devices where
+ * seeking is free, like the ramdisk.
+ */
+static void noop_add_request(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp;
+
+	for (tmp = dev->current_request ; tmp->next ; tmp = tmp->next)
+		/* nothing */;
+	tmp->next = req;
+}
+
+struct elevator elevator_noop = { "noop", noop_add_request, NULL };
+
+/*
+ * The deadline scheduler. Requests are kept in one-way elevator order,
+ * but every request also has a deadline: READ_EXPIRE after it was
+ * queued for reads, WRITE_EXPIRE for writes. When a request has waited
+ * past its deadline it is moved up to be started next, reads before
+ * writes and the oldest first, so a long sorted stream of writes can't
+ * starve the reads behind it (nor the other way round).
+ */
+#define READ_EXPIRE	(HZ/2)
+#define WRITE_EXPIRE	(5*HZ)
+
+static void deadline_dispatch(struct blk_dev_struct * dev)
+{
+	struct request * head, * prev, * tmp;
+	struct request * best = NULL, * best_prev = NULL;
+	unsigned long expires, best_expires = 0;
+
+	if (!(head = dev->current_request))
+		return;
+	for (prev = head ; (tmp = prev->next) != NULL ; prev = tmp) {
+		expires = tmp->start + (tmp->cmd == READ ? READ_EXPIRE : WRITE_EXPIRE);
+		if (expires > jiffies)
+			continue;
+		if (best) {
+			if (best->cmd == READ && tmp->cmd != READ)
+				continue;
+			if (best->cmd == tmp->cmd && expires >= best_expires)
+				continue;
+		}
+		best = tmp;
+		best_prev = prev;
+		best_expires = expires;
+	}
+	if (!best || best_prev == head)
+		return;
+	best_prev->next = best->next;
+	best->next = head->next;
+	head->next = best;
+	queue_stats[dev - blk_dev].expired++;
+}
+
+static void deadline_add_request(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp;
+
+	for (tmp = dev->current_request ; tmp->next ; tmp = tmp->next) {
+		if ((IN_ORDER(tmp,req) ||
+		    !IN_ORDER(tmp,tmp->next)) &&
+		    IN_ORDER(req,tmp->next))
+			break;
+	}
+	req->next = tmp->next;
+	tmp->next = req;
+	deadline_dispatch(dev);
+}
+
+struct elevator elevator_deadline = {
+	"deadline", deadline_add_request, deadline_dispatch
+};
+
+/*
+ * Account for a finished request. Called by end_request(), and by the
+ * SCSI drivers, which take requests off the queue when they start them.
+ */
+void blk_request_done(struct request * req)
+{
+	struct blk_queue_stats * st;
+	unsigned long wait;
+
+	if (MAJOR(req->dev) >= MAX_BLKDEV)
+		return;
+	st = queue_stats + MAJOR(req->dev);
+	wait = jiffies - req->start;
+	st->done++;
+	st->wait += wait;
+	if (wait > st->max_wait)
+		st->max_wait = wait;
+}
+
+/*
+ * end_request(): the first request of the queue is done. Let the
+ * scheduler pick what comes next, and return the new first request.
+ */
+struct request * blk_next_request(struct request * req)
+{
+	struct blk_dev_struct * dev = blk_dev + MAJOR(req->dev);
+	unsigned long flags;
+
+	blk_request_done(req);
+	save_flags(flags);
+	cli();
+	if (dev->current_request == req && dev->elevator->dispatch)
+		dev->elevator->dispatch(dev);
+	restore_flags(flags);
+	return req->next;
+}
+
+/*
+ * add-request adds a request to the queue, where the I/O scheduler
+ * of the queue wants it. It disables interrupts so that it can muck
+ * with the request-lists in peace.
  */
 static void add_request(struct blk_dev_struct * dev, struct request * req)
 {
+	struct blk_queue_stats * st = queue_stats + (dev - blk_dev);
 	struct request * tmp;
+	int depth;
 
 	req->next = NULL;
+	req->start = jiffies;
 	cli();
+	st->requests++;
 	if (req->bh)
 		req->bh->b_dirt = 0;
 	if (!(tmp = dev->current_request)) {
 		dev->current_request = req;
-		(dev->request_fn)();
+		if (!st->max_depth)
+			st->max_depth = 1;
+		if (!dev->plugged)
+			(dev->request_fn)();
 		sti();
 		return;
 	}
-	for ( ; tmp->next ; tmp = tmp->next) {
-		if ((IN_ORDER(tmp,req) ||
-		    !IN_ORDER(tmp,tmp->next)) &&
-		    IN_ORDER(req,tmp->next))
-			break;
-	}
-	req->next = tmp->next;
-	tmp->next = req;
+	dev->elevator->add_request(dev, req);
+	for (depth = 0 ; tmp ; tmp = tmp->next)
+		depth++;
+	if (depth > st->max_depth)
+		st->max_depth = depth;
 
 /* for SCSI devices, call request_fn unconditionally */
-	if (scsi_major(MAJOR(req->dev)))
+	if (scsi_major(MAJOR(req->dev)) && !dev->plugged)
 		(dev->request_fn)();
 
 	sti();
 }
 
+/*
+ * A request just grew at its end: if that makes it run into the next
+ * one in the queue, make the two into one.
+ */
+static void attempt_merge(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * next = req->next;
+
+	if (!next || next->dev != req->dev || next->cmd != req->cmd ||
+	    next->waiting || req->sector + req->nr_sectors != next->sector ||
+	    req->nr_sectors + next->nr_sectors > dev->max_sectors)
+		return;
+	req->bhtail->b_reqnext = next->bh;
+	req->bhtail = next->bhtail;
+	req->nr_sectors += next->nr_sectors;
+	if (next->start < req->start)
+		req->start = next->start;
+	req->next = next->next;
+	next->dev = -1;
+	queue_stats[dev - blk_dev].merges++;
+	wake_up(&wait_for_request);
+}
+
 static void make_request(int major,int rw, struct buffer_head * bh)
 {
 	unsigned int sector, count;
-	struct request * req;
+	struct blk_dev_struct * dev;
+	struct request * req, * prev;
 	int rw_ahead, max_req;
 
 /* WRITEA/READA is special case - it is not really needed, so if the */
@@ -224,49 +442,49 @@ static void make_request(int major,int rw, struct buffer_head * bh)
 repeat:
 	cli();
 
-/* The scsi disk drivers completely remove the request from the queue when
- * they start processing an entry.  For this reason it is safe to continue
- * to add links to the top entry for scsi devices.
+/* Try to merge the buffer into a queued request. Only queues that set
+ * max_sectors can take requests of more than one buffer. The first
+ * request is being worked on, unless the queue is plugged, or for scsi
+ * devices: their drivers completely remove a request from the queue
+ * when they start it.
  */
-	if ((major == HD_MAJOR
-	     || major == SCSI_DISK_MAJOR
-	     || major == SCSI_CDROM_MAJOR)
-	    && (req = blk_dev[major].current_request))
-	{
-	        if (major == HD_MAJOR)
+	dev = blk_dev + major;
+	if (dev->max_sectors && (req = dev->current_request)) {
+		if (!scsi_major(major) && !dev->plugged)
 			req = req->next;
+		prev = NULL;
 		while (req) {
 			if (req->dev == bh->b_dev &&
 			    !req->waiting &&
 			    req->cmd == rw &&
-			    req->sector + req->nr_sectors == sector &&
-			    req->nr_sectors < 254)
+			    req->nr_sectors + count <= dev->max_sectors)
 			{
-				req->bhtail->b_reqnext = bh;
-				req->bhtail = bh;
-				req->nr_sectors += count;
-				bh->b_dirt = 0;
-				sti();
-				return;
+				if (req->sector + req->nr_sectors == sector) {
+					req->bhtail->b_reqnext = bh;
+					req->bhtail = bh;
+					req->nr_sectors += count;
+					bh->b_dirt = 0;
+					queue_stats[major].merges++;
+					attempt_merge(dev, req);
+					sti();
+					return;
+				}
+				if (req->sector - count == sector) {
+					req->nr_sectors += count;
+					bh->b_reqnext = req->bh;
+					req->buffer = bh->b_data;
+					req->current_nr_sectors = count;
+					req->sector = sector;
+					bh->b_dirt = 0;
+					req->bh = bh;
+					queue_stats[major].merges++;
+					if (prev)
+						attempt_merge(dev, prev);
+					sti();
+					return;
+				}
 			}
-
-			if (req->dev == bh->b_dev &&
-			    !req->waiting &&
-			    req->cmd == rw &&
-			    req->sector - count == sector &&
-			    req->nr_sectors < 254)
-			{
-			    	req->nr_sectors += count;
-			    	bh->b_reqnext = req->bh;
-			    	req->buffer = bh->b_data;
-			    	req->current_nr_sectors = count;
-			    	req->sector = sector;
-			    	bh->b_dirt = 0;
-			    	req->bh = bh;
-			    	sti();
-			    	return;
-			}    
-
+			prev = req;
 			req = req->next;
 		}
 	}
@@ -281,6 +499,11 @@ repeat:
 			unlock_buffer(bh);
 			return;
 		}
+		if (plug_list) {
+			sti();
+			run_disk_queues();
+			goto repeat;
+		}
 		sleep_on(&wait_for_request);
 		sti();
 		goto repeat;
@@ -333,6 +556,7 @@ void ll_rw_page(int rw, int dev, int page, char * buffer)
 	req->next = NULL;
 	current->state = TASK_SWAPPING;
 	add_request(major+blk_dev,req);
+	run_disk_queues();
 	schedule();
 }
 
@@ -343,8 +567,6 @@ void ll_rw_page(int rw, int dev, int page, char * buffer)
 void ll_rw_block(int rw, int nr, struct buffer_head * bh[])
 {
 	unsigned int major;
-	struct request plug;
-	int plugged;
 	int correct_size;
 	struct blk_dev_struct * dev;
 	int i;
@@ -389,19 +611,13 @@ void ll_rw_block(int rw, int nr, struct buffer_head * bh[])
 		goto sorry;
 	}
 
-	/* If there are no pending requests for this device, then we insert
-	   a dummy request for that device.  This will prevent the request
-	   from starting until we have shoved all of the blocks into the
-	   queue, and then we let it rip.  */
+	/* If there are no pending requests for this device, plug the
+	   queue: the requests are held until the whole burst is in (see
+	   plug_device()), and then they go to the driver sorted and
+	   merged.  */
 
-	plugged = 0;
 	cli();
-	if (!dev->current_request && nr > 1) {
-		dev->current_request = &plug;
-		plug.dev = -1;
-		plug.next = NULL;
-		plugged = 1;
-	}
+	plug_device(dev);
 	sti();
 	for (i = 0; i < nr; i++) {
 		if (bh[i]) {
@@ -413,12 +629,6 @@ void ll_rw_block(int rw, int nr, struct buffer_head * bh[])
 				kstat.pgpgout++;
 		}
 	}
-	if (plugged) {
-		cli();
-		dev->current_request = plug.next;
-		(dev->request_fn)();
-		sti();
-	}
 	return;
 
       sorry:
@@ -468,13 +678,46 @@ void ll_rw_swap_file(int rw, int dev, unsigned int *b, int nb, char *buf)
 		req->next = NULL;
 		current->state = TASK_UNINTERRUPTIBLE;
 		add_request(major+blk_dev,req);
+		run_disk_queues();
 		schedule();
 	}
 }
 
+/*
+ * /proc/iostats: queue depth, merging and latency per block major.
+ */
+int get_iostats(char * buffer)
+{
+	struct blk_queue_stats * st;
+	struct request * req;
+	unsigned long flags;
+	int i, depth, len;
+
+	len = sprintf(buffer, "major elevator  depth max_depth   requests     merges"
+		"    expired       done avg_wait_ms max_wait_ms\n");
+	for (i = 0 ; i < MAX_BLKDEV ; i++) {
+		if (!blk_dev[i].request_fn)
+			continue;
+		st = queue_stats + i;
+		save_flags(flags);
+		cli();
+		depth = 0;
+		for (req = blk_dev[i].current_request ; req ; req = req->next)
+			depth++;
+		restore_flags(flags);
+		len += sprintf(buffer+len, "%5d %-8s %6d %9d %10lu %10lu %10lu %10lu %11lu %11lu\n",
+			i, blk_dev[i].elevator->name, depth, st->max_depth,
+			st->requests, st->merges, st->expired, st->done,
+			st->done ? st->wait / st->done * 1000 / HZ : 0,
+			st->max_wait * 1000 / HZ);
+	}
+	return len;
+}
+
 long blk_dev_init(long mem_start, long mem_end)
 {
     struct request * req;
+    int i;
 
     req = all_requests + NR_REQUEST;
     while (--req >= all_requests) {
@@ -482,6 +725,13 @@ long blk_dev_init(long mem_start, long mem_end)
         req->next = NULL;
     }
     memset(ro_bits,0,sizeof(ro_bits));
+    init_timer(&plug_timer);
+    plug_timer.function = plug_timeout;
+    for (i = 0; i < MAX_BLKDEV; i++)
+        blk_dev[i].elevator = &elevator_deadline;
+    blk_dev[HD_MAJOR].max_sectors = 254;
+    blk_dev[SCSI_DISK_MAJOR].max_sectors = 254;
+    blk_dev[SCSI_CDROM_MAJOR].max_sectors = 254;
     mem_start = hd_init(mem_start, mem_end);
 #ifdef CONFIG_BLK_DEV_XD
     mem_start = xd_init(mem_start,mem_end);
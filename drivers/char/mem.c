@@ -95,7 +95,7 @@ static int mmap_mem(struct inode * inode, struct file * file,
 	if (remap_page_range(addr, off, len, prot))
 		return -EAGAIN;
 /* try to create a dummy vmm-structure so that the rest of the kernel knows we are here */
-	mpnt = (struct vm_area_struct * ) kmalloc(sizeof(struct vm_area_struct), GFP_KERNEL);
+	mpnt = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 	if (!mpnt)
 		return 0;
 
@@ -189,7 +189,7 @@ static int mmap_zero(struct inode * inode, struct file * file,
 	 * try to create a dummy vmm-structure so that the
 	 * rest of the kernel knows we are here
 	 */
-	mpnt = (struct vm_area_struct *)kmalloc(sizeof(*mpnt), GFP_KERNEL);
+	mpnt = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 	if (!mpnt)
 		return 0;
 
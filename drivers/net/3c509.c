@@ -603,7 +603,7 @@ el3_rx(struct device *dev)
 					continue;
 				} else {
 					printk("%s: receive buffers full.\n", dev->name);
-					kfree_s(skb, sksize);
+					kfree_skbmem(skb, sksize);
 				}
 #endif
 			} else if (el3_debug)
@@ -704,7 +704,7 @@ static void net_rx(struct device *dev)
 #else
 		skb->lock = 0;
 		if (dev_rint((unsigned char*)skb, pkt_len, IN_SKBUFF, dev) != 0) {
-			kfree_s(skb, sksize);
+			kfree_skbmem(skb, sksize);
 			lp->stats.rx_dropped++;
 			break;
 		}
@@ -797,7 +797,7 @@ DMAbuf_reset_dma (int chan)
 
 /*
  * The sound_mem_init() is called by mem_init() immediately after mem_map is
- * initialized and before free_page_list is created.
+ * initialized and before the free page lists are built.
  * 
  * This routine allocates DMA buffers at the end of available physical memory (
  * <16M) and marks pages reserved at mem_map.
@@ -26,8 +26,10 @@
 #include <linux/string.h>
 #include <linux/locks.h>
 #include <linux/errno.h>
+#include <linux/mm.h>
 
 #include <asm/system.h>
+#include <asm/segment.h>
 #include <asm/io.h>
 
 #ifdef CONFIG_SCSI
@@ -48,17 +50,108 @@ extern int check_mcd_media_change(int, int);
 
 static int grow_buffers(int pri, int size);
 
-static struct buffer_head * hash_table[NR_HASH];
-static struct buffer_head * free_list = NULL;
+static int buffersize_index[9] = {-1,  0,  1, -1,  2, -1, -1, -1, 3};
+#define BUFSIZE_INDEX(X) (buffersize_index[(X)>>9])
+
+/*
+ * The hash table starts out at MIN_HASH_BITS and is doubled by
+ * grow_buffers() whenever the average chain would get longer than two.
+ */
+#define MIN_HASH_BITS 10
+#define MAX_HASH_BITS 16
+
+static struct buffer_head * hash_table_init[1 << MIN_HASH_BITS];
+static struct buffer_head ** hash_table = hash_table_init;
+static int hash_bits = MIN_HASH_BITS;
+static int hash_resizing = 0;
+
+/*
+ * Per-device buffer cache statistics, exported through /proc/buffers.
+ * Devices are hashed into a small fixed table; once it is full, the
+ * rest are accounted to the last ("other") slot.
+ */
+#define NR_BUF_STATS 32
+
+static struct buffer_stats {
+	dev_t dev;
+	unsigned long hits;		/* getblk() found the block cached */
+	unsigned long misses;		/* getblk() had to take a new buffer */
+	unsigned long evictions;	/* cached blocks thrown out for reuse */
+	unsigned long writebacks;	/* dirty buffers written back */
+	unsigned long badsize;		/* lookups with the wrong block size */
+	unsigned long ra_blocks;	/* blocks started by file read-ahead */
+	unsigned long ra_hits;		/* file pages found already read ahead */
+	unsigned long ra_misses;	/* file pages that had to be read */
+} buffer_stats[NR_BUF_STATS+1];
+
+static struct buffer_stats * buf_stats(dev_t dev)
+{
+	struct buffer_stats * st;
+	int i, n;
+
+	i = ((dev * 0x9e370001UL) >> 27) % NR_BUF_STATS;
+	for (n = NR_BUF_STATS ; n-- > 0 ; i = (i + 1) % NR_BUF_STATS) {
+		st = buffer_stats + i;
+		if (st->dev == dev)
+			return st;
+		if (!st->dev) {
+			st->dev = dev;
+			return st;
+		}
+	}
+	return buffer_stats + NR_BUF_STATS;
+}
+
+/*
+ * Read-ahead accounting for the page cache (mm/filemap.c).
+ */
+void readahead_stats(dev_t dev, int blocks, int hits, int misses)
+{
+	struct buffer_stats * st = buf_stats(dev);
+
+	st->ra_blocks += blocks;
+	st->ra_hits += hits;
+	st->ra_misses += misses;
+}
+
+static struct buffer_head * lru_list[NR_SIZES][NR_LIST] = {{NULL, }, };
 static struct buffer_head * unused_list = NULL;
 static struct wait_queue * buffer_wait = NULL;
 
 int nr_buffers = 0;
 int buffermem = 0;
 int nr_buffer_heads = 0;
+static int nr_buffers_lru[NR_SIZES][NR_LIST] = {{0, }, };
+static int nr_buffers_type[NR_LIST] = {0, };
 static int min_free_pages = 20;	/* nr free pages needed before buffer grows */
 extern int *blksize_size[];
 
+/*
+ * Tuning parameters of the dirty-buffer flusher, settable through
+ * sys_bdflush(). Times are in jiffies.
+ */
+static union bdflush_param {
+	struct {
+		int nfract;	/* percentage of the cache dirty before
+				   bdflush is woken up */
+		int ndirty;	/* max buffers written per bdflush pass */
+		int age_buffer;	/* age of a dirty buffer before bdflush
+				   writes it back anyway */
+		int interval;	/* time between periodic bdflush passes */
+	} b_un;
+	unsigned int data[4];
+} bdf_prm = {{40, 500, 30*HZ, 5*HZ}};
+
+#define N_PARAM (sizeof(bdf_prm.data)/sizeof(bdf_prm.data[0]))
+
+static int bdflush_min[N_PARAM] = {  0,   10,      HZ,     HZ};
+static int bdflush_max[N_PARAM] = {100, 5000, 600*HZ, 600*HZ};
+
+static struct task_struct * bdflush_tsk = NULL;
+static struct wait_queue * bdflush_wait = NULL;
+static struct wait_queue * bdflush_done = NULL;
+static int bdflush_kicked = 0;
+
 /*
  * Rewrote the wait-routines to use the "new" wait-queue functionality,
  * and getting rid of the cli-sti pairs. The wait-queue routines still
@@ -72,6 +165,7 @@ void __wait_on_buffer(struct buffer_head * bh)
 {
 	struct wait_queue wait = { current, NULL };
 
+	run_disk_queues();
 	bh->b_count++;
 	add_wait_queue(&bh->b_wait, &wait);
 repeat:
@@ -92,7 +186,8 @@ repeat:
 static int sync_buffers(dev_t dev, int wait)
 {
 	int i, retry, pass = 0, err = 0;
-	struct buffer_head * bh;
+	int isize, nlist;
+	struct buffer_head * bh, * next;
 
 	/* One pass for no-wait, three for wait:
 	   0) write out all dirty, unlocked buffers;
@@ -101,42 +196,56 @@ static int sync_buffers(dev_t dev, int wait)
 	 */
 repeat:
 	retry = 0;
-	bh = free_list;
-	for (i = nr_buffers*2 ; i-- > 0 ; bh = bh->b_next_free) {
-		if (dev && bh->b_dev != dev)
+	for (isize = 0 ; isize < NR_SIZES ; isize++)
+	for (nlist = 0 ; nlist < NR_LIST ; nlist++) {
+	repeat1:
+		bh = lru_list[isize][nlist];
+		if (!bh)
 			continue;
+		for (i = nr_buffers_lru[isize][nlist]*2 ; i-- > 0 ; bh = next) {
+			/* The buffer moved to another list while we slept */
+			if (bh->b_list != nlist)
+				goto repeat1;
+			next = bh->b_next_free;
+			if (!lru_list[isize][nlist])
+				break;
+			if (dev && bh->b_dev != dev)
+				continue;
 #if 0 /* Disable bad-block debugging code */
-		if (bh->b_req && !bh->b_lock &&
-		    !bh->b_dirt && !bh->b_uptodate)
-			printk ("Warning (IO error) - orphaned block %08x on %04x\n",
-				bh->b_blocknr, bh->b_dev);
+			if (bh->b_req && !bh->b_lock &&
+			    !bh->b_dirt && !bh->b_uptodate)
+				printk ("Warning (IO error) - orphaned block %08x on %04x\n",
+					bh->b_blocknr, bh->b_dev);
 #endif
-		if (bh->b_lock)
-		{
-			/* Buffer is locked; skip it unless wait is
-			   requested AND pass > 0. */
-			if (!wait || !pass) {
-				retry = 1;
+			if (bh->b_lock)
+			{
+				/* Buffer is locked; skip it unless wait is
+				   requested AND pass > 0. */
+				if (!wait || !pass) {
+					retry = 1;
+					continue;
+				}
+				wait_on_buffer (bh);
+			}
+			/* If an unlocked buffer is not uptodate, there has been 
+			   an IO error. Skip it. */
+			if (wait && bh->b_req && !bh->b_lock &&
+			    !bh->b_dirt && !bh->b_uptodate)
+			{
+				err = 1;
 				continue;
 			}
-			wait_on_buffer (bh);
-		}
-		/* If an unlocked buffer is not uptodate, there has been 
-		   an IO error. Skip it. */
-		if (wait && bh->b_req && !bh->b_lock &&
-		    !bh->b_dirt && !bh->b_uptodate)
-		{
-			err = 1;
-			continue;
+			/* Don't write clean buffers.  Don't write ANY buffers
+			   on the third pass. */
+			if (!bh->b_dirt || pass>=2)
+				continue;
+			bh->b_count++;
+			buf_stats(bh->b_dev)->writebacks++;
+			ll_rw_block(WRITE, 1, &bh);
+			bh->b_count--;
+			refile_buffer(bh);
+			retry = 1;
 		}
-		/* Don't write clean buffers.  Don't write ANY buffers
-		   on the third pass. */
-		if (!bh->b_dirt || pass>=2)
-			continue;
-		bh->b_count++;
-		ll_rw_block(WRITE, 1, &bh);
-		bh->b_count--;
-		retry = 1;
 	}
 	/* If we are waiting for the sync to succeed, and if any dirty
 	   blocks were written, then repeat; on the second pass, only
@@ -190,16 +299,27 @@ asmlinkage int sys_fsync(unsigned int fd)
 
 void invalidate_buffers(dev_t dev)
 {
-	int i;
-	struct buffer_head * bh;
-
-	bh = free_list;
-	for (i = nr_buffers*2 ; --i > 0 ; bh = bh->b_next_free) {
-		if (bh->b_dev != dev)
+	int i, isize, nlist;
+	struct buffer_head * bh, * next;
+
+	for (isize = 0 ; isize < NR_SIZES ; isize++)
+	for (nlist = 0 ; nlist < NR_LIST ; nlist++) {
+	repeat:
+		bh = lru_list[isize][nlist];
+		if (!bh)
 			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dev == dev)
-			bh->b_uptodate = bh->b_dirt = bh->b_req = 0;
+		for (i = nr_buffers_lru[isize][nlist]*2 ; --i > 0 ; bh = next) {
+			if (bh->b_list != nlist)
+				goto repeat;
+			next = bh->b_next_free;
+			if (!lru_list[isize][nlist])
+				break;
+			if (bh->b_dev != dev)
+				continue;
+			wait_on_buffer(bh);
+			if (bh->b_dev == dev)
+				bh->b_uptodate = bh->b_dirt = bh->b_req = 0;
+		}
 	}
 }
 
@@ -280,9 +400,59 @@ void check_disk_change(dev_t dev)
 #endif
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+/*
+ * Multiplicative hash: consecutive blocks of one device and the same block
+ * on different devices both end up spread over the whole table.
+ */
+#define _hashfn(dev,block) \
+	(((((unsigned long)(dev) << 16) ^ (unsigned long)(block)) * 0x9e370001UL) \
+	 >> (32 - hash_bits))
 #define hash(dev,block) hash_table[_hashfn(dev,block)]
 
+/*
+ * Double the hash table. The new table is allocated first (which may
+ * sleep), and the chains are then moved over with interrupts off.
+ */
+static void resize_hash_table(void)
+{
+	struct buffer_head ** new_table, ** old_table;
+	struct buffer_head * bh, * next;
+	unsigned long flags;
+	int i, old_bits, new_bits;
+
+	if (hash_resizing || hash_bits >= MAX_HASH_BITS)
+		return;
+	hash_resizing = 1;
+	new_bits = hash_bits + 1;
+	new_table = (struct buffer_head **)
+		vmalloc(sizeof(struct buffer_head *) << new_bits);
+	if (!new_table) {
+		hash_resizing = 0;
+		return;
+	}
+	memset(new_table, 0, sizeof(struct buffer_head *) << new_bits);
+	save_flags(flags);
+	cli();
+	old_table = hash_table;
+	old_bits = hash_bits;
+	hash_table = new_table;
+	hash_bits = new_bits;
+	for (i = 0 ; i < (1 << old_bits) ; i++) {
+		for (bh = old_table[i] ; bh ; bh = next) {
+			next = bh->b_next;
+			bh->b_prev = NULL;
+			bh->b_next = hash(bh->b_dev, bh->b_blocknr);
+			hash(bh->b_dev, bh->b_blocknr) = bh;
+			if (bh->b_next)
+				bh->b_next->b_prev = bh;
+		}
+	}
+	restore_flags(flags);
+	if (old_table != hash_table_init)
+		vfree(old_table);
+	hash_resizing = 0;
+}
+
 static inline void remove_from_hash_queue(struct buffer_head * bh)
 {
     if (bh->b_next)
@@ -294,68 +464,124 @@ static inline void remove_from_hash_queue(struct buffer_head * bh)
     bh->b_next = bh->b_prev = NULL;
 }
 
-static inline void remove_from_free_list(struct buffer_head * bh)
+static inline void remove_from_lru_list(struct buffer_head * bh)
 {
+    struct buffer_head ** head;
+
     if (!(bh->b_prev_free) || !(bh->b_next_free))
-        panic("VFS: Free block list corrupted");
+        panic("VFS: LRU block list corrupted");
+    head = &lru_list[BUFSIZE_INDEX(bh->b_size)][bh->b_list];
     bh->b_prev_free->b_next_free = bh->b_next_free;
     bh->b_next_free->b_prev_free = bh->b_prev_free;
-    if (free_list == bh)
-        free_list = bh->b_next_free;
+    if (*head == bh)
+        *head = bh->b_next_free;
+    if (*head == bh)
+        *head = NULL;
     bh->b_next_free = bh->b_prev_free = NULL;
+    nr_buffers_lru[BUFSIZE_INDEX(bh->b_size)][bh->b_list]--;
+    nr_buffers_type[bh->b_list]--;
 }
 
-static inline void remove_from_queues(struct buffer_head * bh)
+/* add to the back (the most recently used end) of its LRU list */
+static inline void put_last_lru(struct buffer_head * bh)
 {
-    remove_from_hash_queue(bh);
-    remove_from_free_list(bh);
+    struct buffer_head ** head;
+
+    head = &lru_list[BUFSIZE_INDEX(bh->b_size)][bh->b_list];
+    if (!*head) {
+        *head = bh;
+        bh->b_prev_free = bh;
+    }
+    bh->b_next_free = *head;
+    bh->b_prev_free = (*head)->b_prev_free;
+    (*head)->b_prev_free->b_next_free = bh;
+    (*head)->b_prev_free = bh;
+    nr_buffers_lru[BUFSIZE_INDEX(bh->b_size)][bh->b_list]++;
+    nr_buffers_type[bh->b_list]++;
 }
 
-static inline void put_first_free(struct buffer_head * bh)
+static inline void remove_from_queues(struct buffer_head * bh)
 {
-	if (!bh || (bh == free_list))
-		return;
-	remove_from_free_list(bh);
-/* add to front of free list */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
-	free_list = bh;
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    remove_from_hash_queue(bh);
+    remove_from_lru_list(bh);
+    restore_flags(flags);
 }
 
-static inline void put_last_free(struct buffer_head * bh)
+/*
+ * Move a buffer to the most recently used end of its LRU list.
+ */
+static inline void touch_buffer(struct buffer_head * bh)
 {
-    if (!bh)
-        return;
-    if (bh == free_list) {
-        free_list = bh->b_next_free;
-        return;
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    if (bh->b_next_free) {
+        remove_from_lru_list(bh);
+        put_last_lru(bh);
     }
-    remove_from_free_list(bh);
-    /* add to back of free list */
-    bh->b_next_free = free_list;
-    bh->b_prev_free = free_list->b_prev_free;
-    free_list->b_prev_free->b_next_free = bh;
-    free_list->b_prev_free = bh;
+    restore_flags(flags);
 }
 
 static inline void insert_into_queues(struct buffer_head * bh)
 {
-    /* put at end of free list */
-    bh->b_next_free = free_list;
-    bh->b_prev_free = free_list->b_prev_free;
-    free_list->b_prev_free->b_next_free = bh;
-    free_list->b_prev_free = bh;
+    unsigned long flags;
+
+    save_flags(flags);
+    cli();
+    /* put at end of its LRU list */
+    bh->b_list = BUF_CLEAN;
+    if (bh->b_lock)
+        bh->b_list = BUF_LOCKED;
+    else if (bh->b_dirt)
+        bh->b_list = BUF_DIRTY;
+    put_last_lru(bh);
     /* put the buffer in new hash-queue if it has a device */
     bh->b_prev = NULL;
     bh->b_next = NULL;
-    if (!bh->b_dev)
-        return;
-    bh->b_next = hash(bh->b_dev, bh->b_blocknr);
-    hash(bh->b_dev, bh->b_blocknr) = bh;
-    if (bh->b_next)
-        bh->b_next->b_prev = bh;
+    if (bh->b_dev) {
+        bh->b_next = hash(bh->b_dev, bh->b_blocknr);
+        hash(bh->b_dev, bh->b_blocknr) = bh;
+        if (bh->b_next)
+            bh->b_next->b_prev = bh;
+    }
+    restore_flags(flags);
+}
+
+/*
+ * Put a buffer on the LRU list matching its state: interrupts unlock
+ * buffers and filesystems mark them dirty without telling us, so this
+ * is called whenever a buffer is released, unlocked or found on the
+ * wrong list.
+ */
+void refile_buffer(struct buffer_head * bh)
+{
+    unsigned long flags;
+    unsigned int dispose;
+
+    if (bh->b_lock)
+        dispose = BUF_LOCKED;
+    else if (bh->b_dirt)
+        dispose = BUF_DIRTY;
+    else
+        dispose = BUF_CLEAN;
+    save_flags(flags);
+    cli();
+    if (bh->b_next_free && dispose != bh->b_list) {
+        remove_from_lru_list(bh);
+        bh->b_list = dispose;
+        if (dispose == BUF_DIRTY)
+            bh->b_flushtime = jiffies + bdf_prm.b_un.age_buffer;
+        put_last_lru(bh);
+    }
+    restore_flags(flags);
+    if (dispose == BUF_DIRTY &&
+        nr_buffers_type[BUF_DIRTY] * 100 > nr_buffers * bdf_prm.b_un.nfract)
+        wakeup_bdflush(0);
 }
 
 static struct buffer_head * find_buffer(dev_t dev, int block, int size)
@@ -367,6 +593,7 @@ static struct buffer_head * find_buffer(dev_t dev, int block, int size)
             if (tmp->b_size == size)
                 return tmp;
             else {
+                buf_stats(dev)->badsize++;
                 printk("VFS: Wrong blocksize on device %d/%d\n",
                          MAJOR(dev), MINOR(dev));
                 return NULL;
@@ -400,7 +627,7 @@ struct buffer_head * get_hash_table(dev_t dev, int block, int size)
 
 void set_blocksize(dev_t dev, int size)
 {
-    int i;
+    int i, isize, nlist;
     struct buffer_head * bh, *bhnext;
 
     if (!blksize_size[MAJOR(dev)])
@@ -422,23 +649,32 @@ void set_blocksize(dev_t dev, int size)
 
     /* 
      * We need to be quite careful how we do this - we are moving 
-     * entries around on the free list, and we can get in a loop if we 
+     * entries around on the LRU lists, and we can get in a loop if we 
      * are not careful.
      */
 
-    bh = free_list;
-    for (i = nr_buffers * 2 ; --i > 0 ; bh = bhnext) {
-        bhnext = bh->b_next_free; 
-        if (bh->b_dev != dev)
-            continue;
-        if (bh->b_size == size)
+    for (isize = 0 ; isize < NR_SIZES ; isize++)
+    for (nlist = 0 ; nlist < NR_LIST ; nlist++) {
+    repeat:
+        bh = lru_list[isize][nlist];
+        if (!bh)
             continue;
-
-        wait_on_buffer(bh);
-        if (bh->b_dev == dev && bh->b_size != size)
-            bh->b_uptodate = bh->b_dirt = 0;
-        remove_from_hash_queue(bh);
-     /* put_first_free(bh); */
+        for (i = nr_buffers_lru[isize][nlist] * 2 ; --i > 0 ; bh = bhnext) {
+            if (bh->b_list != nlist)
+                goto repeat;
+            bhnext = bh->b_next_free; 
+            if (!lru_list[isize][nlist])
+                break;
+            if (bh->b_dev != dev)
+                continue;
+            if (bh->b_size == size)
+                continue;
+
+            wait_on_buffer(bh);
+            if (bh->b_dev == dev && bh->b_size != size)
+                bh->b_uptodate = bh->b_dirt = 0;
+            remove_from_hash_queue(bh);
+        }
     }
 }
 
@@ -452,69 +688,132 @@ void set_blocksize(dev_t dev, int size)
  * 14.02.92: changed it to sync dirty buffers a bit: better performance
  * when the filesystem starts to get full of dirty blocks (I hope).
  */
-#define BADNESS(bh) (((bh)->b_dirt<<1)+(bh)->b_lock)
+static struct buffer_head * find_clean_buffer(int size)
+{
+    struct buffer_head * bh, * next;
+    int isize = BUFSIZE_INDEX(size);
+    int i;
+
+    bh = lru_list[isize][BUF_CLEAN];
+    for (i = nr_buffers_lru[isize][BUF_CLEAN] ; i-- > 0 && bh ; bh = next) {
+        next = bh->b_next_free;
+        if (bh->b_lock || bh->b_dirt) {
+            refile_buffer(bh);
+            continue;
+        }
+        /* in use, or sharing its page with a code page: look later */
+        if (bh->b_count ||
+            mem_map[MAP_NR((unsigned long) bh->b_data)] != 1) {
+            touch_buffer(bh);
+            continue;
+        }
+        return bh;
+    }
+    return NULL;
+}
+
+/*
+ * Write back some dirty buffers of the given size ourselves. This is
+ * only done when no bdflush is running to do it for us.
+ */
+static void write_some_buffers(int size)
+{
+    struct buffer_head * bh, * next;
+    int isize = BUFSIZE_INDEX(size);
+    int i, n;
+
+    bh = lru_list[isize][BUF_DIRTY];
+    n = bdf_prm.b_un.ndirty;
+    for (i = nr_buffers_lru[isize][BUF_DIRTY] ; i-- > 0 && n > 0 && bh ; bh = next) {
+        next = bh->b_next_free;
+        if (bh->b_lock || !bh->b_dirt) {
+            refile_buffer(bh);
+            continue;
+        }
+        bh->b_count++;
+        buf_stats(bh->b_dev)->writebacks++;
+        ll_rw_block(WRITE, 1, &bh);
+        bh->b_count--;
+        refile_buffer(bh);
+        n--;
+    }
+}
+
+/*
+ * Ok, this is getblk, and it isn't very clear, again to hinder
+ * race-conditions. Most of the code is seldom used, (ie repeating),
+ * so it should be much more efficient than it looks.
+ *
+ * A buffer to reuse is taken from the head of the clean LRU list for
+ * this size. Dirty buffers are never written from here unless there is
+ * no bdflush: when only dirty buffers are left we kick bdflush and wait
+ * for it to clean some, instead of syncing every device.
+ */
 struct buffer_head * getblk(dev_t dev, int block, int size)
 {
-    struct buffer_head * bh, * tmp;
-    int buffers;
+    struct buffer_head * bh;
+    int isize = BUFSIZE_INDEX(size);
+    int missed = 0;
     static int grow_size = 0;
 
 repeat:
     bh = get_hash_table(dev, block, size);
     if (bh) {
+        if (!missed)
+            buf_stats(dev)->hits++;
         if (bh->b_uptodate && !bh->b_dirt)
-            put_last_free(bh);
+            touch_buffer(bh);
         return bh;
     }
+    if (!missed) {
+        buf_stats(dev)->misses++;
+        missed = 1;
+    }
     grow_size -= size;
     if (nr_free_pages > min_free_pages && grow_size <= 0) {
         if (grow_buffers(GFP_BUFFER, size))
             grow_size = PAGE_SIZE;
     }
-    buffers = nr_buffers;
-    bh = NULL;
-
-    for (tmp = free_list; buffers-- > 0; tmp = tmp->b_next_free) {
-        if (tmp->b_count || tmp->b_size != size)
-            continue;
-        if (mem_map[MAP_NR((unsigned long) tmp->b_data)] != 1)
-            continue;
-        if (!bh || BADNESS(tmp) < BADNESS(bh)) {
-            bh = tmp;
-            if (!BADNESS(tmp))
-                break;
-        }
-#if 0
-        if (tmp->b_dirt) {
-            tmp->b_count++;
-            ll_rw_block(WRITEA, 1, &tmp);
-            tmp->b_count--;
-        }
-#endif
-    }
 
+    bh = find_clean_buffer(size);
     if (!bh) {
         if (nr_free_pages > 5)
             if (grow_buffers(GFP_BUFFER, size))
                 goto repeat;
-        if (!grow_buffers(GFP_ATOMIC, size))
+        if (nr_buffers_lru[isize][BUF_DIRTY]) {
+            if (bdflush_tsk && bdflush_tsk != current)
+                wakeup_bdflush(1);
+            else
+                write_some_buffers(size);
+            goto repeat;
+        }
+        if (grow_buffers(GFP_ATOMIC, size))
+            goto repeat;
+        /*
+         * Nothing to reuse but buffers under I/O: their unlock puts
+         * them back on the clean list without waking buffer_wait,
+         * so wait for the oldest one itself.
+         */
+        if ((bh = lru_list[isize][BUF_LOCKED]) != NULL) {
+            bh->b_count++;
+            wait_on_buffer(bh);
+            bh->b_count--;
+        } else
             sleep_on(&buffer_wait);
         goto repeat;
     }
 
     wait_on_buffer(bh);
-    if (bh->b_count || bh->b_size != size)
-        goto repeat;
-    if (bh->b_dirt) {
-        sync_buffers(0,0);
+    if (bh->b_count || bh->b_size != size || bh->b_dirt)
         goto repeat;
-    }
 /* NOTE!! While we slept waiting for this block, somebody else might */
 /* already have added "this" block to the cache. check it */
     if (find_buffer(dev, block, size))
         goto repeat;
 /* OK, FINALLY we know that this buffer is the only one of its kind, */
 /* and that it's unused (b_count=0), unlocked (b_lock=0), and clean */
+    if (bh->b_dev)
+        buf_stats(bh->b_dev)->evictions++;
     bh->b_count = 1;
     bh->b_dirt = 0;
     bh->b_uptodate = 0;
@@ -534,6 +833,7 @@ void brelse(struct buffer_head * buf)
     if (buf->b_count) {
         if (--buf->b_count)
             return;
+        refile_buffer(buf);
         wake_up(&buffer_wait);
         return;
     }
@@ -839,9 +1139,7 @@ __asm__ __volatile__("rep ; movsl": \
  */
 unsigned long bread_page(unsigned long address, dev_t dev, int b[], int size, int prot)
 {
-	struct buffer_head * bh[8];
 	unsigned long where;
-	int i, j;
 
 	if (!(prot & PAGE_RW)) {
 		where = try_to_share_buffers(address,dev,b,size);
@@ -849,21 +1147,40 @@ unsigned long bread_page(unsigned long address, dev_t dev, int b[], int size, in
 			return where;
 	}
 	++current->maj_flt;
+	read_page_blocks(address, dev, b, size);
+	return address;
+}
+
+/*
+ * Read the blocks b[] into the page at 'address', all at the same time.
+ * Zero block numbers are holes and leave the page alone. Returns -EIO if
+ * any block could not be read, otherwise the number of blocks that were
+ * neither cached nor already being read in (by read-ahead).
+ */
+int read_page_blocks(unsigned long address, dev_t dev, int b[], int size)
+{
+	struct buffer_head * bh[8];
+	int i, j, error = 0, started = 0;
+
  	for (i=0, j=0; j<PAGE_SIZE ; i++, j+= size) {
 		bh[i] = NULL;
-		if (b[i])
+		if (b[i]) {
 			bh[i] = getblk(dev, b[i], size);
+			if (!bh[i]->b_uptodate && !bh[i]->b_lock)
+				started++;
+		}
 	}
 	read_buffers(bh,i);
-	where = address;
  	for (i=0, j=0; j<PAGE_SIZE ; i++, j += size,address += size) {
 		if (bh[i]) {
 			if (bh[i]->b_uptodate)
 				COPYBLK(size, (unsigned long) bh[i]->b_data,address);
+			else
+				error = -EIO;
 			brelse(bh[i]);
 		}
 	}
-	return where;
+	return error ? error : started;
 }
 
 /*
@@ -888,16 +1205,10 @@ static int grow_buffers(int pri, int size)
     }
     tmp = bh;
     while (1) {
-        if (free_list) {
-            tmp->b_next_free = free_list;
-            tmp->b_prev_free = free_list->b_prev_free;
-            free_list->b_prev_free->b_next_free = tmp;
-            free_list->b_prev_free = tmp;
-        } else {
-            tmp->b_prev_free = tmp;
-            tmp->b_next_free = tmp;
-        }
-        free_list = tmp;
+        tmp->b_list = BUF_CLEAN;
+        put_last_lru(tmp);
+        /* fresh buffers go to the head, so they are used first */
+        lru_list[BUFSIZE_INDEX(size)][BUF_CLEAN] = tmp;
         ++nr_buffers;
         if (tmp->b_this_page)
             tmp = tmp->b_this_page;
@@ -906,6 +1217,8 @@ static int grow_buffers(int pri, int size)
     }
     tmp->b_this_page = bh;
     buffermem += PAGE_SIZE;
+    if (pri != GFP_ATOMIC && nr_buffers > (2 << hash_bits))
+        resize_hash_table();
     return 1;
 }
 
@@ -934,6 +1247,8 @@ static int try_to_free(struct buffer_head * bh, struct buffer_head ** bhp)
 		p = tmp;
 		tmp = tmp->b_this_page;
 		nr_buffers--;
+		if (p->b_dev)
+			buf_stats(p->b_dev)->evictions++;
 		if (p == *bhp)
 			*bhp = p->b_prev_free;
 		remove_from_queues(p);
@@ -953,36 +1268,51 @@ static int try_to_free(struct buffer_head * bh, struct buffer_head ** bhp)
  */
 int shrink_buffers(unsigned int priority)
 {
-	struct buffer_head *bh;
-	int i;
+	struct buffer_head *bh, *tmp;
+	int i, isize, nlist;
 
 	if (priority < 2)
-		sync_buffers(0,0);
-	bh = free_list;
+		wakeup_bdflush(0);
 	i = nr_buffers >> priority;
-	for ( ; i-- > 0 ; bh = bh->b_next_free) {
-		if (bh->b_count ||
-		    (priority >= 5 &&
-		     mem_map[MAP_NR((unsigned long) bh->b_data)] > 1)) {
-			put_last_free(bh);
-			continue;
-		}
-		if (!bh->b_this_page)
+	for (nlist = 0 ; nlist < NR_LIST ; nlist++)
+	for (isize = 0 ; isize < NR_SIZES ; isize++) {
+	repeat:
+		bh = lru_list[isize][nlist];
+		if (!bh)
 			continue;
-		if (bh->b_lock) {
-			if (priority)
+		for ( ; i-- > 0 ; bh = bh->b_next_free) {
+			if (bh->b_list != nlist)
+				goto repeat;
+			if (bh->b_count ||
+			    (priority >= 5 &&
+			     mem_map[MAP_NR((unsigned long) bh->b_data)] > 1)) {
+				touch_buffer(bh);
+				goto repeat;
+			}
+			if (!bh->b_this_page)
 				continue;
-			else
-				wait_on_buffer(bh);
-		}
-		if (bh->b_dirt) {
-			bh->b_count++;
-			ll_rw_block(WRITEA, 1, &bh);
-			bh->b_count--;
-			continue;
+			if (bh->b_lock) {
+				if (priority)
+					continue;
+				else
+					wait_on_buffer(bh);
+			}
+			if (bh->b_dirt) {
+				bh->b_count++;
+				buf_stats(bh->b_dev)->writebacks++;
+				ll_rw_block(WRITEA, 1, &bh);
+				bh->b_count--;
+				refile_buffer(bh);
+				goto repeat;
+			}
+			tmp = bh;
+			if (try_to_free(bh, &bh))
+				return 1;
+			if (bh != tmp)
+				goto repeat;
 		}
-		if (try_to_free(bh, &bh))
-			return 1;
+		if (i <= 0)
+			return 0;
 	}
 	return 0;
 }
@@ -990,24 +1320,78 @@ int shrink_buffers(unsigned int priority)
 void show_buffers(void)
 {
 	struct buffer_head * bh;
-	int found = 0, locked = 0, dirty = 0, used = 0, lastused = 0;
+	int found, locked, dirty, used, lastused;
+	int isize, nlist;
+	static char *buf_types[NR_LIST] = {"CLEAN", "LOCKED", "DIRTY"};
 
 	printk("Buffer memory:   %6dkB\n",buffermem>>10);
 	printk("Buffer heads:    %6d\n",nr_buffer_heads);
 	printk("Buffer blocks:   %6d\n",nr_buffers);
-	bh = free_list;
-	do {
-		found++;
-		if (bh->b_lock)
-			locked++;
-		if (bh->b_dirt)
-			dirty++;
-		if (bh->b_count)
-			used++, lastused = found;
-		bh = bh->b_next_free;
-	} while (bh != free_list);
-	printk("Buffer mem: %d buffers, %d used (last=%d), %d locked, %d dirty\n",
-		found, used, lastused, locked, dirty);
+	for (nlist = 0 ; nlist < NR_LIST ; nlist++)
+	for (isize = 0 ; isize < NR_SIZES ; isize++) {
+		bh = lru_list[isize][nlist];
+		if (!bh)
+			continue;
+		found = locked = dirty = used = lastused = 0;
+		do {
+			found++;
+			if (bh->b_lock)
+				locked++;
+			if (bh->b_dirt)
+				dirty++;
+			if (bh->b_count)
+				used++, lastused = found;
+			bh = bh->b_next_free;
+		} while (bh != lru_list[isize][nlist]);
+		printk("%6s %4d: %d buffers, %d used (last=%d), %d locked, %d dirty\n",
+			buf_types[nlist], 512 << isize,
+			found, used, lastused, locked, dirty);
+	}
+}
+
+/*
+ * /proc/buffers: hash table shape and the per-device counters.
+ */
+int get_buffer_stats(char * buffer)
+{
+	struct buffer_stats * st;
+	struct buffer_head * bh;
+	int i, n, used = 0, longest = 0, len;
+
+	for (i = 0 ; i < (1 << hash_bits) ; i++) {
+		n = 0;
+		for (bh = hash_table[i] ; bh ; bh = bh->b_next)
+			n++;
+		if (n)
+			used++;
+		if (n > longest)
+			longest = n;
+	}
+	len = sprintf(buffer,
+		"hash: %d buckets, %d used, longest chain %d, %d buffers\n"
+		"lists: %d clean, %d locked, %d dirty\n"
+		"dev         hits     misses  evictions writebacks    badsize"
+		"   ra_blocks    ra_hits  ra_misses\n",
+		1 << hash_bits, used, longest, nr_buffers,
+		nr_buffers_type[BUF_CLEAN], nr_buffers_type[BUF_LOCKED],
+		nr_buffers_type[BUF_DIRTY]);
+	for (i = 0 ; i <= NR_BUF_STATS ; i++) {
+		st = buffer_stats + i;
+		if (i < NR_BUF_STATS && !st->dev)
+			continue;
+		if (i == NR_BUF_STATS && !st->hits && !st->misses &&
+		    !st->evictions && !st->writebacks && !st->ra_blocks)
+			continue;
+		if (i < NR_BUF_STATS)
+			len += sprintf(buffer+len, "%02x:%02x", MAJOR(st->dev), MINOR(st->dev));
+		else
+			len += sprintf(buffer+len, "other");
+		len += sprintf(buffer+len, " %10lu %10lu %10lu %10lu %10lu"
+			" %11lu %10lu %10lu\n",
+			st->hits, st->misses, st->evictions, st->writebacks,
+			st->badsize, st->ra_blocks, st->ra_hits, st->ra_misses);
+	}
+	return len;
 }
 
 /*
@@ -1025,11 +1409,120 @@ void buffer_init(void)
         min_free_pages = 200;
     else
         min_free_pages = 20;
-    for (i = 0 ; i < NR_HASH ; i++)
+    for (i = 0 ; i < (1 << hash_bits) ; i++)
         hash_table[i] = NULL;
-    free_list = 0;
     grow_buffers(GFP_KERNEL, BLOCK_SIZE);
-    if (!free_list)
+    if (!lru_list[BUFSIZE_INDEX(BLOCK_SIZE)][BUF_CLEAN])
         panic("VFS: Unable to initialize buffer free list!");
     return;
 }
+
+/*
+ * Wake up bdflush, and optionally wait for it to finish a pass. This
+ * is what getblk() does instead of writing back the whole cache itself.
+ */
+void wakeup_bdflush(int wait)
+{
+	if (!bdflush_tsk)
+		return;
+	bdflush_kicked = 1;
+	wake_up(&bdflush_wait);
+	if (wait)
+		sleep_on(&bdflush_done);
+}
+
+/*
+ * Write back dirty buffers, oldest first. Unless 'all' is set, only
+ * buffers that have been dirty for longer than age_buffer are written.
+ * At most ndirty buffers are started per call.
+ */
+static int flush_dirty_buffers(int all)
+{
+	struct buffer_head * bh, * next;
+	int i, isize, nwritten = 0;
+
+	for (isize = 0 ; isize < NR_SIZES ; isize++) {
+	repeat:
+		bh = lru_list[isize][BUF_DIRTY];
+		for (i = nr_buffers_lru[isize][BUF_DIRTY] ; i-- > 0 && bh ; bh = next) {
+			if (bh->b_list != BUF_DIRTY)
+				goto repeat;
+			next = bh->b_next_free;
+			if (bh->b_lock || !bh->b_dirt) {
+				refile_buffer(bh);
+				continue;
+			}
+			/* the list is in order of dirtying */
+			if (!all && bh->b_flushtime > jiffies)
+				break;
+			if (nwritten >= bdf_prm.b_un.ndirty)
+				return nwritten;
+			bh->b_count++;
+			buf_stats(bh->b_dev)->writebacks++;
+			ll_rw_block(WRITE, 1, &bh);
+			bh->b_count--;
+			refile_buffer(bh);
+			nwritten++;
+		}
+	}
+	return nwritten;
+}
+
+static inline int too_many_dirty(void)
+{
+	return nr_buffers_type[BUF_DIRTY] * 100 > nr_buffers * bdf_prm.b_un.nfract;
+}
+
+/*
+ * sys_bdflush(0, 0) turns the caller into the buffer flushing daemon and
+ * never returns unless killed. func 1 does a single flush pass, and
+ * func >= 2 reads (even) or writes (odd) tuning parameter (func-2)/2.
+ */
+asmlinkage int sys_bdflush(int func, long data)
+{
+	int i, error;
+
+	if (!suser())
+		return -EPERM;
+
+	if (func == 1)
+		return flush_dirty_buffers(too_many_dirty());
+
+	if (func >= 2) {
+		i = (func-2) >> 1;
+		if (i < 0 || i >= N_PARAM)
+			return -EINVAL;
+		if ((func & 1) == 0) {
+			error = verify_area(VERIFY_WRITE, (void *) data, sizeof(int));
+			if (error)
+				return error;
+			put_fs_long(bdf_prm.data[i], data);
+			return 0;
+		}
+		if (data < bdflush_min[i] || data > bdflush_max[i])
+			return -EINVAL;
+		bdf_prm.data[i] = data;
+		return 0;
+	}
+
+	if (bdflush_tsk)
+		return -EBUSY;
+	bdflush_tsk = current;
+	for (;;) {
+		/* when asked to, or over the limit, don't look at the age */
+		i = bdflush_kicked || too_many_dirty();
+		bdflush_kicked = 0;
+		i = flush_dirty_buffers(i);
+		wake_up(&bdflush_done);
+		if (current->signal & (1 << (SIGKILL-1)))
+			break;
+		current->signal = 0;
+		if (bdflush_kicked || (i && too_many_dirty()))
+			continue;
+		current->timeout = jiffies + bdf_prm.b_un.interval;
+		interruptible_sleep_on(&bdflush_wait);
+	}
+	bdflush_tsk = NULL;
+	wake_up(&bdflush_done);
+	return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ *  linux/fs/dcache.c
+ *
+ *  Directory entry cache, shared by all filesystems.
+ *
+ *  lookup() in fs/namei.c looks a name up here before it asks the
+ *  filesystem. An entry maps (device, directory, directory version,
+ *  name) to an inode number, or to 0 if the name doesn't exist. Names
+ *  are never removed when a directory changes: the VFS gives the
+ *  directory a new i_version instead, so that its old entries stop
+ *  matching and simply age out. Every in-core inode starts out with a
+ *  version of its own, which also takes care of inode numbers that are
+ *  reused after a directory is removed.
+ *
+ *  Only filesystems on a real device are cached, as nfs and proc can
+ *  change under us. "." and ".." are left to the filesystem: a rename
+ *  changes ".." without the directory itself getting a new version.
+ *
+ *  New entries go on the first level LRU list and move to the second
+ *  level when they are hit, so one large directory scan can't push out
+ *  the names that are used all the time.
+ */
+
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/major.h>
+
+#define DCACHE_NAME_LEN	30
+#define DCACHE_MIN	256
+#define DCACHE_MAX	8192
+
+struct dir_cache_entry {
+	struct dir_cache_entry * next_hash, * prev_hash;
+	struct dir_cache_entry * next_lru, * prev_lru;
+	unsigned long dir;
+	unsigned long version;
+	unsigned long ino;		/* 0 for a name that doesn't exist */
+	dev_t dev;
+	unsigned short hash;
+	unsigned char level;		/* 0 free, 1 or 2 */
+	unsigned char name_len;
+	char name[DCACHE_NAME_LEN];
+};
+
+static struct dir_cache_entry * dcache = NULL;
+static struct dir_cache_entry ** hash_table;
+static int nr_dcache, hash_mask, level2_max;
+
+/* lru_list[level] is the least recently used entry of each level */
+static struct dir_cache_entry * lru_list[3] = { NULL, NULL, NULL };
+static int lru_count[3] = { 0, 0, 0 };
+
+static struct {
+	unsigned long lookups, hits, negative;
+	unsigned long adds, evictions, promotions;
+} dcache_stats;
+
+/*
+ * Bumped whenever a directory changes and for each new in-core
+ * inode, see get_empty_inode().
+ */
+unsigned long event = 0;
+
+static inline unsigned int name_hash(dev_t dev, unsigned long dir,
+	unsigned long version, const char * name, int len)
+{
+	unsigned long hash = dev ^ dir ^ (version << 8);
+
+	while (len--)
+		hash = (hash << 5) + hash + (unsigned char) *name++;
+	return (hash ^ (hash >> 16)) & hash_mask;
+}
+
+static inline void remove_lru(struct dir_cache_entry * de)
+{
+	int level = de->level;
+
+	if (de->next_lru == de)
+		lru_list[level] = NULL;
+	else {
+		de->next_lru->prev_lru = de->prev_lru;
+		de->prev_lru->next_lru = de->next_lru;
+		if (lru_list[level] == de)
+			lru_list[level] = de->next_lru;
+	}
+	lru_count[level]--;
+}
+
+/* Put an entry on a level as the most recently used one. */
+static inline void add_lru(struct dir_cache_entry * de, int level)
+{
+	struct dir_cache_entry * head = lru_list[level];
+
+	de->level = level;
+	if (!head) {
+		lru_list[level] = de->next_lru = de->prev_lru = de;
+	} else {
+		de->next_lru = head;
+		de->prev_lru = head->prev_lru;
+		head->prev_lru->next_lru = de;
+		head->prev_lru = de;
+	}
+	lru_count[level]++;
+}
+
+static inline void remove_hash(struct dir_cache_entry * de)
+{
+	if (de->next_hash)
+		de->next_hash->prev_hash = de->prev_hash;
+	if (de->prev_hash)
+		de->prev_hash->next_hash = de->next_hash;
+	else
+		hash_table[de->hash] = de->next_hash;
+	de->next_hash = de->prev_hash = NULL;
+}
+
+static inline void add_hash(struct dir_cache_entry * de, unsigned int hash)
+{
+	de->hash = hash;
+	de->prev_hash = NULL;
+	de->next_hash = hash_table[hash];
+	if (de->next_hash)
+		de->next_hash->prev_hash = de;
+	hash_table[hash] = de;
+}
+
+static struct dir_cache_entry * find_entry(struct inode * dir,
+	const char * name, int len, unsigned int hash)
+{
+	struct dir_cache_entry * de;
+
+	for (de = hash_table[hash] ; de ; de = de->next_hash)
+		if (de->dir == dir->i_ino && de->dev == dir->i_dev &&
+		    de->version == dir->i_version && de->name_len == len &&
+		    !memcmp(de->name, name, len))
+			break;
+	return de;
+}
+
+static inline int dcache_ok(struct inode * dir, const char * name, int len)
+{
+	if (!dcache || len > DCACHE_NAME_LEN)
+		return 0;
+	if (MAJOR(dir->i_dev) == UNNAMED_MAJOR)
+		return 0;
+	if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))
+		return 0;
+	return 1;
+}
+
+/*
+ * Returns 1 and the inode number (0 if the name is known not to exist)
+ * if the name is in the cache, 0 if we have to ask the filesystem.
+ */
+int dcache_lookup(struct inode * dir, const char * name, int len,
+	unsigned long * ino)
+{
+	struct dir_cache_entry * de, * old;
+
+	if (!dcache_ok(dir, name, len))
+		return 0;
+	dcache_stats.lookups++;
+	de = find_entry(dir, name, len,
+		name_hash(dir->i_dev, dir->i_ino, dir->i_version, name, len));
+	if (!de)
+		return 0;
+	dcache_stats.hits++;
+	if (!de->ino)
+		dcache_stats.negative++;
+	remove_lru(de);
+	if (de->level == 1)
+		dcache_stats.promotions++;
+	add_lru(de, 2);
+	if (lru_count[2] > level2_max) {
+		old = lru_list[2];
+		remove_lru(old);
+		add_lru(old, 1);
+	}
+	*ino = de->ino;
+	return 1;
+}
+
+/*
+ * Remember what the filesystem said about a name: ino is 0 if it
+ * doesn't exist.
+ */
+void dcache_add(struct inode * dir, const char * name, int len,
+	unsigned long ino)
+{
+	struct dir_cache_entry * de;
+	unsigned int hash;
+
+	if (!dcache_ok(dir, name, len))
+		return;
+	hash = name_hash(dir->i_dev, dir->i_ino, dir->i_version, name, len);
+	de = find_entry(dir, name, len, hash);
+	if (de) {
+		de->ino = ino;
+		return;
+	}
+	if (!(de = lru_list[0])) {
+		if (!(de = lru_list[1]))
+			de = lru_list[2];
+		remove_hash(de);
+		dcache_stats.evictions++;
+	}
+	remove_lru(de);
+	de->dev = dir->i_dev;
+	de->dir = dir->i_ino;
+	de->version = dir->i_version;
+	de->ino = ino;
+	de->name_len = len;
+	memcpy(de->name, name, len);
+	add_hash(de, hash);
+	add_lru(de, 1);
+	dcache_stats.adds++;
+}
+
+/*
+ * One entry for every 8kB of memory, within limits. The table is
+ * allocated here, before mem_init(), as it doesn't fit in a kmalloc().
+ */
+unsigned long dcache_init(unsigned long start, unsigned long end)
+{
+	int i, hash_size;
+
+	nr_dcache = (end - start) >> 13;
+	if (nr_dcache < DCACHE_MIN)
+		nr_dcache = DCACHE_MIN;
+	if (nr_dcache > DCACHE_MAX)
+		nr_dcache = DCACHE_MAX;
+	for (hash_size = 1 ; hash_size < nr_dcache / 2 ; hash_size <<= 1)
+		;
+	hash_mask = hash_size - 1;
+	level2_max = nr_dcache / 2;
+
+	start = (start + 15) & ~15;
+	dcache = (struct dir_cache_entry *) start;
+	start += nr_dcache * sizeof(struct dir_cache_entry);
+	hash_table = (struct dir_cache_entry **) start;
+	start += hash_size * sizeof(struct dir_cache_entry *);
+	memset(hash_table, 0, hash_size * sizeof(struct dir_cache_entry *));
+	for (i = 0 ; i < nr_dcache ; i++) {
+		dcache[i].next_hash = dcache[i].prev_hash = NULL;
+		add_lru(dcache + i, 0);
+	}
+	return start;
+}
+
+/*
+ * /proc/dcache
+ */
+int get_dcache_stats(char * buffer)
+{
+	unsigned long lookups = dcache_stats.lookups;
+	unsigned long hits = dcache_stats.hits;
+	int rate = 0;
+
+	if (lookups >= 0x1000000)
+		rate = hits / (lookups / 100);
+	else if (lookups)
+		rate = hits * 100 / lookups;
+	return sprintf(buffer,
+		"entries: %d, %d level 1, %d level 2, %d hash buckets\n"
+		"lookups: %lu, hits %lu (%d%%), negative hits %lu\n"
+		"adds: %lu, evictions %lu, promotions %lu\n",
+		nr_dcache, lru_count[1], lru_count[2], hash_mask + 1,
+		lookups, hits, rate, dcache_stats.negative,
+		dcache_stats.adds, dcache_stats.evictions,
+		dcache_stats.promotions);
+}
@@ -78,6 +78,7 @@ int open_inode(struct inode * inode, int mode)
 	f->f_inode = inode;
 	f->f_pos = 0;
 	f->f_reada = 0;
+	f->f_rapos = f->f_raend = f->f_ralen = 0;
 	f->f_op = inode->i_op->default_file_ops;
 	if (f->f_op->open) {
 		error = f->f_op->open(inode,f);
@@ -153,6 +154,7 @@ int core_dump(long signr, struct pt_regs * regs)
 	file.f_inode = inode;
 	file.f_pos = 0;
 	file.f_reada = 0;
+	file.f_rapos = file.f_raend = file.f_ralen = 0;
 	file.f_op = inode->i_op->default_file_ops;
 	if (file.f_op->open)
 		if (file.f_op->open(inode,&file))
@@ -271,7 +273,7 @@ unsigned long * create_tables(char * p,int argc,int envc,int ibcs)
 	unsigned long * sp;
 	struct vm_area_struct *mpnt;
 
-	mpnt = (struct vm_area_struct *)kmalloc(sizeof(*mpnt), GFP_KERNEL);
+	mpnt = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 	if (mpnt) {
 		mpnt->vm_task = current;
 		mpnt->vm_start = PAGE_MASK & (unsigned long) p;
@@ -430,6 +432,7 @@ int read_exec(struct inode *inode, unsigned long offset,
     file.f_inode = inode;
     file.f_pos = 0;
     file.f_reada = 0;
+    file.f_rapos = file.f_raend = file.f_ralen = 0;
     file.f_op = inode->i_op->default_file_ops;
     if (file.f_op->open)
         if (file.f_op->open(inode,&file))
@@ -492,7 +495,7 @@ void flush_old_exec(struct linux_binprm * bprm)
         mpnt1 = mpnt->vm_next;
         if (mpnt->vm_ops && mpnt->vm_ops->close)
             mpnt->vm_ops->close(mpnt);
-        kfree(mpnt);
+        kmem_cache_free(vm_area_cachep, mpnt);
         mpnt = mpnt1;
     }
 
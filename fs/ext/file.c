@@ -22,6 +22,7 @@
 #include <linux/fcntl.h>
 #include <linux/stat.h>
 #include <linux/locks.h>
+#include <linux/pagemap.h>
 
 #define	NBUF	32
 
@@ -245,6 +246,7 @@ static int ext_file_write(struct inode * inode, struct file * filp, char * buf,
 		}
 		written += c;
 		memcpy_fromfs(p,buf,c);
+		update_vm_cache(inode, pos - c, p, c);
 		buf += c;
 		bh->b_uptodate = 1;
 		bh->b_dirt = 1;
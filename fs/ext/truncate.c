@@ -15,6 +15,7 @@
 #include <linux/stat.h>
 #include <linux/fcntl.h>
 #include <linux/errno.h>
+#include <linux/pagemap.h>
 
 /*
  * Truncate has the most races in the whole filesystem: coding it is
@@ -230,6 +231,7 @@ void ext_truncate(struct inode * inode)
 	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 	     S_ISLNK(inode->i_mode)))
 		return;
+	truncate_inode_pages(inode, inode->i_size);
 	while (1) {
 		retry = trunc_direct(inode);
 		retry |= trunc_indirect(inode,9,inode->u.ext_i.i_data+9);
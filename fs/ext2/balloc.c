@@ -137,10 +137,51 @@ static struct ext2_group_desc * get_group_desc (struct super_block * sb,
     return gdp + desc;
 }
 
+/*
+ * Number of zero bytes in a block bitmap, ie of free runs of 8 blocks
+ * that start on a byte
+ */
+static long count_free_bytes (struct super_block * sb, unsigned char * map)
+{
+    long count = 0;
+    int i;
+
+    for (i = 0; i < (EXT2_BLOCKS_PER_GROUP(sb) + 7) >> 3; i++)
+        if (!map[i])
+            count++;
+    return count;
+}
+
+/*
+ * Keep the free byte count of a group right after the bits [j, j + n)
+ * of its bitmap have been set, or after bit j has been cleared.
+ */
+static void update_free_bytes (struct super_block * sb, int group,
+			       unsigned char * map, int j, int n, int set)
+{
+    struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info + group;
+    int b, lo, hi;
+
+    if (gi->gi_free_bytes < 0)
+        return;
+    if (!set) {
+        if (!map[j >> 3])
+            gi->gi_free_bytes++;
+        return;
+    }
+    for (b = j >> 3; b <= (j + n - 1) >> 3; b++) {
+        lo = (b << 3) < j ? j & 7 : 0;
+        hi = (b << 3) + 8 > j + n ? j + n - (b << 3) : 8;
+        if (map[b] == (((1 << hi) - 1) & ~((1 << lo) - 1)))
+            gi->gi_free_bytes--;
+    }
+}
+
 static void read_block_bitmap (struct super_block * sb,
               unsigned int block_group, unsigned long bitmap_nr)
 {
     struct ext2_group_desc * gdp;
+    struct ext2_group_info * gi;
     struct buffer_head * bh;
 	
     gdp = get_group_desc (sb, block_group, NULL);
@@ -152,25 +193,34 @@ static void read_block_bitmap (struct super_block * sb,
                            block_group, gdp->bg_block_bitmap);
     sb->u.ext2_sb.s_block_bitmap_number[bitmap_nr] = block_group;
     sb->u.ext2_sb.s_block_bitmap[bitmap_nr] = bh;
+    gi = sb->u.ext2_sb.s_group_info + block_group;
+    gi->gi_block_slot = bitmap_nr;
+    gi->gi_block_used = ++sb->u.ext2_sb.s_bitmap_clock;
+    if (gi->gi_free_bytes < 0)
+        gi->gi_free_bytes = count_free_bytes (sb,
+                                   (unsigned char *) bh->b_data);
 }
 
 /*
  * load_block_bitmap loads the block bitmap for a blocks group
  *
- * It maintains a cache for the last bitmaps loaded.  This cache is managed
- * with a LRU algorithm.
+ * The bitmaps are cached in s_block_bitmap[], which is sized when the
+ * file system is mounted: it holds the bitmaps of all the groups unless
+ * that would take too much memory (see ext2_read_super).  The group info
+ * tells in which slot the bitmap of a group is, so a hit is found
+ * without a search.  When the cache is full the least recently used
+ * bitmap makes room.
  *
  * Notes:
  * 1/ There is one cache per mounted file system.
- * 2/ If the file system contains less than EXT2_MAX_GROUP_LOADED groups,
- *    this function reads the bitmap without maintaining a LRU cache.
+ * 2/ The slot returned stays valid until the next call.
  */
 static int load__block_bitmap (struct super_block * sb,
 			       unsigned int block_group)
 {
-    int i, j;
-    unsigned long block_bitmap_number;
-    struct buffer_head * block_bitmap;
+    struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info;
+    unsigned long age, oldest;
+    int i, slot;
 
     if (block_group >= sb->u.ext2_sb.s_groups_count)
         ext2_panic (sb, "load_block_bitmap",
@@ -178,63 +228,38 @@ static int load__block_bitmap (struct super_block * sb,
                         "block_group = %d, groups_count = %lu",
                           block_group, sb->u.ext2_sb.s_groups_count);
 
-    if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED) {
-        if (sb->u.ext2_sb.s_block_bitmap[block_group]) {
-            if (sb->u.ext2_sb.s_block_bitmap_number[block_group] !=
-                                      block_group)
-                ext2_panic (sb, "load_block_bitmap",
-                                "block_group != block_bitmap_number");
-            else
-                return block_group;
-        } else {
-            read_block_bitmap (sb, block_group, block_group);
-            return block_group;
+    if (sb->u.ext2_sb.s_loaded_block_bitmaps < sb->u.ext2_sb.s_max_loaded)
+        slot = sb->u.ext2_sb.s_loaded_block_bitmaps++;
+    else {
+        slot = 0;
+        oldest = 0;
+        for (i = 0; i < sb->u.ext2_sb.s_loaded_block_bitmaps; i++) {
+            age = sb->u.ext2_sb.s_bitmap_clock -
+                  gi[sb->u.ext2_sb.s_block_bitmap_number[i]].gi_block_used;
+            if (age >= oldest) {
+                oldest = age;
+                slot = i;
+            }
         }
+        gi[sb->u.ext2_sb.s_block_bitmap_number[slot]].gi_block_slot = -1;
+        brelse (sb->u.ext2_sb.s_block_bitmap[slot]);
     }
-
-    for (i = 0; i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-                sb->u.ext2_sb.s_block_bitmap_number[i] != block_group; i++)
-        ;
-    if (i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-                sb->u.ext2_sb.s_block_bitmap_number[i] == block_group) {
-        block_bitmap_number = sb->u.ext2_sb.s_block_bitmap_number[i];
-        block_bitmap = sb->u.ext2_sb.s_block_bitmap[i];
-        for (j = i; j > 0; j--) {
-            sb->u.ext2_sb.s_block_bitmap_number[j] =
-                     sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-            sb->u.ext2_sb.s_block_bitmap[j] =
-                     sb->u.ext2_sb.s_block_bitmap[j - 1];
-        }
-        sb->u.ext2_sb.s_block_bitmap_number[0] = block_bitmap_number;
-        sb->u.ext2_sb.s_block_bitmap[0] = block_bitmap;
-    } else {
-        if (sb->u.ext2_sb.s_loaded_block_bitmaps < EXT2_MAX_GROUP_LOADED)
-            sb->u.ext2_sb.s_loaded_block_bitmaps++;
-        else
-            brelse (sb->u.ext2_sb.s_block_bitmap[EXT2_MAX_GROUP_LOADED - 1]);
-        for (j = sb->u.ext2_sb.s_loaded_block_bitmaps - 1; j > 0;  j--) {
-            sb->u.ext2_sb.s_block_bitmap_number[j] =
-                     sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-            sb->u.ext2_sb.s_block_bitmap[j] =
-                     sb->u.ext2_sb.s_block_bitmap[j - 1];
-        }
-        read_block_bitmap (sb, block_group, 0);
-    }
-    return 0;
+    read_block_bitmap (sb, block_group, slot);
+    return slot;
 }
 
 static inline int load_block_bitmap (struct super_block * sb,
 				     unsigned int block_group)
 {
-    if (sb->u.ext2_sb.s_loaded_block_bitmaps > 0 &&
-                sb->u.ext2_sb.s_block_bitmap_number[0] == block_group)
-        return 0;
-	
-    if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED && 
-         sb->u.ext2_sb.s_block_bitmap_number[block_group] == block_group &&
-         sb->u.ext2_sb.s_block_bitmap[block_group]) 
-        return block_group;
+    struct ext2_group_info * gi;
 
+    if (block_group < sb->u.ext2_sb.s_groups_count) {
+        gi = sb->u.ext2_sb.s_group_info + block_group;
+        if (gi->gi_block_slot >= 0) {
+            gi->gi_block_used = ++sb->u.ext2_sb.s_bitmap_clock;
+            return gi->gi_block_slot;
+        }
+    }
     return load__block_bitmap (sb, block_group);
 }
 
@@ -297,6 +322,9 @@ void ext2_free_blocks (struct super_block * sb, unsigned long block,
 				      "bit already cleared for block %lu", 
 				      block);
 		else {
+			update_free_bytes (sb, block_group,
+					   (unsigned char *) bh->b_data,
+					   bit + i, 1, 0);
 			gdp->bg_free_blocks_count++;
 			es->s_free_blocks_count++;
 		}
@@ -316,30 +344,231 @@ void ext2_free_blocks (struct super_block * sb, unsigned long block,
 }
 
 /*
- * ext2_new_block uses a goal block to assist allocation.  If the goal is
- * free, or there is a free block within 32 blocks of the goal, that block
- * is allocated.  Otherwise a forward search is made for a free block; within 
- * each block group the search first looks for an entire free byte in the block
- * bitmap, and then for any free bit if that fails.
+ * Reservation windows
+ *
+ * A regular file being written gets a window of blocks in front of it
+ * that other files don't allocate from, so that files written at the
+ * same time in one group don't end up interleaved. Windows only exist
+ * in memory and don't touch the bitmaps: a window is just a claim on a
+ * range of blocks that were free when it was opened. The windows of a
+ * file system are kept on one list, sorted by block, and like the
+ * bitmaps they are protected by lock_super().
+ *
+ * When a file has used up its window it gets a new one after it,
+ * twice as large if most of the old one was used. Windows are given
+ * back when the file is closed for writing or truncated. Allocations
+ * only ignore the windows when there is no other free space left.
  */
-int ext2_new_block (struct super_block * sb, unsigned long goal,
-		    unsigned long * prealloc_count,
-		    unsigned long * prealloc_block)
+static inline struct ext2_reserve_window * rsv_head (struct super_block * sb)
+{
+	return &sb->u.ext2_sb.s_rsv_window_head;
+}
+
+/*
+ * Returns the first window that ends at or after 'block', or the list
+ * head if there is none.
+ */
+static struct ext2_reserve_window * rsv_search (struct super_block * sb,
+						unsigned long block)
+{
+	struct ext2_reserve_window * head = rsv_head (sb);
+	struct ext2_reserve_window * rsv;
+
+	for (rsv = head->rsv_next; rsv != head; rsv = rsv->rsv_next)
+		if (rsv->rsv_end >= block)
+			break;
+	return rsv;
+}
+
+static inline int in_window (struct super_block * sb, unsigned long block)
+{
+	struct ext2_reserve_window * rsv = rsv_search (sb, block);
+
+	return rsv != rsv_head (sb) && rsv->rsv_start <= block;
+}
+
+static inline void rsv_unlink (struct ext2_reserve_window * rsv)
+{
+	rsv->rsv_prev->rsv_next = rsv->rsv_next;
+	rsv->rsv_next->rsv_prev = rsv->rsv_prev;
+	rsv->rsv_next = rsv->rsv_prev = NULL;
+}
+
+/*
+ * Open a window at 'block', which is free and in no other window. It
+ * ends at the goal size, the end of the group or the next window,
+ * whichever comes first.
+ */
+static void rsv_open (struct super_block * sb,
+		      struct ext2_reserve_window * rsv, unsigned long block)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	struct ext2_reserve_window * next;
+	unsigned long end, group_end;
+
+	group_end = block - (block - es->s_first_data_block) %
+		EXT2_BLOCKS_PER_GROUP(sb) + EXT2_BLOCKS_PER_GROUP(sb) - 1;
+	end = block + rsv->rsv_goal_size - 1;
+	if (end > group_end)
+		end = group_end;
+	if (end >= es->s_blocks_count)
+		end = es->s_blocks_count - 1;
+	next = rsv_search (sb, block);
+	if (next != rsv_head (sb) && end >= next->rsv_start)
+		end = next->rsv_start - 1;
+	rsv->rsv_start = block;
+	rsv->rsv_end = end;
+	rsv->rsv_alloc_hit = 0;
+	rsv->rsv_next = next;
+	rsv->rsv_prev = next->rsv_prev;
+	next->rsv_prev->rsv_next = rsv;
+	next->rsv_prev = rsv;
+}
+
+void ext2_discard_reservation (struct inode * inode)
+{
+	struct ext2_reserve_window * rsv = &inode->u.ext2_i.i_rsv_window;
+
+	if (!rsv->rsv_next)
+		return;
+	lock_super (inode->i_sb);
+	if (rsv->rsv_next)
+		rsv_unlink (rsv);
+	unlock_super (inode->i_sb);
+}
+
+/*
+ * Look for a free block in one group at or after bit 'start', a whole
+ * free byte of the bitmap if 'byte' is set. The bitmap is scanned a
+ * byte or a word at a time; if 'skip' is set, blocks in reservation
+ * windows are stepped over. Returns the bit, or -1.
+ */
+static int find_group_block (struct super_block * sb, int group, char * map,
+			     int start, int byte, int skip)
+{
+	struct ext2_reserve_window * rsv;
+	unsigned long base;
+	int j = start, k;
+
+	base = group * EXT2_BLOCKS_PER_GROUP(sb) +
+		sb->u.ext2_sb.s_es->s_first_data_block;
+	while (j < EXT2_BLOCKS_PER_GROUP(sb)) {
+		if (byte) {
+			k = (find_first_zero_byte (map + (j >> 3),
+				(EXT2_BLOCKS_PER_GROUP(sb) - j + 7) >> 3) -
+				map) << 3;
+			if (k < j)
+				k = j;
+		} else
+			k = find_next_zero_bit ((unsigned long *) map,
+						EXT2_BLOCKS_PER_GROUP(sb), j);
+		if (k >= EXT2_BLOCKS_PER_GROUP(sb))
+			return -1;
+		if (!skip)
+			return k;
+		rsv = rsv_search (sb, base + k);
+		if (rsv == rsv_head (sb) || rsv->rsv_start > base + k)
+			return k;
+		j = rsv->rsv_end + 1 - base;
+	}
+	return -1;
+}
+
+/*
+ * Find a free block near 'goal': the goal itself or a free block within
+ * the next 32 blocks, else the start of a free byte in the rest of the
+ * goal's group, else any free block there. After that the other groups
+ * are searched in turn, again for a free byte first. Groups known to
+ * have no free byte left aren't searched for one. With 'skip' set
+ * blocks in reservation windows are not taken.
+ */
+static unsigned long find_free_block (struct super_block * sb,
+				      unsigned long goal, int skip)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info;
+	struct ext2_group_desc * gdp;
+	char * map;
+	int i, j, k, n, near;
+
+	i = (goal - es->s_first_data_block) / EXT2_BLOCKS_PER_GROUP(sb);
+	j = (goal - es->s_first_data_block) % EXT2_BLOCKS_PER_GROUP(sb);
+	gdp = get_group_desc (sb, i, NULL);
+	if (gdp->bg_free_blocks_count > 0) {
+		map = sb->u.ext2_sb.s_block_bitmap[load_block_bitmap (sb, i)]->b_data;
+		near = find_group_block (sb, i, map, j, 0, skip);
+		if (near >= 0 && near < j + 32) {
+			k = near;
+			goto got_block;
+		}
+		k = -1;
+		if (gi[i].gi_free_bytes)
+			k = find_group_block (sb, i, map, j, 1, skip);
+		if (k >= 0)
+			goto search_back;
+		if (near >= 0) {
+			k = near;
+			goto got_block;
+		}
+	}
+
+	for (n = 0; n < sb->u.ext2_sb.s_groups_count; n++) {
+		if (++i >= sb->u.ext2_sb.s_groups_count)
+			i = 0;
+		gdp = get_group_desc (sb, i, NULL);
+		if (gdp->bg_free_blocks_count <= 0)
+			continue;
+		map = sb->u.ext2_sb.s_block_bitmap[load_block_bitmap (sb, i)]->b_data;
+		k = -1;
+		if (gi[i].gi_free_bytes)
+			k = find_group_block (sb, i, map, 0, 1, skip);
+		if (k >= 0)
+			goto search_back;
+		k = find_group_block (sb, i, map, 0, 0, skip);
+		if (k >= 0)
+			goto got_block;
+	}
+	return 0;
+
+search_back:
+	/*
+	 * We have found a free byte in the block bitmap. Now search
+	 * backwards up to 7 bits to find the start of this group of
+	 * free blocks.
+	 */
+	for (n = 0; n < 7 && k > 0 && !test_bit (k - 1, map); n++, k--) {
+		if (skip && in_window (sb, k - 1 + i * EXT2_BLOCKS_PER_GROUP(sb) +
+					   es->s_first_data_block))
+			break;
+	}
+
+got_block:
+	return k + i * EXT2_BLOCKS_PER_GROUP(sb) + es->s_first_data_block;
+}
+
+/*
+ * ext2_new_blocks allocates a run of up to *count contiguous blocks
+ * near 'goal' and returns the first one, with *count set to the number
+ * of blocks allocated. The blocks are not cleared.
+ *
+ * If 'rsv' is given the blocks come from that reservation window, and
+ * a new window is opened when the goal is not in it or it is full.
+ * Without a window, blocks in the windows of other files are left
+ * alone as long as there is other free space.
+ */
+int ext2_new_blocks (struct super_block * sb, unsigned long goal,
+		     unsigned long * count, struct ext2_reserve_window * rsv)
 {
 	struct buffer_head * bh;
 	struct buffer_head * bh2;
-	char * p, * r;
-	int i, j, k, tmp;
-	unsigned long lmap;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
 	struct ext2_super_block * es;
+	struct ext2_reserve_window * next;
+	unsigned long block, limit, n;
+	int i, j, k;
 
-#ifdef EXT2FS_DEBUG
-	static int goal_hits = 0, goal_attempts = 0;
-#endif
 	if (!sb) {
-		printk ("ext2_new_block: nonexistent device");
+		printk ("ext2_new_blocks: nonexistent device");
 		return 0;
 	}
 	lock_super (sb);
@@ -351,203 +580,160 @@ int ext2_new_block (struct super_block * sb, unsigned long goal,
 
 	ext2_debug ("goal=%lu.\n", goal);
 
-repeat:
-	/*
-	 * First, test whether the goal block is free.
-	 */
 	if (goal < es->s_first_data_block || goal >= es->s_blocks_count)
 		goal = es->s_first_data_block;
-	i = (goal - es->s_first_data_block) / EXT2_BLOCKS_PER_GROUP(sb);
-	gdp = get_group_desc (sb, i, &bh2);
-	if (gdp->bg_free_blocks_count > 0) {
-		j = ((goal - es->s_first_data_block) % EXT2_BLOCKS_PER_GROUP(sb));
-#ifdef EXT2FS_DEBUG
-		if (j)
-			goal_attempts++;
-#endif
-		bitmap_nr = load_block_bitmap (sb, i);
-		bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
-
-		ext2_debug ("goal is at %d:%d.\n", i, j);
-
-		if (!test_bit(j, bh->b_data)) {
-#ifdef EXT2FS_DEBUG
-			goal_hits++;
-			ext2_debug ("goal bit allocated.\n");
-#endif
-			goto got_block;
-		}
-		if (j) {
-			/*
-			 * The goal was occupied; search forward for a free 
-			 * block within the next 32 blocks
-			 */
-			lmap = ((((unsigned long *) bh->b_data)[j >> 5]) >>
-				((j & 31) + 1));
-			if (j < EXT2_BLOCKS_PER_GROUP(sb) - 32)
-				lmap |= (((unsigned long *) bh->b_data)[(j >> 5) + 1]) <<
-				 (31 - (j & 31));
-			else
-				lmap |= 0xffffffff << (31 - (j & 31));
-			if (lmap != 0xffffffffl) {
-				__asm__ ("bsfl %1,%0"
-					 : "=r" (k)
-					 : "r" (~lmap));
-				k++;
-				if ((j + k) < EXT2_BLOCKS_PER_GROUP(sb)) {
-					j += k;
-					goto got_block;
+repeat:
+	block = 0;
+	limit = es->s_blocks_count - 1;
+	if (rsv) {
+		if (rsv->rsv_next && goal >= rsv->rsv_start &&
+		    goal <= rsv->rsv_end + 1) {
+			if (goal <= rsv->rsv_end) {
+				i = (rsv->rsv_start - es->s_first_data_block) /
+					EXT2_BLOCKS_PER_GROUP(sb);
+				j = (goal - es->s_first_data_block) %
+					EXT2_BLOCKS_PER_GROUP(sb);
+				k = j + rsv->rsv_end - goal + 1;
+				bh = sb->u.ext2_sb.s_block_bitmap[
+					load_block_bitmap (sb, i)];
+				/*
+				 * k may end inside j's word, which
+				 * find_next_zero_bit() can't handle
+				 */
+				for (n = j; n < k && test_bit (n, bh->b_data);
+				     n++)
+					;
+				if (n < k) {
+					block = goal + n - j;
+					limit = rsv->rsv_end;
 				}
 			}
+			if (!block) {
+				/* used up: the next one goes after it */
+				if (rsv->rsv_alloc_hit >
+				    (rsv->rsv_end - rsv->rsv_start + 1) / 2 &&
+				    rsv->rsv_goal_size < EXT2_MAX_RESERVE_BLOCKS)
+					rsv->rsv_goal_size <<= 1;
+				if (rsv->rsv_end + 1 < es->s_blocks_count)
+					goal = rsv->rsv_end + 1;
+			}
 		}
-	
-		ext2_debug ("Bit not found near goal\n");
-
-		/*
-		 * There has been no free block found in the near vicinity
-		 * of the goal: do a search forward through the block groups,
-		 * searching in each group first for an entire free byte in
-		 * the bitmap and then for any free bit.
-		 * 
-		 * Search first in the remainder of the current group; then,
-		 * cyclicly search throught the rest of the groups.
-		 */
-		p = ((char *) bh->b_data) + (j >> 3);
-		r = find_first_zero_byte (p, 
-					  (EXT2_BLOCKS_PER_GROUP(sb) - j + 7) >> 3);
-		k = (r - ((char *) bh->b_data)) << 3;
-		if (k < EXT2_BLOCKS_PER_GROUP(sb)) {
-			j = k;
-			goto search_back;
+		if (!block) {
+			if (rsv->rsv_next)
+				rsv_unlink (rsv);
+			block = find_free_block (sb, goal, 1);
+			if (block) {
+				rsv_open (sb, rsv, block);
+				limit = rsv->rsv_end;
+			}
 		}
-		k = find_next_zero_bit ((unsigned long *) bh->b_data, 
-					EXT2_BLOCKS_PER_GROUP(sb),
-					j);
-		if (k < EXT2_BLOCKS_PER_GROUP(sb)) {
-			j = k;
-			goto got_block;
+	} else {
+		block = find_free_block (sb, goal, 1);
+		if (block) {
+			next = rsv_search (sb, block);
+			if (next != rsv_head (sb))
+				limit = next->rsv_start - 1;
 		}
 	}
-
-	ext2_debug ("Bit not found in block group %d.\n", i);
-
-	/*
-	 * Now search the rest of the groups.  We assume that 
-	 * i and gdp correctly point to the last group visited.
-	 */
-	for (k = 0; k < sb->u.ext2_sb.s_groups_count; k++) {
-		i++;
-		if (i >= sb->u.ext2_sb.s_groups_count)
-			i = 0;
-		gdp = get_group_desc (sb, i, &bh2);
-		if (gdp->bg_free_blocks_count > 0)
-			break;
-	}
-	if (k >= sb->u.ext2_sb.s_groups_count) {
-		unlock_super (sb);
-		return 0;
+	if (!block) {
+		ext2_debug ("no block outside the reservation windows\n");
+		limit = es->s_blocks_count - 1;
+		block = find_free_block (sb, goal, 0);
+		if (!block) {
+			unlock_super (sb);
+			return 0;
+		}
 	}
-	bitmap_nr = load_block_bitmap (sb, i);
-	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
-	r = find_first_zero_byte (bh->b_data, 
-				  EXT2_BLOCKS_PER_GROUP(sb) >> 3);
-	j = (r - bh->b_data) << 3;
-	if (j < EXT2_BLOCKS_PER_GROUP(sb))
-		goto search_back;
-	else
-		j = find_first_zero_bit ((unsigned long *) bh->b_data,
-					 EXT2_BLOCKS_PER_GROUP(sb));
-	if (j >= EXT2_BLOCKS_PER_GROUP(sb)) {
-		ext2_error (sb, "ext2_new_block",
-			    "Free blocks count corrupted for block group %d", i);
+
+	if (block >= es->s_blocks_count) {
+		ext2_error (sb, "ext2_new_blocks",
+			    "block >= blocks count\n"
+			    "block = %lu", block);
 		unlock_super (sb);
 		return 0;
 	}
-
-search_back:
-	/* 
-	 * We have succeeded in finding a free byte in the block
-	 * bitmap.  Now search backwards up to 7 bits to find the
-	 * start of this group of free blocks.
-	 */
-	for (k = 0; k < 7 && j > 0 && !test_bit (j - 1, bh->b_data); k++, j--);
-	
-got_block:
+	i = (block - es->s_first_data_block) / EXT2_BLOCKS_PER_GROUP(sb);
+	j = (block - es->s_first_data_block) % EXT2_BLOCKS_PER_GROUP(sb);
+	gdp = get_group_desc (sb, i, &bh2);
+	bh = sb->u.ext2_sb.s_block_bitmap[load_block_bitmap (sb, i)];
 
 	ext2_debug ("using block group %d(%d)\n", i, gdp->bg_free_blocks_count);
 
-	tmp = j + i * EXT2_BLOCKS_PER_GROUP(sb) + es->s_first_data_block;
-
 	if (test_opt (sb, CHECK_STRICT) &&
-	    (tmp == gdp->bg_block_bitmap ||
-	     tmp == gdp->bg_inode_bitmap ||
-	     in_range (tmp, gdp->bg_inode_table, sb->u.ext2_sb.s_itb_per_group)))
-		ext2_panic (sb, "ext2_new_block",
+	    (block == gdp->bg_block_bitmap ||
+	     block == gdp->bg_inode_bitmap ||
+	     in_range (block, gdp->bg_inode_table,
+		       sb->u.ext2_sb.s_itb_per_group)))
+		ext2_panic (sb, "ext2_new_blocks",
 			    "Allocating block in system zone\n"
-			    "block = %u", tmp);
+			    "block = %lu", block);
 
 	if (set_bit (j, bh->b_data)) {
-		ext2_warning (sb, "ext2_new_block",
+		ext2_warning (sb, "ext2_new_blocks",
 			      "bit already set for block %d", j);
 		goto repeat;
 	}
+	for (n = 1; n < *count && j + n < EXT2_BLOCKS_PER_GROUP(sb) &&
+		    block + n <= limit; n++)
+		if (set_bit (j + n, bh->b_data))
+			break;
+	update_free_bytes (sb, i, (unsigned char *) bh->b_data, j, n, 1);
+	if (rsv && rsv->rsv_next && block >= rsv->rsv_start &&
+	    block <= rsv->rsv_end)
+		rsv->rsv_alloc_hit += n;
 
-	ext2_debug ("found bit %d\n", j);
-
-	/*
-	 * Do block preallocation now if required.
-	 */
-#ifdef EXT2_PREALLOCATE
-	if (prealloc_block) {
-		*prealloc_count = 0;
-		*prealloc_block = tmp + 1;
-		for (k = 1;
-		     k < 8 && (j + k) < EXT2_BLOCKS_PER_GROUP(sb); k++) {
-			if (set_bit (j + k, bh->b_data))
-				break;
-			(*prealloc_count)++;
-		}	
-		gdp->bg_free_blocks_count -= *prealloc_count;
-		es->s_free_blocks_count -= *prealloc_count;
-		ext2_debug ("Preallocated a further %lu bits.\n",
-			    *prealloc_count);
-	}
-#endif
-
-	j = tmp;
+	ext2_debug ("allocated %lu blocks at %lu\n", n, block);
 
 	bh->b_dirt = 1;
 	if (sb->s_flags & MS_SYNC) {
 		ll_rw_block (WRITE, 1, &bh);
 		wait_on_buffer (bh);
 	}
+	gdp->bg_free_blocks_count -= n;
+	bh2->b_dirt = 1;
+	es->s_free_blocks_count -= n;
+	sb->u.ext2_sb.s_sbh->b_dirt = 1;
+	sb->s_dirt = 1;
+	unlock_super (sb);
+	*count = n;
+	return block;
+}
 
-	if (j >= es->s_blocks_count) {
-		ext2_error (sb, "ext2_new_block",
-			    "block >= blocks count\n"
-			    "block_group = %d, block=%d", i, j);
-		unlock_super (sb);
+/*
+ * ext2_new_block allocates and clears one block near 'goal', outside
+ * the reservation windows if possible. If prealloc_block is given the
+ * blocks right after it are preallocated as well.
+ */
+int ext2_new_block (struct super_block * sb, unsigned long goal,
+		    unsigned long * prealloc_count,
+		    unsigned long * prealloc_block)
+{
+	struct buffer_head * bh;
+	unsigned long count = 1;
+	int j;
+
+#ifdef EXT2_PREALLOCATE
+	if (prealloc_block)
+		count = EXT2_PREALLOC_BLOCKS;
+#endif
+	if (!(j = ext2_new_blocks (sb, goal, &count, NULL)))
 		return 0;
+#ifdef EXT2_PREALLOCATE
+	if (prealloc_block) {
+		*prealloc_count = count - 1;
+		*prealloc_block = j + 1;
+		ext2_debug ("Preallocated a further %lu bits.\n",
+			    *prealloc_count);
 	}
+#endif
 	if (!(bh = getblk (sb->s_dev, j, sb->s_blocksize))) {
 		ext2_error (sb, "ext2_new_block", "cannot get block %d", j);
-		unlock_super (sb);
 		return 0;
 	}
 	clear_block (bh->b_data, sb->s_blocksize);
 	bh->b_uptodate = 1;
 	bh->b_dirt = 1;
 	brelse (bh);
-
-	ext2_debug ("allocating block %d. "
-		    "Goal hits %d of %d.\n", j, goal_hits, goal_attempts);
-
-	gdp->bg_free_blocks_count--;
-	bh2->b_dirt = 1;
-	es->s_free_blocks_count--;
-	sb->u.ext2_sb.s_sbh->b_dirt = 1;
-	sb->s_dirt = 1;
-	unlock_super (sb);
 	return j;
 }
 
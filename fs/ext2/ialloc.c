@@ -89,6 +89,7 @@ static void read_inode_bitmap (struct super_block * sb,
             unsigned long block_group, unsigned int bitmap_nr)
 {
     struct ext2_group_desc * gdp;
+    struct ext2_group_info * gi;
     struct buffer_head * bh;
 
     gdp = get_group_desc (sb, block_group, NULL);
@@ -99,77 +100,58 @@ static void read_inode_bitmap (struct super_block * sb,
                           block_group, gdp->bg_inode_bitmap);
     sb->u.ext2_sb.s_inode_bitmap_number[bitmap_nr] = block_group;
     sb->u.ext2_sb.s_inode_bitmap[bitmap_nr] = bh;
+    gi = sb->u.ext2_sb.s_group_info + block_group;
+    gi->gi_inode_slot = bitmap_nr;
+    gi->gi_inode_used = ++sb->u.ext2_sb.s_bitmap_clock;
 }
 
 /*
  * load_inode_bitmap loads the inode bitmap for a blocks group
  *
- * It maintains a cache for the last bitmaps loaded.  This cache is managed
- * with a LRU algorithm.
+ * It maintains a cache for the bitmaps loaded, sized to the file system
+ * like the cache of block bitmaps (see load_block_bitmap in balloc.c).
+ * The group info gives the slot of a cached bitmap; when the cache is
+ * full the least recently used bitmap is replaced.
  *
  * Notes:
  * 1/ There is one cache per mounted file system.
- * 2/ If the file system contains less than EXT2_MAX_GROUP_LOADED groups,
- *    this function reads the bitmap without maintaining a LRU cache.
+ * 2/ The slot returned stays valid until the next call.
  */
 static int load_inode_bitmap (struct super_block * sb,
 			      unsigned int block_group)
 {
-    int i, j;
-    unsigned long inode_bitmap_number;
-    struct buffer_head * inode_bitmap;
+    struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info;
+    unsigned long age, oldest;
+    int i, slot;
 
     if (block_group >= sb->u.ext2_sb.s_groups_count)
         ext2_panic (sb, "load_inode_bitmap",
                         "block_group >= groups_count\n"
                         "block_group = %d, groups_count = %lu",
                            block_group, sb->u.ext2_sb.s_groups_count);
-    if (sb->u.ext2_sb.s_loaded_inode_bitmaps > 0 &&
-            sb->u.ext2_sb.s_inode_bitmap_number[0] == block_group)
-        return 0;
-    if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED) {
-        if (sb->u.ext2_sb.s_inode_bitmap[block_group]) {
-            if (sb->u.ext2_sb.s_inode_bitmap_number[block_group] != 
-                                             block_group)
-                ext2_panic (sb, "load_inode_bitmap",
-                                "block_group != inode_bitmap_number");
-            else
-                return block_group;
-        } else {
-            read_inode_bitmap (sb, block_group, block_group);
-            return block_group;
-        }
+    if (gi[block_group].gi_inode_slot >= 0) {
+        gi[block_group].gi_inode_used = ++sb->u.ext2_sb.s_bitmap_clock;
+        return gi[block_group].gi_inode_slot;
     }
 
-    for (i = 0; i < sb->u.ext2_sb.s_loaded_inode_bitmaps &&
-             sb->u.ext2_sb.s_inode_bitmap_number[i] != block_group; i++)
-        ;
-    if (i < sb->u.ext2_sb.s_loaded_inode_bitmaps &&
-             sb->u.ext2_sb.s_inode_bitmap_number[i] == block_group) {
-        inode_bitmap_number = sb->u.ext2_sb.s_inode_bitmap_number[i];
-        inode_bitmap = sb->u.ext2_sb.s_inode_bitmap[i];
-        for (j = i; j > 0; j--) {
-            sb->u.ext2_sb.s_inode_bitmap_number[j] =
-                  sb->u.ext2_sb.s_inode_bitmap_number[j - 1];
-            sb->u.ext2_sb.s_inode_bitmap[j] =
-                  sb->u.ext2_sb.s_inode_bitmap[j - 1];
-        }
-        sb->u.ext2_sb.s_inode_bitmap_number[0] = inode_bitmap_number;
-        sb->u.ext2_sb.s_inode_bitmap[0] = inode_bitmap;
-    } else {
-        if (sb->u.ext2_sb.s_loaded_inode_bitmaps < EXT2_MAX_GROUP_LOADED)
-            sb->u.ext2_sb.s_loaded_inode_bitmaps++;
-        else
-            brelse (sb->u.ext2_sb.s_inode_bitmap[EXT2_MAX_GROUP_LOADED - 1]);
-        for (j = sb->u.ext2_sb.s_loaded_inode_bitmaps - 1; j > 0; j--) {
-            sb->u.ext2_sb.s_inode_bitmap_number[j] =
-                 sb->u.ext2_sb.s_inode_bitmap_number[j - 1];
-            sb->u.ext2_sb.s_inode_bitmap[j] =
-                 sb->u.ext2_sb.s_inode_bitmap[j - 1];
+    if (sb->u.ext2_sb.s_loaded_inode_bitmaps < sb->u.ext2_sb.s_max_loaded)
+        slot = sb->u.ext2_sb.s_loaded_inode_bitmaps++;
+    else {
+        slot = 0;
+        oldest = 0;
+        for (i = 0; i < sb->u.ext2_sb.s_loaded_inode_bitmaps; i++) {
+            age = sb->u.ext2_sb.s_bitmap_clock -
+                  gi[sb->u.ext2_sb.s_inode_bitmap_number[i]].gi_inode_used;
+            if (age >= oldest) {
+                oldest = age;
+                slot = i;
+            }
         }
-        read_inode_bitmap (sb, block_group, 0);
+        gi[sb->u.ext2_sb.s_inode_bitmap_number[slot]].gi_inode_slot = -1;
+        brelse (sb->u.ext2_sb.s_inode_bitmap[slot]);
     }
-    return 0;
+    read_inode_bitmap (sb, block_group, slot);
+    return slot;
 }
 
 /*
@@ -486,7 +468,7 @@ repeat:
 	inode->i_blksize = sb->s_blocksize;
 	inode->i_blocks = 0;
 	inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
-	inode->u.ext2_i.i_flags = dir->u.ext2_i.i_flags;
+	inode->u.ext2_i.i_flags = dir->u.ext2_i.i_flags & ~EXT2_INDEX_FL;
 	inode->u.ext2_i.i_faddr = 0;
 	inode->u.ext2_i.i_frag = 0;
 	inode->u.ext2_i.i_fsize = 0;
@@ -494,6 +476,8 @@ repeat:
 	inode->u.ext2_i.i_dir_acl = 0;
 	inode->u.ext2_i.i_dtime = 0;
 	inode->u.ext2_i.i_block_group = i;
+	inode->u.ext2_i.i_rsv_window.rsv_goal_size =
+		EXT2_DEFAULT_RESERVE_BLOCKS;
 	inode->i_op = NULL;
 	if (inode->u.ext2_i.i_flags & EXT2_SYNC_FL)
 		inode->i_flags |= MS_SYNC;
@@ -57,6 +57,90 @@ static int block_bmap (struct buffer_head * bh, int nr)
 	return tmp;
 }
 
+/*
+ * Each inode caches a few runs of blocks that are contiguous both in
+ * the file and on disk, so that a file read or written sequentially
+ * doesn't have its indirect blocks looked at for every block. A run
+ * is found when one of its blocks is mapped: the pointers after it in
+ * i_data or in the indirect block are looked at as well. Runs only
+ * have to be trimmed when blocks are taken away from the file, which
+ * truncate does; new blocks only fill holes, and holes aren't cached.
+ */
+static unsigned long extent_lookup (struct inode * inode, unsigned long block)
+{
+	struct ext2_extent * e = inode->u.ext2_i.i_extent;
+	int i;
+
+	for (i = 0; i < EXT2_EXTENT_CACHE; i++, e++)
+		if (block - e->e_block < e->e_len)
+			return e->e_start + block - e->e_block;
+	return 0;
+}
+
+/*
+ * Cache the run that starts at 'block', which is mapped by p[0], while
+ * p[1] .. p[max - 1] map the blocks after it.
+ */
+static void extent_add (struct inode * inode, unsigned long block,
+			unsigned long * p, int max)
+{
+	struct ext2_extent * e = inode->u.ext2_i.i_extent;
+	unsigned long len;
+	int i;
+
+	for (len = 1; len < max && p[len] == p[0] + len; len++)
+		;
+	for (i = 0; i < EXT2_EXTENT_CACHE; i++, e++)
+		if (e->e_len && block == e->e_block + e->e_len &&
+		    p[0] == e->e_start + e->e_len) {
+			e->e_len += len;
+			return;
+		}
+	e = inode->u.ext2_i.i_extent + inode->u.ext2_i.i_extent_next;
+	if (++inode->u.ext2_i.i_extent_next >= EXT2_EXTENT_CACHE)
+		inode->u.ext2_i.i_extent_next = 0;
+	e->e_block = block;
+	e->e_start = p[0];
+	e->e_len = len;
+}
+
+/*
+ * Forget the cached runs from 'block' on, before the blocks are freed.
+ */
+void ext2_forget_extents (struct inode * inode, unsigned long block)
+{
+	struct ext2_extent * e = inode->u.ext2_i.i_extent;
+	int i;
+
+	for (i = 0; i < EXT2_EXTENT_CACHE; i++, e++)
+		if (e->e_block >= block)
+			e->e_len = 0;
+		else if (e->e_block + e->e_len > block)
+			e->e_len = block - e->e_block;
+	inode->u.ext2_i.i_extent_version++;
+}
+
+/*
+ * block_bmap for the last level, which caches the run it is in
+ * unless a truncate got in while we slept reading the chain.
+ */
+static int leaf_bmap (struct inode * inode, struct buffer_head * bh,
+		      int nr, unsigned long block, unsigned long version)
+{
+	unsigned long * p;
+	int tmp;
+
+	if (!bh)
+		return 0;
+	p = (unsigned long *) bh->b_data + nr;
+	tmp = *p;
+	if (tmp && version == inode->u.ext2_i.i_extent_version)
+		extent_add (inode, block, p,
+			    EXT2_ADDR_PER_BLOCK(inode->i_sb) - nr);
+	brelse (bh);
+	return tmp;
+}
+
 /* 
  * ext2_discard_prealloc and ext2_alloc_block are atomic wrt. the
  * superblock in the same manner as are ext2_free_blocks and
@@ -64,7 +148,7 @@ static int block_bmap (struct buffer_head * bh, int nr)
  * here, since ext2_new_block will do the necessary locking and we
  * can't block until then.
  */
-void ext2_discard_prealloc (struct inode * inode)
+static void ext2_free_prealloc (struct inode * inode)
 {
 #ifdef EXT2_PREALLOCATE
 	if (inode->u.ext2_i.i_prealloc_count) {
@@ -77,13 +161,46 @@ void ext2_discard_prealloc (struct inode * inode)
 #endif
 }
 
+/*
+ * Give back the preallocated blocks and the reservation window.
+ */
+void ext2_discard_prealloc (struct inode * inode)
+{
+	ext2_free_prealloc (inode);
+	ext2_discard_reservation (inode);
+}
+
+static int ext2_clear_new_block (struct inode * inode, unsigned long block)
+{
+	struct buffer_head * bh;
+
+	/* It doesn't matter if we block in getblk() since
+	   we have already atomically allocated the block, and
+	   are only clearing it now. */
+	if (!(bh = getblk (inode->i_sb->s_dev, block,
+			   inode->i_sb->s_blocksize))) {
+		ext2_error (inode->i_sb, "ext2_alloc_block",
+			    "cannot get block %lu", block);
+		return 0;
+	}
+	clear_block (bh->b_data, inode->i_sb->s_blocksize);
+	bh->b_uptodate = 1;
+	bh->b_dirt = 1;
+	brelse (bh);
+	return 1;
+}
+
+/*
+ * Regular files allocate from their reservation window, a run of
+ * blocks at a time: the first one is used now and the rest are kept
+ * as preallocated blocks for the next calls.
+ */
 static int ext2_alloc_block (struct inode * inode, unsigned long goal)
 {
 #ifdef EXT2FS_DEBUG
 	static unsigned long alloc_hits = 0, alloc_attempts = 0;
 #endif
-	unsigned long result;
-	struct buffer_head * bh;
+	unsigned long result, count;
 
 	wait_on_super (inode->i_sb);
 
@@ -96,36 +213,29 @@ static int ext2_alloc_block (struct inode * inode, unsigned long goal)
 		inode->u.ext2_i.i_prealloc_count--;
 		ext2_debug ("preallocation hit (%lu/%lu).\n",
 			    ++alloc_hits, ++alloc_attempts);
-
-		/* It doesn't matter if we block in getblk() since
-		   we have already atomically allocated the block, and
-		   are only clearing it now. */
-		if (!(bh = getblk (inode->i_sb->s_dev, result,
-				   inode->i_sb->s_blocksize))) {
-			ext2_error (inode->i_sb, "ext2_alloc_block",
-				    "cannot get block %lu", result);
+		if (!ext2_clear_new_block (inode, result))
 			return 0;
-		}
-		clear_block (bh->b_data, inode->i_sb->s_blocksize);
-		bh->b_uptodate = 1;
-		bh->b_dirt = 1;
-		brelse (bh);
-	} else {
-		ext2_discard_prealloc (inode);
-		ext2_debug ("preallocation miss (%lu/%lu).\n",
-			    alloc_hits, ++alloc_attempts);
-		if (S_ISREG(inode->i_mode))
-			result = ext2_new_block
-				(inode->i_sb, goal,
-				 &inode->u.ext2_i.i_prealloc_count,
-				 &inode->u.ext2_i.i_prealloc_block);
-		else
-			result = ext2_new_block (inode->i_sb, goal, 0, 0);
+		return result;
 	}
+	ext2_free_prealloc (inode);
+	ext2_debug ("preallocation miss (%lu/%lu).\n",
+		    alloc_hits, ++alloc_attempts);
+	count = EXT2_PREALLOC_BLOCKS;
 #else
-	result = ext2_new_block (inode->i_sb, goal, 0, 0);
+	count = 1;
 #endif
-
+	if (!S_ISREG(inode->i_mode))
+		return ext2_new_block (inode->i_sb, goal, 0, 0);
+	result = ext2_new_blocks (inode->i_sb, goal, &count,
+				  &inode->u.ext2_i.i_rsv_window);
+	if (!result)
+		return 0;
+#ifdef EXT2_PREALLOCATE
+	inode->u.ext2_i.i_prealloc_block = result + 1;
+	inode->u.ext2_i.i_prealloc_count = count - 1;
+#endif
+	if (!ext2_clear_new_block (inode, result))
+		return 0;
 	return result;
 }
 
@@ -134,6 +244,8 @@ int ext2_bmap (struct inode * inode, int block)
 {
 	int i;
 	int addr_per_block = EXT2_ADDR_PER_BLOCK(inode->i_sb);
+	unsigned long b = block;
+	unsigned long version;
 
 	if (block < 0) {
 		ext2_warning (inode->i_sb, "ext2_bmap", "block < 0");
@@ -145,15 +257,24 @@ int ext2_bmap (struct inode * inode, int block)
 		ext2_warning (inode->i_sb, "ext2_bmap", "block > big");
 		return 0;
 	}
-	if (block < EXT2_NDIR_BLOCKS)
-		return inode_bmap (inode, block);
+	if ((i = extent_lookup (inode, b)))
+		return i;
+	version = inode->u.ext2_i.i_extent_version;
+	if (block < EXT2_NDIR_BLOCKS) {
+		i = inode_bmap (inode, block);
+		if (i)
+			extent_add (inode, b, inode->u.ext2_i.i_data + block,
+				    EXT2_NDIR_BLOCKS - block);
+		return i;
+	}
 	block -= EXT2_NDIR_BLOCKS;
 	if (block < addr_per_block) {
 		i = inode_bmap (inode, EXT2_IND_BLOCK);
 		if (!i)
 			return 0;
-		return block_bmap (bread (inode->i_dev, i,
-					  inode->i_sb->s_blocksize), block);
+		return leaf_bmap (inode, bread (inode->i_dev, i,
+					inode->i_sb->s_blocksize),
+				  block, b, version);
 	}
 	block -= addr_per_block;
 	if (block < addr_per_block * addr_per_block) {
@@ -165,9 +286,9 @@ int ext2_bmap (struct inode * inode, int block)
 				block / addr_per_block);
 		if (!i)
 			return 0;
-		return block_bmap (bread (inode->i_dev, i,
-					  inode->i_sb->s_blocksize),
-				   block & (addr_per_block - 1));
+		return leaf_bmap (inode, bread (inode->i_dev, i,
+					inode->i_sb->s_blocksize),
+				  block & (addr_per_block - 1), b, version);
 	}
 	block -= addr_per_block * addr_per_block;
 	i = inode_bmap (inode, EXT2_TIND_BLOCK);
@@ -181,8 +302,9 @@ int ext2_bmap (struct inode * inode, int block)
 			(block / addr_per_block) & (addr_per_block - 1));
 	if (!i)
 		return 0;
-	return block_bmap (bread (inode->i_dev, i, inode->i_sb->s_blocksize),
-			   block & (addr_per_block - 1));
+	return leaf_bmap (inode, bread (inode->i_dev, i,
+				inode->i_sb->s_blocksize),
+			  block & (addr_per_block - 1), b, version);
 }
 
 static struct buffer_head * inode_getblk (struct inode * inode, int nr,
@@ -331,7 +453,7 @@ struct buffer_head * ext2_getblk(struct inode * inode, long block,
                                int create, int * err)
 {
     struct buffer_head * bh;
-    unsigned long b;
+    unsigned long b, tmp, version;
     unsigned long addr_per_block = EXT2_ADDR_PER_BLOCK(inode->i_sb);
 
     *err = -EIO;
@@ -362,31 +484,44 @@ struct buffer_head * ext2_getblk(struct inode * inode, long block,
 
     *err = -ENOSPC;
     b = block;
+    if ((tmp = extent_lookup (inode, b))) {
+        bh = getblk (inode->i_dev, tmp, inode->i_sb->s_blocksize);
+        if (extent_lookup (inode, b) == tmp)
+            return bh;
+        brelse (bh);
+    }
+
+    /*
+     * The block found below goes into the extent cache, unless a
+     * truncate got in while we slept
+     */
+    version = inode->u.ext2_i.i_extent_version;
     if (block < EXT2_NDIR_BLOCKS)
-        return inode_getblk (inode, block, create, b, err);
-    block -= EXT2_NDIR_BLOCKS;
-    if (block < addr_per_block) {
+        bh = inode_getblk (inode, block, create, b, err);
+    else if ((block -= EXT2_NDIR_BLOCKS) < addr_per_block) {
         bh = inode_getblk (inode, EXT2_IND_BLOCK, create, b, err);
-        return block_getblk (inode, bh, block, create,
+        bh = block_getblk (inode, bh, block, create,
                       inode->i_sb->s_blocksize, b, err);
-    }
-    block -= addr_per_block;
-    if (block < addr_per_block * addr_per_block) {
+    } else if ((block -= addr_per_block) < addr_per_block * addr_per_block) {
         bh = inode_getblk (inode, EXT2_DIND_BLOCK, create, b, err);
         bh = block_getblk (inode, bh, block / addr_per_block, create,
                       inode->i_sb->s_blocksize, b, err);
-        return block_getblk (inode, bh, block & (addr_per_block - 1),
+        bh = block_getblk (inode, bh, block & (addr_per_block - 1),
                       create, inode->i_sb->s_blocksize, b, err);
-    }
-    block -= addr_per_block * addr_per_block;
-    bh = inode_getblk (inode, EXT2_TIND_BLOCK, create, b, err);
-    bh = block_getblk (inode, bh, block/(addr_per_block * addr_per_block),
+    } else {
+        block -= addr_per_block * addr_per_block;
+        bh = inode_getblk (inode, EXT2_TIND_BLOCK, create, b, err);
+        bh = block_getblk (inode, bh, block/(addr_per_block * addr_per_block),
                        create, inode->i_sb->s_blocksize, b, err);
-    bh = block_getblk (inode, bh, (block/addr_per_block) & 
+        bh = block_getblk (inode, bh, (block/addr_per_block) & 
                        (addr_per_block - 1),
                        create, inode->i_sb->s_blocksize, b, err);
-    return block_getblk (inode, bh, block & (addr_per_block - 1), create,
+        bh = block_getblk (inode, bh, block & (addr_per_block - 1), create,
                        inode->i_sb->s_blocksize, b, err);
+    }
+    if (bh && version == inode->u.ext2_i.i_extent_version)
+        extent_add (inode, b, &bh->b_blocknr, 1);
+    return bh;
 }
 
 struct buffer_head * ext2_bread (struct inode * inode, int block, 
@@ -465,6 +600,7 @@ void ext2_read_inode (struct inode * inode)
     inode->u.ext2_i.i_block_group = block_group;
     inode->u.ext2_i.i_next_alloc_block = 0;
     inode->u.ext2_i.i_next_alloc_goal = 0;
+    inode->u.ext2_i.i_rsv_window.rsv_goal_size = EXT2_DEFAULT_RESERVE_BLOCKS;
     if (inode->u.ext2_i.i_prealloc_count)
         ext2_error (inode->i_sb, "ext2_read_inode",
                  "New inode has non-zero prealloc count!");
@@ -63,6 +63,687 @@ static int ext2_match (int len, const char * const name,
 	return (int) same;
 }
 
+/*
+ * Hashed directory index
+ *
+ * Once a directory grows past one block it is turned into a two or three
+ * level tree. Block 0 keeps "." and "..", but ".." covers the rest of the
+ * block and the index root lives in that space. Index nodes are blocks
+ * with a single empty entry that covers the whole block. To anything
+ * that walks the directory entries, e2fsck and readdir() included, all
+ * of this looks like free space, so the directory stays valid ext2.
+ *
+ * An index block is an array of (hash, block) pairs, sorted by hash. The
+ * first pair has no hash: its place holds the limit and count of the
+ * array. Each leaf holds the names whose hash falls between its own
+ * hash and the next one. Bit 0 of the hash is not part of the name hash:
+ * it says that the leaf continues the names of the one before, as a leaf
+ * that is split between two names with the same hash must.
+ *
+ * If the index doesn't look right EXT2_INDEX_FL is cleared and the
+ * directory is searched and grown the old way.
+ */
+#define DX_MAX_LEVELS	2
+#define DX_ROOT_OFFSET	24	/* after "." and the name of ".." */
+#define ERR_BAD_DX_DIR	-75000
+
+struct dx_entry {
+	unsigned long hash;
+	unsigned long block;
+};
+
+struct dx_countlimit {
+	unsigned short limit;
+	unsigned short count;
+};
+
+struct dx_root_info {
+	unsigned long reserved_zero;
+	unsigned char hash_version;	/* 0 */
+	unsigned char info_length;	/* 8 */
+	unsigned char indirect_levels;
+	unsigned char unused_flags;
+};
+
+struct dx_frame {
+	struct buffer_head * bh;
+	struct dx_entry * entries;
+	struct dx_entry * at;
+};
+
+struct dx_map_entry {
+	unsigned long hash;
+	unsigned short offs;
+	unsigned short size;
+};
+
+#define dx_get_count(e)		(((struct dx_countlimit *) (e))->count)
+#define dx_get_limit(e)		(((struct dx_countlimit *) (e))->limit)
+#define dx_set_count(e,n)	(((struct dx_countlimit *) (e))->count = (n))
+#define dx_set_limit(e,n)	(((struct dx_countlimit *) (e))->limit = (n))
+
+#define dx_root_info(bh) \
+	((struct dx_root_info *) ((bh)->b_data + DX_ROOT_OFFSET))
+#define dx_node_entries(bh) \
+	((struct dx_entry *) ((bh)->b_data + EXT2_DIR_REC_LEN(0)))
+#define dx_root_limit(dir) \
+	(((dir)->i_sb->s_blocksize - DX_ROOT_OFFSET - \
+	  sizeof (struct dx_root_info)) / sizeof (struct dx_entry))
+#define dx_node_limit(dir) \
+	(((dir)->i_sb->s_blocksize - EXT2_DIR_REC_LEN(0)) / \
+	 sizeof (struct dx_entry))
+
+static inline int is_dx (struct inode * dir)
+{
+	return dir->u.ext2_i.i_flags & EXT2_INDEX_FL;
+}
+
+/*
+ * "." and ".." are only in block 0, which is not a leaf.
+ */
+static inline int dx_name_ok (const char * name, int len)
+{
+	if (!len)
+		return 0;
+	if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))
+		return 0;
+	return 1;
+}
+
+/*
+ * The same hash e2fsck knows as the legacy one.
+ */
+static unsigned long dx_hash (const char * name, int len)
+{
+	unsigned long hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+	while (len--) {
+		hash = hash1 + (hash0 ^ (*name++ * 7152373));
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+static void dx_clear_index (struct inode * dir)
+{
+	dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+	if (!IS_RDONLY(dir))
+		dir->i_dirt = 1;
+}
+
+static inline int dx_bad_block (struct inode * dir, unsigned long block)
+{
+	return !block ||
+		block >= dir->i_size >> EXT2_BLOCK_SIZE_BITS(dir->i_sb);
+}
+
+static void dx_release (struct dx_frame * frames)
+{
+	int i;
+
+	for (i = 0; i < DX_MAX_LEVELS; i++)
+		brelse (frames[i].bh);
+}
+
+/*
+ * Walk the index down to the leaf that should hold 'hash'. On success
+ * frames[] holds the path, one frame per level, and the last frame is
+ * returned. On failure nothing is held and *err is set, to
+ * ERR_BAD_DX_DIR if the index is corrupt.
+ */
+static struct dx_frame * dx_probe (struct inode * dir, unsigned long hash,
+				   struct dx_frame * frames, int * err)
+{
+	struct dx_frame * frame = frames;
+	struct ext2_dir_entry * de;
+	struct dx_root_info * info;
+	struct dx_entry * entries, * p, * q, * m;
+	struct buffer_head * bh;
+	unsigned int count, levels;
+
+	frames[0].bh = frames[1].bh = NULL;
+	if (!(bh = ext2_bread (dir, 0, 0, err)))
+		return NULL;
+	de = (struct ext2_dir_entry *) bh->b_data;
+	info = dx_root_info (bh);
+	if (de->rec_len != EXT2_DIR_REC_LEN(1) ||
+	    ((struct ext2_dir_entry *) (bh->b_data + de->rec_len))->rec_len !=
+	    dir->i_sb->s_blocksize - EXT2_DIR_REC_LEN(1)) {
+		ext2_warning (dir->i_sb, "dx_probe",
+			      "bad index root, inode %lu", dir->i_ino);
+		goto fail;
+	}
+	if (info->hash_version != 0 || info->info_length != 8 ||
+	    info->unused_flags) {
+		ext2_warning (dir->i_sb, "dx_probe",
+			      "unknown index version, inode %lu", dir->i_ino);
+		goto fail;
+	}
+	if ((levels = info->indirect_levels) >= DX_MAX_LEVELS) {
+		ext2_warning (dir->i_sb, "dx_probe",
+			      "unsupported index depth %u, inode %lu",
+			      levels, dir->i_ino);
+		goto fail;
+	}
+	entries = (struct dx_entry *) (info + 1);
+	if (dx_get_limit (entries) != dx_root_limit (dir)) {
+		ext2_warning (dir->i_sb, "dx_probe",
+			      "bad index root limit, inode %lu", dir->i_ino);
+		goto fail;
+	}
+	while (1) {
+		count = dx_get_count (entries);
+		if (!count || count > dx_get_limit (entries)) {
+			ext2_warning (dir->i_sb, "dx_probe",
+				      "bad index count %u, inode %lu",
+				      count, dir->i_ino);
+			goto fail;
+		}
+		p = entries + 1;
+		q = entries + count - 1;
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (m->hash > hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		frame->bh = bh;
+		frame->entries = entries;
+		frame->at = p - 1;
+		if (dx_bad_block (dir, frame->at->block)) {
+			ext2_warning (dir->i_sb, "dx_probe",
+				      "bad index block %lu, inode %lu",
+				      frame->at->block, dir->i_ino);
+			bh = NULL;
+			goto fail;
+		}
+		if (!levels--)
+			return frame;
+		if (!(bh = ext2_bread (dir, frame->at->block, 0, err)))
+			goto fail_err;
+		entries = dx_node_entries (bh);
+		if (dx_get_limit (entries) != dx_node_limit (dir)) {
+			ext2_warning (dir->i_sb, "dx_probe",
+				      "bad index node limit, inode %lu",
+				      dir->i_ino);
+			goto fail;
+		}
+		frame++;
+	}
+fail:
+	*err = ERR_BAD_DX_DIR;
+fail_err:
+	brelse (bh);
+	while (frame >= frames) {
+		if (frame->bh != bh)
+			brelse (frame->bh);
+		frame->bh = NULL;
+		frame--;
+	}
+	return NULL;
+}
+
+/*
+ * Step to the next leaf if it continues the names with this hash.
+ * Returns 1 if there is one, 0 if not and < 0 on error.
+ */
+static int dx_next_block (struct inode * dir, unsigned long hash,
+			  struct dx_frame * frame, struct dx_frame * frames)
+{
+	struct dx_frame * p = frame;
+	struct buffer_head * bh;
+	int num = 0, err;
+
+	while (1) {
+		p->at++;
+		if (p->at < p->entries + dx_get_count (p->entries))
+			break;
+		if (p == frames)
+			return 0;
+		num++;
+		p--;
+	}
+	if (!(p->at->hash & 1) || (p->at->hash & ~1) != hash)
+		return 0;
+	while (num--) {
+		if (dx_bad_block (dir, p->at->block))
+			return ERR_BAD_DX_DIR;
+		if (!(bh = ext2_bread (dir, p->at->block, 0, &err)))
+			return err;
+		p++;
+		brelse (p->bh);
+		p->bh = bh;
+		p->entries = p->at = dx_node_entries (bh);
+		if (dx_get_limit (p->entries) != dx_node_limit (dir) ||
+		    !dx_get_count (p->entries))
+			return ERR_BAD_DX_DIR;
+	}
+	if (dx_bad_block (dir, frame->at->block))
+		return ERR_BAD_DX_DIR;
+	return 1;
+}
+
+/*
+ * Lookups don't take i_sem, so a leaf can be split under a search that
+ * sleeps. do_split() gives the directory a new i_version, and a search
+ * that missed while that happened is simply done again.
+ */
+static struct buffer_head * dx_find_entry (struct inode * dir,
+	const char * name, int namelen, struct ext2_dir_entry ** res_dir,
+	int * err)
+{
+	struct dx_frame frames[DX_MAX_LEVELS], * frame;
+	struct buffer_head * bh;
+	struct ext2_dir_entry * de;
+	unsigned long hash = dx_hash (name, namelen);
+	unsigned long version, offset;
+	char * top;
+
+repeat:
+	version = dir->i_version;
+	if (!(frame = dx_probe (dir, hash, frames, err)))
+		return NULL;
+	do {
+		offset = frame->at->block << EXT2_BLOCK_SIZE_BITS(dir->i_sb);
+		if (!(bh = ext2_bread (dir, frame->at->block, 0, err)))
+			goto out;
+		de = (struct ext2_dir_entry *) bh->b_data;
+		top = bh->b_data + dir->i_sb->s_blocksize;
+		while ((char *) de < top) {
+			if (!ext2_check_dir_entry ("dx_find_entry", dir,
+						   de, bh, offset)) {
+				brelse (bh);
+				*err = -EIO;
+				goto out;
+			}
+			if (de->inode && ext2_match (namelen, name, de)) {
+				dx_release (frames);
+				*res_dir = de;
+				return bh;
+			}
+			offset += de->rec_len;
+			de = (struct ext2_dir_entry *) ((char *) de + de->rec_len);
+		}
+		brelse (bh);
+		*err = dx_next_block (dir, hash, frame, frames);
+	} while (*err == 1);
+	if (!*err)
+		*err = -ENOENT;
+out:
+	dx_release (frames);
+	if (*err == -ENOENT && dir->i_version != version)
+		goto repeat;
+	return NULL;
+}
+
+/*
+ * Add a name to one block, if there is room for it. Same semantics as
+ * ext2_add_entry(), but returns -ENOSPC if the block is full.
+ */
+static int add_dirent_to_buf (struct inode * dir, const char * name,
+			      int namelen, struct buffer_head * bh,
+			      unsigned long offset,
+			      struct ext2_dir_entry ** res_dir)
+{
+	unsigned short rec_len = EXT2_DIR_REC_LEN(namelen);
+	struct ext2_dir_entry * de, * de1;
+	char * top = bh->b_data + dir->i_sb->s_blocksize;
+
+	de = (struct ext2_dir_entry *) bh->b_data;
+	while ((char *) de < top) {
+		if (!ext2_check_dir_entry ("add_dirent_to_buf", dir, de, bh,
+					   offset))
+			return -ENOENT;
+		if (de->inode != 0 && ext2_match (namelen, name, de))
+			return -EEXIST;
+		if ((de->inode == 0 && de->rec_len >= rec_len) ||
+		    (de->rec_len >= EXT2_DIR_REC_LEN(de->name_len) + rec_len)) {
+			if (de->inode) {
+				de1 = (struct ext2_dir_entry *) ((char *) de +
+					EXT2_DIR_REC_LEN(de->name_len));
+				de1->rec_len = de->rec_len -
+					EXT2_DIR_REC_LEN(de->name_len);
+				de->rec_len = EXT2_DIR_REC_LEN(de->name_len);
+				de = de1;
+			}
+			de->inode = 0;
+			de->name_len = namelen;
+			memcpy (de->name, name, namelen);
+			dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+			dir->i_dirt = 1;
+			bh->b_dirt = 1;
+			*res_dir = de;
+			return 0;
+		}
+		offset += de->rec_len;
+		de = (struct ext2_dir_entry *) ((char *) de + de->rec_len);
+	}
+	return -ENOSPC;
+}
+
+/*
+ * Add a block at the end of the directory. It is made to look like an
+ * empty directory block before anyone can see it.
+ */
+static struct buffer_head * ext2_append (struct inode * dir,
+					 unsigned long * block, int * err)
+{
+	struct buffer_head * bh;
+	struct ext2_dir_entry * de;
+
+	*block = dir->i_size >> EXT2_BLOCK_SIZE_BITS(dir->i_sb);
+	if (!(bh = ext2_bread (dir, *block, 1, err)))
+		return NULL;
+	de = (struct ext2_dir_entry *) bh->b_data;
+	de->inode = 0;
+	de->rec_len = dir->i_sb->s_blocksize;
+	de->name_len = 0;
+	bh->b_dirt = 1;
+	dir->i_size += dir->i_sb->s_blocksize;
+	dir->i_dirt = 1;
+	return bh;
+}
+
+/* Put a new (hash, block) pair after frame->at, which must have room. */
+static void dx_insert_block (struct dx_frame * frame, unsigned long hash,
+			     unsigned long block)
+{
+	struct dx_entry * entries = frame->entries;
+	struct dx_entry * new = frame->at + 1;
+	int count = dx_get_count (entries);
+
+	memmove (new + 1, new, (char *) (entries + count) - (char *) new);
+	new->hash = hash;
+	new->block = block;
+	dx_set_count (entries, count + 1);
+	frame->bh->b_dirt = 1;
+}
+
+/*
+ * Squeeze the free space of a leaf together. This moves entries, so it
+ * is only done when a split still left no room for the new name.
+ */
+static void dx_compact (struct buffer_head * bh, int size)
+{
+	struct ext2_dir_entry * de, * next, * last = NULL;
+	char * to = bh->b_data, * top = bh->b_data + size;
+	int rec_len;
+
+	for (de = (struct ext2_dir_entry *) to; (char *) de < top; de = next) {
+		next = (struct ext2_dir_entry *) ((char *) de + de->rec_len);
+		if (!de->inode)
+			continue;
+		rec_len = EXT2_DIR_REC_LEN(de->name_len);
+		if ((char *) de != to)
+			memmove (to, de, rec_len);
+		last = (struct ext2_dir_entry *) to;
+		last->rec_len = rec_len;
+		to += rec_len;
+	}
+	if (last)
+		last->rec_len = top - (char *) last;
+	else {
+		de = (struct ext2_dir_entry *) bh->b_data;
+		de->inode = 0;
+		de->rec_len = size;
+	}
+}
+
+/*
+ * Split a full leaf: the upper half of the names by hash go to a new
+ * block. Returns the half 'hash' belongs in, with *bh released or
+ * swapped as needed.
+ *
+ * Everything that can sleep is done first. Moved names are emptied in
+ * the old block but stay where they are: unlink and rename hold entries
+ * across a sleep and check that the inode number is still theirs.
+ */
+static int do_split (struct inode * dir, struct buffer_head ** bh,
+		     struct dx_frame * frame, unsigned long hash)
+{
+	struct dx_map_entry * map, tmp;
+	struct buffer_head * bh2;
+	struct ext2_dir_entry * de, * de2, * pde;
+	unsigned long newblock, hash2;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	char * data = (*bh)->b_data, * top = data + blocksize;
+	int count, move, size, continued, i, j, err;
+
+	map = (struct dx_map_entry *) __get_free_page (GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	if (!(bh2 = ext2_append (dir, &newblock, &err))) {
+		free_page ((unsigned long) map);
+		return err;
+	}
+
+	count = 0;
+	for (de = (struct ext2_dir_entry *) data; (char *) de < top;
+	     de = (struct ext2_dir_entry *) ((char *) de + de->rec_len)) {
+		if (!de->inode)
+			continue;
+		map[count].hash = dx_hash (de->name, de->name_len);
+		map[count].offs = (char *) de - data;
+		map[count].size = EXT2_DIR_REC_LEN(de->name_len);
+		count++;
+	}
+	for (i = 1; i < count; i++) {
+		tmp = map[i];
+		for (j = i; j > 0 && map[j - 1].hash > tmp.hash; j--)
+			map[j] = map[j - 1];
+		map[j] = tmp;
+	}
+	size = move = 0;
+	for (i = count - 1; i > 0; i--) {
+		if (size + map[i].size / 2 > blocksize / 2)
+			break;
+		size += map[i].size;
+		move++;
+	}
+	i = count - move;
+	hash2 = map[i].hash;
+	continued = hash2 == map[i - 1].hash;
+
+	de2 = pde = (struct ext2_dir_entry *) bh2->b_data;
+	for (; i < count; i++) {
+		de = (struct ext2_dir_entry *) (data + map[i].offs);
+		memcpy (de2, de, map[i].size);
+		de2->rec_len = map[i].size;
+		pde = de2;
+		de2 = (struct ext2_dir_entry *) ((char *) de2 + map[i].size);
+		de->inode = 0;
+	}
+	pde->rec_len = bh2->b_data + blocksize - (char *) pde;
+	free_page ((unsigned long) map);
+
+	pde = NULL;
+	for (de = (struct ext2_dir_entry *) data; (char *) de < top;
+	     de = (struct ext2_dir_entry *) ((char *) de + de->rec_len)) {
+		if (!de->inode && pde)
+			pde->rec_len += de->rec_len;
+		else
+			pde = de;
+	}
+	(*bh)->b_dirt = 1;
+	bh2->b_dirt = 1;
+	dx_insert_block (frame, hash2 + continued, newblock);
+	dir->i_version = ++event;
+
+	if (hash >= hash2) {
+		brelse (*bh);
+		*bh = bh2;
+	} else
+		brelse (bh2);
+	return 0;
+}
+
+/*
+ * ext2_add_entry() for an indexed directory. dir->i_sem is held, so
+ * this is the only thing changing the index.
+ */
+static struct buffer_head * dx_add_entry (struct inode * dir,
+	const char * name, int namelen, struct ext2_dir_entry ** res_dir,
+	int * err)
+{
+	struct dx_frame frames[DX_MAX_LEVELS], * frame;
+	struct dx_entry * entries, * entries2;
+	struct buffer_head * bh, * bh2;
+	unsigned long hash = dx_hash (name, namelen);
+	unsigned long newblock, hash2;
+	int levels, icount, icount1;
+
+	if (!(frame = dx_probe (dir, hash, frames, err)))
+		return NULL;
+	entries = frame->entries;
+	if (!(bh = ext2_bread (dir, frame->at->block, 0, err)))
+		goto out;
+	*err = add_dirent_to_buf (dir, name, namelen, bh,
+		frame->at->block << EXT2_BLOCK_SIZE_BITS(dir->i_sb), res_dir);
+	if (*err != -ENOSPC)
+		goto out;
+
+	/*
+	 * The leaf is full and will be split. Make room for the new leaf
+	 * in the index first, if needed.
+	 */
+	if ((icount = dx_get_count (entries)) == dx_get_limit (entries)) {
+		levels = frame - frames;
+		if (levels &&
+		    dx_get_count (frames[0].entries) ==
+		    dx_get_limit (frames[0].entries)) {
+			ext2_warning (dir->i_sb, "dx_add_entry",
+				      "directory index full, inode %lu",
+				      dir->i_ino);
+			*err = -ENOSPC;
+			goto out;
+		}
+		if (!(bh2 = ext2_append (dir, &newblock, err)))
+			goto out;
+		entries2 = dx_node_entries (bh2);
+		if (levels) {
+			/* split the index node in two */
+			icount1 = icount / 2;
+			hash2 = entries[icount1].hash;
+			memcpy (entries2, entries + icount1,
+				(icount - icount1) * sizeof (struct dx_entry));
+			dx_set_limit (entries2, dx_node_limit (dir));
+			dx_set_count (entries2, icount - icount1);
+			dx_set_count (entries, icount1);
+			frame->bh->b_dirt = 1;
+			bh2->b_dirt = 1;
+			dx_insert_block (frames, hash2, newblock);
+			if (frame->at - entries >= icount1) {
+				frame->at = entries2 + (frame->at - entries - icount1);
+				frame->entries = entries2;
+				brelse (frame->bh);
+				frame->bh = bh2;
+			} else
+				brelse (bh2);
+		} else {
+			/* the root is full: move it down a level */
+			memcpy (entries2, entries,
+				icount * sizeof (struct dx_entry));
+			dx_set_limit (entries2, dx_node_limit (dir));
+			dx_set_count (entries, 1);
+			entries[0].block = newblock;
+			dx_root_info (frames[0].bh)->indirect_levels = 1;
+			frames[0].bh->b_dirt = 1;
+			bh2->b_dirt = 1;
+			frame = frames + 1;
+			frame->bh = bh2;
+			frame->entries = entries2;
+			frame->at = entries2 + (frames[0].at - entries);
+			frames[0].at = entries;
+		}
+	}
+	if ((*err = do_split (dir, &bh, frame, hash)))
+		goto out;
+	*err = add_dirent_to_buf (dir, name, namelen, bh, 0, res_dir);
+	if (*err == -ENOSPC) {
+		dx_compact (bh, dir->i_sb->s_blocksize);
+		*err = add_dirent_to_buf (dir, name, namelen, bh, 0, res_dir);
+	}
+out:
+	dx_release (frames);
+	if (*err) {
+		brelse (bh);
+		return NULL;
+	}
+	return bh;
+}
+
+/*
+ * A directory of one block is full: move everything but "." and ".."
+ * to a new leaf and build the index root in block 0. Returns
+ * ERR_BAD_DX_DIR if block 0 isn't laid out as mkdir() does it.
+ */
+static struct buffer_head * dx_make_indexed (struct inode * dir,
+	const char * name, int namelen, struct ext2_dir_entry ** res_dir,
+	int * err)
+{
+	struct buffer_head * bh, * bh2;
+	struct ext2_dir_entry * de, * dotdot, * to, * last = NULL;
+	struct dx_root_info * info;
+	struct dx_entry * entries;
+	unsigned long block;
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	char * top;
+	int rec_len;
+
+	if (!(bh = ext2_bread (dir, 0, 0, err)))
+		return NULL;
+	de = (struct ext2_dir_entry *) bh->b_data;
+	dotdot = (struct ext2_dir_entry *) (bh->b_data + EXT2_DIR_REC_LEN(1));
+	if (de->rec_len != EXT2_DIR_REC_LEN(1) || de->name_len != 1 ||
+	    de->name[0] != '.' || dotdot->name_len != 2 ||
+	    dotdot->name[0] != '.' || dotdot->name[1] != '.') {
+		brelse (bh);
+		*err = ERR_BAD_DX_DIR;
+		return NULL;
+	}
+	if (!(bh2 = ext2_append (dir, &block, err))) {
+		brelse (bh);
+		return NULL;
+	}
+
+	top = bh->b_data + blocksize;
+	to = (struct ext2_dir_entry *) bh2->b_data;
+	for (de = (struct ext2_dir_entry *) ((char *) dotdot + dotdot->rec_len);
+	     (char *) de < top;
+	     de = (struct ext2_dir_entry *) ((char *) de + de->rec_len)) {
+		if (!de->inode)
+			continue;
+		rec_len = EXT2_DIR_REC_LEN(de->name_len);
+		memcpy (to, de, rec_len);
+		to->rec_len = rec_len;
+		last = to;
+		to = (struct ext2_dir_entry *) ((char *) to + rec_len);
+	}
+	if (last)
+		last->rec_len = bh2->b_data + blocksize - (char *) last;
+
+	dotdot->rec_len = blocksize - EXT2_DIR_REC_LEN(1);
+	memset (bh->b_data + DX_ROOT_OFFSET, 0, blocksize - DX_ROOT_OFFSET);
+	info = dx_root_info (bh);
+	info->info_length = sizeof (struct dx_root_info);
+	entries = (struct dx_entry *) (info + 1);
+	dx_set_limit (entries, dx_root_limit (dir));
+	dx_set_count (entries, 1);
+	entries[0].block = block;
+	bh->b_dirt = 1;
+	bh2->b_dirt = 1;
+	dir->u.ext2_i.i_flags |= EXT2_INDEX_FL;
+	dir->i_dirt = 1;
+	dir->i_version = ++event;
+	brelse (bh2);
+	brelse (bh);
+	return dx_add_entry (dir, name, namelen, res_dir, err);
+}
+
 /*
  *	ext2_find_entry()
  *
@@ -93,6 +774,15 @@ static struct buffer_head * ext2_find_entry (struct inode * dir,
         namelen = EXT2_NAME_LEN;
 #endif
 
+    if (is_dx (dir) && dx_name_ok (name, namelen)) {
+        struct buffer_head * bh;
+
+        bh = dx_find_entry (dir, name, namelen, res_dir, &err);
+        if (bh || err != ERR_BAD_DX_DIR)
+            return bh;
+        dx_clear_index (dir);
+    }
+
     memset (bh_use, 0, sizeof (bh_use));
     toread = 0;
     for (block = 0; block < NAMEI_RA_SIZE; ++block) {
@@ -246,6 +936,12 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 		*err = -ENOENT;
 		return NULL;
 	}
+	if (is_dx (dir)) {
+		bh = dx_add_entry (dir, name, namelen, res_dir, err);
+		if (bh || *err != ERR_BAD_DX_DIR)
+			return bh;
+		dx_clear_index (dir);
+	}
 	bh = ext2_bread (dir, 0, 0, err);
 	if (!bh)
 		return NULL;
@@ -257,6 +953,13 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 		if ((char *)de >= sb->s_blocksize + bh->b_data) {
 			brelse (bh);
 			bh = NULL;
+			if (offset == sb->s_blocksize &&
+			    dir->i_size == offset && !is_dx (dir)) {
+				bh = dx_make_indexed (dir, name, namelen,
+						      res_dir, err);
+				if (bh || *err != ERR_BAD_DX_DIR)
+					return bh;
+			}
 			bh = ext2_bread (dir, offset >> EXT2_BLOCK_SIZE_BITS(sb), 1, err);
 			if (!bh)
 				return NULL;
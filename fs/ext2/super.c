@@ -24,6 +24,8 @@
 #include <linux/stat.h>
 #include <linux/string.h>
 #include <linux/locks.h>
+#include <linux/mm.h>
+#include <linux/malloc.h>
 
 extern int vsprintf (char *, const char *, va_list);
 
@@ -89,6 +91,66 @@ void ext2_warning (struct super_block * sb, const char * function,
 		MAJOR(sb->s_dev), MINOR(sb->s_dev), function, buf);
 }
 
+/*
+ * The bitmap caches hold the bitmaps of all the groups, unless each of
+ * them would pin more than 1/64 of the memory in buffers. The group info
+ * and the cache slots are allocated together.
+ */
+static int ext2_alloc_bitmap_cache (struct super_block * sb)
+{
+	unsigned long groups = sb->u.ext2_sb.s_groups_count;
+	unsigned long nr;
+	char * p;
+	int i;
+
+	nr = (high_memory >> 6) / sb->s_blocksize;
+	if (nr < EXT2_MAX_GROUP_LOADED)
+		nr = EXT2_MAX_GROUP_LOADED;
+	if (nr > groups)
+		nr = groups;
+	p = (char *) kmalloc (groups * sizeof (struct ext2_group_info) +
+			      nr * 2 * (sizeof (unsigned long) +
+					sizeof (struct buffer_head *)),
+			      GFP_KERNEL);
+	if (!p)
+		return 0;
+	sb->u.ext2_sb.s_group_info = (struct ext2_group_info *) p;
+	p += groups * sizeof (struct ext2_group_info);
+	sb->u.ext2_sb.s_block_bitmap = (struct buffer_head **) p;
+	p += nr * sizeof (struct buffer_head *);
+	sb->u.ext2_sb.s_inode_bitmap = (struct buffer_head **) p;
+	p += nr * sizeof (struct buffer_head *);
+	sb->u.ext2_sb.s_block_bitmap_number = (unsigned long *) p;
+	p += nr * sizeof (unsigned long);
+	sb->u.ext2_sb.s_inode_bitmap_number = (unsigned long *) p;
+	for (i = 0; i < groups; i++) {
+		sb->u.ext2_sb.s_group_info[i].gi_block_slot = -1;
+		sb->u.ext2_sb.s_group_info[i].gi_inode_slot = -1;
+		sb->u.ext2_sb.s_group_info[i].gi_free_bytes = -1;
+		sb->u.ext2_sb.s_group_info[i].gi_block_used = 0;
+		sb->u.ext2_sb.s_group_info[i].gi_inode_used = 0;
+	}
+	sb->u.ext2_sb.s_max_loaded = nr;
+	sb->u.ext2_sb.s_loaded_inode_bitmaps = 0;
+	sb->u.ext2_sb.s_loaded_block_bitmaps = 0;
+	sb->u.ext2_sb.s_bitmap_clock = 0;
+	return 1;
+}
+
+static void ext2_free_bitmap_cache (struct super_block * sb)
+{
+	int i;
+
+	for (i = 0; i < sb->u.ext2_sb.s_loaded_inode_bitmaps; i++)
+		brelse (sb->u.ext2_sb.s_inode_bitmap[i]);
+	for (i = 0; i < sb->u.ext2_sb.s_loaded_block_bitmaps; i++)
+		brelse (sb->u.ext2_sb.s_block_bitmap[i]);
+	sb->u.ext2_sb.s_loaded_inode_bitmaps = 0;
+	sb->u.ext2_sb.s_loaded_block_bitmaps = 0;
+	kfree (sb->u.ext2_sb.s_group_info);
+	sb->u.ext2_sb.s_group_info = NULL;
+}
+
 void ext2_put_super (struct super_block * sb)
 {
 	int i;
@@ -105,12 +167,7 @@ void ext2_put_super (struct super_block * sb)
 	for (i = 0; i < EXT2_MAX_GROUP_DESC; i++)
 		if (sb->u.ext2_sb.s_group_desc[i])
 			brelse (sb->u.ext2_sb.s_group_desc[i]);
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_inode_bitmap[i])
-			brelse (sb->u.ext2_sb.s_inode_bitmap[i]);
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_block_bitmap[i])
-			brelse (sb->u.ext2_sb.s_block_bitmap[i]);
+	ext2_free_bitmap_cache (sb);
 	brelse (sb->u.ext2_sb.s_sbh);
 	unlock_super (sb);
 	return;
@@ -444,6 +501,9 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
     sb->u.ext2_sb.s_mount_state = es->s_state;
     sb->u.ext2_sb.s_rename_lock = 0;
     sb->u.ext2_sb.s_rename_wait = NULL;
+    sb->u.ext2_sb.s_rsv_window_head.rsv_next =
+        sb->u.ext2_sb.s_rsv_window_head.rsv_prev =
+        &sb->u.ext2_sb.s_rsv_window_head;
 #ifdef EXT2FS_PRE_02B_COMPAT
     if (sb->s_magic == EXT2_PRE_02B_MAGIC) {
         if (es->s_blocks_count > 262144) {
@@ -544,14 +604,15 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
         printk ("EXT2-fs: group descriptors corrupted !\n");
         return NULL;
     }
-    for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++) {
-        sb->u.ext2_sb.s_inode_bitmap_number[i] = 0;
-        sb->u.ext2_sb.s_inode_bitmap[i] = NULL;
-        sb->u.ext2_sb.s_block_bitmap_number[i] = 0;
-        sb->u.ext2_sb.s_block_bitmap[i] = NULL;
+    if (!ext2_alloc_bitmap_cache (sb)) {
+        sb->s_dev = 0;
+        unlock_super (sb);
+        for (j = 0; j < i; j++)
+            brelse (sb->u.ext2_sb.s_group_desc[j]);
+        brelse (bh);
+        printk ("EXT2-fs: not enough memory for the bitmap cache\n");
+        return NULL;
     }
-    sb->u.ext2_sb.s_loaded_inode_bitmaps = 0;
-    sb->u.ext2_sb.s_loaded_block_bitmaps = 0;
     unlock_super (sb);
     /*
      * set up enough so that it can read an inode
@@ -563,6 +624,7 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
         for (i = 0; i < EXT2_MAX_GROUP_DESC; i++)
             if (sb->u.ext2_sb.s_group_desc[i])
                 brelse (sb->u.ext2_sb.s_group_desc[i]);
+        ext2_free_bitmap_cache (sb);
         brelse (bh);
         printk ("EXT2-fs: get root inode failed\n");
         return NULL;
@@ -656,6 +718,10 @@ int ext2_remount (struct super_block * sb, int * flags, char * data)
 	return 0;
 }
 
+/*
+ * The free counts in the super block are kept up to date by the
+ * allocators, so statfs never has to look at the bitmaps.
+ */
 void ext2_statfs (struct super_block * sb, struct statfs * buf)
 {
 	long tmp;
@@ -663,7 +729,7 @@ void ext2_statfs (struct super_block * sb, struct statfs * buf)
 	put_fs_long (EXT2_SUPER_MAGIC, &buf->f_type);
 	put_fs_long (sb->s_blocksize, &buf->f_bsize);
 	put_fs_long (sb->u.ext2_sb.s_es->s_blocks_count, &buf->f_blocks);
-	tmp = ext2_count_free_blocks (sb);
+	tmp = sb->u.ext2_sb.s_es->s_free_blocks_count;
 	put_fs_long (tmp, &buf->f_bfree);
 	if (tmp >= sb->u.ext2_sb.s_es->s_r_blocks_count)
 		put_fs_long (tmp - sb->u.ext2_sb.s_es->s_r_blocks_count,
@@ -671,7 +737,7 @@ void ext2_statfs (struct super_block * sb, struct statfs * buf)
 	else
 		put_fs_long (0, &buf->f_bavail);
 	put_fs_long (sb->u.ext2_sb.s_es->s_inodes_count, &buf->f_files);
-	put_fs_long (ext2_count_free_inodes (sb), &buf->f_ffree);
+	put_fs_long (sb->u.ext2_sb.s_es->s_free_inodes_count, &buf->f_ffree);
 	put_fs_long (EXT2_NAME_LEN, &buf->f_namelen);
 	/* Don't know what value to put in buf->f_fsid */
 }
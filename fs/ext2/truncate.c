@@ -24,6 +24,7 @@
 #include <linux/sched.h>
 #include <linux/stat.h>
 #include <linux/locks.h>
+#include <linux/pagemap.h>
 
 #define clear_block(addr,size,value) \
 	__asm__("cld\n\t" \
@@ -84,6 +85,7 @@ repeat:
 			continue;
 		}
 		*p = 0;
+		ext2_forget_extents (inode, i);
 		inode->i_blocks -= blocks;
 		inode->i_dirt = 1;
 		if (inode->u.ext2_i.i_flags & EXT2_SECRM_FL) {
@@ -133,6 +135,7 @@ static int trunc_indirect (struct inode * inode, int offset, unsigned long * p)
 	}
 	if (!ind_bh) {
 		*p = 0;
+		ext2_forget_extents (inode, offset);
 		return 0;
 	}
 repeat:
@@ -161,6 +164,7 @@ repeat:
 			continue;
 		}
 		*ind = 0;
+		ext2_forget_extents (inode, offset + i);
 		ind_bh->b_dirt = 1;
 		if (inode->u.ext2_i.i_flags & EXT2_SECRM_FL) {
 			clear_block (bh->b_data, inode->i_sb->s_blocksize,
@@ -229,6 +233,7 @@ static int trunc_dindirect (struct inode * inode, int offset,
 	}
 	if (!dind_bh) {
 		*p = 0;
+		ext2_forget_extents (inode, offset);
 		return 0;
 	}
 repeat:
@@ -291,6 +296,8 @@ static int trunc_tindirect (struct inode * inode)
 	}
 	if (!tind_bh) {
 		*p = 0;
+		ext2_forget_extents (inode, EXT2_NDIR_BLOCKS + addr_per_block +
+				     addr_per_block * addr_per_block);
 		return 0;
 	}
 repeat:
@@ -335,6 +342,7 @@ void ext2_truncate (struct inode * inode)
 	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 	    S_ISLNK(inode->i_mode)))
 		return;
+	truncate_inode_pages(inode, inode->i_size);
 	ext2_discard_prealloc(inode);
 	while (1) {
 		retry = trunc_direct(inode);
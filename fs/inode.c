@@ -9,6 +9,7 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/string.h>
+#include <linux/pagemap.h>
 
 #include <asm/system.h>
 
@@ -153,6 +154,8 @@ void clear_inode(struct inode * inode)
     struct wait_queue * wait;
 
     wait_on_inode(inode);
+    if (inode->i_pages)
+        truncate_inode_pages(inode, 0);
     remove_inode_hash(inode);
     remove_inode_free(inode);
     wait = ((volatile struct inode *) inode)->i_wait;
@@ -390,6 +393,7 @@ repeat:
     clear_inode(inode);
     inode->i_count = 1;
     inode->i_nlink = 1;
+    inode->i_version = ++event;
     inode->i_sem.count = 1;
     nr_free_inodes--;
     if (nr_free_inodes < 0) {
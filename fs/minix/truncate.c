@@ -9,6 +9,7 @@
 #include <linux/minix_fs.h>
 #include <linux/stat.h>
 #include <linux/fcntl.h>
+#include <linux/pagemap.h>
 
 /*
  * Truncate has the most races in the whole filesystem: coding it is
@@ -172,6 +173,7 @@ void minix_truncate(struct inode * inode)
     if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
            S_ISLNK(inode->i_mode)))
         return;
+    truncate_inode_pages(inode, inode->i_size);
     while (1) {
         retry = trunc_direct(inode);
         retry |= trunc_indirect(inode, 7, inode->u.minix_i.i_data + 7);
@@ -90,12 +90,16 @@ int permission(struct inode * inode,int mask)
  * lookup() looks up one part of a pathname, using the fs-dependent
  * routines (currently minix_lookup) for it. It also checks for
  * fathers (pseudo-roots, mount-points)
+ *
+ * The dcache is tried first, and what the filesystem says is added to
+ * it, unless the directory changed while we were waiting for it.
  */
 int lookup(struct inode * dir,const char * name, int len,
 	struct inode ** result)
 {
     struct super_block * sb;
-    int perm;
+    unsigned long ino, version;
+    int perm, error;
 
     *result = NULL;
     if (!dir)
@@ -127,7 +131,26 @@ int lookup(struct inode * dir,const char * name, int len,
         *result = dir;
         return 0;
     }
-    return dir->i_op->lookup(dir, name, len, result);
+    if (dcache_lookup(dir, name, len, &ino)) {
+        if (!ino) {
+            iput(dir);
+            return -ENOENT;
+        }
+        *result = iget(dir->i_sb, ino);
+        iput(dir);
+        return *result ? 0 : -EACCES;
+    }
+    version = dir->i_version;
+    dir->i_count++;
+    error = dir->i_op->lookup(dir, name, len, result);
+    if (dir->i_version == version) {
+        if (!error && (*result)->i_dev == dir->i_dev)
+            dcache_add(dir, name, len, (*result)->i_ino);
+        else if (error == -ENOENT)
+            dcache_add(dir, name, len, 0);
+    }
+    iput(dir);
+    return error;
 }
 
 int follow_link(struct inode * dir, struct inode * inode,
@@ -315,6 +338,7 @@ int open_namei(const char * pathname, int flag, int mode,
         else {
             dir->i_count++;    /* create eats the dir */
             error = dir->i_op->create(dir, basename, namelen, mode, res_inode);
+            dir->i_version = ++event;
             up(&dir->i_sem);
             iput(dir);
             return error;
@@ -408,9 +432,12 @@ int do_mknod(const char * filename, int mode, dev_t dev)
 		iput(dir);
 		return -EPERM;
 	}
+	dir->i_count++;		/* mknod eats the dir */
 	down(&dir->i_sem);
 	error = dir->i_op->mknod(dir,basename,namelen,mode,dev);
+	dir->i_version = ++event;
 	up(&dir->i_sem);
+	iput(dir);
 	return error;
 }
 
@@ -463,9 +490,12 @@ static int do_mkdir(const char * pathname, int mode)
 		iput(dir);
 		return -EPERM;
 	}
+	dir->i_count++;		/* mkdir eats the dir */
 	down(&dir->i_sem);
 	error = dir->i_op->mkdir(dir,basename,namelen,mode);
+	dir->i_version = ++event;
 	up(&dir->i_sem);
+	iput(dir);
 	return error;
 }
 
@@ -507,7 +537,11 @@ static int do_rmdir(const char * name)
 		iput(dir);
 		return -EPERM;
 	}
-	return dir->i_op->rmdir(dir,basename,namelen);
+	dir->i_count++;		/* rmdir eats the dir */
+	error = dir->i_op->rmdir(dir,basename,namelen);
+	dir->i_version = ++event;
+	iput(dir);
+	return error;
 }
 
 asmlinkage int sys_rmdir(const char * pathname)
@@ -548,7 +582,11 @@ static int do_unlink(const char * name)
 		iput(dir);
 		return -EPERM;
 	}
-	return dir->i_op->unlink(dir,basename,namelen);
+	dir->i_count++;		/* unlink eats the dir */
+	error = dir->i_op->unlink(dir,basename,namelen);
+	dir->i_version = ++event;
+	iput(dir);
+	return error;
 }
 
 asmlinkage int sys_unlink(const char * pathname)
@@ -589,9 +627,12 @@ static int do_symlink(const char * oldname, const char * newname)
 		iput(dir);
 		return -EPERM;
 	}
+	dir->i_count++;		/* symlink eats the dir */
 	down(&dir->i_sem);
 	error = dir->i_op->symlink(dir,basename,namelen,oldname);
+	dir->i_version = ++event;
 	up(&dir->i_sem);
+	iput(dir);
 	return error;
 }
 
@@ -648,9 +689,12 @@ static int do_link(struct inode * oldinode, const char * newname)
 		iput(oldinode);
 		return -EPERM;
 	}
+	dir->i_count++;		/* link eats the dir */
 	down(&dir->i_sem);
 	error = dir->i_op->link(oldinode, dir, basename, namelen);
+	dir->i_version = ++event;
 	up(&dir->i_sem);
+	iput(dir);
 	return error;
 }
 
@@ -724,10 +768,16 @@ static int do_rename(const char * oldname, const char * newname)
 		iput(new_dir);
 		return -EPERM;
 	}
+	old_dir->i_count++;	/* rename eats both dirs */
+	new_dir->i_count++;
 	down(&new_dir->i_sem);
 	error = old_dir->i_op->rename(old_dir, old_base, old_len, 
 		new_dir, new_base, new_len);
+	old_dir->i_version = ++event;
+	new_dir->i_version = ++event;
 	up(&new_dir->i_sem);
+	iput(old_dir);
+	iput(new_dir);
 	return error;
 }
 
@@ -406,6 +406,7 @@ int do_open(const char * filename, int flags, int mode)
     f->f_inode = inode;
     f->f_pos = 0;
     f->f_reada = 0;
+    f->f_rapos = f->f_raend = f->f_ralen = 0;
     f->f_op = NULL;
     if (inode->i_op)
         f->f_op = inode->i_op->default_file_ops;
@@ -17,6 +17,7 @@
 #include <linux/a.out.h>
 #include <linux/string.h>
 #include <linux/mman.h>
+#include <linux/pagemap.h>
 
 #include <asm/segment.h>
 #include <asm/io.h>
@@ -130,14 +131,22 @@ static int get_uptime(char * buffer)
 static int get_meminfo(char * buffer)
 {
 	struct sysinfo i;
+	int len, order;
 
 	si_meminfo(&i);
 	si_swapinfo(&i);
-	return sprintf(buffer, "        total:   used:    free:   shared:  buffers:\n"
+	len = sprintf(buffer, "        total:   used:    free:   shared:  buffers:\n"
 		"Mem:  %8lu %8lu %8lu %8lu %8lu\n"
 		"Swap: %8lu %8lu %8lu\n",
 		i.totalram, i.totalram-i.freeram, i.freeram, i.sharedram, i.bufferram,
 		i.totalswap, i.totalswap-i.freeswap, i.freeswap);
+	len += sprintf(buffer+len, "Free areas:");
+	for (order = 0 ; order < NR_MEM_LISTS ; order++)
+		len += sprintf(buffer+len, " %d*%lukB", nr_free_area[order],
+			(PAGE_SIZE >> 10) << order);
+	len += sprintf(buffer+len, "\nPage cache: %d kB\n",
+		nr_cached_pages << (PAGE_SHIFT - 10));
+	return len;
 }
 
 static int get_version(char * buffer)
@@ -256,7 +265,7 @@ static int get_stat(int pid, char * buffer)
 {
 	struct task_struct ** p = get_task(pid);
 	unsigned long sigignore=0, sigcatch=0, bit=1, wchan;
-	unsigned long vsize, eip, esp;
+	unsigned long vsize, eip, esp, it_real_value, flags;
 	int i,tty_pgrp;
 	char state;
 
@@ -283,6 +292,14 @@ static int get_stat(int pid, char * buffer)
 		default: sigcatch |= bit;
 		} bit <<= 1;
 	}
+	/* the timer wheel keeps the time left in real_timer only */
+	it_real_value = 0;
+	save_flags(flags);
+	cli();
+	if ((*p)->real_timer.prev &&
+	    (long) ((*p)->real_timer.expires - jiffies) > 0)
+		it_real_value = (*p)->real_timer.expires - jiffies;
+	restore_flags(flags);
 	tty_pgrp = (*p)->tty;
 	if (tty_pgrp > 0 && tty_table[tty_pgrp])
 		tty_pgrp = tty_table[tty_pgrp]->pgrp;
@@ -313,7 +330,7 @@ static int get_stat(int pid, char * buffer)
 		(*p)->priority, /* this is the nice value ---
 				   subtract 15 in your user-level program. */
 		(*p)->timeout,
-		(*p)->it_real_value,
+		it_real_value,
 		(*p)->start_time,
 		vsize,
 		(*p)->rss, /* you might want to shift this left 3 */
@@ -442,6 +459,11 @@ static int get_maps(int pid, char *buf)
 }
 
 extern int get_module_list(char *);
+extern int get_timer_list(char *);
+extern int get_buffer_stats(char *);
+extern int get_slabinfo(char *);
+extern int get_iostats(char *);
+extern int get_dcache_stats(char *);
 
 static int array_read(struct inode * inode, struct file * file,char * buf, int count)
 {
@@ -499,6 +521,21 @@ static int array_read(struct inode * inode, struct file * file,char * buf, int c
 		case 17:
 			length = get_kstat(page);
 			break;
+		case 18:
+			length = get_timer_list(page);
+			break;
+		case 19:
+			length = get_buffer_stats(page);
+			break;
+		case 20:
+			length = get_slabinfo(page);
+			break;
+		case 21:
+			length = get_iostats(page);
+			break;
+		case 22:
+			length = get_dcache_stats(page);
+			break;
 		default:
 			free_page((unsigned long) page);
 			return -EBADF;
@@ -44,6 +44,9 @@ extern int raw_get_info(char *);
 extern int arp_get_info(char *);
 extern int dev_get_info(char *);
 extern int rt_get_info(char *);
+extern int skb_pool_get_info(char *);
+extern int sock_hash_get_info(char *);
+extern int dev_backlog_get_info(char *);
 #endif /* CONFIG_INET */
 
 
@@ -91,7 +94,10 @@ static struct proc_dir_entry net_dir[] = {
 	{ 131,3,"dev" },
 	{ 132,3,"raw" },
 	{ 133,3,"tcp" },
-	{ 134,3,"udp" }
+	{ 134,3,"udp" },
+	{ 135,8,"skb_pool" },
+	{ 136,8,"sockhash" },
+	{ 137,7,"backlog" }
 #endif	/* CONFIG_INET */
 };
 
@@ -190,6 +196,15 @@ static int proc_readnet(struct inode * inode, struct file * file,
 		case 134:
 			length = udp_get_info(page);
 			break;
+		case 135:
+			length = skb_pool_get_info(page);
+			break;
+		case 136:
+			length = sock_hash_get_info(page);
+			break;
+		case 137:
+			length = dev_backlog_get_info(page);
+			break;
 #endif /* CONFIG_INET */
 		default:
 			free_page((unsigned long) page);
@@ -67,6 +67,11 @@ static struct proc_dir_entry root_dir[] = {
 	{14,5,"kcore" },
    	{16,7,"modules" },
    	{17,4,"stat" },
+   	{18,6,"timers" },
+   	{19,7,"buffers" },
+   	{20,8,"slabinfo" },
+   	{21,7,"iostats" },
+   	{22,6,"dcache" },
 };
 
 #define NR_ROOT_DIRENTRY ((sizeof (root_dir))/(sizeof (root_dir[0])))
@@ -15,6 +15,7 @@
 #include <linux/fs.h>
 #include <linux/sysv_fs.h>
 #include <linux/stat.h>
+#include <linux/pagemap.h>
 
 
 /* There are two different implementations of truncate() here.
@@ -488,6 +489,7 @@ void sysv_truncate(struct inode * inode)
 		printk("sysv_truncate: truncating symbolic link\n");
 	else if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode)))
 		return;
+	truncate_inode_pages(inode, inode->i_size);
 	if (inode->i_sb->sv_block_size_ratio_bits > 0) { /* block_size < BLOCK_SIZE ? */
 		coh_lock_inode(inode); /* do not write to the inode while we truncate */
 		while (coh_trunc_all(inode)) {
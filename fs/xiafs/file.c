@@ -20,6 +20,7 @@
 #include <linux/fcntl.h>
 #include <linux/stat.h>
 #include <linux/locks.h>
+#include <linux/pagemap.h>
 
 #include "xiafs_mac.h"
 
@@ -238,6 +239,7 @@ xiafs_file_write(struct inode * inode, struct file * filp, char * buf, int count
 	}
 	written += c;
 	memcpy_fromfs(cp,buf,c);
+	update_vm_cache(inode, pos - c, cp, c);
 	buf += c;
 	bh->b_uptodate = 1;
 	bh->b_dirt = 1;
@@ -16,6 +16,7 @@
 #include <linux/fcntl.h>
 
 #include "xiafs_mac.h"
+#include <linux/pagemap.h>
 
 /*
  * Linus' comment:
@@ -183,6 +184,7 @@ void xiafs_truncate(struct inode * inode)
     if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 	  S_ISLNK(inode->i_mode)))
         return;
+    truncate_inode_pages(inode, inode->i_size);
     while (1) {
         retry = trunc_direct(inode);
         retry |= trunc_indirect(inode, 8, &(inode->u.xiafs_i.i_ind_zone)); 
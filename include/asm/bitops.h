@@ -39,6 +39,16 @@ static __inline__ int clear_bit(int nr, void * addr)
 	return oldbit;
 }
 
+static __inline__ int change_bit(int nr, void * addr)
+{
+	int oldbit;
+
+	__asm__ __volatile__("btcl %2,%1\n\tsbbl %0,%0"
+		:"=r" (oldbit),"=m" (ADDR)
+		:"r" (nr));
+	return oldbit;
+}
+
 /*
  * This routine doesn't need to be atomic, but it's faster to code it
  * this way.
@@ -95,6 +105,19 @@ static __inline__ int clear_bit(int nr, int * addr)
 	return retval;
 }
 
+static __inline__ int change_bit(int nr, int * addr)
+{
+	int	mask, retval;
+
+	addr += nr >> 5;
+	mask = 1 << (nr & 0x1f);
+	cli();
+	retval = (mask & *addr) != 0;
+	*addr ^= mask;
+	sti();
+	return retval;
+}
+
 static __inline__ int test_bit(int nr, int * addr)
 {
 	int	mask;
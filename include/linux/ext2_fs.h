@@ -48,6 +48,13 @@
  * Define EXT2_PREALLOCATE to preallocate data blocks for expanding files
  */
 #define EXT2_PREALLOCATE
+#define EXT2_PREALLOC_BLOCKS		8
+
+/*
+ * Reservation window sizes, in blocks
+ */
+#define EXT2_DEFAULT_RESERVE_BLOCKS	32
+#define EXT2_MAX_RESERVE_BLOCKS		1024
 
 /*
  * The second extended file system version
@@ -199,6 +206,7 @@ struct ext2_group_desc
 #define	EXT2_UNRM_FL			0x0002	/* Undelete */
 #define	EXT2_COMPR_FL			0x0004	/* Compress file */
 #define EXT2_SYNC_FL			0x0008	/* Synchronous updates */
+#define EXT2_INDEX_FL			0x1000	/* Hashed directory index */
 
 /*
  * ioctl commands
@@ -347,6 +355,9 @@ extern int ext2_permission (struct inode *, int);
 /* balloc.c */
 extern int ext2_new_block (struct super_block *, unsigned long,
 			   unsigned long *, unsigned long *);
+extern int ext2_new_blocks (struct super_block *, unsigned long,
+			    unsigned long *, struct ext2_reserve_window *);
+extern void ext2_discard_reservation (struct inode *);
 extern void ext2_free_blocks (struct super_block *, unsigned long,
 			      unsigned long);
 extern unsigned long ext2_count_free_blocks (struct super_block *);
@@ -395,6 +406,7 @@ extern void ext2_write_inode (struct inode *);
 extern void ext2_put_inode (struct inode *);
 extern int ext2_sync_inode (struct inode *);
 extern void ext2_discard_prealloc (struct inode *);
+extern void ext2_forget_extents (struct inode *, unsigned long);
 
 /* ioctl.c */
 extern int ext2_ioctl (struct inode *, struct file *, unsigned int,
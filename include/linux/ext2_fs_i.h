@@ -15,6 +15,31 @@
 #ifndef _LINUX_EXT2_FS_I
 #define _LINUX_EXT2_FS_I
 
+/*
+ * A range of blocks set aside for the next allocations of one file,
+ * see fs/ext2/balloc.c
+ */
+struct ext2_reserve_window {
+	struct ext2_reserve_window * rsv_next;	/* NULL if there is none */
+	struct ext2_reserve_window * rsv_prev;
+	unsigned long rsv_start;		/* first and last block */
+	unsigned long rsv_end;
+	unsigned long rsv_goal_size;		/* size of the next window */
+	unsigned long rsv_alloc_hit;		/* blocks used in this one */
+};
+
+/*
+ * A run of logical blocks of a file that are contiguous on disk,
+ * see ext2_bmap() in fs/ext2/inode.c
+ */
+#define EXT2_EXTENT_CACHE	4
+
+struct ext2_extent {
+	unsigned long e_block;			/* first logical block */
+	unsigned long e_start;			/* and where it is */
+	unsigned long e_len;			/* 0 if unused */
+};
+
 /*
  * second extended file system inode data in memory
  */
@@ -34,6 +59,10 @@ struct ext2_inode_info {
 	unsigned long  i_next_alloc_goal;
 	unsigned long  i_prealloc_block;
 	unsigned long  i_prealloc_count;
+	struct ext2_reserve_window i_rsv_window;
+	struct ext2_extent i_extent[EXT2_EXTENT_CACHE];
+	unsigned long  i_extent_version;	/* bumped when trimmed */
+	unsigned short i_extent_next;		/* the one to replace next */
 };
 
 #endif	/* _LINUX_EXT2_FS_I */
@@ -16,7 +16,19 @@
 #define _LINUX_EXT2_FS_SB
 
 #define EXT2_MAX_GROUP_DESC	8
-#define EXT2_MAX_GROUP_LOADED	8
+#define EXT2_MAX_GROUP_LOADED	8	/* bitmaps cached at least */
+
+/*
+ * In-core summary of a group, kept up to date by the allocators
+ */
+struct ext2_group_info {
+	short gi_block_slot;		/* in s_block_bitmap[], -1 if none */
+	short gi_inode_slot;		/* in s_inode_bitmap[], -1 if none */
+	long gi_free_bytes;		/* zero bytes in the block bitmap,
+					   -1 until it has been read */
+	unsigned long gi_block_used;	/* LRU stamps of the bitmaps */
+	unsigned long gi_inode_used;
+};
 
 /*
  * second extended-fs super-block data in memory
@@ -36,14 +48,18 @@ struct ext2_sb_info {
 	struct buffer_head * s_group_desc[EXT2_MAX_GROUP_DESC];
 	unsigned short s_loaded_inode_bitmaps;
 	unsigned short s_loaded_block_bitmaps;
-	unsigned long s_inode_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_inode_bitmap[EXT2_MAX_GROUP_LOADED];
-	unsigned long s_block_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_block_bitmap[EXT2_MAX_GROUP_LOADED];
+	unsigned short s_max_loaded;	/* Size of the bitmap caches */
+	unsigned long s_bitmap_clock;	/* LRU clock of the bitmap caches */
+	unsigned long * s_inode_bitmap_number;
+	struct buffer_head ** s_inode_bitmap;
+	unsigned long * s_block_bitmap_number;
+	struct buffer_head ** s_block_bitmap;
+	struct ext2_group_info * s_group_info;	/* One per group */
 	int s_rename_lock;
 	struct wait_queue * s_rename_wait;
 	unsigned long  s_mount_opt;
 	unsigned short s_mount_state;
+	struct ext2_reserve_window s_rsv_window_head;	/* sorted by block */
 };
 
 #endif	/* _LINUX_EXT2_FS_SB */
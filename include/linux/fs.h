@@ -28,7 +28,6 @@
 #define NR_INODE 2048	/* this should be bigger than NR_FILE */
 #define NR_FILE 1024	/* this can well be larger on a larger system */
 #define NR_SUPER 32
-#define NR_HASH 997
 #define NR_IHASH 131
 #define NR_FILE_LOCKS 64
 #define BLOCK_SIZE 1024
@@ -46,6 +45,7 @@
 extern void buffer_init(void);
 extern unsigned long inode_init(unsigned long start, unsigned long end);
 extern unsigned long file_table_init(unsigned long start, unsigned long end);
+extern unsigned long dcache_init(unsigned long start, unsigned long end);
 
 #define MAJOR(a) (int)((unsigned short)(a) >> 8)
 #define MINOR(a) (int)((unsigned short)(a) & 0xFF)
@@ -144,8 +144,23 @@ struct buffer_head {
 	struct buffer_head * b_next_free;
 	struct buffer_head * b_this_page;	/* circular list of buffers in one page */
 	struct buffer_head * b_reqnext;		/* request queue */
+	unsigned int b_list;			/* LRU list the buffer is on */
+	unsigned long b_flushtime;		/* when a dirty buffer is due */
 };
 
+/*
+ * The buffer cache keeps one LRU list of each kind per buffer size, so
+ * that a clean buffer to reuse can be found without scanning past the
+ * dirty and locked ones. Buffers are moved to the right list lazily,
+ * by refile_buffer().
+ */
+#define BUF_CLEAN	0
+#define BUF_LOCKED	1	/* buffers waiting for i/o */
+#define BUF_DIRTY	2	/* dirty buffers, waiting for bdflush */
+#define NR_LIST		3
+
+#define NR_SIZES	4	/* 512, 1024, 2048 and 4096 bytes */
+
 #include <linux/pipe_fs_i.h>
 #include <linux/minix_fs_i.h>
 #include <linux/ext_fs_i.h>
@@ -171,12 +186,14 @@ struct inode {
 	time_t		i_ctime;
 	unsigned long	i_blksize;
 	unsigned long	i_blocks;
+	unsigned long	i_version;	/* for the dcache, see fs/dcache.c */
 	struct semaphore i_sem;
 	struct inode_operations * i_op;
 	struct super_block * i_sb;
 	struct wait_queue * i_wait;
 	struct file_lock * i_flock;
 	struct vm_area_struct * i_mmap;
+	struct cached_page * i_pages;
 	struct inode * i_next, * i_prev;
 	struct inode * i_hash_next, * i_hash_prev;
 	struct inode * i_bound_to, * i_bound_by;
@@ -210,6 +227,9 @@ struct file {
 	unsigned short f_flags;
 	unsigned short f_count;
 	unsigned short f_reada;
+	unsigned long f_rapos;		/* where a sequential read would go on */
+	unsigned long f_raend;		/* end of the read-ahead already started */
+	unsigned long f_ralen;		/* read-ahead window, 0 when random */
 	struct file *f_next, *f_prev;
 	struct inode * f_inode;
 	struct file_operations * f_op;
@@ -380,16 +400,26 @@ extern struct inode * get_empty_inode(void);
 extern void insert_inode_hash(struct inode *);
 extern void clear_inode(struct inode *);
 extern struct inode * get_pipe_inode(void);
+extern unsigned long event;
+extern int dcache_lookup(struct inode * dir, const char * name, int len,
+	unsigned long * ino);
+extern void dcache_add(struct inode * dir, const char * name, int len,
+	unsigned long ino);
 extern struct file * get_empty_filp(void);
 extern struct buffer_head * get_hash_table(dev_t dev, int block, int size);
 extern struct buffer_head * getblk(dev_t dev, int block, int size);
 extern void ll_rw_block(int rw, int nr, struct buffer_head * bh[]);
+extern void run_disk_queues(void);
 extern void ll_rw_page(int rw, int dev, int nr, char * buffer);
 extern void ll_rw_swap_file(int rw, int dev, unsigned int *b, int nb, char *buffer);
 extern void brelse(struct buffer_head * buf);
+extern void refile_buffer(struct buffer_head * buf);
+extern void wakeup_bdflush(int wait);
 extern void set_blocksize(dev_t dev, int size);
 extern struct buffer_head * bread(dev_t dev, int block, int size);
 extern unsigned long bread_page(unsigned long addr,dev_t dev,int b[],int size,int prot);
+extern int read_page_blocks(unsigned long addr,dev_t dev,int b[],int size);
+extern void readahead_stats(dev_t dev, int blocks, int hits, int misses);
 extern struct buffer_head * breada(dev_t dev,int block,...);
 extern void put_super(dev_t dev);
 extern dev_t ROOT_DEV;
@@ -405,6 +435,7 @@ extern int char_write(struct inode *, struct file *, char *, int);
 extern int block_write(struct inode *, struct file *, char *, int);
 
 extern int generic_mmap(struct inode *, struct file *, unsigned long, size_t, int, unsigned long);
+extern int generic_file_read(struct inode *, struct file *, char *, int);
 
 extern int block_fsync(struct inode *, struct file *);
 extern int file_fsync(struct inode *, struct file *);
@@ -117,6 +117,7 @@ struct ifreq {
 		short	ifru_flags;
 		int	ifru_metric;
 		int	ifru_mtu;
+		int	ifru_qdisc;
 		caddr_t	ifru_data;
 	} ifr_ifru;
 };
@@ -130,6 +131,7 @@ struct ifreq {
 #define	ifr_flags	ifr_ifru.ifru_flags	/* flags		*/
 #define	ifr_metric	ifr_ifru.ifru_metric	/* metric		*/
 #define	ifr_mtu		ifr_ifru.ifru_mtu	/* mtu			*/
+#define	ifr_qdisc	ifr_ifru.ifru_qdisc	/* queueing discipline	*/
 #define	ifr_data	ifr_ifru.ifru_data	/* for use by interface	*/
 
 /*
@@ -23,6 +23,8 @@ static inline void lock_buffer(struct buffer_head * bh)
 static inline void unlock_buffer(struct buffer_head * bh)
 {
 	bh->b_lock = 0;
+	if (bh->b_list == BUF_LOCKED)
+		refile_buffer(bh);
 	wake_up(&bh->b_wait);
 }
 
@@ -27,4 +27,17 @@ void kfree_s(void * obj, int size);
 
 #endif
 
+/*
+ * Object caches, see mm/slab.c
+ */
+struct kmem_cache;
+
+extern struct kmem_cache * kmem_cache_create(const char * name, int size,
+	int align, void (*ctor)(void *));
+extern int kmem_cache_destroy(struct kmem_cache * cachep);
+extern void * kmem_cache_alloc(struct kmem_cache * cachep, int priority);
+extern void kmem_cache_free(struct kmem_cache * cachep, void * objp);
+extern int kmem_cache_shrink(struct kmem_cache * cachep);
+extern int kmem_cache_reap(int priority);
+
 #endif /* _LINUX_MALLOC_H */
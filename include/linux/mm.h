@@ -77,18 +77,26 @@ extern volatile short free_page_ptr; /* used by malloc and tcp/ip. */
 
 extern int nr_swap_pages;
 extern int nr_free_pages;
-extern unsigned long free_page_list;
-extern int nr_secondary_pages;
-extern unsigned long secondary_page_list;
 
+/*
+ * Free memory is kept in power-of-two blocks of 1 up to
+ * 1 << (NR_MEM_LISTS-1) pages by a buddy allocator.
+ * The last MAX_SECONDARY_PAGES free pages are only handed out to
+ * GFP_ATOMIC requests, or when try_to_free_page() has failed.
+ */
+#define NR_MEM_LISTS 6
 #define MAX_SECONDARY_PAGES 20
 
+extern int nr_free_area[NR_MEM_LISTS];
+extern unsigned long free_area_init(unsigned long start_mem, unsigned long end_mem);
+
 /*
  * This is timing-critical - most of the time in getting a new page
  * goes to clearing the page. If you want a page without the clearing
  * overhead, just use __get_free_page() directly..
  */
-extern unsigned long __get_free_page(int priority);
+extern unsigned long __get_free_pages(int priority, unsigned long order);
+#define __get_free_page(priority) __get_free_pages((priority),0)
 static inline unsigned long get_free_page(int priority)
 {
     unsigned long page;
@@ -103,7 +111,8 @@ static inline unsigned long get_free_page(int priority)
 
 /* memory.c */
 
-extern void free_page(unsigned long addr);
+extern void free_pages(unsigned long addr, unsigned long order);
+#define free_page(addr) free_pages((addr),0)
 extern unsigned long put_dirty_page(struct task_struct * tsk,unsigned long page,
 	unsigned long address);
 extern void free_page_tables(struct task_struct * tsk);
@@ -141,6 +150,8 @@ extern void si_swapinfo(struct sysinfo * val);
 extern void rw_swap_page(int rw, unsigned long nr, char * buf);
 
 /* mmap.c */
+extern struct kmem_cache * vm_area_cachep;
+extern void vm_area_init(void);
 extern int do_mmap(struct file * file, unsigned long addr, unsigned long len,
 	unsigned long prot, unsigned long flags, unsigned long off);
 typedef int (*map_mergep_fnp)(const struct vm_area_struct *,
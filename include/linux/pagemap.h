@@ -0,0 +1,31 @@
+#ifndef _LINUX_PAGEMAP_H
+#define _LINUX_PAGEMAP_H
+
+/*
+ * Page cache for regular file data, keyed by (inode, page offset).
+ * See mm/filemap.c.
+ */
+
+#include <linux/fs.h>
+
+struct cached_page {
+	struct inode * cp_inode;
+	unsigned long cp_offset;		/* page aligned offset in the file */
+	unsigned long cp_page;			/* the data */
+	int cp_uptodate;			/* 0 while it is read in */
+	struct cached_page * cp_next_hash, * cp_prev_hash;
+	struct cached_page * cp_next_inode, * cp_prev_inode;
+	struct cached_page * cp_next_lru, * cp_prev_lru;
+};
+
+extern int nr_cached_pages;
+
+extern unsigned long find_page(struct inode * inode, unsigned long offset);
+extern unsigned long get_inode_page(struct inode * inode, unsigned long offset);
+extern void update_vm_cache(struct inode * inode, unsigned long pos,
+	char * buf, int count);
+extern void truncate_inode_pages(struct inode * inode, unsigned long start);
+extern int shrink_page_cache(int priority);
+extern void page_cache_init(void);
+
+#endif
@@ -29,6 +29,7 @@ extern int EISA_bus;
 #define MCA_bus 0
 
 #include <linux/tasks.h>
+#include <linux/timer.h>
 #include <asm/system.h>
 
 /*
@@ -89,6 +90,19 @@ extern unsigned long avenrun[];		/* Load averages */
 #define TASK_STOPPED		4
 #define TASK_SWAPPING		5
 
+/*
+ * Run queues are indexed by 'counter'. The counter of a task never
+ * reaches twice its priority (max 35), so 128 levels are plenty.
+ */
+#define NR_RUN_LEVELS		128
+#define RUN_BITMAP_SIZE		(NR_RUN_LEVELS/32)
+
+struct run_queue {
+	int nr_running;
+	unsigned long bitmap[RUN_BITMAP_SIZE];
+	struct task_struct * level[NR_RUN_LEVELS];
+};
+
 #ifndef NULL
 #define NULL ((void *) 0)
 #endif
@@ -176,6 +190,14 @@ struct task_struct {
 	int debugreg[8];  /* Hardware debugging registers */
 /* various fields */
 	struct task_struct *next_task, *prev_task;
+	/*
+	 * run-queue linkage: a task is on a run queue iff run_queue is
+	 * non-NULL. The task that is currently running is never queued.
+	 */
+	struct task_struct *next_run, *prev_run;
+	struct run_queue *run_queue;
+	int run_level;
+	unsigned long sched_epoch;	/* last counter recalculation seen */
 	struct sigaction sigaction[32];
 	unsigned long saved_kernel_stack;
 	unsigned long kernel_stack_page;
@@ -204,6 +226,7 @@ struct task_struct {
 	unsigned long timeout;
 	unsigned long it_real_value, it_prof_value, it_virt_value;
 	unsigned long it_real_incr, it_prof_incr, it_virt_incr;
+	struct timer_list real_timer;	/* ITIMER_REAL */
 	long utime,stime,cutime,cstime,start_time;
 	unsigned long min_flt, maj_flt;
 	unsigned long cmin_flt, cmaj_flt;
@@ -262,6 +285,7 @@ struct task_struct {
 /* state etc */	{ 0,15,15,0,0,0,0, \
 /* debugregs */ { 0, },            \
 /* schedlink */	&init_task,&init_task, \
+/* runqueue */	NULL,NULL,NULL,0,0, \
 /* signals */	{{ 0, },}, \
 /* stack */	0,(unsigned long) &init_kernel_stack, \
 /* ec,brk... */	0,0,0,0,0,0,0,0,0,0,0,0,0, \
@@ -270,7 +294,9 @@ struct task_struct {
 /* suppl grps*/ {NOGROUP,}, \
 /* proc links*/ &init_task,&init_task,NULL,NULL,NULL,NULL, \
 /* uid etc */	0,0,0,0,0,0, \
-/* timeout */	0,0,0,0,0,0,0,0,0,0,0,0, \
+/* timeout */	0,0,0,0,0,0,0, \
+/* real_timer */ {NULL,NULL,0,0,it_real_fn}, \
+/* utime */	0,0,0,0,0, \
 /* min_flt */	0,0,0,0, \
 /* rlimits */   { {LONG_MAX, LONG_MAX}, {LONG_MAX, LONG_MAX},  \
 		  {LONG_MAX, LONG_MAX}, {LONG_MAX, LONG_MAX},  \
@@ -303,8 +329,6 @@ extern struct task_struct *task[NR_TASKS];
 extern struct task_struct *last_task_used_math;
 extern struct task_struct *current;
 extern unsigned long volatile jiffies;
-extern unsigned long itimer_ticks;
-extern unsigned long itimer_next;
 extern struct timeval xtime;
 extern int need_resched;
 
@@ -314,6 +338,8 @@ extern void sleep_on(struct wait_queue ** p);
 extern void interruptible_sleep_on(struct wait_queue ** p);
 extern void wake_up(struct wait_queue ** p);
 extern void wake_up_interruptible(struct wait_queue ** p);
+extern void wake_up_process(struct task_struct * tsk);
+extern void it_real_fn(unsigned long);
 
 extern void notify_parent(struct task_struct * tsk);
 extern int send_sig(unsigned long sig,struct task_struct * p,int priv);
@@ -67,6 +67,8 @@ struct ip_config {
 #define	SIOCSIFHWADDR	0x8924		/* set hardware address (NI)	*/
 #define SIOCGIFENCAP	0x8925		/* get/set slip encapsulation   */
 #define SIOCSIFENCAP	0x8926		
+#define SIOCGIFQDISC	0x8927		/* get transmit queueing discipline */
+#define SIOCSIFQDISC	0x8928		/* set transmit queueing discipline */
 
 /* Routing table calls (oldrtent - don't use) */
 #define SIOCADDRTOLD	0x8940		/* add routing table entry	*/
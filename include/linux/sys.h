@@ -150,6 +150,7 @@ extern int sys_quotactl();
 extern int sys_getpgid();
 extern int sys_fchdir();
 extern int sys_bdflush();
+extern int sys_sendfile();       /* 152, after the debug calls */
 
 /*
  * These are system calls that will be removed at some time
@@ -173,7 +174,6 @@ extern int sys_bdflush();
  */
 
 #define sys_quotactl	sys_ni_syscall
-#define sys_bdflush	sys_ni_syscall
 
 typedef int (*fn_ptr)();
 
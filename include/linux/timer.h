@@ -1,6 +1,8 @@
 #ifndef _LINUX_TIMER_H
 #define _LINUX_TIMER_H
 
+#include <linux/stddef.h>
+
 /*
  * DON'T CHANGE THESE!! Most of them are hardcoded into some assembly language
  * as well as being defined here.
@@ -84,4 +86,15 @@ struct timer_list {
 extern void add_timer(struct timer_list * timer);
 extern int  del_timer(struct timer_list * timer);
 
+/*
+ * A timer that lives in kmalloc()'ed memory has to be initialized
+ * before the first add_timer() or del_timer(): the timer code uses
+ * the link fields to tell whether it is pending.
+ */
+static inline void init_timer(struct timer_list * timer)
+{
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
 #endif
@@ -142,6 +142,8 @@
 #define __NR_getpgid		132
 #define __NR_fchdir		133
 #define __NR_bdflush		134
+/* 135 - 151 are the debug system calls, see <demo/syscall.h> */
+#define __NR_sendfile		152
 
 extern int errno;
 
@@ -23,6 +23,7 @@
 #include <linux/delay.h>
 #include <linux/utsname.h>
 #include <linux/ioport.h>
+#include <linux/pagemap.h>
 
 #ifdef CONFIG_DEMO_CODE
 #include <demo/debug.h>
@@ -61,6 +62,7 @@ static inline _syscall3(int,open,const char *,file,int,flag,int,mode)
 static inline _syscall1(int,close,int,fd)
 static inline _syscall1(int,_exit,int,exitcode)
 static inline _syscall3(pid_t,waitpid,pid_t,pid,int *,wait_stat,int,options)
+static inline _syscall2(int,bdflush,int,func,int,data)
 
 static inline pid_t wait(int * wait_stat)
 {
@@ -425,8 +427,11 @@ asmlinkage void start_kernel(void)
 #endif
     memory_start = inode_init(memory_start, memory_end);
     memory_start = file_table_init(memory_start, memory_end);
+    memory_start = dcache_init(memory_start, memory_end);
     mem_init(low_memory_start,memory_start,memory_end);
     buffer_init();
+    vm_area_init();
+    page_cache_init();
 #ifdef CONFIG_DEBUG_DEBUGCALL
     do_debugcall(DEBUG_FS);
 #endif
@@ -526,6 +531,9 @@ void init(void)
 #ifdef CONFIG_DEBUG_DEBUGCALL
     do_debugcall(DEBUG_USER1);
 #endif
+    /* start the dirty buffer flushing daemon */
+    if (!fork())
+        _exit(bdflush(0,0));
     sprintf(term, "TERM=con%dx%d", ORIG_VIDEO_COLS, ORIG_VIDEO_LINES);
     (void) open("/dev/tty1", O_RDWR, 0);
     (void) dup(0);
@@ -54,7 +54,7 @@ int send_sig(unsigned long sig,struct task_struct * p,int priv)
 		return 0;
 	if ((sig == SIGKILL) || (sig == SIGCONT)) {
 		if (p->state == TASK_STOPPED)
-			p->state = TASK_RUNNING;
+			wake_up_process(p);
 		p->exit_code = 0;
 		p->signal &= ~( (1<<(SIGSTOP-1)) | (1<<(SIGTSTP-1)) |
 				(1<<(SIGTTIN-1)) | (1<<(SIGTTOU-1)) );
@@ -64,6 +64,8 @@ int send_sig(unsigned long sig,struct task_struct * p,int priv)
 		p->signal &= ~(1<<(SIGCONT-1));
 	/* Actually generate the signal */
 	generate(sig,p);
+	if (p->state == TASK_INTERRUPTIBLE && (p->signal & ~p->blocked))
+		wake_up_process(p);
 	return 0;
 }
 
@@ -355,6 +357,7 @@ NORET_TYPE void do_exit(long code)
 	int i;
 
 fake_volatile:
+	del_timer(&current->real_timer);
 	if (current->semun)
 		sem_exit();
 	if (current->shm)
@@ -380,7 +383,7 @@ fake_volatile:
 			mpnt1 = mpnt->vm_next;
 			if (mpnt->vm_ops && mpnt->vm_ops->close)
 				mpnt->vm_ops->close(mpnt);
-			kfree(mpnt);
+			kmem_cache_free(vm_area_cachep, mpnt);
 			mpnt = mpnt1;
 		}
 	}
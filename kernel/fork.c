@@ -98,7 +98,7 @@ int dup_mmap(struct task_struct * tsk)
 	tsk->stk_vma = NULL;
 	p = &tsk->mmap;
 	for (mpnt = current->mmap ; mpnt ; mpnt = mpnt->vm_next) {
-		tmp = (struct vm_area_struct *) kmalloc(sizeof(struct vm_area_struct), GFP_KERNEL);
+		tmp = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 		if (!tmp)
 			return -ENOMEM;
 		*tmp = *mpnt;
@@ -149,6 +149,8 @@ asmlinkage int sys_fork(struct pt_regs regs)
     p->signal = 0;
     p->it_real_value = p->it_virt_value = p->it_prof_value = 0;
     p->it_real_incr = p->it_virt_incr = p->it_prof_incr = 0;
+    p->real_timer.next = p->real_timer.prev = NULL;
+    p->real_timer.data = (unsigned long) p;
     p->leader = 0;    /* process leadership doesn't inherit */
     p->utime = p->stime = 0;
     p->cutime = p->cstime = 0;
@@ -223,7 +225,9 @@ asmlinkage int sys_fork(struct pt_regs regs)
         set_ldt_desc(gdt + (nr << 1) + FIRST_LDT_ENTRY, &default_ldt, 1);
 
     p->counter = current->counter >> 1;
-    p->state = TASK_RUNNING;    /* do this last, just in case */
+    p->next_run = p->prev_run = NULL;
+    p->run_queue = NULL;
+    wake_up_process(p);    /* do this last, just in case */
     return p->pid;
 bad_fork_cleanup:
     task[nr] = NULL;
@@ -28,13 +28,33 @@ static void jiffiestotv(unsigned long jiffies, struct timeval *value)
 	return;
 }
 
+/*
+ * ITIMER_REAL is a timer-list entry in the task structure: this is
+ * what runs when it goes off.
+ */
+void it_real_fn(unsigned long __data)
+{
+	struct task_struct * p = (struct task_struct *) __data;
+
+	send_sig(SIGALRM, p, 1);
+	p->it_real_value = p->it_real_incr;
+	if (p->it_real_incr) {
+		p->real_timer.expires = p->it_real_incr;
+		add_timer(&p->real_timer);
+	}
+}
+
 int _getitimer(int which, struct itimerval *value)
 {
 	register unsigned long val, interval;
 
 	switch (which) {
 	case ITIMER_REAL:
-		val = current->it_real_value;
+		val = 0;
+		if (del_timer(&current->real_timer)) {
+			val = current->real_timer.expires;
+			add_timer(&current->real_timer);
+		}
 		interval = current->it_real_incr;
 		break;
 	case ITIMER_VIRTUAL:
@@ -81,13 +101,13 @@ int _setitimer(int which, struct itimerval *value, struct itimerval *ovalue)
 		return k;
 	switch (which) {
 		case ITIMER_REAL:
-			if (j) {
-				j += 1+itimer_ticks;
-				if (j < itimer_next)
-					itimer_next = j;
-			}
+			del_timer(&current->real_timer);
 			current->it_real_value = j;
 			current->it_real_incr = i;
+			if (j) {
+				current->real_timer.expires = j;
+				add_timer(&current->real_timer);
+			}
 			break;
 		case ITIMER_VIRTUAL:
 			if (j)
@@ -155,7 +155,8 @@ sys_demo_setup, sys_demo_open, sys_vfs_namei, sys_vfs_inode,
 sys_demo_read, sys_vfs_buffer, sys_demo_write, sys_demo_minixfs,
 sys_demo_syscall, sys_demo_close, sys_demo_fork, sys_demo_creat,
 sys_demo_chdir, sys_demo_exit, sys_vfs_ext2fs, sys_demo_paging,
-sys_demo_pgt_entence
+sys_demo_pgt_entence,
+sys_sendfile
 };
 
 /* So we don't have to do any more manual updating.... */
@@ -205,9 +206,165 @@ asmlinkage void math_emulate(long arg)
 
 #endif /* CONFIG_MATH_EMULATION */
 
-unsigned long itimer_ticks = 0;
-unsigned long itimer_next = ~0;
-static unsigned long lost_ticks = 0;
+/*
+ * The run queues. Runnable tasks that still have some of their time
+ * slice left live on the 'active' queue, indexed by their counter. A
+ * task that has used up its slice gets its counter recalculated right
+ * away and moves over to the 'expired' queue. When the active queue
+ * runs dry the two are simply swapped, so there is never a global
+ * recalculation pass over the task list.
+ *
+ * Sleeping tasks miss the recalculations that happen while they are
+ * asleep: sched_epoch counts the swaps, and a task catches up on the
+ * ones it missed when it is woken up (see refresh_counter()).
+ */
+static struct run_queue run_queues[2];
+static struct run_queue * active = run_queues + 0;
+static struct run_queue * expired = run_queues + 1;
+static unsigned long sched_epoch = 0;
+
+static inline int find_last_bit(unsigned long * bitmap)
+{
+	int i, bit;
+
+	for (i = RUN_BITMAP_SIZE-1 ; i >= 0 ; i--) {
+		if (!bitmap[i])
+			continue;
+		__asm__("bsrl %1,%0":"=r" (bit):"r" (bitmap[i]));
+		return (i << 5) + bit;
+	}
+	return -1;
+}
+
+static inline void enqueue_task(struct task_struct * p, struct run_queue * rq)
+{
+	int level = p->counter;
+	struct task_struct ** head;
+
+	if (level >= NR_RUN_LEVELS)
+		level = NR_RUN_LEVELS-1;
+	head = rq->level + level;
+	if (!*head) {
+		p->next_run = p->prev_run = p;
+		*head = p;
+		rq->bitmap[level >> 5] |= 1UL << (level & 31);
+	} else {
+		p->next_run = *head;
+		p->prev_run = (*head)->prev_run;
+		p->prev_run->next_run = p;
+		(*head)->prev_run = p;
+	}
+	p->run_queue = rq;
+	p->run_level = level;
+	rq->nr_running++;
+}
+
+static inline void dequeue_task(struct task_struct * p)
+{
+	struct run_queue * rq = p->run_queue;
+	struct task_struct ** head = rq->level + p->run_level;
+
+	if (p->next_run == p) {
+		*head = NULL;
+		rq->bitmap[p->run_level >> 5] &= ~(1UL << (p->run_level & 31));
+	} else {
+		p->next_run->prev_run = p->prev_run;
+		p->prev_run->next_run = p->next_run;
+		if (*head == p)
+			*head = p->next_run;
+	}
+	p->next_run = p->prev_run = NULL;
+	p->run_queue = NULL;
+	rq->nr_running--;
+}
+
+/*
+ * Apply the 'counter = counter/2 + priority' recalculations that
+ * happened while the task was not on a run queue. The counter
+ * converges after a handful of rounds, so the loop is bounded.
+ */
+static inline void refresh_counter(struct task_struct * p)
+{
+	long missed = sched_epoch - p->sched_epoch;
+
+	if (missed > 8)
+		missed = 8;
+	while (missed-- > 0)
+		p->counter = (p->counter >> 1) + p->priority;
+	p->sched_epoch = sched_epoch;
+}
+
+/*
+ * Must be called with interrupts disabled.
+ */
+static inline void add_to_runqueue(struct task_struct * p)
+{
+	if (p == &init_task || p->run_queue)
+		return;
+	refresh_counter(p);
+	if (p->counter > 0) {
+		enqueue_task(p, active);
+		return;
+	}
+	p->counter = p->priority;
+	p->sched_epoch = sched_epoch + 1;
+	enqueue_task(p, expired);
+}
+
+/*
+ * Pick the runnable task with the largest counter and take it off
+ * its run queue. Must be called with interrupts disabled.
+ */
+static inline struct task_struct * pick_next_task(void)
+{
+	struct task_struct * next;
+
+	if (!active->nr_running) {
+		struct run_queue * tmp;
+
+		if (!expired->nr_running)
+			return &init_task;
+		tmp = active;
+		active = expired;
+		expired = tmp;
+		sched_epoch++;
+	}
+	next = active->level[find_last_bit(active->bitmap)];
+	dequeue_task(next);
+	return next;
+}
+
+/*
+ * Make a task runnable and put it on a run queue. The current task is
+ * never queued while it runs: schedule() requeues it when it gives up
+ * the cpu.
+ */
+void wake_up_process(struct task_struct * p)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	p->state = TASK_RUNNING;
+	if (p != current) {
+		add_to_runqueue(p);
+		if (p->counter > current->counter)
+			need_resched = 1;
+	}
+	restore_flags(flags);
+}
+
+/*
+ * Timeouts of interruptible sleeps are timer-list entries armed by
+ * schedule() itself, so nobody has to poll p->timeout any more.
+ */
+static void process_timeout(unsigned long data)
+{
+	struct task_struct * p = (struct task_struct *) data;
+
+	p->timeout = 0;
+	wake_up_process(p);
+}
 
 /*
  *  'schedule()' is the scheduler function. It's a very simple and nice
@@ -218,84 +375,49 @@ static unsigned long lost_ticks = 0;
  * tasks can run. It can not be killed, and it cannot sleep. The 'state'
  * information in task[0] is never used.
  *
- * The "confuse_gcc" goto is used only to get better assembly code..
- * Djikstra probably hates me.
+ * Picking the next task is a run-queue lookup, so its cost no longer
+ * depends on the number of tasks in the system.
  */
 asmlinkage void schedule(void)
 {
-    int c;
-    struct task_struct * p;
+    struct task_struct * prev;
     struct task_struct * next;
-    unsigned long ticks;
+    struct timer_list timer;
 
-    /* check alarm, wake up any interruptible tasks that have got a signal */
-
-    cli();
-    ticks = itimer_ticks;
-    itimer_ticks = 0;
-    itimer_next = ~0;
-    sti();
     need_resched = 0;
-    p = &init_task;
-    for (;;) {
-        if ((p = p->next_task) == &init_task)
-            goto confuse_gcc1;
-        if (ticks && p->it_real_value) {
-            if (p->it_real_value <= ticks) {
-                send_sig(SIGALRM, p, 1);
-                if (!p->it_real_incr) {
-                    p->it_real_value = 0;
-                    goto end_itimer;
-                }
-                do {
-                    p->it_real_value += p->it_real_incr;
-                } while (p->it_real_value <= ticks);
-            }
-            p->it_real_value -= ticks;
-            if (p->it_real_value < itimer_next)
-                itimer_next = p->it_real_value;
-        }
-end_itimer:
-        if (p->state != TASK_INTERRUPTIBLE)
-            continue;
-        if (p->signal & ~p->blocked) {
-            p->state = TASK_RUNNING;
-            continue;
-        }
-        if (p->timeout && p->timeout <= jiffies) {
-            p->timeout = 0;
-            p->state = TASK_RUNNING;
+    timer.prev = NULL;
+    prev = current;
+    if (prev->state == TASK_INTERRUPTIBLE && prev->timeout) {
+        if (prev->timeout <= jiffies) {
+            prev->timeout = 0;
+            prev->state = TASK_RUNNING;
+        } else {
+            timer.next = NULL;
+            timer.expires = prev->timeout - jiffies;
+            timer.data = (unsigned long) prev;
+            timer.function = process_timeout;
+            add_timer(&timer);
         }
     }
-confuse_gcc1:
 
     /* this is the scheduler proper: */
-#if 0
-    /* give processes that go to sleep a bit higher priority.. */
-    /* This depends on the values for TASK_XXX */
-    /* This gives smoother scheduling for some things, but */
-    /* can be very unfair under some circumstances, so.. */ 
-    if (TASK_UNINTERRUPTIBLE >= (unsigned) current->state &&
-                 current->counter < current->priority*2) {
-        ++current->counter;
-    }
-#endif
-    c = -1;
-    next = p = &init_task;
-    for (;;) {
-        if ((p = p->next_task) == &init_task)
-            goto confuse_gcc2;
-        if (p->state == TASK_RUNNING && p->counter > c)
-            c = p->counter, next = p;
-    }
-confuse_gcc2:
-    if (!c) {
-        for_each_task(p)
-            p->counter = (p->counter >> 1) + p->priority;
-    }
-    if(current != next)
+
+    /*
+     * Interrupts stay off until we have switched, so that a wake-up
+     * can't slip in between requeueing 'prev' and leaving it.
+     */
+    cli();
+    if (prev->state == TASK_INTERRUPTIBLE && (prev->signal & ~prev->blocked))
+        prev->state = TASK_RUNNING;
+    if (prev->state == TASK_RUNNING)
+        add_to_runqueue(prev);
+    next = pick_next_task();
+    if (prev != next)
         kstat.context_swtch++;
     switch_to(next);
+    sti();
+    if (timer.prev)
+        del_timer(&timer);
     /* Now maybe reload the debug registers */
     if(current->debugreg[7]) {
         loaddebug(0);
@@ -331,11 +453,8 @@ void wake_up(struct wait_queue **q)
 	do {
 		if ((p = tmp->task) != NULL) {
 			if ((p->state == TASK_UNINTERRUPTIBLE) ||
-			    (p->state == TASK_INTERRUPTIBLE)) {
-				p->state = TASK_RUNNING;
-				if (p->counter > current->counter)
-					need_resched = 1;
-			}
+			    (p->state == TASK_INTERRUPTIBLE))
+				wake_up_process(p);
 		}
 		if (!tmp->next) {
 			printk("wait_queue is bad (eip = %08lx)\n",((unsigned long *) q)[-1]);
@@ -357,11 +476,8 @@ void wake_up_interruptible(struct wait_queue **q)
 		return;
 	do {
 		if ((p = tmp->task) != NULL) {
-			if (p->state == TASK_INTERRUPTIBLE) {
-				p->state = TASK_RUNNING;
-				if (p->counter > current->counter)
-					need_resched = 1;
-			}
+			if (p->state == TASK_INTERRUPTIBLE)
+				wake_up_process(p);
 		}
 		if (!tmp->next) {
 			printk("wait_queue is bad (eip = %08lx)\n",((unsigned long *) q)[-1]);
@@ -415,56 +531,219 @@ void sleep_on(struct wait_queue **p)
 	__sleep_on(p,TASK_UNINTERRUPTIBLE);
 }
 
-static struct timer_list * next_timer = NULL;
+/*
+ * The timer lists are kept in a cascading timer wheel: tv1 holds the
+ * timers that expire within the next 256 ticks, one slot per tick, and
+ * tv2-tv5 hold the later ones with progressively coarser slots. Adding
+ * and deleting a timer is O(1); when tv1 wraps around, the next slot of
+ * tv2 is redistributed ("cascaded") into tv1, and so on upwards.
+ *
+ * add_timer() still takes 'expires' relative to now, and del_timer()
+ * still leaves the remaining ticks in it, so callers don't see the
+ * absolute expiry times the wheel works with internally.
+ */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+struct timer_vec {
+	int index;
+	struct timer_list *vec[TVN_SIZE];
+};
+
+struct timer_vec_root {
+	int index;
+	struct timer_list *vec[TVR_SIZE];
+};
+
+static struct timer_vec tv5 = { 0 };
+static struct timer_vec tv4 = { 0 };
+static struct timer_vec tv3 = { 0 };
+static struct timer_vec tv2 = { 0 };
+static struct timer_vec_root tv1 = { 0 };
+
+static struct timer_vec * const tvecs[] = {
+	(struct timer_vec *)&tv1, &tv2, &tv3, &tv4, &tv5
+};
+
+#define NOOF_TVECS (sizeof(tvecs) / sizeof(tvecs[0]))
+
+static unsigned long timer_jiffies = 0;
+
+/* statistics for /proc/timers */
+static unsigned long nr_timers = 0;
+static unsigned long timers_added = 0;
+static unsigned long timers_deleted = 0;
+static unsigned long timers_expired = 0;
+static unsigned long timers_cascaded = 0;
+
+/*
+ * A pending timer has a non-NULL prev pointer: either the previous
+ * timer in its slot, or the slot itself (that works because 'next'
+ * is the first member of struct timer_list).
+ */
+static inline void insert_timer(struct timer_list *timer,
+	struct timer_list **vec, int idx)
+{
+	if ((timer->next = vec[idx]) != NULL)
+		vec[idx]->prev = timer;
+	vec[idx] = timer;
+	timer->prev = (struct timer_list *)&vec[idx];
+}
+
+static inline void internal_add_timer(struct timer_list *timer)
+{
+	unsigned long expires = timer->expires;
+	unsigned long idx = expires - timer_jiffies;
+
+	if (idx < TVR_SIZE) {
+		int i = expires & TVR_MASK;
+		insert_timer(timer, tv1.vec, i);
+	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
+		int i = (expires >> TVR_BITS) & TVN_MASK;
+		insert_timer(timer, tv2.vec, i);
+	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
+		int i = (expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
+		insert_timer(timer, tv3.vec, i);
+	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
+		int i = (expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
+		insert_timer(timer, tv4.vec, i);
+	} else if ((long) idx < 0) {
+		/* already due: run it on the next timer_bh */
+		insert_timer(timer, tv1.vec, tv1.index);
+	} else {
+		int i = (expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK;
+		insert_timer(timer, tv5.vec, i);
+	}
+}
+
+static inline void detach_timer(struct timer_list *timer)
+{
+	struct timer_list *prev = timer->prev;
+	struct timer_list *next = timer->next;
+
+	if (next)
+		next->prev = prev;
+	prev->next = next;
+	timer->next = timer->prev = NULL;
+}
 
 void add_timer(struct timer_list * timer)
 {
 	unsigned long flags;
-	struct timer_list ** p;
 
 	if (!timer)
 		return;
-	timer->next = NULL;
-	p = &next_timer;
 	save_flags(flags);
 	cli();
-	while (*p) {
-		if ((*p)->expires > timer->expires) {
-			(*p)->expires -= timer->expires;
-			timer->next = *p;
-			break;
-		}
-		timer->expires -= (*p)->expires;
-		p = &(*p)->next;
+	if (timer->prev) {
+		restore_flags(flags);
+		printk("add_timer() called with pending timer (%p)\n", timer);
+		return;
 	}
-	*p = timer;
+	timer->expires += jiffies;
+	internal_add_timer(timer);
+	nr_timers++;
+	timers_added++;
 	restore_flags(flags);
 }
 
 int del_timer(struct timer_list * timer)
 {
 	unsigned long flags;
-	unsigned long expires = 0;
-	struct timer_list **p;
 
-	p = &next_timer;
 	save_flags(flags);
 	cli();
-	while (*p) {
-		if (*p == timer) {
-			if ((*p = timer->next) != NULL)
-				(*p)->expires += timer->expires;
-			timer->expires += expires;
-			restore_flags(flags);
-			return 1;
-		}
-		expires += (*p)->expires;
-		p = &(*p)->next;
+	if (timer->prev) {
+		detach_timer(timer);
+		if ((long) (timer->expires - jiffies) > 0)
+			timer->expires -= jiffies;
+		else
+			timer->expires = 0;
+		nr_timers--;
+		timers_deleted++;
+		restore_flags(flags);
+		return 1;
 	}
 	restore_flags(flags);
 	return 0;
 }
 
+static inline void cascade_timers(struct timer_vec *tv)
+{
+	struct timer_list *timer;
+
+	while ((timer = tv->vec[tv->index]) != NULL) {
+		detach_timer(timer);
+		internal_add_timer(timer);
+		timers_cascaded++;
+	}
+	tv->index = (tv->index + 1) & TVN_MASK;
+}
+
+static inline void run_timer_list(void)
+{
+	cli();
+	while ((long)(jiffies - timer_jiffies) >= 0) {
+		struct timer_list *timer;
+
+		if (!tv1.index) {
+			int n = 1;
+			do {
+				cascade_timers(tvecs[n]);
+			} while (tvecs[n]->index == 1 && ++n < NOOF_TVECS);
+		}
+		while ((timer = tv1.vec[tv1.index]) != NULL) {
+			void (*fn)(unsigned long) = timer->function;
+			unsigned long data = timer->data;
+
+			detach_timer(timer);
+			nr_timers--;
+			timers_expired++;
+			sti();
+			fn(data);
+			cli();
+		}
+		++timer_jiffies;
+		tv1.index = (tv1.index + 1) & TVR_MASK;
+	}
+	sti();
+}
+
+int get_timer_list(char * buffer)
+{
+	struct timer_list * timer;
+	unsigned long mask;
+	int i, j, len, slots;
+	unsigned long count;
+
+	len = sprintf(buffer, "pending  %lu\n", nr_timers);
+	len += sprintf(buffer+len, "vectors ");
+	cli();
+	for (i = 0 ; i < NOOF_TVECS ; i++) {
+		slots = i ? TVN_SIZE : TVR_SIZE;
+		count = 0;
+		for (j = 0 ; j < slots ; j++)
+			for (timer = tvecs[i]->vec[j] ; timer ; timer = timer->next)
+				count++;
+		len += sprintf(buffer+len, " %lu", count);
+	}
+	sti();
+	for (count = 0, mask = timer_active ; mask ; mask >>= 1)
+		count += mask & 1;
+	len += sprintf(buffer+len, "\nadded    %lu\n"
+				"deleted  %lu\n"
+				"expired  %lu\n"
+				"cascaded %lu\n"
+				"static   %lu\n",
+		timers_added, timers_deleted, timers_expired,
+		timers_cascaded, count);
+	return len;
+}
+
 unsigned long timer_active = 0;
 struct timer_struct timer_table[32];
 
@@ -581,17 +860,8 @@ static void timer_bh(void * unused)
 	unsigned long mask;
 	struct timer_struct *tp;
 
-	cli();
-	while (next_timer && next_timer->expires == 0) {
-		void (*fn)(unsigned long) = next_timer->function;
-		unsigned long data = next_timer->data;
-		next_timer = next_timer->next;
-		sti();
-		fn(data);
-		cli();
-	}
-	sti();
-	
+	run_timer_list();
+
 	for (mask = 1, tp = timer_table+0 ; mask ; tp++,mask += mask) {
 		if (mask > timer_active)
 			break;
@@ -613,9 +883,6 @@ static void timer_bh(void * unused)
  */
 static void do_timer(struct pt_regs * regs)
 {
-	unsigned long mask;
-	struct timer_struct *tp;
-
 	long ltemp;
 
 	/* Advance the phase, once it gets to one microsecond, then
@@ -701,30 +968,8 @@ static void do_timer(struct pt_regs * regs)
 		current->it_prof_value = current->it_prof_incr;
 		send_sig(SIGPROF,current,1);
 	}
-	for (mask = 1, tp = timer_table+0 ; mask ; tp++,mask += mask) {
-		if (mask > timer_active)
-			break;
-		if (!(mask & timer_active))
-			continue;
-		if (tp->expires > jiffies)
-			continue;
-		mark_bh(TIMER_BH);
-	}
-	cli();
-	itimer_ticks++;
-	if (itimer_ticks > itimer_next)
-		need_resched = 1;
-	if (next_timer) {
-		if (next_timer->expires) {
-			next_timer->expires--;
-			if (!next_timer->expires)
-				mark_bh(TIMER_BH);
-		} else {
-			lost_ticks++;
-			mark_bh(TIMER_BH);
-		}
-	}
-	sti();
+	/* timer_bh also runs the timer wheel, so it goes every tick */
+	mark_bh(TIMER_BH);
 }
 
 asmlinkage int sys_alarm(long seconds)
@@ -0,0 +1,524 @@
+/*
+ *	linux/mm/filemap.c
+ *
+ *  The page cache for regular file data.
+ *
+ *  Cached pages are looked up by (inode, page offset), not by device
+ *  block, so a hot file is found a page at a time rather than a block at
+ *  a time, and read() and mmap() of the same file share one copy of the
+ *  data. Each cached page has a small descriptor on a hash chain, on the
+ *  list of its inode (for truncate and for clear_inode()) and on a global
+ *  LRU list that shrink_page_cache() walks when memory gets tight.
+ *
+ *  The cache holds one reference (mem_map count) on every page it
+ *  caches: a count of one means nobody but the cache is using it.
+ *
+ *  Writes still go through the buffer cache: the filesystem's write
+ *  routine calls update_vm_cache() to keep a cached copy up to date, and
+ *  its truncate calls truncate_inode_pages(). A page is in the cache
+ *  while it is being read, so that a write or truncate in the meantime
+ *  can throw it out and have the reader start over.
+ *
+ *  Read-ahead is per open file: generic_file_read() keeps a window in the
+ *  struct file that grows while the file is read sequentially and shrinks
+ *  when it isn't, and starts READA requests into the buffer cache for it.
+ */
+
+#include <linux/stat.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/malloc.h>
+#include <linux/locks.h>
+#include <linux/pagemap.h>
+
+#include <asm/segment.h>
+#include <asm/system.h>
+
+#define PAGE_HASH_BITS 10
+#define PAGE_HASH_SIZE (1 << PAGE_HASH_BITS)
+
+#define page_hashfn(inode,offset) \
+	((((unsigned long) (inode) / sizeof(struct inode)) + \
+	  ((offset) >> PAGE_SHIFT)) & (PAGE_HASH_SIZE-1))
+#define page_hash(inode,offset) page_hash_table[page_hashfn(inode,offset)]
+
+#define NBUF_AHEAD 16			/* blocks per read-ahead request batch */
+#define MAX_READAHEAD (32*PAGE_SIZE)	/* largest read-ahead window */
+
+static struct cached_page * page_hash_table[PAGE_HASH_SIZE];
+static struct cached_page * page_lru = NULL;	/* oldest first */
+static struct wait_queue * page_wait = NULL;	/* pages being read in */
+static struct kmem_cache * cached_page_cachep = NULL;
+
+int nr_cached_pages = 0;
+
+static inline void remove_from_lru(struct cached_page * cp)
+{
+	cp->cp_next_lru->cp_prev_lru = cp->cp_prev_lru;
+	cp->cp_prev_lru->cp_next_lru = cp->cp_next_lru;
+	if (page_lru == cp)
+		page_lru = cp->cp_next_lru;
+	if (page_lru == cp)
+		page_lru = NULL;
+	cp->cp_next_lru = cp->cp_prev_lru = NULL;
+}
+
+static inline void put_last_lru(struct cached_page * cp)
+{
+	if (!page_lru) {
+		page_lru = cp;
+		cp->cp_prev_lru = cp;
+	}
+	cp->cp_next_lru = page_lru;
+	cp->cp_prev_lru = page_lru->cp_prev_lru;
+	page_lru->cp_prev_lru->cp_next_lru = cp;
+	page_lru->cp_prev_lru = cp;
+}
+
+static struct cached_page * find_cached_page(struct inode * inode,
+	unsigned long offset)
+{
+	struct cached_page * cp;
+
+	for (cp = page_hash(inode, offset) ; cp ; cp = cp->cp_next_hash)
+		if (cp->cp_inode == inode && cp->cp_offset == offset)
+			return cp;
+	return NULL;
+}
+
+static void remove_cached_page(struct cached_page * cp)
+{
+	struct inode * inode = cp->cp_inode;
+
+	if (cp->cp_next_hash)
+		cp->cp_next_hash->cp_prev_hash = cp->cp_prev_hash;
+	if (cp->cp_prev_hash)
+		cp->cp_prev_hash->cp_next_hash = cp->cp_next_hash;
+	else
+		page_hash(inode, cp->cp_offset) = cp->cp_next_hash;
+	if (cp->cp_next_inode)
+		cp->cp_next_inode->cp_prev_inode = cp->cp_prev_inode;
+	if (cp->cp_prev_inode)
+		cp->cp_prev_inode->cp_next_inode = cp->cp_next_inode;
+	else
+		inode->i_pages = cp->cp_next_inode;
+	remove_from_lru(cp);
+	nr_cached_pages--;
+	if (!cp->cp_uptodate)
+		wake_up(&page_wait);
+	free_page(cp->cp_page);
+	kmem_cache_free(cached_page_cachep, cp);
+}
+
+/*
+ * Put a page (on which the caller holds a reference) into the cache.
+ * If the descriptor can't be allocated the page just stays uncached.
+ */
+static struct cached_page * add_to_page_cache(struct inode * inode,
+	unsigned long offset, unsigned long page)
+{
+	struct cached_page * cp;
+
+	cp = (struct cached_page *) kmem_cache_alloc(cached_page_cachep, GFP_BUFFER);
+	if (!cp)
+		return NULL;
+	cp->cp_inode = inode;
+	cp->cp_offset = offset;
+	cp->cp_page = page;
+	cp->cp_uptodate = 1;
+	cp->cp_prev_hash = NULL;
+	cp->cp_next_hash = page_hash(inode, offset);
+	if (cp->cp_next_hash)
+		cp->cp_next_hash->cp_prev_hash = cp;
+	page_hash(inode, offset) = cp;
+	cp->cp_prev_inode = NULL;
+	cp->cp_next_inode = inode->i_pages;
+	if (cp->cp_next_inode)
+		cp->cp_next_inode->cp_prev_inode = cp;
+	inode->i_pages = cp;
+	put_last_lru(cp);
+	mem_map[MAP_NR(page)]++;
+	nr_cached_pages++;
+	return cp;
+}
+
+/*
+ * Look up a cached page, waiting for it if it is being read in. Returns
+ * the page address with a reference held for the caller (to be dropped
+ * with free_page()), or 0.
+ */
+unsigned long find_page(struct inode * inode, unsigned long offset)
+{
+	struct cached_page * cp;
+
+	while ((cp = find_cached_page(inode, offset)) && !cp->cp_uptodate)
+		sleep_on(&page_wait);
+	if (!cp)
+		return 0;
+	mem_map[MAP_NR(cp->cp_page)]++;
+	remove_from_lru(cp);
+	put_last_lru(cp);
+	return cp->cp_page;
+}
+
+/*
+ * Get the page at the given (page aligned) offset of the file, reading it
+ * in and adding it to the cache if it isn't there yet. Returns the page
+ * with a reference held for the caller, or 0 on error.
+ */
+unsigned long get_inode_page(struct inode * inode, unsigned long offset)
+{
+	struct cached_page * cp;
+	unsigned long page, new_page;
+	int nr[PAGE_SIZE/512];
+	int i, block, blocksize;
+
+repeat:
+	page = find_page(inode, offset);
+	if (page)
+		return page;
+	new_page = get_free_page(GFP_KERNEL);	/* holes read as zero */
+	if (!new_page)
+		return 0;
+	/* somebody else may have read it in while we slept */
+	page = find_page(inode, offset);
+	if (page) {
+		free_page(new_page);
+		return page;
+	}
+	cp = add_to_page_cache(inode, offset, new_page);
+	if (cp)
+		cp->cp_uptodate = 0;
+	blocksize = inode->i_sb->s_blocksize;
+	block = offset >> inode->i_sb->s_blocksize_bits;
+	for (i = 0 ; i < PAGE_SIZE / blocksize ; i++)
+		nr[i] = bmap(inode, block + i);
+	i = read_page_blocks(new_page, inode->i_dev, nr, blocksize);
+	if (i >= 0)
+		readahead_stats(inode->i_dev, 0, !i, i > 0);
+	if (!cp) {
+		/* no descriptor: the caller gets an uncached copy */
+		if (i < 0) {
+			free_page(new_page);
+			return 0;
+		}
+		return new_page;
+	}
+	/*
+	 * A write or truncate while we slept throws the page out, as what
+	 * was read may be older than what it changed: start over then.
+	 */
+	cp = find_cached_page(inode, offset);
+	if (!cp || cp->cp_page != new_page) {
+		free_page(new_page);
+		if (i < 0)
+			return 0;
+		goto repeat;
+	}
+	if (i < 0) {
+		remove_cached_page(cp);
+		free_page(new_page);
+		return 0;
+	}
+	cp->cp_uptodate = 1;
+	wake_up(&page_wait);
+	return new_page;
+}
+
+/*
+ * Keep the cache coherent with a write that went through the buffer
+ * cache: copy the new data into any cached page it covers.
+ */
+void update_vm_cache(struct inode * inode, unsigned long pos,
+	char * buf, int count)
+{
+	struct cached_page * cp;
+	unsigned long offset;
+	int len;
+
+	if (!inode->i_pages)
+		return;
+	while (count > 0) {
+		offset = pos & ~PAGE_MASK;
+		len = PAGE_SIZE - offset;
+		if (len > count)
+			len = count;
+		cp = find_cached_page(inode, pos & PAGE_MASK);
+		if (cp && !cp->cp_uptodate)
+			remove_cached_page(cp);
+		else if (cp)
+			memcpy((char *) cp->cp_page + offset, buf, len);
+		pos += len;
+		buf += len;
+		count -= len;
+	}
+}
+
+/*
+ * Throw out the cached pages at and after 'start', and clear the part of
+ * the page straddling it. Called on truncate, and with start 0 when the
+ * inode is cleared.
+ */
+void truncate_inode_pages(struct inode * inode, unsigned long start)
+{
+	struct cached_page * cp, * next;
+	unsigned long offset;
+
+	for (cp = inode->i_pages ; cp ; cp = next) {
+		next = cp->cp_next_inode;
+		if (cp->cp_offset >= start || !cp->cp_uptodate) {
+			remove_cached_page(cp);
+			continue;
+		}
+		offset = start - cp->cp_offset;
+		if (offset < PAGE_SIZE)
+			memset((char *) cp->cp_page + offset, 0, PAGE_SIZE - offset);
+	}
+}
+
+/*
+ * Free the oldest cached page that isn't in use by anybody else.
+ * Priority 0 means scan the whole cache.
+ */
+int shrink_page_cache(int priority)
+{
+	struct cached_page * cp;
+	int i;
+
+	i = nr_cached_pages >> priority;
+	if (!i && nr_cached_pages)
+		i = 1;
+	while (i-- > 0 && (cp = page_lru) != NULL) {
+		if (mem_map[MAP_NR(cp->cp_page)] == 1) {
+			remove_cached_page(cp);
+			return 1;
+		}
+		remove_from_lru(cp);
+		put_last_lru(cp);
+	}
+	return 0;
+}
+
+/*
+ * Start reading the blocks of the pages from 'start' to 'end' into the
+ * buffer cache, so that get_inode_page() finds them there. Blocks that
+ * are cached or already on their way in are skipped. Returns the number
+ * of blocks started.
+ */
+static int read_ahead_pages(struct inode * inode, unsigned long start,
+	unsigned long end)
+{
+	struct buffer_head * bh[NBUF_AHEAD];
+	unsigned long offset;
+	int i, n, started, block, blocksize;
+
+	if (end > inode->i_size)
+		end = inode->i_size;
+	blocksize = inode->i_sb->s_blocksize;
+	n = started = 0;
+	for (offset = start & PAGE_MASK ; offset < end ; offset += PAGE_SIZE) {
+		if (find_cached_page(inode, offset))
+			continue;
+		for (i = 0 ; i < PAGE_SIZE / blocksize ; i++) {
+			block = bmap(inode, (offset >> inode->i_sb->s_blocksize_bits) + i);
+			if (!block)
+				continue;
+			bh[n] = getblk(inode->i_dev, block, blocksize);
+			if (bh[n]->b_uptodate || bh[n]->b_lock) {
+				brelse(bh[n]);
+				continue;
+			}
+			if (++n < NBUF_AHEAD)
+				continue;
+			ll_rw_block(READA, n, bh);
+			started += n;
+			while (n)
+				brelse(bh[--n]);
+		}
+	}
+	if (n) {
+		ll_rw_block(READA, n, bh);
+		started += n;
+		while (n)
+			brelse(bh[--n]);
+	}
+	return started;
+}
+
+/*
+ * Per-file read-ahead. A read that starts where the last one ended is
+ * sequential: the window opens at read_ahead[] for the device and doubles
+ * with every batch, up to MAX_READAHEAD. A new batch is started once the
+ * reader is within half a window of the end of the last one, so the
+ * disk stays ahead of a steady reader. Any other read halves the window
+ * and starts nothing; devices with no read_ahead[] never read ahead.
+ */
+static void file_read_ahead(struct inode * inode, struct file * filp,
+	unsigned long ppos, unsigned long pos)
+{
+	unsigned long min;
+	int started;
+
+	min = PAGE_ALIGN(read_ahead[MAJOR(inode->i_dev)] << 9);
+	if (ppos != filp->f_rapos || !min) {
+		filp->f_rapos = pos;
+		filp->f_raend = 0;
+		filp->f_ralen >>= 1;
+		if (filp->f_ralen < PAGE_SIZE)
+			filp->f_ralen = 0;
+		return;
+	}
+	filp->f_rapos = pos;
+	if (filp->f_ralen < min)
+		filp->f_ralen = min;
+	if (filp->f_raend < pos)
+		filp->f_raend = pos;
+	if (filp->f_raend - pos > filp->f_ralen / 2 || filp->f_raend >= inode->i_size)
+		return;
+	started = read_ahead_pages(inode, filp->f_raend, pos + filp->f_ralen);
+	filp->f_raend = pos + filp->f_ralen;
+	filp->f_ralen <<= 1;
+	if (filp->f_ralen > MAX_READAHEAD)
+		filp->f_ralen = MAX_READAHEAD;
+	if (started)
+		readahead_stats(inode->i_dev, started, 0, 0);
+}
+
+/*
+ * Read from a regular file through the page cache, a whole page at a
+ * time. Filesystems using this need a bmap() operation.
+ */
+int generic_file_read(struct inode * inode, struct file * filp,
+	char * buf, int count)
+{
+	unsigned long ppos, pos, page, offset;
+	int read, nr;
+
+	if (!inode->i_op || !inode->i_op->bmap)
+		return -EINVAL;
+	ppos = pos = filp->f_pos;
+	if (pos >= inode->i_size || count <= 0)
+		return 0;
+	if (count > inode->i_size - pos)
+		count = inode->i_size - pos;
+	read = 0;
+	while (count > 0) {
+		offset = pos & ~PAGE_MASK;
+		nr = PAGE_SIZE - offset;
+		if (nr > count)
+			nr = count;
+		page = get_inode_page(inode, pos & PAGE_MASK);
+		if (!page)
+			break;
+		memcpy_tofs(buf, (char *) page + offset, nr);
+		free_page(page);
+		buf += nr;
+		pos += nr;
+		read += nr;
+		count -= nr;
+	}
+	filp->f_pos = pos;
+	if (!read)
+		return -EIO;
+	file_read_ahead(inode, filp, ppos, pos);
+	if (!IS_RDONLY(inode)) {
+		inode->i_atime = CURRENT_TIME;
+		inode->i_dirt = 1;
+	}
+	return read;
+}
+
+/*
+ * sendfile(): copy part of a regular file to another file or a socket
+ * without going through user space. Each cached page is handed to the
+ * output's write() as it is, with the kernel data segment loaded so
+ * that the "user" copy in there reads from the page. For a TCP socket
+ * that is a single copy, checksummed on the way, instead of the two of
+ * a read()/write() loop. If offset is given it is used and updated in
+ * place of the input file position.
+ */
+asmlinkage int sys_sendfile(unsigned int out_fd, unsigned int in_fd,
+	off_t * offset, unsigned int count)
+{
+	struct file * in_file, * out_file;
+	struct inode * in_inode, * out_inode;
+	unsigned long ppos, pos, page, old_fs;
+	int written, error, nr, n;
+
+	if (in_fd >= NR_OPEN || !(in_file = current->filp[in_fd]) ||
+	    !(in_inode = in_file->f_inode))
+		return -EBADF;
+	if (out_fd >= NR_OPEN || !(out_file = current->filp[out_fd]) ||
+	    !(out_inode = out_file->f_inode))
+		return -EBADF;
+	if (!(in_file->f_mode & 1) || !(out_file->f_mode & 2))
+		return -EBADF;
+	if (!S_ISREG(in_inode->i_mode) || !in_inode->i_op ||
+	    !in_inode->i_op->bmap)
+		return -EINVAL;
+	if (!out_file->f_op || !out_file->f_op->write)
+		return -EINVAL;
+	ppos = pos = in_file->f_pos;
+	if (offset) {
+		error = verify_area(VERIFY_WRITE, offset, sizeof(*offset));
+		if (error)
+			return error;
+		ppos = pos = get_fs_long((unsigned long *) offset);
+	}
+	if (pos >= in_inode->i_size)
+		count = 0;
+	else if (count > in_inode->i_size - pos)
+		count = in_inode->i_size - pos;
+
+	written = error = 0;
+	while (count > 0) {
+		nr = PAGE_SIZE - (pos & ~PAGE_MASK);
+		if (nr > count)
+			nr = count;
+		page = get_inode_page(in_inode, pos & PAGE_MASK);
+		if (!page) {
+			error = -EIO;
+			break;
+		}
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		n = out_file->f_op->write(out_inode, out_file,
+			(char *) page + (pos & ~PAGE_MASK), nr);
+		set_fs(old_fs);
+		free_page(page);
+		if (n <= 0) {
+			error = n;
+			break;
+		}
+		pos += n;
+		written += n;
+		count -= n;
+		if (n < nr)
+			break;
+	}
+
+	if (offset)
+		put_fs_long(pos, (unsigned long *) offset);
+	else
+		in_file->f_pos = pos;
+	if (!written)
+		return error;
+	file_read_ahead(in_inode, in_file, ppos, pos);
+	if (!IS_RDONLY(in_inode)) {
+		in_inode->i_atime = CURRENT_TIME;
+		in_inode->i_dirt = 1;
+	}
+	return written;
+}
+
+void page_cache_init(void)
+{
+	cached_page_cachep = kmem_cache_create("cached_page",
+		sizeof(struct cached_page), 0, NULL);
+	if (!cached_page_cachep)
+		panic("page_cache_init: cannot create cached_page cache");
+}
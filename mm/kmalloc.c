@@ -17,7 +17,7 @@
    I want this number to be increased in the near future:
         loadable device drivers should use this function to get memory */
 
-#define MAX_KMALLOC_K 4
+#define MAX_KMALLOC_K 128	/* largest area the buddy allocator hands out */
 
 
 /* This defines how many times we should try to allocate a free page before
@@ -86,24 +86,35 @@ struct size_descriptor {
     int nfrees;
     int nbytesmalloced;
     int npages;
+    unsigned long gfporder; /* number of pages in the area required */
 };
 
 
+/*
+ * The classes above 4080 bytes take one object per multi-page area from
+ * the buddy allocator.
+ */
 struct size_descriptor sizes[] = { 
-	{ NULL,  32,127, 0,0,0,0 },
-	{ NULL,  64, 63, 0,0,0,0 },
-	{ NULL, 128, 31, 0,0,0,0 },
-	{ NULL, 252, 16, 0,0,0,0 },
-	{ NULL, 508,  8, 0,0,0,0 },
-	{ NULL,1020,  4, 0,0,0,0 },
-	{ NULL,2040,  2, 0,0,0,0 },
-	{ NULL,4080,  1, 0,0,0,0 },
-	{ NULL,   0,  0, 0,0,0,0 }
+	{ NULL,  32,127, 0,0,0,0, 0},
+	{ NULL,  64, 63, 0,0,0,0, 0},
+	{ NULL, 128, 31, 0,0,0,0, 0},
+	{ NULL, 252, 16, 0,0,0,0, 0},
+	{ NULL, 508,  8, 0,0,0,0, 0},
+	{ NULL,1020,  4, 0,0,0,0, 0},
+	{ NULL,2040,  2, 0,0,0,0, 0},
+	{ NULL,4080,  1, 0,0,0,0, 0},
+	{ NULL,8176,  1, 0,0,0,0, 1},
+	{ NULL,16368, 1, 0,0,0,0, 2},
+	{ NULL,32752, 1, 0,0,0,0, 3},
+	{ NULL,65520, 1, 0,0,0,0, 4},
+	{ NULL,131056,1, 0,0,0,0, 5},
+	{ NULL,   0,  0, 0,0,0,0, 0}
 };
 
 
 #define NBLOCKS(order)          (sizes[order].nblocks)
 #define BLOCKSIZE(order)        (sizes[order].size)
+#define AREASIZE(order)         (PAGE_SIZE << (sizes[order].gfporder))
 
 long kmalloc_init (long start_mem, long end_mem)
 {
@@ -115,12 +126,12 @@ long kmalloc_init (long start_mem, long end_mem)
  */
     for (order = 0; BLOCKSIZE(order); order++) {
         if ((NBLOCKS (order) * BLOCKSIZE(order) + 
-             sizeof(struct page_descriptor)) > PAGE_SIZE) {
+             sizeof(struct page_descriptor)) > AREASIZE(order)) {
             printk ("Cannot use %d bytes out of %d in order = %d "
                     "block mallocs\n",
                     NBLOCKS (order) * BLOCKSIZE(order) + 
                     sizeof(struct page_descriptor),
-                    (int) PAGE_SIZE,
+                    (int) AREASIZE(order),
                     BLOCKSIZE (order));
             panic ("This only happens if someone messes with kmalloc");
         }
@@ -205,8 +216,8 @@ void *kmalloc (size_t size, int priority)
         sz = BLOCKSIZE(order);
 
         /* This can be done with ints on: This is private to this invocation */
-        page = (struct page_descriptor *) __get_free_page(priority & 
-                                         GFP_LEVEL_MASK);
+        page = (struct page_descriptor *) __get_free_pages(priority & 
+                                GFP_LEVEL_MASK, sizes[order].gfporder);
         if (!page) {
             printk ("Couldn't get a free page.....\n");
             return NULL;
@@ -307,7 +318,7 @@ void kfree_s(void *ptr,int size)
             else
                 printk ("Ooops. page %p doesn't show on freelist.\n", page);
         }
-        free_page((long)page);
+        free_pages((long)page, sizes[order].gfporder);
     }
     restore_flags(flags);
 
@@ -40,6 +40,7 @@
 #include <linux/types.h>
 #include <linux/ptrace.h>
 #include <linux/mman.h>
+#include <linux/pagemap.h>
 
 unsigned long high_memory = 0;
 
@@ -50,15 +51,6 @@ extern void die_if_kernel(char *,struct pt_regs *,long);
 
 int nr_swap_pages = 0;
 int nr_free_pages = 0;
-unsigned long free_page_list = 0;
-/*
- * The secondary free_page_list is used for malloc() etc things that
- * may need pages during interrupts etc. Normal get_free_page() operations
- * don't touch it, so it stays as a kind of "panic-list", that can be
- * accessed when all other mm tricks have failed.
- */
-int nr_secondary_pages = 0;
-unsigned long secondary_page_list = 0;
 
 #define copy_page(from,to) \
 __asm__("cld ; rep ; movsl": :"S" (from),"D" (to),"c" (1024))
@@ -982,7 +974,9 @@ void show_mem(void)
 
 	printk("Mem-info:\n");
 	printk("Free pages:      %6dkB\n",nr_free_pages<<(PAGE_SHIFT-10));
-	printk("Secondary pages: %6dkB\n",nr_secondary_pages<<(PAGE_SHIFT-10));
+	for (i = 0 ; i < NR_MEM_LISTS ; i++)
+		printk("%d*%lukB ", nr_free_area[i], (PAGE_SIZE>>10) << i);
+	printk("\n");
 	printk("Free swap:       %6dkB\n",nr_swap_pages<<(PAGE_SHIFT-10));
 	i = high_memory >> PAGE_SHIFT;
 	while (i-- > 0) {
@@ -1067,6 +1061,7 @@ void mem_init(unsigned long start_low_mem,
     start_mem = (unsigned long) p;
     while (p > mem_map)
         *--p = MAP_PAGE_RESERVED;
+    start_mem = free_area_init(start_mem, end_mem);
     start_low_mem = PAGE_ALIGN(start_low_mem);
     start_mem = PAGE_ALIGN(start_mem);
     while (start_low_mem < 0xA0000) {
@@ -1080,7 +1075,6 @@ void mem_init(unsigned long start_low_mem,
 #ifdef CONFIG_SOUND
     sound_mem_init();
 #endif
-    free_page_list = 0;
     nr_free_pages = 0;
     for (tmp = 0 ; tmp < end_mem ; tmp += PAGE_SIZE) {
         if (mem_map[MAP_NR(tmp)]) {
@@ -1092,9 +1086,8 @@ void mem_init(unsigned long start_low_mem,
                 datapages++;
             continue;
         } 
-        *(unsigned long *) tmp = free_page_list;
-        free_page_list = tmp;
-        nr_free_pages++;
+        mem_map[MAP_NR(tmp)] = 1;
+        free_page(tmp);
     }
     tmp = nr_free_pages << PAGE_SHIFT;
     printk("Memory: %luk/%luk available (%dk kernel code, %dk "
@@ -1143,18 +1136,54 @@ void si_meminfo(struct sysinfo *val)
 
 
 /* This handles a generic mmap of a disk file */
+/*
+ * Page aligned mappings are served from the page cache, so they share
+ * their pages with read() and with other mappings of the file. A write
+ * fault gets a private copy right away; read faults map the cached page
+ * and leave the copying to do_wp_page().
+ */
 void file_mmap_nopage(int error_code, struct vm_area_struct * area, unsigned long address)
 {
 	struct inode * inode = area->vm_inode;
 	unsigned int block;
-	unsigned long page;
+	unsigned long page, new_page, offset;
 	int nr[8];
 	int i, j;
 	int prot = area->vm_page_prot;
 
 	address &= PAGE_MASK;
-	block = address - area->vm_start + area->vm_offset;
-	block >>= inode->i_sb->s_blocksize_bits;
+	offset = address - area->vm_start + area->vm_offset;
+	if (!(offset & ~PAGE_MASK)) {
+		page = find_page(inode, offset);
+		if (page)
+			++area->vm_task->min_flt;
+		else {
+			++area->vm_task->maj_flt;
+			page = get_inode_page(inode, offset);
+		}
+		if (page) {
+			if (error_code & PAGE_RW) {
+				new_page = __get_free_page(GFP_KERNEL);
+				if (new_page)
+					copy_page(page, new_page);
+				free_page(page);
+				page = new_page;
+				prot |= PAGE_RW | PAGE_DIRTY;
+			}
+			if (!page) {
+				oom(current);
+				put_page(area->vm_task, BAD_PAGE, address, PAGE_PRIVATE);
+				return;
+			}
+			if (put_page(area->vm_task, page, address, prot))
+				return;
+			free_page(page);
+			oom(current);
+			return;
+		}
+		/* read error: fall back to reading it privately */
+	}
+	block = offset >> inode->i_sb->s_blocksize_bits;
 
 	page = get_free_page(GFP_KERNEL);
 	if (share_page(area, area->vm_task, inode, address, error_code, page)) {
@@ -16,6 +16,8 @@
 #include <asm/segment.h>
 #include <asm/system.h>
 
+struct kmem_cache * vm_area_cachep = NULL;
+
 static int anon_map(struct inode *, struct file *,
 		    unsigned long, size_t, int,
 		    unsigned long);
@@ -210,7 +212,7 @@ void unmap_fixup(struct vm_area_struct *area,
 	if (addr > area->vm_start && end < area->vm_end)
 	{
 		/* Add end mapping -- leave beginning for below */
-		mpnt = (struct vm_area_struct *)kmalloc(sizeof(*mpnt), GFP_KERNEL);
+		mpnt = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 
 		*mpnt = *area;
 		mpnt->vm_offset += (end - area->vm_start);
@@ -222,7 +224,7 @@ void unmap_fixup(struct vm_area_struct *area,
 	}
 
 	/* construct whatever mapping is needed */
-	mpnt = (struct vm_area_struct *)kmalloc(sizeof(*mpnt), GFP_KERNEL);
+	mpnt = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 	*mpnt = *area;
 	insert_vm_struct(current, mpnt);
 }
@@ -301,7 +303,7 @@ int do_munmap(unsigned long addr, size_t len)
 		else
 			unmap_fixup(mpnt, st, end-st);
 
-		kfree(mpnt);
+		kmem_cache_free(vm_area_cachep, mpnt);
 	}
 
 	unmap_page_range(addr, len);
@@ -332,7 +334,7 @@ int generic_mmap(struct inode * inode, struct file * file,
 	}
 	brelse(bh);
 
-	mpnt = (struct vm_area_struct * ) kmalloc(sizeof(struct vm_area_struct), GFP_KERNEL);
+	mpnt = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 	if (!mpnt)
 		return -ENOMEM;
 
@@ -434,7 +436,7 @@ void merge_segments(struct vm_area_struct *mpnt,
 		 */
 		prev->vm_end = mpnt->vm_end;
 		prev->vm_next = mpnt->vm_next;
-		kfree_s(mpnt, sizeof(*mpnt));
+		kmem_cache_free(vm_area_cachep, mpnt);
 		mpnt = prev;
 	}
 }
@@ -452,7 +454,7 @@ static int anon_map(struct inode *ino, struct file * file,
 	if (zeromap_page_range(addr, len, mask))
 		return -ENOMEM;
 
-	mpnt = (struct vm_area_struct * ) kmalloc(sizeof(struct vm_area_struct), GFP_KERNEL);
+	mpnt = (struct vm_area_struct *) kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
 	if (!mpnt)
 		return -ENOMEM;
 
@@ -480,3 +482,11 @@ int ignoff_mergep(const struct vm_area_struct *m1,
 
 	return (struct inode *)data == m1->vm_inode;
 }
+
+void vm_area_init(void)
+{
+	vm_area_cachep = kmem_cache_create("vm_area_struct",
+		sizeof(struct vm_area_struct), 0, NULL);
+	if (!vm_area_cachep)
+		panic("vm_area_init: cannot create vm_area_struct cache");
+}
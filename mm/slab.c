@@ -0,0 +1,343 @@
+/*
+ *  linux/mm/slab.c
+ *
+ *  Object caches for fixed-size kernel objects.
+ *
+ *  A cache hands out objects of one size. Its memory comes in slabs of
+ *  one page each: a slab descriptor and an array of free-list indices at
+ *  the front of the page, the objects after that. Objects are constructed
+ *  once when their slab is created and keep their constructed state
+ *  across kmem_cache_free()/kmem_cache_alloc(), so a constructor is only
+ *  run when memory is really new.
+ *
+ *  Every cache keeps its slabs on three lists: full, partial and free.
+ *  Allocation prefers partial slabs, so that free slabs stay free and can
+ *  be given back by kmem_cache_reap() when memory gets tight. Slabs are
+ *  coloured, ie the objects start at a different offset in successive
+ *  slabs, so that the same object in different slabs doesn't always land
+ *  on the same cache lines.
+ *
+ *  Like kmalloc(), everything here is protected by cli(), so it can be
+ *  used from interrupts with GFP_ATOMIC.
+ */
+
+#include <linux/mm.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/malloc.h>
+#include <asm/system.h>
+
+#define SLAB_COLOUR_OFF	32	/* colouring step, a cache line */
+#define SLAB_END	0xffff	/* end of the free index chain */
+
+struct kmem_slab {
+	struct kmem_slab * next, * prev;
+	struct kmem_cache * cache;
+	unsigned long s_mem;		/* address of the first object */
+	int inuse;			/* objects handed out */
+	unsigned short free;		/* index of the first free object */
+	unsigned short bufctl[0];	/* next free index, per object */
+};
+
+struct kmem_cache {
+	struct kmem_cache * next;	/* all caches, for /proc/slabinfo */
+	const char * name;
+	int objsize;			/* size asked for */
+	int size;			/* objsize rounded up to the alignment */
+	int align;
+	int num;			/* objects per slab */
+	int colour;			/* number of different offsets */
+	int colour_off;
+	int colour_next;
+	void (*ctor)(void *);
+	struct kmem_slab * slabs_full;
+	struct kmem_slab * slabs_partial;
+	struct kmem_slab * slabs_free;
+	int nr_slabs;
+	int active_objs;
+	unsigned long allocs, frees, grown, reaped;
+};
+
+#define SLAB_DESC(p) ((struct kmem_slab *)(((unsigned long)(p)) & PAGE_MASK))
+
+static struct kmem_cache * cache_chain = NULL;
+
+static inline void slab_unlink(struct kmem_slab ** list, struct kmem_slab * slab)
+{
+	if (slab->next)
+		slab->next->prev = slab->prev;
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	slab->next = slab->prev = NULL;
+}
+
+static inline void slab_link(struct kmem_slab ** list, struct kmem_slab * slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+/*
+ * Work out how many objects fit in a slab, leaving room for the slab
+ * descriptor and one free index per object at the front.
+ */
+static int slab_estimate(int size, int align, int * left)
+{
+	int num, head;
+
+	num = (PAGE_SIZE - sizeof(struct kmem_slab)) / (size + sizeof(unsigned short));
+	for ( ; num > 0 ; num--) {
+		head = sizeof(struct kmem_slab) + num * sizeof(unsigned short);
+		head = (head + align - 1) & ~(align - 1);
+		if (head + num * size <= PAGE_SIZE) {
+			*left = PAGE_SIZE - head - num * size;
+			return num;
+		}
+	}
+	return 0;
+}
+
+struct kmem_cache * kmem_cache_create(const char * name, int size, int align,
+	void (*ctor)(void *))
+{
+	struct kmem_cache * cachep;
+	unsigned long flags;
+	int left;
+
+	if (align < sizeof(long))
+		align = sizeof(long);
+	if (align & (align - 1)) {
+		printk("kmem_cache_create: %s: bad alignment %d\n", name, align);
+		return NULL;
+	}
+	cachep = (struct kmem_cache *) kmalloc(sizeof(*cachep), GFP_KERNEL);
+	if (!cachep)
+		return NULL;
+	memset(cachep, 0, sizeof(*cachep));
+	cachep->name = name;
+	cachep->objsize = size;
+	cachep->align = align;
+	cachep->size = (size + align - 1) & ~(align - 1);
+	cachep->ctor = ctor;
+	cachep->num = slab_estimate(cachep->size, align, &left);
+	if (!cachep->num) {
+		printk("kmem_cache_create: %s: objects of %d bytes don't fit "
+		       "in a slab\n", name, size);
+		kfree_s(cachep, sizeof(*cachep));
+		return NULL;
+	}
+	cachep->colour_off = SLAB_COLOUR_OFF;
+	if (cachep->colour_off < align)
+		cachep->colour_off = align;
+	cachep->colour = left / cachep->colour_off + 1;
+
+	save_flags(flags);
+	cli();
+	cachep->next = cache_chain;
+	cache_chain = cachep;
+	restore_flags(flags);
+	return cachep;
+}
+
+/*
+ * Get a new page for the cache and construct all its objects.
+ */
+static int kmem_cache_grow(struct kmem_cache * cachep, int priority)
+{
+	struct kmem_slab * slab;
+	unsigned long flags, offset;
+	int i;
+
+	slab = (struct kmem_slab *) __get_free_page(priority);
+	if (!slab)
+		return 0;
+	save_flags(flags);
+	cli();
+	offset = cachep->colour_next * cachep->colour_off;
+	if (++cachep->colour_next >= cachep->colour)
+		cachep->colour_next = 0;
+	restore_flags(flags);
+
+	slab->cache = cachep;
+	slab->inuse = 0;
+	slab->s_mem = sizeof(struct kmem_slab) + cachep->num * sizeof(unsigned short);
+	slab->s_mem = (slab->s_mem + cachep->align - 1) & ~(cachep->align - 1);
+	slab->s_mem += offset + (unsigned long) slab;
+	for (i = 0 ; i < cachep->num ; i++) {
+		if (cachep->ctor)
+			cachep->ctor((void *) (slab->s_mem + i * cachep->size));
+		slab->bufctl[i] = i + 1;
+	}
+	slab->bufctl[cachep->num - 1] = SLAB_END;
+	slab->free = 0;
+
+	cli();
+	slab_link(&cachep->slabs_free, slab);
+	cachep->nr_slabs++;
+	cachep->grown++;
+	restore_flags(flags);
+	return 1;
+}
+
+void * kmem_cache_alloc(struct kmem_cache * cachep, int priority)
+{
+	struct kmem_slab * slab;
+	unsigned long flags;
+	void * objp;
+	extern unsigned long intr_count;
+
+	if (intr_count && priority != GFP_ATOMIC) {
+		printk("kmem_cache_alloc called nonatomically from interrupt %08lx\n",
+		       (unsigned long) __builtin_return_address(0));
+		priority = GFP_ATOMIC;
+	}
+	save_flags(flags);
+	for (;;) {
+		cli();
+		if ((slab = cachep->slabs_partial) != NULL)
+			break;
+		if ((slab = cachep->slabs_free) != NULL) {
+			slab_unlink(&cachep->slabs_free, slab);
+			slab_link(&cachep->slabs_partial, slab);
+			break;
+		}
+		restore_flags(flags);
+		if (!kmem_cache_grow(cachep, priority))
+			return NULL;
+	}
+	objp = (void *) (slab->s_mem + slab->free * cachep->size);
+	slab->free = slab->bufctl[slab->free];
+	if (++slab->inuse == cachep->num) {
+		slab_unlink(&cachep->slabs_partial, slab);
+		slab_link(&cachep->slabs_full, slab);
+	}
+	cachep->active_objs++;
+	cachep->allocs++;
+	restore_flags(flags);
+	return objp;
+}
+
+/*
+ * Give an object back to its cache. The object should be in its
+ * constructed state again, as it will be handed out as such.
+ */
+void kmem_cache_free(struct kmem_cache * cachep, void * objp)
+{
+	struct kmem_slab * slab = SLAB_DESC(objp);
+	unsigned long flags, offset;
+	int i;
+
+	offset = (unsigned long) objp - slab->s_mem;
+	if (slab->cache != cachep || offset % cachep->size ||
+	    offset >= cachep->num * cachep->size) {
+		printk("kmem_cache_free: %s: bad object %p\n",
+		       cachep->name, objp);
+		return;
+	}
+	i = offset / cachep->size;
+	save_flags(flags);
+	cli();
+	if (slab->inuse == cachep->num) {
+		slab_unlink(&cachep->slabs_full, slab);
+		slab_link(&cachep->slabs_partial, slab);
+	}
+	slab->bufctl[i] = slab->free;
+	slab->free = i;
+	if (!--slab->inuse) {
+		slab_unlink(&cachep->slabs_partial, slab);
+		slab_link(&cachep->slabs_free, slab);
+	}
+	cachep->active_objs--;
+	cachep->frees++;
+	restore_flags(flags);
+}
+
+/*
+ * Free the pages of all empty slabs in one cache.
+ */
+int kmem_cache_shrink(struct kmem_cache * cachep)
+{
+	struct kmem_slab * slab;
+	unsigned long flags;
+	int freed = 0;
+
+	save_flags(flags);
+	for (;;) {
+		cli();
+		if (!(slab = cachep->slabs_free))
+			break;
+		slab_unlink(&cachep->slabs_free, slab);
+		cachep->nr_slabs--;
+		cachep->reaped++;
+		restore_flags(flags);
+		free_page((unsigned long) slab);
+		freed++;
+	}
+	restore_flags(flags);
+	return freed;
+}
+
+int kmem_cache_destroy(struct kmem_cache * cachep)
+{
+	struct kmem_cache ** p;
+	unsigned long flags;
+
+	if (cachep->active_objs) {
+		printk("kmem_cache_destroy: %s: %d objects still in use\n",
+		       cachep->name, cachep->active_objs);
+		return -EBUSY;
+	}
+	save_flags(flags);
+	cli();
+	for (p = &cache_chain ; *p ; p = &(*p)->next)
+		if (*p == cachep) {
+			*p = cachep->next;
+			break;
+		}
+	restore_flags(flags);
+	kmem_cache_shrink(cachep);
+	kfree_s(cachep, sizeof(*cachep));
+	return 0;
+}
+
+/*
+ * Called by try_to_free_page(): give back the empty slabs of every
+ * cache. Returns 1 if at least one page was freed.
+ */
+int kmem_cache_reap(int priority)
+{
+	struct kmem_cache * cachep;
+	int freed = 0;
+
+	for (cachep = cache_chain ; cachep ; cachep = cachep->next)
+		freed += kmem_cache_shrink(cachep);
+	return freed != 0;
+}
+
+int get_slabinfo(char * buffer)
+{
+	struct kmem_cache * cachep;
+	int len;
+
+	len = sprintf(buffer, "%-16s %7s %7s %7s %6s %5s %8s %8s %6s %6s\n",
+		"name", "active", "objs", "objsize", "slabs", "per",
+		"allocs", "frees", "grown", "reaped");
+	for (cachep = cache_chain ; cachep ; cachep = cachep->next) {
+		if (len > PAGE_SIZE - 128)
+			break;
+		len += sprintf(buffer+len,
+			"%-16s %7d %7d %7d %6d %5d %8lu %8lu %6lu %6lu\n",
+			cachep->name, cachep->active_objs,
+			cachep->nr_slabs * cachep->num, cachep->objsize,
+			cachep->nr_slabs, cachep->num,
+			cachep->allocs, cachep->frees,
+			cachep->grown, cachep->reaped);
+	}
+	return len;
+}
@@ -17,6 +17,8 @@
 #include <linux/errno.h>
 #include <linux/string.h>
 #include <linux/stat.h>
+#include <linux/malloc.h>
+#include <linux/pagemap.h>
 
 #include <asm/system.h> /* for cli()/sti() */
 #include <asm/bitops.h>
@@ -45,7 +47,6 @@ static struct swap_info_struct {
 	unsigned long max;
 } swap_info[MAX_SWAPFILES];
 
-extern unsigned long free_page_list;
 extern int shm_swap (int);
 
 /*
@@ -476,6 +477,10 @@ static int try_to_free_page(void)
 	int i=6;
 
 	while (i--) {
+		if (kmem_cache_reap(i))
+			return 1;
+		if (shrink_page_cache(i))
+			return 1;
 		if (shrink_buffers(i))
 			return 1;
 		if (shm_swap(i))
@@ -487,20 +492,63 @@ static int try_to_free_page(void)
 }
 
 /*
+ * The buddy allocator. Free blocks of 2^order pages are kept on doubly
+ * linked lists through their first page. free_area_map[order] has one bit
+ * for every pair of buddies, which is flipped whenever one of the two is
+ * allocated or freed: it is set exactly when one of them is free. The
+ * largest order has no buddies and no map.
+ *
  * Note that this must be atomic, or bad things will happen when
  * pages are requested in interrupts (as malloc can do). Thus the
  * cli/sti's.
  */
-static inline void add_mem_queue(unsigned long addr, unsigned long * queue)
+struct mem_list {
+	struct mem_list * next;
+	struct mem_list * prev;
+};
+
+static struct mem_list free_area_list[NR_MEM_LISTS];
+static unsigned char * free_area_map[NR_MEM_LISTS];
+int nr_free_area[NR_MEM_LISTS] = {0, };
+
+static inline void add_mem_queue(struct mem_list * head, struct mem_list * entry)
 {
-    addr &= PAGE_MASK;
-    *(unsigned long *) addr = *queue;
-    *queue = addr;
+	entry->prev = head;
+	entry->next = head->next;
+	head->next->prev = entry;
+	head->next = entry;
+}
+
+static inline void remove_mem_queue(struct mem_list * entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+static inline void free_pages_ok(unsigned long addr, unsigned long order)
+{
+	unsigned long map_nr = MAP_NR(addr);
+
+	nr_free_pages += 1 << order;
+	while (order < NR_MEM_LISTS-1) {
+		if (!change_bit(map_nr >> (1+order), free_area_map[order]))
+			break;
+		/* the buddy is free too: take it off its list and merge */
+		remove_mem_queue((struct mem_list *)
+			((map_nr ^ (1 << order)) << PAGE_SHIFT));
+		nr_free_area[order]--;
+		map_nr &= ~(1UL << order);
+		order++;
+	}
+	add_mem_queue(free_area_list + order,
+		(struct mem_list *) (map_nr << PAGE_SHIFT));
+	nr_free_area[order]++;
 }
 
 /*
- * Free_page() adds the page to the free lists. This is optimized for
- * fast normal cases (no error jumps taken normally).
+ * Free_pages() gives a block back to the free lists, once its use
+ * count (kept in the mem_map entry of the first page) drops to zero.
+ * This is optimized for fast normal cases (no error jumps taken normally).
  *
  * The way to optimize jumps for gcc-2.2.2 is to:
  *  - select the "normal" case and put it inside the if () { XXX }
@@ -509,7 +557,7 @@ static inline void add_mem_queue(unsigned long addr, unsigned long * queue)
  * With the above two rules, you get a straight-line execution path
  * for the normal case, giving better asm-code.
  */
-void free_page(unsigned long addr)
+void free_pages(unsigned long addr, unsigned long order)
 {
     if (addr < high_memory) {
         unsigned short * map = mem_map + MAP_NR(addr);
@@ -521,14 +569,12 @@ void free_page(unsigned long addr)
                 save_flags(flag);
                 cli();
                 if (!--*map) {
-                    if (nr_secondary_pages < MAX_SECONDARY_PAGES) {
-                        add_mem_queue(addr, &secondary_page_list);
-                        nr_secondary_pages++;
-                        restore_flags(flag);
-                        return;
+                    if (order) {
+                        int i = 1 << order;
+                        while (--i > 0)
+                            map[i] = 0;
                     }
-                    add_mem_queue(addr,&free_page_list);
-                    nr_free_pages++;
+                    free_pages_ok(addr & PAGE_MASK, order);
                 }
                 restore_flags(flag);
             }
@@ -542,54 +588,63 @@ void free_page(unsigned long addr)
 }
 
 /*
- * This is one ugly macro, but it simplifies checking, and makes
- * this speed-critical place reasonably fast, especially as we have
- * to do things with the interrupt flag etc.
- *
- * Note that this #define is heavily optimized to give fast code
- * for the normal case - the if-statements are ordered so that gcc-2.2.2
- * will make *no* jumps for the normal code. Don't touch unless you
- * know what you are doing.
+ * Take a block of the given order off the free lists, splitting a
+ * larger one if need be. Called with interrupts off.
  */
-#define REMOVE_FROM_MEM_QUEUE(queue,nr) \
-    cli(); \
-    if ((result = queue) != 0) { \
-        if (!(result & ~PAGE_MASK) && result < high_memory) { \
-            queue = *(unsigned long *) result; \
-            if (!mem_map[MAP_NR(result)]) { \
-                mem_map[MAP_NR(result)] = 1; \
-                nr--; \
-                last_free_pages[index = \
-                    (index + 1) & (NR_LAST_FREE_PAGES - 1)] = result; \
-                restore_flags(flag); \
-                return result; \
-            } \
-            printk("Free page %08lx has mem_map = %d\n", \
-                          result,mem_map[MAP_NR(result)]); \
-        } else \
-            printk("Result = 0x%08lx - memory map destroyed\n", result); \
-        queue = 0; \
-        nr = 0; \
-    } else if (nr) { \
-        printk(#nr " is %d, but " #queue " is empty\n",nr); \
-        nr = 0; \
-    } \
-    restore_flags(flag)
+static inline unsigned long rmqueue(unsigned long order)
+{
+	struct mem_list * head, * next;
+	unsigned long map_nr, new_order, size;
+	unsigned short * map;
+
+	for (new_order = order ; new_order < NR_MEM_LISTS ; new_order++) {
+		head = free_area_list + new_order;
+		next = head->next;
+		if (next == head)
+			continue;
+		remove_mem_queue(next);
+		nr_free_area[new_order]--;
+		map_nr = MAP_NR((unsigned long) next);
+		if (new_order < NR_MEM_LISTS-1)
+			change_bit(map_nr >> (1+new_order), free_area_map[new_order]);
+		/* give back the upper halves we don't need */
+		size = 1 << new_order;
+		while (new_order > order) {
+			new_order--;
+			size >>= 1;
+			add_mem_queue(free_area_list + new_order,
+				(struct mem_list *) ((map_nr + size) << PAGE_SHIFT));
+			change_bit(map_nr >> (1+new_order), free_area_map[new_order]);
+			nr_free_area[new_order]++;
+		}
+		map = mem_map + map_nr;
+		for (size = 0 ; size < (1 << order) ; size++) {
+			if (map[size])
+				printk("Free page %08lx has mem_map = %d\n",
+				       (map_nr + size) << PAGE_SHIFT, map[size]);
+			map[size] = 1;
+		}
+		nr_free_pages -= 1 << order;
+		return (unsigned long) next;
+	}
+	return 0;
+}
 
 /*
- * Get physical address of first (actually last :-) free page, and mark it
+ * Get physical address of first (actually last :-) free block, and mark it
  * used. If no free pages left, return 0.
  *
  * Note that this is one of the most heavily called functions in the kernel,
  * so it's a bit timing-critical (especially as we have to disable interrupts
- * in it). See the above macro which does most of the work, and which is
- * optimized for a fast normal path of execution.
+ * in it). Single pages come straight off the order-0 list in the normal
+ * case.
  */
-unsigned long __get_free_page(int priority)
+unsigned long __get_free_pages(int priority, unsigned long order)
 {
     extern unsigned long intr_count;
     unsigned long result, flag;
     static unsigned long index = 0;
+    unsigned long reclaimed = 0;
 
     /* this routine can be called at interrupt time via
        malloc.  We want to make sure that the critical
@@ -601,16 +656,59 @@ unsigned long __get_free_page(int priority)
                  ((unsigned long *)&priority)[-1]);
         priority = GFP_ATOMIC;
     }
+    if (order >= NR_MEM_LISTS)
+        return 0;
     save_flags(flag);
 repeat:
-    REMOVE_FROM_MEM_QUEUE(free_page_list, nr_free_pages);
+    cli();
+    if (priority == GFP_ATOMIC ||
+        nr_free_pages > MAX_SECONDARY_PAGES + (1 << order)) {
+        if ((result = rmqueue(order)) != 0) {
+            if (!order)
+                last_free_pages[index = (index + 1) & (NR_LAST_FREE_PAGES - 1)] = result;
+            restore_flags(flag);
+            return result;
+        }
+    }
+    restore_flags(flag);
     if (priority == GFP_BUFFER)
         return 0;
+    /*
+     * Freed pages need not coalesce, so with fragmented memory an
+     * order > 0 request could reclaim forever. Give it one pass of
+     * as many pages as it asks for.
+     */
     if (priority != GFP_ATOMIC)
-        if (try_to_free_page())
+        if (try_to_free_page() && (!order || ++reclaimed < (1 << order)))
             goto repeat;
-    REMOVE_FROM_MEM_QUEUE(secondary_page_list, nr_secondary_pages);
-    return 0;
+    /* last resort: dip into the reserved pages */
+    cli();
+    result = rmqueue(order);
+    restore_flags(flag);
+    return result;
+}
+
+/*
+ * Set up the (empty) free lists and allocate the buddy bitmaps. Called
+ * from mem_init() before any page is freed.
+ */
+unsigned long free_area_init(unsigned long start_mem, unsigned long end_mem)
+{
+	int i;
+	unsigned long bitmap_size;
+
+	start_mem = (start_mem + 3) & ~3;
+	for (i = 0 ; i < NR_MEM_LISTS ; i++) {
+		free_area_list[i].next = free_area_list[i].prev = free_area_list + i;
+		nr_free_area[i] = 0;
+		/* one bit per pair of 2^i page blocks, rounded up to words */
+		bitmap_size = (MAP_NR(end_mem) + (2 << i) - 1) >> (i+1);
+		bitmap_size = (bitmap_size + 31) >> 3 & ~3;
+		free_area_map[i] = (unsigned char *) start_mem;
+		memset((void *) start_mem, 0, bitmap_size);
+		start_mem += bitmap_size;
+	}
+	return start_mem;
 }
 
 /*
@@ -115,18 +115,49 @@ static struct {
 #define	ARP_MAX_TYPE	(sizeof(arp_types) / sizeof(arp_types[0]))
 
 
-struct arp_table *arp_tables[ARP_TABLE_SIZE] = {
+/*
+ * The cache is a hash table that grows with the number of entries in
+ * it. arp_find() looks entries up without disabling interrupts: it
+ * bumps arp_readers while it walks a chain, and an entry (or an old
+ * bucket array) taken out of the table while somebody may still be
+ * looking at it is only freed by arp_reap() once nobody is. Everything
+ * that changes the table does so under cli().
+ *
+ * Each entry has its own timer. An incomplete entry repeats its
+ * request every ARP_RES_TIME, and is thrown away together with the
+ * packets waiting on it after ARP_MAX_TRIES. A complete entry is looked
+ * at again ARP_TIMEOUT after we last heard from the host: if it wasn't
+ * used since it goes, otherwise the host is asked again while we keep
+ * using the old address.
+ */
+#define arp_barrier()	__asm__ __volatile__("": : :"memory")
+
+struct arp_hash {
+  unsigned int		mask;		/* size - 1, size a power of two */
+  struct arp_table	**buckets;
+};
+
+static struct arp_table *arp_buckets0[ARP_TABLE_SIZE] = {
   NULL,
 };
+static struct arp_hash arp_hash0 = { ARP_TABLE_SIZE - 1, arp_buckets0 };
+static struct arp_hash *volatile arp_hash = &arp_hash0;
+
+static volatile int arp_readers = 0;	/* lockless lookups in progress	*/
+static struct arp_table *arp_dead = NULL;
+static struct arp_hash *arp_old_hash = NULL;
+static int arp_entries = 0;
 
 static int arp_proxies=0;	/* So we can avoid the proxy arp 
 				   overhead with the usual case of
 				   no proxy arps */
 
+/* Packets for devices that don't use eth_rebuild_header() wait here. */
 struct sk_buff * volatile arp_q = NULL;
 
 static struct arp_table *arp_lookup(unsigned long addr);
 static struct arp_table *arp_lookup_proxy(unsigned long addr);
+void arp_send(unsigned long paddr, struct device *dev, unsigned long saddr);
 
 /* Dump the ADDRESS bytes of an unknown hardware type. */
 static char *
@@ -273,7 +304,6 @@ static void arp_queue_ticker(unsigned long data/*UNUSED*/)
 }
 
 
-
 /* Create and send our response to an ARP request. */
 static int
 arp_response(struct arphdr *arp1, struct device *dev,  int addrtype)
@@ -282,8 +312,8 @@ arp_response(struct arphdr *arp1, struct device *dev,  int addrtype)
   struct sk_buff *skb;
   unsigned long src, dst;
   unsigned char *ptr1, *ptr2;
+  unsigned char ha[MAX_ADDR_LEN];
   int hlen;
-  struct arp_table *apt = NULL;/* =NULL otherwise the compiler gives warnings */
 
   /* Decode the source (REQUEST) message. */
   ptr1 = ((unsigned char *) &arp1->ar_op) + sizeof(u_short);
@@ -292,7 +322,15 @@ arp_response(struct arphdr *arp1, struct device *dev,  int addrtype)
   
   if(addrtype!=IS_MYADDR)
   {
-  	apt=arp_lookup_proxy(dst);
+	struct arp_table *apt;
+
+	arp_readers++;
+	arp_barrier();
+	apt=arp_lookup_proxy(dst);
+	if(apt!=NULL)
+		memcpy(ha, apt->ha, arp1->ar_hln);
+	arp_barrier();
+	arp_readers--;
   	if(apt==NULL)
   		return(1);
   }
@@ -333,7 +371,7 @@ arp_response(struct arphdr *arp1, struct device *dev,  int addrtype)
   if(addrtype==IS_MYADDR)
 	  memcpy(ptr2, dev->dev_addr, arp2->ar_hln);
   else		/* Proxy arp, so pull from the table */
-  	  memcpy(ptr2, apt->ha, arp2->ar_hln);
+  	  memcpy(ptr2, ha, arp2->ar_hln);
   ptr2 += arp2->ar_hln;
   memcpy(ptr2, ptr1 + (arp1->ar_hln * 2) + arp1->ar_pln, arp2->ar_pln);
   ptr2 += arp2->ar_pln;
@@ -355,34 +393,33 @@ arp_response(struct arphdr *arp1, struct device *dev,  int addrtype)
 }
 
 
-/* This will find an entry in the ARP table by looking at the IP address. */
+static inline unsigned long
+arp_hashfn(unsigned long paddr, unsigned int mask)
+{
+  unsigned long h = ntohl(paddr);
+
+  h ^= h >> 16;
+  h ^= h >> 8;
+  return(h & mask);
+}
+
+
+/*
+ * This will find an entry in the ARP table by looking at the IP address.
+ * The caller either has interrupts off or holds arp_readers up.
+ */
 static struct arp_table *
 arp_lookup(unsigned long paddr)
 {
+  struct arp_hash *h = arp_hash;
   struct arp_table *apt;
-  unsigned long hash;
 
   DPRINTF((DBG_ARP, "ARP: lookup(%s)\n", in_ntoa(paddr)));
 
-  /* We don't want to ARP ourselves. */
-  if (chk_addr(paddr) == IS_MYADDR) {
-	printk("ARP: ARPing my own IP address %s !\n", in_ntoa(paddr));
-	return(NULL);
-  }
-
-  /* Loop through the table for the desired address. */
-  hash = htonl(paddr) & (ARP_TABLE_SIZE - 1);
-  cli();
-  apt = arp_tables[hash];
-  while(apt != NULL) {
-	if (apt->ip == paddr) {
-		sti();
-		return(apt);
-	}
+  apt = h->buckets[arp_hashfn(paddr, h->mask)];
+  while(apt != NULL && apt->ip != paddr)
 	apt = apt->next;
-  }
-  sti();
-  return(NULL);
+  return(apt);
 }
 
 
@@ -390,89 +427,253 @@ arp_lookup(unsigned long paddr)
 static struct arp_table *arp_lookup_proxy(unsigned long paddr)
 {
   struct arp_table *apt;
-  unsigned long hash;
 
   DPRINTF((DBG_ARP, "ARP: lookup proxy(%s)\n", in_ntoa(paddr)));
 
-  /* Loop through the table for the desired address. */
-  hash = htonl(paddr) & (ARP_TABLE_SIZE - 1);
-  cli();
-  apt = arp_tables[hash];
-  while(apt != NULL) {
-	if (apt->ip == paddr && (apt->flags & ATF_PUBL) ) {
-		sti();
-		return(apt);
-	}
-	apt = apt->next;
-  }
-  sti();
-  return(NULL);
+  apt = arp_lookup(paddr);
+  if (apt != NULL && !(apt->flags & ATF_PUBL))
+	return(NULL);
+  return(apt);
 }
 
 
-/* Delete an ARP mapping entry in the cache. */
-void
-arp_destructor(unsigned long paddr, int force)
+/*
+ * Copy out the hardware address of an entry without disabling
+ * interrupts: if it was changed under us, copy it again.
+ */
+static inline void
+arp_copy_ha(struct arp_table *apt, unsigned char *haddr, int len)
 {
-  struct arp_table *apt;
-  struct arp_table **lapt;
-  unsigned long hash;
+  unsigned int seq;
+
+  do {
+	seq = apt->seq;
+	arp_barrier();
+	memcpy(haddr, apt->ha, len);
+	arp_barrier();
+  } while (seq != apt->seq);
+}
 
-  DPRINTF((DBG_ARP, "ARP: destroy(%s)\n", in_ntoa(paddr)));
 
-  /* We cannot destroy our own ARP entry. */
-  if (chk_addr(paddr) == IS_MYADDR) {
-	DPRINTF((DBG_ARP, "ARP: Destroying my own IP address %s !\n",
-							in_ntoa(paddr)));
+/* Free what was taken out of the table, if nobody can still see it. */
+static void
+arp_reap(void)
+{
+  struct arp_table *apt;
+
+  if (arp_readers)
 	return;
+  while((apt = arp_dead) != NULL) {
+	arp_dead = apt->dead;
+	kfree_s(apt, sizeof(struct arp_table));
   }
-  hash = htonl(paddr) & (ARP_TABLE_SIZE - 1);
-
-  cli();
-  lapt = &arp_tables[hash];
-  while ((apt = *lapt) != NULL) {
-	if (apt->ip == paddr) {
-		if((apt->flags&ATF_PERM) && !force)
-			return;
-		*lapt = apt->next;
-		if(apt->flags&ATF_PUBL)
-			arp_proxies--;			
-		kfree_s(apt, sizeof(struct arp_table));
-		sti();
-		return;
-	}
-	lapt = &apt->next;
+  if (arp_old_hash != NULL) {
+	kfree_s(arp_old_hash, sizeof(struct arp_hash) +
+		(arp_old_hash->mask + 1) * sizeof(struct arp_table *));
+	arp_old_hash = NULL;
   }
-  sti();
 }
 
+
 /*
- *	Kill an entry - eg for ioctl()
+ * Double the number of buckets. A lookup running in the meantime may
+ * miss its entry, in which case arp_find() just takes the slow path.
+ * Called with interrupts off.
  */
+static void
+arp_grow(void)
+{
+  struct arp_hash *old = arp_hash, *new;
+  struct arp_table *apt, *next;
+  unsigned int size, i, hash;
 
-void arp_destroy(unsigned long paddr)
-{	
-	arp_destructor(paddr,1);
+  size = (old->mask + 1) * 2;
+  if (size > ARP_TABLE_MAX)
+	return;
+  arp_reap();
+  if (arp_old_hash != NULL)
+	return;
+  new = (struct arp_hash *) kmalloc(sizeof(struct arp_hash) +
+			size * sizeof(struct arp_table *), GFP_ATOMIC);
+  if (new == NULL)
+	return;
+  new->mask = size - 1;
+  new->buckets = (struct arp_table **) (new + 1);
+  memset(new->buckets, 0, size * sizeof(struct arp_table *));
+  for(i = 0; i <= old->mask; i++) {
+	for(apt = old->buckets[i]; apt != NULL; apt = next) {
+		next = apt->next;
+		hash = arp_hashfn(apt->ip, new->mask);
+		apt->next = new->buckets[hash];
+		new->buckets[hash] = apt;
+	}
+  }
+  arp_hash = new;
+  if (old != &arp_hash0)
+	arp_old_hash = old;
+  arp_reap();
+}
+
+
+/* Let a packet go: nobody is going to resolve its address. */
+static void
+arp_drop(struct sk_buff *skb)
+{
+  skb->magic = 0;
+  skb->next = NULL;
+  skb->prev = NULL;
+  skb->sk = NULL;
+  if(skb->free)
+	kfree_skb(skb, FREE_WRITE);
+	/* If free was 0, magic is now 0, next is 0 and 
+	   the write queue will notice and kill */
+}
+
+
+/* Try to send a packet that was waiting for ARP. */
+static void
+arp_xmit(struct sk_buff *skb)
+{
+  skb->magic = 0;
+  skb->next = NULL;
+  skb->prev = NULL;
+  if (!skb->dev->rebuild_header(skb->data, skb->dev)) {
+	skb->arp = 1;
+	skb->dev->queue_xmit(skb, skb->dev, 0);
+  } else
+	arp_queue(skb);
+}
+
+
+/* Send whatever was waiting on an entry we took the queue of. */
+static void
+arp_flush(struct sk_buff *volatile *list)
+{
+  struct sk_buff *skb;
+
+  while((skb = skb_dequeue(list)) != NULL)
+	arp_xmit(skb);
+}
+
+
+/* Take the waiting packets off an entry. Called with interrupts off. */
+static void
+arp_take_queue(struct arp_table *apt, struct sk_buff *volatile *list)
+{
+  *list = apt->queue;
+  skb_new_list_head(list);
+  apt->queue = NULL;
+  apt->qlen = 0;
 }
 
+
 /*
- *	Delete a possibly invalid entry (see timer.c)
+ * Take an entry out of the table and throw away what was waiting on it.
+ * Called with interrupts off.
  */
+static void
+arp_delete(struct arp_table *apt)
+{
+  struct arp_table **lapt;
+  struct sk_buff *skb;
 
-void arp_destroy_maybe(unsigned long paddr)
+  DPRINTF((DBG_ARP, "ARP: delete(%s)\n", in_ntoa(apt->ip)));
+
+  lapt = &arp_hash->buckets[arp_hashfn(apt->ip, arp_hash->mask)];
+  while (*lapt != NULL) {
+	if (*lapt == apt) {
+		*lapt = apt->next;
+		break;
+	}
+	lapt = &(*lapt)->next;
+  }
+  del_timer(&apt->timer);
+  arp_entries--;
+  if(apt->flags&ATF_PUBL)
+	arp_proxies--;
+  while((skb = skb_dequeue(&apt->queue)) != NULL)
+	arp_drop(skb);
+
+  /* apt->next stays valid, so a reader on this entry can go on. */
+  apt->dead = arp_dead;
+  arp_dead = apt;
+  arp_reap();
+}
+
+
+/* (Re)start the timer of an entry. Called with interrupts off. */
+static inline void
+arp_set_timer(struct arp_table *apt, unsigned long expires)
 {
-	arp_destructor(paddr,0);
+  del_timer(&apt->timer);
+  apt->timer.expires = expires;
+  add_timer(&apt->timer);
 }
 
-/* Create an ARP entry.  The caller should check for duplicates! */
+
+/* The timer of an entry went off. */
+static void
+arp_expire(unsigned long data)
+{
+  struct arp_table *apt = (struct arp_table *) data;
+  struct device *dev;
+  unsigned long flags, paddr;
+
+  save_flags(flags);
+  cli();
+  if (apt->flags & ATF_PERM) {
+	restore_flags(flags);
+	return;
+  }
+
+  /*
+   * A complete entry we haven't heard of for ARP_TIMEOUT. If nobody
+   * used it since, it can go. Otherwise check that the host is still
+   * there, but keep using the address while we wait.
+   */
+  if ((apt->flags & ATF_COM) && apt->tries == 0 &&
+      (apt->dev == NULL || (long) (apt->last_used - apt->confirmed) <= 0)) {
+	arp_delete(apt);
+	restore_flags(flags);
+	return;
+  }
+
+  if (apt->tries >= ARP_MAX_TRIES) {
+	/*
+	 * Grmpf.
+	 * We have tried ARP_MAX_TRIES to resolve the IP address.
+	 * This means that the machine does not listen to our ARP
+	 * requests.  Perhaps someone turned off the thing?
+	 */
+	DPRINTF((DBG_ARP, "ARP: giving up on %s\n", in_ntoa(apt->ip)));
+	arp_delete(apt);
+	restore_flags(flags);
+	return;
+  }
+  apt->tries++;
+  arp_set_timer(apt, ARP_RES_TIME);
+  paddr = apt->ip;
+  dev = apt->dev;
+  arp_reap();
+  restore_flags(flags);
+  arp_send(paddr, dev, dev->pa_addr);
+}
+
+
+/*
+ * Create an ARP entry.  The caller should check for duplicates, and
+ * have interrupts off. Without a hardware address the entry is
+ * incomplete, and the caller sends the first request.
+ */
 static struct arp_table *
-arp_create(unsigned long paddr, unsigned char *addr, int hlen, int htype)
+arp_create(unsigned long paddr, unsigned char *addr, int hlen, int htype,
+	   struct device *dev)
 {
   struct arp_table *apt;
   unsigned long hash;
 
   DPRINTF((DBG_ARP, "ARP: create(%s, ", in_ntoa(paddr)));
-  DPRINTF((DBG_ARP, "%s, ", eth_print(addr)));
+  DPRINTF((DBG_ARP, "%s, ", addr ? eth_print(addr) : "incomplete"));
   DPRINTF((DBG_ARP, "%d, %d)\n", hlen, htype));
 
   apt = (struct arp_table *) kmalloc(sizeof(struct arp_table), GFP_ATOMIC);
@@ -482,21 +683,101 @@ arp_create(unsigned long paddr, unsigned char *addr, int hlen, int htype)
   }
 
   /* Fill in the allocated ARP cache entry. */
-  hash = htonl(paddr) & (ARP_TABLE_SIZE - 1);
+  memset(apt, 0, sizeof(struct arp_table));
   apt->ip = paddr;
   apt->hlen = hlen;
   apt->htype = htype;
-  apt->flags = (ATF_INUSE | ATF_COM);		/* USED and COMPLETED entry */
-  memcpy(apt->ha, addr, hlen);
+  apt->dev = dev;
   apt->last_used = jiffies;
-  cli();
-  apt->next = arp_tables[hash];
-  arp_tables[hash] = apt;
-  sti();
+  init_timer(&apt->timer);
+  apt->timer.data = (unsigned long) apt;
+  apt->timer.function = arp_expire;
+  if (addr != NULL) {
+	apt->flags = (ATF_INUSE | ATF_COM);	/* USED and COMPLETED entry */
+	memcpy(apt->ha, addr, hlen);
+	apt->confirmed = jiffies;
+	arp_set_timer(apt, ARP_TIMEOUT);
+  } else {
+	apt->flags = ATF_INUSE;
+	apt->tries = 1;
+	arp_set_timer(apt, ARP_RES_TIME);
+  }
+
+  /* Only make it visible to lockless readers once it is filled in. */
+  hash = arp_hashfn(paddr, arp_hash->mask);
+  apt->next = arp_hash->buckets[hash];
+  arp_barrier();
+  arp_hash->buckets[hash] = apt;
+  if (++arp_entries > 2 * (arp_hash->mask + 1))
+	arp_grow();
   return(apt);
 }
 
 
+/*
+ * We heard from the host of an entry. Called with interrupts off; the
+ * caller sends what was waiting on it.
+ */
+static void
+arp_confirm(struct arp_table *apt, unsigned char *addr, int hlen,
+	    struct device *dev)
+{
+  memcpy(apt->ha, addr, hlen);
+  apt->seq++;
+  apt->hlen = hlen;
+  apt->flags |= ATF_COM;
+  apt->tries = 0;
+  apt->confirmed = jiffies;
+  if (dev != NULL)
+	apt->dev = dev;
+  if (!(apt->flags & ATF_PERM))
+	arp_set_timer(apt, ARP_TIMEOUT);
+}
+
+
+/* Delete an ARP mapping entry in the cache. */
+void
+arp_destructor(unsigned long paddr, int force)
+{
+  struct arp_table *apt;
+  unsigned long flags;
+
+  DPRINTF((DBG_ARP, "ARP: destroy(%s)\n", in_ntoa(paddr)));
+
+  /* We cannot destroy our own ARP entry. */
+  if (chk_addr(paddr) == IS_MYADDR) {
+	DPRINTF((DBG_ARP, "ARP: Destroying my own IP address %s !\n",
+							in_ntoa(paddr)));
+	return;
+  }
+
+  save_flags(flags);
+  cli();
+  apt = arp_lookup(paddr);
+  if (apt != NULL && (!(apt->flags&ATF_PERM) || force))
+	arp_delete(apt);
+  restore_flags(flags);
+}
+
+/*
+ *	Kill an entry - eg for ioctl()
+ */
+
+void arp_destroy(unsigned long paddr)
+{	
+	arp_destructor(paddr,1);
+}
+
+/*
+ *	Delete a possibly invalid entry (see timer.c)
+ */
+
+void arp_destroy_maybe(unsigned long paddr)
+{
+	arp_destructor(paddr,0);
+}
+
+
 /*
  * An ARP REQUEST packet has arrived.
  * We try to be smart here, and fetch the data of the sender of the
@@ -511,7 +792,8 @@ arp_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
 {
   struct arphdr *arp;
   struct arp_table *tbl;
-  unsigned long src, dst;
+  struct sk_buff *volatile work_q = NULL;
+  unsigned long src, dst, flags;
   unsigned char *ptr;
   int ret;
   int addr_hint;
@@ -544,33 +826,37 @@ arp_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
    */
   ptr = ((unsigned char *) &arp->ar_op) + sizeof(u_short);
   memcpy(&src, ptr + arp->ar_hln, arp->ar_pln);
+  memcpy(&dst, ptr + (arp->ar_hln * 2) + arp->ar_pln, arp->ar_pln);
+  addr_hint = chk_addr(dst);
+  save_flags(flags);
+  cli();
   tbl = arp_lookup(src);
   if (tbl != NULL) {
 	DPRINTF((DBG_ARP, "ARP: udating entry for %s\n", in_ntoa(src)));
-	memcpy(tbl->ha, ptr, arp->ar_hln);
-	tbl->hlen = arp->ar_hln;
-	tbl->flags |= ATF_COM;
-	tbl->last_used = jiffies;
-  } else {
-	memcpy(&dst, ptr + (arp->ar_hln * 2) + arp->ar_pln, arp->ar_pln);
-	if (chk_addr(dst) != IS_MYADDR && arp_proxies == 0) {
+	arp_confirm(tbl, ptr, arp->ar_hln, dev);
+	arp_take_queue(tbl, &work_q);
+  } else if (addr_hint != IS_MYADDR && arp_proxies == 0) {
+	restore_flags(flags);
+	kfree_skb(skb, FREE_READ);
+	return(0);
+  } else if (chk_addr(src) != IS_MYADDR) {
+	tbl = arp_create(src, ptr, arp->ar_hln, dev->type, dev);
+	if (tbl == NULL) {
+		restore_flags(flags);
 		kfree_skb(skb, FREE_READ);
 		return(0);
-	} else {
-		tbl = arp_create(src, ptr, arp->ar_hln, arp->ar_hrd);
-		if (tbl == NULL) {
-			kfree_skb(skb, FREE_READ);
-			return(0);
-		}
 	}
   }
+  restore_flags(flags);
 
   /*
    * Since we updated the ARP cache, we might have enough
    * information to send out some previously queued IP
    * datagrams....
    */
-  arp_send_q();
+  arp_flush(&work_q);
+  if (arp_q != NULL)
+	arp_send_q();
 
   /*
    * OK, we used that part of the info.  Now check if the
@@ -585,14 +871,13 @@ arp_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
  * A broadcast arp, ignore it
  */
 
-  if(chk_addr(dst)==IS_BROADCAST)
+  if(addr_hint==IS_BROADCAST)
   {
 	kfree_skb(skb, FREE_READ);
 	return 0;
   }
   
-  memcpy(&dst, ptr + (arp->ar_hln * 2) + arp->ar_pln, arp->ar_pln);
-  if ((addr_hint=chk_addr(dst)) != IS_MYADDR && arp_proxies==0) {
+  if (addr_hint != IS_MYADDR && arp_proxies==0) {
 	DPRINTF((DBG_ARP, "ARP: request was not for me!\n"));
 	kfree_skb(skb, FREE_READ);
 	return(0);
@@ -677,11 +962,31 @@ arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 	   unsigned long saddr)
 {
   struct arp_table *apt;
+  unsigned long flags;
+  int send = 0;
 
   DPRINTF((DBG_ARP, "ARP: find(haddr=%s, ", eth_print(haddr)));
   DPRINTF((DBG_ARP, "paddr=%s, ", in_ntoa(paddr)));
   DPRINTF((DBG_ARP, "dev=%s, saddr=%s)\n", dev->name, in_ntoa(saddr)));
 
+  /*
+   * The usual case: a complete entry. This doesn't disable interrupts,
+   * and doesn't need chk_addr() either, as there are no entries for
+   * our own addresses.
+   */
+  arp_readers++;
+  arp_barrier();
+  apt = arp_lookup(paddr);
+  if (apt != NULL && (apt->flags & ATF_COM)) {
+	arp_copy_ha(apt, haddr, dev->addr_len);
+	apt->last_used = jiffies;
+	arp_barrier();
+	arp_readers--;
+	return(0);
+  }
+  arp_barrier();
+  arp_readers--;
+
   switch(chk_addr(paddr)) {
 	case IS_MYADDR:
 		memcpy(haddr, dev->dev_addr, dev->addr_len);
@@ -690,24 +995,6 @@ arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 		memcpy(haddr, dev->broadcast, dev->addr_len);
 		return(0);
   }
-		
-  apt = arp_lookup(paddr);
-  if (apt != NULL) {
-	/*
-	 * Make sure it's not too old. If it is too old, we will
-	 * just pretend we did not find it, and then arp_send will
-	 * verify the address for us.
-	 */
-        if ((apt->flags & ATF_PERM) ||
-	    (apt->last_used < jiffies+ARP_TIMEOUT && apt->hlen != 0)) {
-		apt->last_used = jiffies;
-		memcpy(haddr, apt->ha, dev->addr_len);
-		return(0);
-	} else {
-		DPRINTF((DBG_ARP, "ARP: find: found expired entry for %s\n",
-							in_ntoa(apt->ip)));
-	}
-  }
 
   /*
    * This assume haddr are at least 4 bytes.
@@ -716,9 +1003,28 @@ arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
    */
   *(unsigned long *)haddr = paddr;
 
-  /* If we didn't find an entry, we will try to send an ARP packet. */
-  arp_send(paddr, dev, saddr);
+  /*
+   * Look again with interrupts off, as we may have missed it while
+   * the table was changed. If there is no entry yet, make an
+   * incomplete one and send the first request; its timer sends the
+   * others.
+   */
+  save_flags(flags);
+  cli();
+  apt = arp_lookup(paddr);
+  if (apt == NULL) {
+	arp_create(paddr, NULL, dev->addr_len, dev->type, dev);
+	send = 1;
+  } else if (apt->flags & ATF_COM) {
+	memcpy(haddr, apt->ha, dev->addr_len);
+	apt->last_used = jiffies;
+	restore_flags(flags);
+	return(0);
+  }
+  restore_flags(flags);
 
+  if (send)
+	arp_send(paddr, dev, saddr);
   return(1);
 }
 
@@ -728,6 +1034,8 @@ void
 arp_add(unsigned long addr, unsigned char *haddr, struct device *dev)
 {
   struct arp_table *apt;
+  struct sk_buff *volatile work_q = NULL;
+  unsigned long flags;
 
   DPRINTF((DBG_ARP, "ARP: add(%s, ", in_ntoa(addr)));
   DPRINTF((DBG_ARP, "%s, ", eth_print(haddr)));
@@ -739,15 +1047,22 @@ arp_add(unsigned long addr, unsigned char *haddr, struct device *dev)
 	return;
   }
 
+  /* We don't want to ARP ourselves. */
+  if (chk_addr(addr) == IS_MYADDR)
+	return;
+
   /* First see if the address is already in the table. */
+  save_flags(flags);
+  cli();
   apt = arp_lookup(addr);
   if (apt != NULL) {
 	DPRINTF((DBG_ARP, "ARP: updating entry for %s\n", in_ntoa(addr)));
-	apt->last_used = jiffies;
-	memcpy(apt->ha, haddr , dev->addr_len);
-	return;
-  }
-  arp_create(addr, haddr, dev->addr_len, dev->type);
+	arp_confirm(apt, haddr, dev->addr_len, dev);
+	arp_take_queue(apt, &work_q);
+  } else
+	arp_create(addr, haddr, dev->addr_len, dev->type, dev);
+  restore_flags(flags);
+  arp_flush(&work_q);
 }
 
 
@@ -756,32 +1071,68 @@ void
 arp_add_broad(unsigned long addr, struct device *dev)
 {
   struct arp_table *apt;
+  unsigned long flags;
 
   arp_add(addr, dev->broadcast, dev);
+  save_flags(flags);
+  cli();
   apt = arp_lookup(addr);
   if (apt != NULL) {
 	apt->flags |= ATF_PERM;
+	del_timer(&apt->timer);
   }
+  restore_flags(flags);
 }
 
 
-/* Queue an IP packet, while waiting for the ARP reply packet. */
+/*
+ * Queue an IP packet, while waiting for the ARP reply packet.
+ * Packets built by eth_header() still have the IP address they are
+ * waiting for in the destination, so they can wait on its entry and
+ * go as soon as the reply is in. Anything else goes on arp_q, which
+ * is retried every time a reply comes in.
+ */
 void
 arp_queue(struct sk_buff *skb)
 {
-  cli();
-  skb->tries = ARP_MAX_TRIES;
+  struct arp_table *apt = NULL;
+  struct sk_buff *old;
+  unsigned long flags;
 
+  save_flags(flags);
+  cli();
   if (skb->next != NULL) {
-	sti();
+	restore_flags(flags);
 	printk("ARP: arp_queue skb already on queue magic=%X.\n", skb->magic);
 	return;
   }
+
+  if (skb->dev->rebuild_header == eth_rebuild_header)
+	apt = arp_lookup(*(unsigned long *) ((struct ethhdr *) skb->data)->h_dest);
+  if (apt != NULL) {
+	if (apt->flags & ATF_COM) {
+		/* The reply came in while the driver had it. */
+		restore_flags(flags);
+		arp_xmit(skb);
+		return;
+	}
+	skb_queue_tail(&apt->queue, skb);
+	skb->magic = ARP_QUEUE_MAGIC;
+	if (++apt->qlen > ARP_MAX_QUEUE) {
+		old = skb_dequeue(&apt->queue);
+		apt->qlen--;
+		arp_drop(old);
+	}
+	restore_flags(flags);
+	return;
+  }
+
+  skb->tries = ARP_MAX_TRIES;
   if(arp_q==NULL)
   	arp_queue_kick();
   skb_queue_tail(&arp_q,skb);
   skb->magic = ARP_QUEUE_MAGIC;
-  sti();
+  restore_flags(flags);
 }
 
 
@@ -804,34 +1155,33 @@ int
 arp_get_info(char *buffer)
 {
   struct arpreq *req;
+  struct arp_hash *h;
   struct arp_table *apt;
   int i;
   char *pos;
 
   /* Loop over the ARP table and copy structures to the buffer. */
   pos = buffer;
-  i = 0;
-  for (i = 0; i < ARP_TABLE_SIZE; i++) {
-	cli();
-	apt = arp_tables[i];
-	sti();
-	while (apt != NULL) {
+  arp_readers++;
+  arp_barrier();
+  h = arp_hash;
+  for (i = 0; i <= h->mask; i++) {
+	for (apt = h->buckets[i]; apt != NULL; apt = apt->next) {
 		if (pos < (buffer + 4000)) {
 			req = (struct arpreq *) pos;
 			memset((char *) req, 0, sizeof(struct arpreq));
 			req->arp_pa.sa_family = AF_INET;
 			memcpy((char *) req->arp_pa.sa_data, (char *) &apt->ip, 4);
 				req->arp_ha.sa_family = apt->htype;
-			memcpy((char *) req->arp_ha.sa_data,
-		       		(char *) &apt->ha, apt->hlen);
+			arp_copy_ha(apt, (unsigned char *) req->arp_ha.sa_data,
+				    apt->hlen);
 			req->arp_flags = apt->flags;
 		}
 		pos += sizeof(struct arpreq);
-		cli();
-		apt = apt->next;
-		sti();
 	}
   }
+  arp_barrier();
+  arp_readers--;
   return(pos - buffer);
 }
 
@@ -843,6 +1193,8 @@ arp_req_set(struct arpreq *req)
   struct arpreq r;
   struct arp_table *apt;
   struct sockaddr_in *si;
+  struct sk_buff *volatile work_q = NULL;
+  unsigned long flags;
   int htype, hlen;
 
   /* We only understand about IP addresses... */
@@ -875,19 +1227,34 @@ arp_req_set(struct arpreq *req)
 	printk("ARP: SETARP: requested PA is 0.0.0.0 !\n");
 	return(-EINVAL);
   }
+  if (chk_addr(si->sin_addr.s_addr) == IS_MYADDR)
+	return(-EINVAL);
+  save_flags(flags);
+  cli();
   apt = arp_lookup(si->sin_addr.s_addr);
   if (apt == NULL) {
 	apt = arp_create(si->sin_addr.s_addr,
-		(unsigned char *) r.arp_ha.sa_data, hlen, htype);
-	if (apt == NULL) return(-ENOMEM);
+		(unsigned char *) r.arp_ha.sa_data, hlen, htype, NULL);
+	if (apt == NULL) {
+		restore_flags(flags);
+		return(-ENOMEM);
+	}
   }
 
   /* We now have a pointer to an ARP entry.  Update it! */
-  memcpy((char *) &apt->ha, (char *) &r.arp_ha.sa_data, hlen);
-  apt->last_used = jiffies;
-  apt->flags = r.arp_flags;
+  if(apt->flags&ATF_PUBL)
+	arp_proxies--;
+  apt->flags = r.arp_flags | ATF_INUSE;
   if(apt->flags&ATF_PUBL)
   	arp_proxies++;		/* Count proxy arps so we know if to use it */
+  apt->htype = htype;
+  apt->last_used = jiffies;
+  arp_confirm(apt, (unsigned char *) r.arp_ha.sa_data, hlen, NULL);
+  if (apt->flags & ATF_PERM)
+	del_timer(&apt->timer);
+  arp_take_queue(apt, &work_q);
+  restore_flags(flags);
+  arp_flush(&work_q);
 
   return(0);
 }
@@ -900,6 +1267,7 @@ arp_req_get(struct arpreq *req)
   struct arpreq r;
   struct arp_table *apt;
   struct sockaddr_in *si;
+  unsigned long flags;
 
   /* We only understand about IP addresses... */
   memcpy_fromfs(&r, req, sizeof(r));
@@ -907,12 +1275,18 @@ arp_req_get(struct arpreq *req)
 
   /* Is there an existing entry for this address? */
   si = (struct sockaddr_in *) &r.arp_pa;
+  save_flags(flags);
+  cli();
   apt = arp_lookup(si->sin_addr.s_addr);
-  if (apt == NULL) return(-ENXIO);
+  if (apt == NULL) {
+	restore_flags(flags);
+	return(-ENXIO);
+  }
 
   /* We found it; copy into structure. */
   memcpy((char *) r.arp_ha.sa_data, (char *) &apt->ha, apt->hlen);
   r.arp_ha.sa_family = apt->htype;
+  restore_flags(flags);
 
   /* Copy the information back */
   memcpy_tofs(req, &r, sizeof(r));
@@ -18,11 +18,15 @@
 #ifndef _ARP_H
 #define _ARP_H
 
-#define ARP_TABLE_SIZE	16		/* size of ARP table		*/
+#include <linux/timer.h>
+
+#define ARP_TABLE_SIZE	32		/* initial size of ARP table	*/
+#define ARP_TABLE_MAX	1024		/* it doesn't grow beyond this	*/
 #define ARP_TIMEOUT	30000		/* five minutes			*/
 #define ARP_RES_TIME	250		/* 2.5 seconds			*/
 
 #define ARP_MAX_TRIES	3		/* max # of tries to send ARP	*/
+#define ARP_MAX_QUEUE	3		/* packets waiting per entry	*/
 #define ARP_QUEUE_MAGIC	0x0432447A	/* magic # for queues		*/
 
 
@@ -41,6 +45,14 @@ struct arp_table {
   unsigned char			ha[MAX_ADDR_LEN];
   unsigned char			hlen;
   unsigned char			htype;
+  unsigned char			tries;		/* requests sent, 0 if none due	*/
+  unsigned char			qlen;
+  volatile unsigned int		seq;		/* bumped when ha changes	*/
+  unsigned long			confirmed;	/* last heard from the host	*/
+  struct device			*dev;
+  struct timer_list		timer;
+  struct sk_buff *volatile	queue;		/* waiting for the reply	*/
+  struct arp_table		*dead;		/* to be freed by arp_reap()	*/
 };
 
 
@@ -134,6 +134,7 @@ static struct packet_type ip_packet_type = {
 
 struct packet_type *ptype_base = &ip_packet_type;
 static struct sk_buff *volatile backlog = NULL;
+static volatile int backlog_len = 0;
 static unsigned long ip_bcast = 0;
 
 
@@ -397,7 +398,6 @@ int
 dev_close(struct device *dev)
 {
   if (dev->flags != 0) {
-  	int ct=0;
 	dev->flags = 0;
 	if (dev->stop) 
 		dev->stop(dev);
@@ -407,14 +407,7 @@ dev_close(struct device *dev)
 	dev->pa_brdaddr = 0;
 	dev->pa_mask = 0;
 	/* Purge any queued packets when we down the link */
-	while(ct<DEV_NUMBUFFS)
-	{
-		struct sk_buff *skb;
-		while((skb=skb_dequeue(&dev->buffs[ct]))!=NULL)
-			if(skb->free)
-				kfree_skb(skb,FREE_WRITE);
-		ct++;
-	}
+	qdisc_reset(dev);
   }
 
   return(0);
@@ -460,19 +453,13 @@ dev_queue_xmit(struct sk_buff *skb, struct device *dev, int pri)
 	return;
   }
 
-  /* Put skb into a bidirectional circular linked list. */
-  DPRINTF((DBG_DEV, "dev_queue_xmit dev->buffs[%d]=%X\n",
-					pri, dev->buffs[pri]));
-
-  /* Interrupts should already be cleared by hard_start_xmit. */
-  cli();
-  skb->magic = DEV_QUEUE_MAGIC;
+  /* Leave it to the queueing discipline of the device. */
+  DPRINTF((DBG_DEV, "dev_queue_xmit: queueing on %s (%s), pri %d\n",
+					dev->name, qdisc_name(dev), pri));
   if(where)
-  	skb_queue_head(&dev->buffs[pri],skb);
+  	qdisc_requeue(skb, dev, pri);
   else
-  	skb_queue_tail(&dev->buffs[pri],skb);
-  skb->magic = DEV_QUEUE_MAGIC;
-  sti();
+  	qdisc_enqueue(skb, dev, pri);
 }
 
 /*
@@ -482,13 +469,31 @@ dev_queue_xmit(struct sk_buff *skb, struct device *dev, int pri)
 void
 netif_rx(struct sk_buff *skb)
 {
+  struct device *dev = skb->dev;
+  unsigned long flags;
+
   /* Set any necessary flags. */
   skb->sk = NULL;
   skb->free = 1;
   
-  /* and add it to the "backlog" queue. */
+  /* Drop it if the bottom half is that far behind already. */
   IS_SKB(skb);
+  save_flags(flags);
+  cli();
+  if (backlog_len >= MAX_BACKLOG) {
+	dev->rx_backlog_drops++;
+	restore_flags(flags);
+	kfree_skb(skb, FREE_READ);
+	mark_bh(INET_BH);
+	return;
+  }
+  backlog_len++;
+  if (++dev->rx_backlog > dev->rx_backlog_max)
+	dev->rx_backlog_max = dev->rx_backlog;
+
+  /* and add it to the "backlog" queue. */
   skb_queue_tail(&backlog,skb);
+  restore_flags(flags);
    
   /* If any packet arrived, mark it for processing. */
   if (backlog != NULL) mark_bh(INET_BH);
@@ -584,59 +589,24 @@ int in_inet_bh()	/* Used by timer.c */
 }
 
 /*
- * This function gets called periodically, to see if we can
- * process any data that came in from some interface.
- *
+ * Hand one packet to every protocol that wants its type. 'first' is
+ * the first packet_type that can match, found once for a whole run of
+ * packets of the same type.
  */
-void
-inet_bh(void *tmp)
+static void
+inet_deliver(struct sk_buff *skb, unsigned short type, struct packet_type *first)
 {
-  struct sk_buff *skb;
   struct packet_type *ptype;
-  unsigned short type;
   unsigned char flag = 0;
   int nitcount;
 
-  /* Atomically check and mark our BUSY state. */
-  if (set_bit(1, (void*)&in_bh))
-      return;
-
-  /* Can we send anything now? */
-  dev_transmit();
-  
-  /* Any data left to process? */
-  while((skb=skb_dequeue(&backlog))!=NULL)
-  {
-  	nitcount=dev_nit;
-	flag=0;
-	sti();
-       /*
-	* Bump the pointer to the next structure.
-	* This assumes that the basic 'skb' pointer points to
-	* the MAC header, if any (as indicated by its "length"
-	* field).  Take care now!
-	*/
-       skb->h.raw = skb->data + skb->dev->hard_header_len;
-       skb->len -= skb->dev->hard_header_len;
-
-       /*
-	* Fetch the packet protocol ID.  This is also quite ugly, as
-	* it depends on the protocol driver (the interface itself) to
-	* know what the type is, or where to get it from.  The Ethernet
-	* interfaces fetch the ID from the two bytes in the Ethernet MAC
-	* header (the h_proto field in struct ethhdr), but drivers like
-	* SLIP and PLIP have no alternative but to force the type to be
-	* IP or something like that.  Sigh- FvK
-	*/
-       type = skb->dev->type_trans(skb, skb->dev);
-
+  nitcount=dev_nit;
 	/*
-	 * We got a packet ID.  Now loop over the "known protocols"
-	 * table (which is actually a linked list, but this will
-	 * change soon if I get my way- FvK), and forward the packet
-	 * to anyone who wants it.
+	 * Loop over the "known protocols" table (which is actually a
+	 * linked list, but this will change soon if I get my way- FvK),
+	 * and forward the packet to anyone who wants it.
 	 */
-	for (ptype = ptype_base; ptype != NULL; ptype = ptype->next) {
+	for (ptype = first; ptype != NULL; ptype = ptype->next) {
 		if (ptype->type == type || ptype->type == NET16(ETH_P_ALL)) {
 			struct sk_buff *skb2;
 
@@ -679,13 +649,114 @@ inet_bh(void *tmp)
 		skb->sk = NULL;
 		kfree_skb(skb, FREE_WRITE);
 	}
+}
+
+
+static inline void
+count_batch(struct device *dev, int n)
+{
+  int i;
+
+  if (!n)
+	return;
+  for (i = 0; n > 1 && i < NR_RX_BATCH - 1; i++)
+	n >>= 1;
+  dev->rx_batch[i]++;
+}
+
 
-	/* Again, see if we can transmit anything now. */
-	dev_transmit();
-	cli();
+/*
+ * This function gets called periodically, to see if we can
+ * process any data that came in from some interface.
+ *
+ * The backlog is taken off in batches of at most INET_BH_QUOTA
+ * packets, with interrupts off only once per batch. Consecutive
+ * packets of one type share the protocol table lookup, and the
+ * interfaces get a chance to transmit after each batch rather than
+ * after every packet. If there is more than one batch waiting we
+ * leave the rest for the next run, so that a flood can't keep us
+ * here forever.
+ */
+void
+inet_bh(void *tmp)
+{
+  struct sk_buff *batch[INET_BH_QUOTA];
+  struct device *devs[INET_BH_QUOTA];
+  unsigned short types[INET_BH_QUOTA];
+  struct sk_buff *skb;
+  struct packet_type *ptype;
+  struct device *dev;
+  int n, i, j, run;
+
+  /* Atomically check and mark our BUSY state. */
+  if (set_bit(1, (void*)&in_bh))
+      return;
+
+  /* Refill the skb pools before the drivers need them again. */
+  skb_pool_refill();
+
+  /* Can we send anything now? */
+  dev_transmit();
+  
+  /* Any data left to process? */
+  cli();
+  for (n = 0; n < INET_BH_QUOTA; n++) {
+	if ((skb = skb_dequeue(&backlog)) == NULL)
+		break;
+	backlog_len--;
+	skb->dev->rx_backlog--;
+	batch[n] = skb;
+	devs[n] = skb->dev;
   }
-  in_bh = 0;
+  if (backlog != NULL)
+	mark_bh(INET_BH);
   sti();
+
+  for (i = 0; i < n; i++) {
+	skb = batch[i];
+       /*
+	* Bump the pointer to the next structure.
+	* This assumes that the basic 'skb' pointer points to
+	* the MAC header, if any (as indicated by its "length"
+	* field).  Take care now!
+	*/
+       skb->h.raw = skb->data + skb->dev->hard_header_len;
+       skb->len -= skb->dev->hard_header_len;
+
+       /*
+	* Fetch the packet protocol ID.  This is also quite ugly, as
+	* it depends on the protocol driver (the interface itself) to
+	* know what the type is, or where to get it from.  The Ethernet
+	* interfaces fetch the ID from the two bytes in the Ethernet MAC
+	* header (the h_proto field in struct ethhdr), but drivers like
+	* SLIP and PLIP have no alternative but to force the type to be
+	* IP or something like that.  Sigh- FvK
+	*/
+       types[i] = skb->dev->type_trans(skb, skb->dev);
+  }
+
+  for (i = 0; i < n; i = j) {
+	for (ptype = ptype_base; ptype != NULL; ptype = ptype->next)
+		if (ptype->type == types[i] || ptype->type == NET16(ETH_P_ALL))
+			break;
+	for (j = i; j < n && types[j] == types[i]; j++)
+		inet_deliver(batch[j], types[i], ptype);
+  }
+
+  /* Per device batch sizes; there are only ever a few devices. */
+  for (i = 0; i < n; i++) {
+	if ((dev = devs[i]) == NULL)
+		continue;
+	for (run = 0, j = i; j < n; j++) {
+		if (devs[j] == dev) {
+			devs[j] = NULL;
+			run++;
+		}
+	}
+	count_batch(dev, run);
+  }
+
+  in_bh = 0;
   dev_transmit();
 }
 
@@ -697,19 +768,17 @@ inet_bh(void *tmp)
  
 void dev_tint(struct device *dev)
 {
-	int i;
+	int pri;
 	struct sk_buff *skb;
 	
-	for(i = 0;i < DEV_NUMBUFFS; i++) {
-		while((skb=skb_dequeue(&dev->buffs[i]))!=NULL)
-		{
-			skb->magic = 0;
-			skb->next = NULL;
-			skb->prev = NULL;
-			dev->queue_xmit(skb,dev,-i - 1);
-			if (dev->tbusy)
-				return;
-		}
+	while((skb=qdisc_dequeue(dev, &pri))!=NULL)
+	{
+		skb->magic = 0;
+		skb->next = NULL;
+		skb->prev = NULL;
+		dev->queue_xmit(skb,dev,-pri - 1);
+		if (dev->tbusy)
+			return;
 	}
 }
 
@@ -763,7 +832,7 @@ char *sprintf_stats(char *buffer, struct device *dev)
   struct enet_statistics *stats = (dev->get_stats ? dev->get_stats(dev): NULL);
 
   if (stats)
-    pos += sprintf(pos, "%6s:%7d %4d %4d %4d %4d %8d %4d %4d %4d %5d %4d\n",
+    pos += sprintf(pos, "%6s:%7d %4d %4d %4d %4d %8d %4d %4d %4d %5d %4d",
 		   dev->name,
 		   stats->rx_packets, stats->rx_errors,
 		   stats->rx_dropped + stats->rx_missed_errors,
@@ -775,7 +844,9 @@ char *sprintf_stats(char *buffer, struct device *dev)
 		   stats->tx_carrier_errors + stats->tx_aborted_errors
 		   + stats->tx_window_errors + stats->tx_heartbeat_errors);
   else
-      pos += sprintf(pos, "%6s: No statistics available.\n", dev->name);
+      pos += sprintf(pos, "%6s: No statistics available.", dev->name);
+  pos += sprintf(pos, " %6s %4lu %6lu %5lu\n", qdisc_name(dev),
+		 dev->tx_queue_len, dev->tx_queue_bytes, dev->tx_queue_drops);
 
   return pos;
 }
@@ -789,14 +860,34 @@ dev_get_info(char *buffer)
 
   pos +=
       sprintf(pos,
-	      "Inter-|   Receive                  |  Transmit\n"
-	      " face |packets errs drop fifo frame|packets errs drop fifo colls carrier\n");
+	      "Inter-|   Receive                  |  Transmit                               |  Queue\n"
+	      " face |packets errs drop fifo frame|packets errs drop fifo colls carrier  qdisc  len  bytes drops\n");
   for (dev = dev_base; dev != NULL; dev = dev->next) {
       pos = sprintf_stats(pos, dev);
   }
   return pos - buffer;
 }
 
+
+/* Called from the PROCfs module. */
+int
+dev_backlog_get_info(char *buffer)
+{
+  char *pos = buffer;
+  struct device *dev;
+  int i;
+
+  pos += sprintf(pos, "Iface  queued    max  drops |   batch:   1   2-3   4-7  8-15 16-31 32-63   64\n");
+  for (dev = dev_base; dev != NULL; dev = dev->next) {
+	pos += sprintf(pos, "%6s %6lu %6lu %6lu |       ", dev->name,
+		dev->rx_backlog, dev->rx_backlog_max, dev->rx_backlog_drops);
+	for (i = 0; i < NR_RX_BATCH; i++)
+		pos += sprintf(pos, " %5lu", dev->rx_batch[i]);
+	pos += sprintf(pos, "\n");
+  }
+  return pos - buffer;
+}
+
 static inline int bad_mask(unsigned long mask, unsigned long addr)
 {
 	if (addr & (mask = ~mask))
@@ -812,7 +903,7 @@ static inline int bad_mask(unsigned long mask, unsigned long addr)
 static int
 dev_ifsioc(void *arg, unsigned int getset)
 {
-  struct ifreq ifr;
+  struct ifreq ifr = { { { 0, } }, };	/* memcpy_fromfs() hides the fill */
   struct device *dev;
   int ret;
 
@@ -870,6 +961,7 @@ dev_ifsioc(void *arg, unsigned int getset)
 		dev->family = ifr.ifr_addr.sa_family;
 		dev->pa_mask = get_mask(dev->pa_addr);
 		dev->pa_brdaddr = dev->pa_addr | ~dev->pa_mask;
+		rt_cache_flush();
 		ret = 0;
 		break;
 	case SIOCGIFBRDADDR:
@@ -885,6 +977,7 @@ dev_ifsioc(void *arg, unsigned int getset)
 	case SIOCSIFBRDADDR:
 		dev->pa_brdaddr = (*(struct sockaddr_in *)
 				    &ifr.ifr_broadaddr).sin_addr.s_addr;
+		rt_cache_flush();
 		ret = 0;
 		break;
 	case SIOCGIFDSTADDR:
@@ -938,8 +1031,17 @@ dev_ifsioc(void *arg, unsigned int getset)
 		break;
 	case SIOCSIFMTU:
 		dev->mtu = ifr.ifr_mtu;
+		dev->tx_queue_limit = 0;	/* follows the MTU */
 		ret = 0;
 		break;
+	case SIOCGIFQDISC:
+		ifr.ifr_qdisc = qdisc_get(dev);
+		memcpy_tofs(arg, &ifr, sizeof(struct ifreq));
+		ret = 0;
+		break;
+	case SIOCSIFQDISC:
+		ret = qdisc_set(dev, ifr.ifr_qdisc);
+		break;
 	case SIOCGIFMEM:
 		printk("NET: ioctl(SIOCGIFMEM, 0x%08X)\n", (int)arg);
 		ret = -EINVAL;
@@ -985,6 +1087,7 @@ dev_ioctl(unsigned int cmd, void *arg)
 	case SIOCGIFMTU:
 	case SIOCGIFMEM:
 	case SIOCGIFHWADDR:
+	case SIOCGIFQDISC:
 		return dev_ifsioc(arg, cmd);
 
 	case SIOCSIFFLAGS:
@@ -995,6 +1098,7 @@ dev_ioctl(unsigned int cmd, void *arg)
 	case SIOCSIFMETRIC:
 	case SIOCSIFMTU:
 	case SIOCSIFMEM:
+	case SIOCSIFQDISC:
 		if (!suser())
 			return -EPERM;
 		return dev_ifsioc(arg, cmd);
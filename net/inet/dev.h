@@ -28,6 +28,7 @@
 #define DEV_NUMBUFFS	3
 #define MAX_ADDR_LEN	7
 #define MAX_HEADER	18
+#define NR_RX_BATCH	7	/* 1, 2-3, 4-7, ... 64 packets per bh run */
 
 #define IS_MYADDR	1		/* address is (one of) our own	*/
 #define IS_LOOPBACK	2		/* address is for LOOPBACK	*/
@@ -137,6 +138,20 @@ struct device {
   					 int num_addrs, void *addrs);
 #define HAVE_SET_MAC_ADDR  		 
   int			  (*set_mac_address)(struct device *dev, void *addr);
+
+  /* Receive backlog statistics, see netif_rx() and inet_bh(). */
+  unsigned long		  rx_backlog;		/* packets waiting now	*/
+  unsigned long		  rx_backlog_max;
+  unsigned long		  rx_backlog_drops;
+  unsigned long		  rx_batch[NR_RX_BATCH];	/* packets per run, log2 */
+
+  /* Transmit queue, see sched.c. No discipline means bfifo. */
+  struct qdisc_ops	  *qdisc;
+  void			  *qdisc_data;
+  unsigned long		  tx_queue_len;		/* packets		*/
+  unsigned long		  tx_queue_bytes;
+  unsigned long		  tx_queue_limit;	/* bytes, 0 = default	*/
+  unsigned long		  tx_queue_drops;
 };
 
 
@@ -153,6 +168,27 @@ struct packet_type {
 };
 
 
+/* Transmit queueing disciplines, see sched.c */
+struct qdisc_ops {
+  char			*name;
+  void			*(*alloc)(void);
+  void			(*release)(void *data);
+  struct sk_buff	*(*enqueue)(struct sk_buff *skb, struct device *dev,
+				    int pri);
+  void			(*requeue)(struct sk_buff *skb, struct device *dev,
+				   int pri);
+  struct sk_buff	*(*dequeue)(struct device *dev, int *pri);
+  void			(*unlink)(struct sk_buff *skb, struct device *dev);
+};
+
+#define QDISC_BFIFO	0
+#define QDISC_SFQ	1
+#define NR_QDISCS	2
+
+/* Bottom half receive limits, see inet_bh() */
+#define MAX_BACKLOG	300	/* packets queued by netif_rx()		*/
+#define INET_BH_QUOTA	64	/* packets handled per inet_bh() run	*/
+
 /* Used by dev_rint */
 #define IN_SKBUFF	1
 #define DEV_QUEUE_MAGIC	0x17432895
@@ -183,7 +219,18 @@ extern void		dev_transmit(void);
 extern int		in_inet_bh(void);
 extern void		inet_bh(void *tmp);
 extern void		dev_tint(struct device *dev);
+extern void		qdisc_enqueue(struct sk_buff *skb, struct device *dev,
+				      int pri);
+extern void		qdisc_requeue(struct sk_buff *skb, struct device *dev,
+				      int pri);
+extern struct sk_buff	*qdisc_dequeue(struct device *dev, int *pri);
+extern void		qdisc_unlink(struct sk_buff *skb);
+extern void		qdisc_reset(struct device *dev);
+extern int		qdisc_set(struct device *dev, int which);
+extern int		qdisc_get(struct device *dev);
+extern char		*qdisc_name(struct device *dev);
 extern int		dev_get_info(char *buffer);
+extern int		dev_backlog_get_info(char *buffer);
 extern int		dev_ioctl(unsigned int cmd, void *);
 
 extern void		dev_init(void);
@@ -459,49 +459,141 @@ ip_fast_csum(unsigned char * buff, int wlen)
 }
 
 /*
- * This routine does all the checksum computations that don't
- * require anything special (like copying or special headers).
+ * Checksum primitives. These return the 32-bit one's complement sum of
+ * the data, not folded to 16 bits, so that sums over pieces of a packet
+ * can be added up (see csum_block_add() in ip.h) and folded once at the
+ * end with csum_fold(). The copying versions checksum user data while
+ * they move it, so that the data is only touched once.
  */
-unsigned short
-ip_compute_csum(unsigned char * buff, int len)
+static inline unsigned long csum_add(unsigned long sum, unsigned long x)
+{
+  sum += x;
+  return sum + (sum < x);
+}
+
+unsigned long
+csum_partial(const unsigned char * buff, int len, unsigned long sum)
 {
-  unsigned long sum = 0;
+  int n = len >> 2;
+  unsigned long bogus;
 
-  /* Do the first multiple of 4 bytes and convert to 16 bits. */
-  if (len > 3) {
+  if (n) {
 	__asm__("clc\n"
-	        "1:\t"
-	    	"lodsl\n\t"
-	    	"adcl %%eax, %%ebx\n\t"
-	    	"loop 1b\n\t"
-	    	"adcl $0, %%ebx\n\t"
-	    	"movl %%ebx, %%eax\n\t"
-	    	"shrl $16, %%eax\n\t"
-	    	"addw %%ax, %%bx\n\t"
-	    	"adcw $0, %%bx"
-	        : "=b" (sum) , "=S" (buff)
-	        : "0" (sum), "c" (len >> 2) ,"1" (buff)
-	        : "ax", "cx", "si", "bx" );
+		"1:\t"
+		"lodsl\n\t"
+		"adcl %%eax, %0\n\t"
+		"decl %2\n\t"
+		"jne 1b\n\t"
+		"adcl $0, %0"
+		: "=r" (sum), "=S" (buff), "=r" (n), "=&a" (bogus)
+		: "0" (sum), "1" (buff), "2" (n)
+		: "memory");
+  }
+  if (len & 2) {
+	sum = csum_add(sum, *(const unsigned short *) buff);
+	buff += 2;
+  }
+  if (len & 1)
+	sum = csum_add(sum, *buff);
+  return(sum);
+}
+
+/* Copy from user space and checksum. */
+unsigned long
+csum_partial_copy_fromfs(const char * src, char * dst, int len, unsigned long sum)
+{
+  int n = len >> 2;
+  unsigned long bogus;
+
+  if (n) {
+	__asm__ __volatile__("clc\n"
+		"1:\t"
+		"fs ; lodsl\n\t"
+		"stosl\n\t"
+		"adcl %%eax, %0\n\t"
+		"decl %3\n\t"
+		"jne 1b\n\t"
+		"adcl $0, %0"
+		: "=r" (sum), "=S" (src), "=D" (dst), "=r" (n), "=&a" (bogus)
+		: "0" (sum), "1" (src), "2" (dst), "3" (n)
+		: "memory");
+  }
+  if (len & 2) {
+	unsigned short w = get_user_word((const short *) src);
+
+	*(unsigned short *) dst = w;
+	sum = csum_add(sum, w);
+	src += 2;
+	dst += 2;
+  }
+  if (len & 1) {
+	unsigned char c = get_user_byte(src);
+
+	*dst = c;
+	sum = csum_add(sum, c);
+  }
+  return(sum);
+}
+
+/* Copy to user space and checksum. */
+unsigned long
+csum_partial_copy_tofs(const char * src, char * dst, int len, unsigned long sum)
+{
+  int n = len >> 2;
+  unsigned long bogus;
+
+  if (n) {
+	__asm__ __volatile__("push %%es\n\t"
+		"push %%fs\n\t"
+		"pop %%es\n\t"
+		"clc\n"
+		"1:\t"
+		"lodsl\n\t"
+		"stosl\n\t"
+		"adcl %%eax, %0\n\t"
+		"decl %3\n\t"
+		"jne 1b\n\t"
+		"adcl $0, %0\n\t"
+		"pop %%es"
+		: "=r" (sum), "=S" (src), "=D" (dst), "=r" (n), "=&a" (bogus)
+		: "0" (sum), "1" (src), "2" (dst), "3" (n)
+		: "memory");
   }
   if (len & 2) {
-	__asm__("lodsw\n\t"
-	    	"addw %%ax, %%bx\n\t"
-	    	"adcw $0, %%bx"
-	        : "=b" (sum), "=S" (buff)
-	        : "0" (sum), "1" (buff)
-	        : "bx", "ax", "si");
+	unsigned short w = *(const unsigned short *) src;
+
+	put_user_word(w, (short *) dst);
+	sum = csum_add(sum, w);
+	src += 2;
+	dst += 2;
   }
   if (len & 1) {
-	__asm__("lodsb\n\t"
-	    	"movb $0, %%ah\n\t"
-	    	"addw %%ax, %%bx\n\t"
-	    	"adcw $0, %%bx"
-	        : "=b" (sum), "=S" (buff)
-	        : "0" (sum), "1" (buff)
-	        : "bx", "ax", "si");
+	unsigned char c = *src;
+
+	put_user_byte(c, dst);
+	sum = csum_add(sum, c);
   }
-  sum =~sum;
-  return(sum & 0xffff);
+  return(sum);
+}
+
+/* Add the TCP/UDP pseudo header to a partial sum. */
+unsigned long
+csum_tcpudp_nofold(unsigned long saddr, unsigned long daddr, int len,
+		   int proto, unsigned long sum)
+{
+  sum = csum_add(sum, saddr);
+  sum = csum_add(sum, daddr);
+  return(csum_add(sum, ((unsigned long) ntohs(len) << 16) + proto * 256));
+}
+
+/*
+ * This routine does all the checksum computations that don't
+ * require anything special (like copying or special headers).
+ */
+unsigned short
+ip_compute_csum(unsigned char * buff, int len)
+{
+  return(csum_fold(csum_partial(buff, len, 0)));
 }
 
 /* Check the header of an incoming IP datagram.  This version is still used in slhc.c. */
@@ -705,6 +797,7 @@ static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct devi
 /*  	printk("Protocol = %d\n",qp->iph->protocol);*/
 	
   	/* Start a timer for this entry. */
+  	init_timer(&qp->timer);
   	qp->timer.expires = IP_FRAG_TIME;		/* about 30 seconds	*/
   	qp->timer.data = (unsigned long) qp;		/* pointer to queue	*/
   	qp->timer.function = ip_expire;			/* expire function	*/
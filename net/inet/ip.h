@@ -59,6 +59,28 @@ struct ipq	 {
 };
 
 
+/* Fold a 32-bit partial checksum (see ip.c) into the final 16 bits. */
+static inline unsigned short csum_fold(unsigned long sum)
+{
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return (~sum) & 0xffff;
+}
+
+/* Add the partial sum of a block that starts 'offset' bytes in. */
+static inline unsigned long csum_block_add(unsigned long sum,
+					   unsigned long sum2, int offset)
+{
+  if (offset & 1)
+	sum2 = ((sum2 & 0xFF00FF) << 8) + ((sum2 >> 8) & 0xFF00FF);
+  sum += sum2;
+  return sum + (sum < sum2);
+}
+
+#define csum_tcpudp_magic(saddr,daddr,len,proto,sum) \
+	csum_fold(csum_tcpudp_nofold(saddr,daddr,len,proto,sum))
+
+
 extern int		backoff(int n);
 
 extern void		ip_print(struct iphdr *ip);
@@ -72,6 +94,15 @@ extern int		ip_build_header(struct sk_buff *skb,
 					struct options *opt, int len,
 					int tos,int ttl);
 extern unsigned short	ip_compute_csum(unsigned char * buff, int len);
+extern unsigned long	csum_partial(const unsigned char * buff, int len,
+				     unsigned long sum);
+extern unsigned long	csum_partial_copy_fromfs(const char * src, char * dst,
+				     int len, unsigned long sum);
+extern unsigned long	csum_partial_copy_tofs(const char * src, char * dst,
+				     int len, unsigned long sum);
+extern unsigned long	csum_tcpudp_nofold(unsigned long saddr,
+				     unsigned long daddr, int len, int proto,
+				     unsigned long sum);
 extern int		ip_rcv(struct sk_buff *skb, struct device *dev,
 			       struct packet_type *pt);
 extern void		ip_queue_xmit(struct sock *sk,
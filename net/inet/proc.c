@@ -131,3 +131,52 @@ int raw_get_info(char *buffer)
 {
   return get__netinfo(&raw_prot, buffer,1);
 }
+
+
+/*
+ * Lookup statistics and chain lengths of the get_sock() tables.
+ */
+static char *
+get__hashinfo(struct proto *pro, char *pos)
+{
+  struct sock *sp;
+  int i, n, socks, used, max;
+
+  pos+=sprintf(pos, "%-4s %10lu %10lu %10lu %10lu", pro->name,
+	pro->lookups, pro->cache_hits, pro->ehash_hits, pro->lhash_hits);
+  socks = used = max = 0;
+  cli();
+  for(i = 0; i < SOCK_EHASH_SIZE; i++) {
+	for(n = 0, sp = pro->sock_ehash[i]; sp != NULL; sp = sp->lookup_next)
+		n++;
+	socks += n;
+	if (n) used++;
+	if (n > max) max = n;
+  }
+  sti();
+  pos+=sprintf(pos, " %6d %4d/%d %4d", socks, used, SOCK_EHASH_SIZE, max);
+  socks = used = max = 0;
+  cli();
+  for(i = 0; i < SOCK_ARRAY_SIZE; i++) {
+	for(n = 0, sp = pro->sock_lhash[i]; sp != NULL; sp = sp->lookup_next)
+		n++;
+	socks += n;
+	if (n) used++;
+	if (n > max) max = n;
+  }
+  sti();
+  pos+=sprintf(pos, " %6d %4d/%d %4d\n", socks, used, SOCK_ARRAY_SIZE, max);
+  return pos;
+}
+
+
+int sock_hash_get_info(char *buffer)
+{
+  char *pos = buffer;
+
+  pos+=sprintf(pos, "prot    lookups      cache       conn     listen"
+		    "  conns  buckets  max  bound  buckets  max\n");
+  pos = get__hashinfo(&tcp_prot, pos);
+  pos = get__hashinfo(&udp_prot, pos);
+  return(pos - buffer);
+}
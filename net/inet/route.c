@@ -16,6 +16,7 @@
  *		Rui Oliveira	:	ICMP routing table updates
  *		(rco@di.uminho.pt)	Routing table insertion and update
  *		Linus Torvalds	:	Rewrote bits to be sensible
+ *					Prefix trie and destination cache
  *
  *		This program is free software; you can redistribute it and/or
  *		modify it under the terms of the GNU General Public License
@@ -47,6 +48,216 @@
 static struct rtable *rt_base = NULL;
 static struct rtable *rt_loopback = NULL;
 
+/*
+ * rt_base is kept sorted most specific mask first, as before, for
+ * /proc and the odd broadcast lookup. rt_route() finds routes in a
+ * path compressed binary trie instead, keyed on the destination in
+ * host order: every node tests the prefix of 'bits' bits in 'key' and
+ * branches on the bit after it. Nodes without a route only join two
+ * subtrees. In front of that is a direct mapped cache of recent
+ * destinations, which is cleared whenever a route or an interface
+ * address changes.
+ */
+struct rt_node {
+  struct rt_node	*rn_child[2];
+  struct rtable		*rn_route;
+  unsigned long		rn_key;
+  unsigned char		rn_bits;
+};
+
+#define RT_CACHE_SIZE	256
+
+struct rt_cache_entry {
+  unsigned long		rc_daddr;
+  struct rtable		*rc_route;
+};
+
+static struct rt_node *rt_trie = NULL;
+static struct rt_cache_entry rt_cache[RT_CACHE_SIZE];
+static unsigned long rt_cache_hits = 0;
+static unsigned long rt_cache_misses = 0;
+static unsigned long rt_cache_flushes = 0;
+
+#define RT_BIT(key, n)	(((key) >> (31 - (n))) & 1)
+
+static inline unsigned long rt_prefix(int bits)
+{
+	return bits ? ~0UL << (32 - bits) : 0;
+}
+
+static inline int rt_mask_bits(unsigned long mask)
+{
+	int bits = 0;
+
+	mask = ntohl(mask);
+	while (bits < 32 && (mask & 0x80000000)) {
+		mask <<= 1;
+		bits++;
+	}
+	return bits;
+}
+
+static inline int rt_cache_hash(unsigned long daddr)
+{
+	daddr ^= daddr >> 16;
+	daddr ^= daddr >> 8;
+	return daddr & (RT_CACHE_SIZE - 1);
+}
+
+/*
+ * Forget all cached destinations. Everything that changes the
+ * routing table or an address rt_route() looks at has to call this.
+ */
+void rt_cache_flush(void)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	memset(rt_cache, 0, sizeof(rt_cache));
+	rt_cache_flushes++;
+	restore_flags(flags);
+}
+
+/*
+ * Longest prefix match, destination in host order.
+ */
+static struct rtable *rt_trie_lookup(unsigned long key)
+{
+	struct rt_node *n = rt_trie;
+	struct rtable *best = NULL;
+
+	while (n != NULL) {
+		if ((key ^ n->rn_key) & rt_prefix(n->rn_bits))
+			break;
+		if (n->rn_route)
+			best = n->rn_route;
+		if (n->rn_bits == 32)
+			break;
+		n = n->rn_child[RT_BIT(key, n->rn_bits)];
+	}
+	return best;
+}
+
+/*
+ * Insert a route. The caller hands in two spare nodes, since we
+ * can't fail half way with interrupts off; whatever is not used is
+ * left in the spare pointers. Call with interrupts off.
+ */
+static void rt_trie_insert(struct rtable *rt, struct rt_node **spare1,
+	struct rt_node **spare2)
+{
+	struct rt_node **np, *n, *new, *glue;
+	unsigned long key, diff;
+	int bits, common;
+
+	key = ntohl(rt->rt_dst);
+	bits = rt_mask_bits(rt->rt_mask);
+	key &= rt_prefix(bits);
+
+	np = &rt_trie;
+	while ((n = *np) != NULL) {
+		common = n->rn_bits < bits ? n->rn_bits : bits;
+		diff = (key ^ n->rn_key) & rt_prefix(common);
+		if (diff) {
+			common = 0;
+			while (!(diff & 0x80000000)) {
+				diff <<= 1;
+				common++;
+			}
+		}
+		if (common == n->rn_bits) {
+			if (n->rn_bits == bits) {
+				n->rn_route = rt;
+				return;
+			}
+			np = &n->rn_child[RT_BIT(key, n->rn_bits)];
+			continue;
+		}
+		new = *spare1;
+		*spare1 = NULL;
+		new->rn_key = key;
+		new->rn_bits = bits;
+		new->rn_route = rt;
+		new->rn_child[0] = new->rn_child[1] = NULL;
+		if (common == bits) {
+			/* The new prefix covers n */
+			new->rn_child[RT_BIT(n->rn_key, bits)] = n;
+			*np = new;
+			return;
+		}
+		glue = *spare2;
+		*spare2 = NULL;
+		glue->rn_key = key & rt_prefix(common);
+		glue->rn_bits = common;
+		glue->rn_route = NULL;
+		glue->rn_child[RT_BIT(key, common)] = new;
+		glue->rn_child[RT_BIT(n->rn_key, common)] = n;
+		*np = glue;
+		return;
+	}
+	new = *spare1;
+	*spare1 = NULL;
+	new->rn_key = key;
+	new->rn_bits = bits;
+	new->rn_route = rt;
+	new->rn_child[0] = new->rn_child[1] = NULL;
+	*np = new;
+}
+
+/*
+ * Take a route out of the trie, and any nodes that no longer do
+ * anything on the way back up. Call with interrupts off.
+ */
+static void rt_trie_delete(struct rtable *rt)
+{
+	struct rt_node **path[33], **np, *n;
+	unsigned long key;
+	int bits, depth = 0;
+
+	key = ntohl(rt->rt_dst);
+	bits = rt_mask_bits(rt->rt_mask);
+	key &= rt_prefix(bits);
+
+	np = &rt_trie;
+	while ((n = *np) != NULL) {
+		if ((key ^ n->rn_key) & rt_prefix(n->rn_bits) || n->rn_bits > bits)
+			return;
+		path[depth++] = np;
+		if (n->rn_bits == bits)
+			break;
+		np = &n->rn_child[RT_BIT(key, n->rn_bits)];
+	}
+	if (n == NULL || n->rn_route != rt)
+		return;
+	n->rn_route = NULL;
+	while (depth-- > 0) {
+		np = path[depth];
+		n = *np;
+		if (n->rn_route)
+			break;
+		if (n->rn_child[0] && n->rn_child[1])
+			break;
+		*np = n->rn_child[0] ? n->rn_child[0] : n->rn_child[1];
+		kfree_s(n, sizeof(struct rt_node));
+	}
+}
+
+/*
+ * Unlink a route from rt_base and the trie and free it. Call with
+ * interrupts off.
+ */
+static void rt_free(struct rtable **rp)
+{
+	struct rtable *r = *rp;
+
+	*rp = r->rt_next;
+	rt_trie_delete(r);
+	if (rt_loopback == r)
+		rt_loopback = NULL;
+	kfree_s(r, sizeof(struct rtable));
+}
+
 /* Dump the contents of a routing table entry. */
 static void
 rt_print(struct rtable *rt)
@@ -80,11 +291,9 @@ static void rt_del(unsigned long dst)
 			rp = &r->rt_next;
 			continue;
 		}
-		*rp = r->rt_next;
-		if (rt_loopback == r)
-			rt_loopback = NULL;
-		kfree_s(r, sizeof(struct rtable));
+		rt_free(rp);
 	} 
+	rt_cache_flush();
 	restore_flags(flags);
 }
 
@@ -107,11 +316,9 @@ void rt_flush(struct device *dev)
 			rp = &r->rt_next;
 			continue;
 		}
-		*rp = r->rt_next;
-		if (rt_loopback == r)
-			rt_loopback = NULL;
-		kfree_s(r, sizeof(struct rtable));
+		rt_free(rp);
 	} 
+	rt_cache_flush();
 	restore_flags(flags);
 }
 
@@ -148,16 +355,13 @@ static inline struct device * get_gw_dev(unsigned long gw)
 {
 	struct rtable * rt;
 
-	for (rt = rt_base ; ; rt = rt->rt_next) {
-		if (!rt)
-			return NULL;
-		if ((gw ^ rt->rt_dst) & rt->rt_mask)
-			continue;
-		/* gateways behind gateways are a no-no */
-		if (rt->rt_flags & RTF_GATEWAY)
-			return NULL;
-		return rt->rt_dev;
-	}
+	rt = rt_trie_lookup(ntohl(gw));
+	if (!rt)
+		return NULL;
+	/* gateways behind gateways are a no-no */
+	if (rt->rt_flags & RTF_GATEWAY)
+		return NULL;
+	return rt->rt_dev;
 }
 
 /*
@@ -168,6 +372,7 @@ void rt_add(short flags, unsigned long dst, unsigned long mask,
 {
 	struct rtable *r, *rt;
 	struct rtable **rp;
+	struct rt_node *spare1, *spare2;
 	unsigned long cpuflags;
 
 	if (flags & RTF_HOST) {
@@ -199,6 +404,17 @@ void rt_add(short flags, unsigned long dst, unsigned long mask,
 		DPRINTF((DBG_RT, "RT: no memory for new route!\n"));
 		return;
 	}
+	spare1 = (struct rt_node *) kmalloc(sizeof(struct rt_node), GFP_ATOMIC);
+	spare2 = (struct rt_node *) kmalloc(sizeof(struct rt_node), GFP_ATOMIC);
+	if (spare1 == NULL || spare2 == NULL) {
+		DPRINTF((DBG_RT, "RT: no memory for new route!\n"));
+		if (spare1)
+			kfree_s(spare1, sizeof(struct rt_node));
+		if (spare2)
+			kfree_s(spare2, sizeof(struct rt_node));
+		kfree_s(rt, sizeof(struct rtable));
+		return;
+	}
 	memset(rt, 0, sizeof(struct rtable));
 	rt->rt_flags = flags | RTF_UP;
 	rt->rt_dst = dst;
@@ -221,10 +437,7 @@ void rt_add(short flags, unsigned long dst, unsigned long mask,
 			rp = &r->rt_next;
 			continue;
 		}
-		*rp = r->rt_next;
-		if (rt_loopback == r)
-			rt_loopback = NULL;
-		kfree_s(r, sizeof(struct rtable));
+		rt_free(rp);
 	}
 	/* add the new route */
 	rp = &rt_base;
@@ -235,9 +448,15 @@ void rt_add(short flags, unsigned long dst, unsigned long mask,
 	}
 	rt->rt_next = r;
 	*rp = rt;
+	rt_trie_insert(rt, &spare1, &spare2);
 	if (rt->rt_dev->flags & IFF_LOOPBACK)
 		rt_loopback = rt;
+	rt_cache_flush();
 	restore_flags(cpuflags);
+	if (spare1)
+		kfree_s(spare1, sizeof(struct rt_node));
+	if (spare2)
+		kfree_s(spare2, sizeof(struct rt_node));
 	return;
 }
 
@@ -343,6 +562,8 @@ rt_get_info(char *buffer)
 		r->rt_flags, r->rt_refcnt, r->rt_use, r->rt_metric,
 		r->rt_mask);
   }
+  pos += sprintf(pos, "# cache: %lu hits, %lu misses, %lu flushes\n",
+		rt_cache_hits, rt_cache_misses, rt_cache_flushes);
   return(pos - buffer);
 }
 
@@ -351,7 +572,12 @@ rt_get_info(char *buffer)
  */
 #define early_out ({ goto no_route; 1; })
 
-struct rtable * rt_route(unsigned long daddr, struct options *opt)
+/*
+ * A broadcast address of one of our interfaces goes out through the
+ * most specific route on that interface, whatever the prefixes say,
+ * so those still take the slow walk down rt_base.
+ */
+static struct rtable * rt_route_broadcast(unsigned long daddr)
 {
 	struct rtable *rt;
 
@@ -363,16 +589,55 @@ struct rtable * rt_route(unsigned long daddr, struct options *opt)
 		     rt->rt_dev->pa_brdaddr == daddr)
 			break;
 	}
-	if (daddr == rt->rt_dev->pa_addr) {
-		if ((rt = rt_loopback) == NULL)
-			goto no_route;
-	}
-	rt->rt_use++;
 	return rt;
 no_route:
 	return NULL;
 }
 
+static struct rtable * rt_route_slow(unsigned long daddr)
+{
+	struct device *dev;
+	struct rtable *rt;
+
+	for (dev = dev_base; dev != NULL; dev = dev->next) {
+		if ((dev->flags & IFF_BROADCAST) && dev->pa_brdaddr == daddr)
+			break;
+	}
+	if (dev != NULL)
+		rt = rt_route_broadcast(daddr);
+	else
+		rt = rt_trie_lookup(ntohl(daddr));
+	if (rt != NULL && daddr == rt->rt_dev->pa_addr)
+		rt = rt_loopback;
+	return rt;
+}
+
+struct rtable * rt_route(unsigned long daddr, struct options *opt)
+{
+	struct rt_cache_entry *rc;
+	struct rtable *rt;
+	unsigned long flags;
+
+	rc = rt_cache + rt_cache_hash(daddr);
+	save_flags(flags);
+	cli();
+	if (rc->rc_route != NULL && rc->rc_daddr == daddr) {
+		rt = rc->rc_route;
+		rt_cache_hits++;
+	} else {
+		rt_cache_misses++;
+		rt = rt_route_slow(daddr);
+		if (rt != NULL) {
+			rc->rc_daddr = daddr;
+			rc->rc_route = rt;
+		}
+	}
+	if (rt != NULL)
+		rt->rt_use++;
+	restore_flags(flags);
+	return rt;
+}
+
 static int get_old_rtent(struct old_rtentry * src, struct rtentry * rt)
 {
 	int err;
@@ -0,0 +1,458 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Transmit queueing disciplines. dev_queue_xmit() hands a
+ *		packet the driver can't take right now to the discipline of
+ *		the device, and dev_tint() asks the discipline which packet
+ *		to offer the driver next.
+ *
+ *		bfifo	The old behaviour: DEV_NUMBUFFS priority bands served
+ *			strictly in order, but with a limit on the bytes
+ *			queued so that a bulk sender can't build up seconds
+ *			of queue in front of everybody else.
+ *		sfq	Stochastic fair queueing: packets are hashed on their
+ *			flow (addresses, protocol and ports for IP, else the
+ *			sending socket) into a number of queues which are
+ *			served round robin, one packet at a time. When the
+ *			byte limit is hit the longest queue loses a packet.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#include <asm/system.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/malloc.h>
+#include <linux/socket.h>
+#include <linux/in.h>
+#include <linux/errno.h>
+#include <linux/if_ether.h>
+#include "inet.h"
+#include "dev.h"
+#include "ip.h"
+#include "protocol.h"
+#include "tcp.h"
+#include "skbuff.h"
+#include "sock.h"
+
+#define TX_QUEUE_MTUS	32	/* default byte limit, in MTUs	*/
+
+
+/*
+ * bfifo: the priority bands live in dev->buffs[] as they always have.
+ */
+static struct sk_buff *
+bfifo_enqueue(struct sk_buff *skb, struct device *dev, int pri)
+{
+  if (dev->tx_queue_bytes + skb->len > dev->tx_queue_limit)
+	return(skb);
+  skb_queue_tail(&dev->buffs[pri], skb);
+  return(NULL);
+}
+
+
+static void
+bfifo_requeue(struct sk_buff *skb, struct device *dev, int pri)
+{
+  skb_queue_head(&dev->buffs[pri], skb);
+}
+
+
+static struct sk_buff *
+bfifo_dequeue(struct device *dev, int *pri)
+{
+  struct sk_buff *skb;
+  int i;
+
+  for(i = 0; i < DEV_NUMBUFFS; i++) {
+	if ((skb = skb_dequeue(&dev->buffs[i])) != NULL) {
+		*pri = i;
+		return(skb);
+	}
+  }
+  return(NULL);
+}
+
+
+static void
+bfifo_unlink(struct sk_buff *skb, struct device *dev)
+{
+  skb_unlink(skb);
+}
+
+
+static struct qdisc_ops bfifo_qdisc = {
+  "bfifo",
+  NULL,
+  NULL,
+  bfifo_enqueue,
+  bfifo_requeue,
+  bfifo_dequeue,
+  bfifo_unlink
+};
+
+
+/*
+ * sfq: the active queues are kept on a ring through next[]; 'tail'
+ * is the one served last, so next[tail] is served next.
+ */
+#define SFQ_HASH	64
+#define SFQ_EMPTY	(-1)
+
+struct sfq_data {
+  struct sk_buff	*volatile queue[SFQ_HASH];
+  unsigned short	qlen[SFQ_HASH];
+  short			next[SFQ_HASH];
+  short			tail;
+  unsigned long		perturb;
+};
+
+
+static int
+sfq_hash(struct sfq_data *q, struct sk_buff *skb, struct device *dev)
+{
+  struct iphdr *iph;
+  unsigned long h;
+  int hlen = dev->hard_header_len;
+
+  h = (unsigned long) skb->sk;
+  if (skb->len >= hlen + sizeof(struct iphdr) &&
+      (hlen == 0 || (hlen >= ETH_HLEN &&
+       ((struct ethhdr *) skb->data)->h_proto == NET16(ETH_P_IP)))) {
+	iph = (struct iphdr *) (skb->data + hlen);
+	h = iph->saddr ^ iph->daddr ^ iph->protocol;
+	if ((iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP) &&
+	    !(iph->frag_off & htons(IP_OFFSET)) &&
+	    skb->len >= hlen + iph->ihl * 4 + 4)
+		h ^= *(unsigned long *) ((unsigned char *) iph + iph->ihl * 4);
+  }
+  h ^= q->perturb;
+  h ^= h >> 16;
+  h ^= h >> 8;
+  return(h & (SFQ_HASH - 1));
+}
+
+
+/* Put an empty queue on the ring, to be served after all the others. */
+static inline void
+sfq_activate(struct sfq_data *q, int b)
+{
+  if (q->tail == SFQ_EMPTY) {
+	q->next[b] = b;
+  } else {
+	q->next[b] = q->next[q->tail];
+	q->next[q->tail] = b;
+  }
+  q->tail = b;
+}
+
+
+/* Take a queue that just went empty off the ring. */
+static void
+sfq_deactivate(struct sfq_data *q, int b)
+{
+  int prev;
+
+  if (q->next[b] == b) {
+	q->tail = SFQ_EMPTY;
+	return;
+  }
+  for(prev = b; q->next[prev] != b; prev = q->next[prev])
+	;
+  q->next[prev] = q->next[b];
+  if (q->tail == b)
+	q->tail = prev;
+}
+
+
+static struct sk_buff *
+sfq_enqueue(struct sk_buff *skb, struct device *dev, int pri)
+{
+  struct sfq_data *q = (struct sfq_data *) dev->qdisc_data;
+  struct sk_buff *victim;
+  int b, i;
+
+  b = sfq_hash(q, skb, dev);
+  skb_queue_tail(&q->queue[b], skb);
+  if (q->qlen[b]++ == 0)
+	sfq_activate(q, b);
+  if (dev->tx_queue_bytes + skb->len <= dev->tx_queue_limit)
+	return(NULL);
+
+  /* Over the limit: the longest queue pays for it. */
+  for(i = 0; i < SFQ_HASH; i++)
+	if (q->queue[i] != NULL && q->qlen[i] > q->qlen[b])
+		b = i;
+  if (q->queue[b] == NULL)
+	return(NULL);
+  victim = q->queue[b]->prev;
+  skb_unlink(victim);
+  if (--q->qlen[b] == 0)
+	sfq_deactivate(q, b);
+  return(victim);
+}
+
+
+static void
+sfq_requeue(struct sk_buff *skb, struct device *dev, int pri)
+{
+  struct sfq_data *q = (struct sfq_data *) dev->qdisc_data;
+  int b, tail;
+
+  b = sfq_hash(q, skb, dev);
+  skb_queue_head(&q->queue[b], skb);
+  if (q->qlen[b]++ == 0) {
+	/* It was the one being served, so it goes first again. */
+	tail = q->tail;
+	sfq_activate(q, b);
+	if (tail != SFQ_EMPTY)
+		q->tail = tail;
+  }
+}
+
+
+static struct sk_buff *
+sfq_dequeue(struct device *dev, int *pri)
+{
+  struct sfq_data *q = (struct sfq_data *) dev->qdisc_data;
+  struct sk_buff *skb;
+  int b;
+
+  if (q->tail == SFQ_EMPTY)
+	return(NULL);
+  b = q->next[q->tail];
+  skb = skb_dequeue(&q->queue[b]);
+  if (--q->qlen[b] == 0)
+	sfq_deactivate(q, b);
+  else
+	q->tail = b;
+  *pri = 0;
+  return(skb);
+}
+
+
+/* Take a packet off whatever queue it is on, as tcp_ack() does. */
+static void
+sfq_unlink(struct sk_buff *skb, struct device *dev)
+{
+  struct sfq_data *q = (struct sfq_data *) dev->qdisc_data;
+  int b;
+
+  b = skb->list - q->queue;
+  skb_unlink(skb);
+  if (b >= 0 && b < SFQ_HASH && --q->qlen[b] == 0)
+	sfq_deactivate(q, b);
+}
+
+
+static void *
+sfq_alloc(void)
+{
+  struct sfq_data *q;
+
+  q = (struct sfq_data *) kmalloc(sizeof(struct sfq_data), GFP_KERNEL);
+  if (q == NULL)
+	return(NULL);
+  memset(q, 0, sizeof(struct sfq_data));
+  q->tail = SFQ_EMPTY;
+  q->perturb = jiffies;
+  return(q);
+}
+
+
+static void
+sfq_release(void *data)
+{
+  kfree_s(data, sizeof(struct sfq_data));
+}
+
+
+static struct qdisc_ops sfq_qdisc = {
+  "sfq",
+  sfq_alloc,
+  sfq_release,
+  sfq_enqueue,
+  sfq_requeue,
+  sfq_dequeue,
+  sfq_unlink
+};
+
+
+static struct qdisc_ops *qdiscs[NR_QDISCS] = {
+  &bfifo_qdisc,
+  &sfq_qdisc
+};
+
+
+static inline struct qdisc_ops *
+dev_qdisc(struct device *dev)
+{
+  return(dev->qdisc ? dev->qdisc : &bfifo_qdisc);
+}
+
+
+/*
+ * Queue a packet the driver didn't take. If something has to go to
+ * stay within the byte limit it is dropped here; packets that still
+ * belong to a socket (TCP data waiting for its ack) are only taken
+ * off the queue and will be sent again by their owner.
+ */
+void
+qdisc_enqueue(struct sk_buff *skb, struct device *dev, int pri)
+{
+  struct sk_buff *victim;
+  unsigned long flags;
+
+  save_flags(flags);
+  cli();
+  if (!dev->tx_queue_limit)
+	dev->tx_queue_limit = dev->mtu * TX_QUEUE_MTUS;
+  skb->magic = DEV_QUEUE_MAGIC;
+  victim = dev_qdisc(dev)->enqueue(skb, dev, pri);
+  dev->tx_queue_len++;
+  dev->tx_queue_bytes += skb->len;
+  if (victim != NULL) {
+	dev->tx_queue_len--;
+	dev->tx_queue_bytes -= victim->len;
+	dev->tx_queue_drops++;
+	victim->magic = 0;
+	victim->next = NULL;
+	victim->prev = NULL;
+	restore_flags(flags);
+	if (victim->free)
+		kfree_skb(victim, FREE_WRITE);
+	return;
+  }
+  restore_flags(flags);
+}
+
+
+/* Put back a packet dev_tint() got but the driver refused. */
+void
+qdisc_requeue(struct sk_buff *skb, struct device *dev, int pri)
+{
+  unsigned long flags;
+
+  save_flags(flags);
+  cli();
+  skb->magic = DEV_QUEUE_MAGIC;
+  dev_qdisc(dev)->requeue(skb, dev, pri);
+  dev->tx_queue_len++;
+  dev->tx_queue_bytes += skb->len;
+  restore_flags(flags);
+}
+
+
+struct sk_buff *
+qdisc_dequeue(struct device *dev, int *pri)
+{
+  struct sk_buff *skb;
+  unsigned long flags;
+
+  save_flags(flags);
+  cli();
+  skb = dev_qdisc(dev)->dequeue(dev, pri);
+  if (skb != NULL) {
+	dev->tx_queue_len--;
+	dev->tx_queue_bytes -= skb->len;
+  }
+  restore_flags(flags);
+  return(skb);
+}
+
+
+/*
+ * Take a packet off the queue it is on, such as one tcp_ack() finds
+ * acknowledged before the driver got to it. Packets that aren't on a
+ * device queue (but on an ARP queue, say) are simply unlinked.
+ */
+void
+qdisc_unlink(struct sk_buff *skb)
+{
+  struct device *dev = skb->dev;
+  unsigned long flags;
+
+  save_flags(flags);
+  cli();
+  if (skb->list == NULL || skb->magic != DEV_QUEUE_MAGIC || dev == NULL) {
+	skb_unlink(skb);
+	restore_flags(flags);
+	return;
+  }
+  dev_qdisc(dev)->unlink(skb, dev);
+  skb->magic = 0;
+  dev->tx_queue_len--;
+  dev->tx_queue_bytes -= skb->len;
+  restore_flags(flags);
+}
+
+
+/* Throw away everything queued, as when the device goes down. */
+void
+qdisc_reset(struct device *dev)
+{
+  struct sk_buff *skb;
+  int pri;
+
+  while((skb = qdisc_dequeue(dev, &pri)) != NULL) {
+	skb->magic = 0;
+	if (skb->free)
+		kfree_skb(skb, FREE_WRITE);
+  }
+}
+
+
+/* Switch a device to another discipline, dropping what is queued. */
+int
+qdisc_set(struct device *dev, int which)
+{
+  struct qdisc_ops *old, *new;
+  void *data = NULL, *old_data;
+  unsigned long flags;
+
+  if (which < 0 || which >= NR_QDISCS)
+	return(-EINVAL);
+  new = qdiscs[which];
+  old = dev_qdisc(dev);
+  if (new == old)
+	return(0);
+  if (new->alloc && (data = new->alloc()) == NULL)
+	return(-ENOMEM);
+
+  save_flags(flags);
+  cli();
+  qdisc_reset(dev);
+  old_data = dev->qdisc_data;
+  dev->qdisc = new;
+  dev->qdisc_data = data;
+  restore_flags(flags);
+  if (old->release)
+	old->release(old_data);
+  return(0);
+}
+
+
+int
+qdisc_get(struct device *dev)
+{
+  int i;
+
+  for(i = 0; i < NR_QDISCS; i++)
+	if (qdiscs[i] == dev_qdisc(dev))
+		return(i);
+  return(0);
+}
+
+
+char *
+qdisc_name(struct device *dev)
+{
+  return(dev_qdisc(dev)->name);
+}
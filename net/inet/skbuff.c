@@ -21,6 +21,7 @@
 #include <asm/segment.h>
 #include <asm/system.h>
 #include <linux/mm.h>
+#include <linux/malloc.h>
 #include <linux/interrupt.h>
 #include <linux/in.h>
 #include "inet.h"
@@ -316,6 +317,7 @@ struct sk_buff *skb_peek_copy(struct sk_buff *volatile* list)
 	struct sk_buff *orig,*newsk;
 	unsigned long flags;
 	unsigned int len;
+	unsigned char pool;
 	/* Now for some games to avoid races */
 
 	do
@@ -352,7 +354,9 @@ struct sk_buff *skb_peek_copy(struct sk_buff *volatile* list)
 
 		IS_SKB(orig);
 		IS_SKB(newsk);
+		pool=newsk->pool;
 		memcpy(newsk,orig,len);
+		newsk->pool=pool;
 		newsk->list=NULL;
 		newsk->magic=0;
 		newsk->next=NULL;
@@ -418,6 +422,129 @@ void kfree_skb(struct sk_buff *skb, int rw)
 		kfree_skbmem(skb->mem_addr, skb->mem_len);
 }
 
+/*
+ *	Socket buffer pool. Most buffers are either small (acks, SYNs, ARP)
+ *	or big enough for a full Ethernet frame, so those two sizes come
+ *	from caches of their own instead of the kmalloc size classes, with
+ *	a free list in front of each. The free lists are kept above 'low'
+ *	by skb_pool_refill() from the INET bottom half, so that drivers
+ *	allocating at interrupt time usually find one, and buffers freed
+ *	while a list holds 'high' go straight back to the cache.
+ */
+
+#define SKB_POOL_NONE	0	/* from kmalloc */
+#define SKB_POOL_SMALL	1
+#define SKB_POOL_MTU	2
+#define NR_SKB_POOLS	2
+
+static struct skb_pool {
+	const char		*name;
+	unsigned int		size;		/* largest buffer it serves */
+	int			low, high;	/* free list watermarks */
+	struct kmem_cache	*cachep;
+	struct sk_buff		*free;		/* linked through ->next */
+	int			count;
+	unsigned long		hits, misses, refills, released;
+} skb_pools[NR_SKB_POOLS] = {
+	{ "small", sizeof(struct sk_buff) + 128, 16, 64 },
+	{ "mtu", sizeof(struct sk_buff) + 1792, 8, 32 }
+};
+
+void skb_pool_init(void)
+{
+	struct skb_pool *pool;
+
+	for (pool = skb_pools; pool < skb_pools + NR_SKB_POOLS; pool++) {
+		pool->cachep = kmem_cache_create(pool->name, pool->size, 0, NULL);
+		if (pool->cachep == NULL)
+			printk("skb_pool_init: cannot create %s cache\n", pool->name);
+	}
+	skb_pool_refill();
+}
+
+/*
+ *	Top the free lists up to their low watermark. Called from the
+ *	INET bottom half, which alloc_skb() marks when a list runs low.
+ */
+
+void skb_pool_refill(void)
+{
+	struct skb_pool *pool;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	for (pool = skb_pools; pool < skb_pools + NR_SKB_POOLS; pool++) {
+		if (pool->cachep == NULL)
+			continue;
+		while (pool->count < pool->low) {
+			skb = (struct sk_buff *) kmem_cache_alloc(pool->cachep, GFP_ATOMIC);
+			if (skb == NULL)
+				break;
+			save_flags(flags);
+			cli();
+			skb->next = pool->free;
+			pool->free = skb;
+			pool->count++;
+			pool->refills++;
+			restore_flags(flags);
+		}
+	}
+}
+
+static struct sk_buff *skb_pool_alloc(struct skb_pool *pool, int priority)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	if ((skb = pool->free) != NULL) {
+		pool->free = skb->next;
+		pool->count--;
+		pool->hits++;
+	} else
+		pool->misses++;
+	restore_flags(flags);
+	if (pool->count < pool->low)
+		mark_bh(INET_BH);
+	if (skb == NULL)
+		skb = (struct sk_buff *) kmem_cache_alloc(pool->cachep, priority);
+	return skb;
+}
+
+static void skb_pool_free(struct skb_pool *pool, struct sk_buff *skb)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	if (pool->count < pool->high) {
+		skb->next = pool->free;
+		pool->free = skb;
+		pool->count++;
+		restore_flags(flags);
+		return;
+	}
+	pool->released++;
+	restore_flags(flags);
+	kmem_cache_free(pool->cachep, skb);
+}
+
+int skb_pool_get_info(char *buffer)
+{
+	struct skb_pool *pool;
+	int len;
+
+	len = sprintf(buffer, "pool   size  free   low  high       hits     misses    refills   released\n");
+	for (pool = skb_pools; pool < skb_pools + NR_SKB_POOLS; pool++)
+		len += sprintf(buffer + len, "%-5s %5u %5d %5d %5d %10lu %10lu %10lu %10lu\n",
+			pool->name, pool->size, pool->count, pool->low, pool->high,
+			pool->hits, pool->misses, pool->refills, pool->released);
+	len += sprintf(buffer + len, "%lu buffers, %lu bytes in use\n",
+		net_skbcount, net_memory);
+	return len;
+}
+
 /*
  *	Allocate a new skbuff. We do this ourselves so we can fill in a few 'private'
  *	fields and also do memory statistics to find all the [BEEP] leaks.
@@ -426,6 +553,7 @@ void kfree_skb(struct sk_buff *skb, int rw)
 struct sk_buff *alloc_skb(unsigned int size,int priority)
 {
 	struct sk_buff *skb;
+	unsigned char pool;
 	extern unsigned long intr_count;
 
 	if (intr_count && priority != GFP_ATOMIC) {
@@ -433,12 +561,23 @@ struct sk_buff *alloc_skb(unsigned int size,int priority)
 			((unsigned long *)&size)[-1]);
 		priority = GFP_ATOMIC;
 	}
-	skb=(struct sk_buff *)kmalloc(size,priority);
+	for (pool = SKB_POOL_SMALL; pool <= NR_SKB_POOLS; pool++)
+		if (size <= skb_pools[pool-1].size && skb_pools[pool-1].cachep)
+			break;
+	if (pool <= NR_SKB_POOLS)
+		skb = skb_pool_alloc(skb_pools + pool - 1, priority);
+	else {
+		pool = SKB_POOL_NONE;
+		skb=(struct sk_buff *)kmalloc(size,priority);
+	}
 	if(skb==NULL)
 		return NULL;
 	skb->free= 2;	/* Invalid so we pick up forgetful users */
 	skb->list= 0;	/* Not on a list */
 	skb->lock= 0;
+	skb->csum= 0;
+	skb->csum_unverified= 0;
+	skb->pool= pool;
 	skb->truesize=size;
 	skb->mem_len=size;
 	skb->mem_addr=skb;
@@ -461,7 +600,10 @@ void kfree_skbmem(void *mem,unsigned size)
 	if(x->magic_debug_cookie==SK_GOOD_SKB)
 	{
 		x->magic_debug_cookie=SK_FREED_SKB;
-		kfree_s(mem,size);
+		if (x->pool != SKB_POOL_NONE)
+			skb_pool_free(skb_pools + x->pool - 1, x);
+		else
+			kfree_s(mem,size);
 		net_skbcount--;
 		net_memory-=size;
 	}
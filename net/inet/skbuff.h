@@ -75,12 +75,17 @@ struct sk_buff {
 				arp;
   unsigned char			tries,lock;	/* Lock is now unused */
   unsigned short		users;		/* User count - see datagram.c (and soon seqpacket.c/stream.c) */
+  unsigned char			csum_unverified;	/* csum still has to be checked */
+  unsigned char			pool;		/* SKB_POOL_xxx it came from, see skbuff.c */
+  unsigned long			csum;		/* Partial checksum, see ip.c */
   unsigned long			padding[0];
   unsigned char			data[0];
 };
 
 #define SK_WMEM_MAX	8192
 #define SK_RMEM_MAX	32767
+#define SK_WMEM_LIMIT	262144	/* most SO_SNDBUF will give you */
+#define SK_RMEM_LIMIT	262144	/* ... and SO_RCVBUF or autotuning */
 
 #define SK_FREED_SKB	0x0DE2C0DE
 #define SK_GOOD_SKB	0xDEC0DED1
@@ -98,6 +103,9 @@ extern struct sk_buff *		skb_peek(struct sk_buff * volatile *list);
 extern struct sk_buff *		skb_peek_copy(struct sk_buff * volatile *list);
 extern struct sk_buff *		alloc_skb(unsigned int size, int priority);
 extern void			kfree_skbmem(void *mem, unsigned size);
+extern void			skb_pool_init(void);
+extern void			skb_pool_refill(void);
+extern int			skb_pool_get_info(char *buffer);
 extern void			skb_kept_by_device(struct sk_buff *skb);
 extern void			skb_device_release(struct sk_buff *skb, int mode);
 extern int			skb_device_locked(struct sk_buff *skb);
@@ -212,6 +212,91 @@ get_new_socknum(struct proto *prot, unsigned short base)
 }
 
 
+/*
+ * Besides the per-port sock_array[], which get_new_socknum(), bind and
+ * /proc walk, every socket is on one of two lookup tables: a connected
+ * socket (both ends fully known) on sock_ehash[], hashed on the whole
+ * address/port pair, everything else on sock_lhash[] by local port.
+ * get_sock() only has to walk the long chains of a busy server port
+ * for sockets that can actually take new connections.
+ */
+static inline int
+sock_ehashfn(unsigned long laddr, unsigned short lport,
+	     unsigned long raddr, unsigned short rport)
+{
+  unsigned long h;
+
+  h = laddr ^ raddr ^ (((unsigned long) lport << 16) | rport);
+  h ^= h >> 16;
+  h ^= h >> 8;
+  return h & (SOCK_EHASH_SIZE - 1);
+}
+
+
+static void
+unhash_lookup(struct sock *sk)
+{
+  struct sock **skp;
+
+  if (sk->prot->last_hit == sk)
+	sk->prot->last_hit = NULL;
+  if ((skp = sk->lookup_head) == NULL)
+	return;
+  for(; *skp != NULL; skp = &(*skp)->lookup_next) {
+	if (*skp == sk) {
+		*skp = sk->lookup_next;
+		break;
+	}
+  }
+  sk->lookup_head = NULL;
+  sk->lookup_next = NULL;
+}
+
+
+/* Call with interrupts off. */
+static void
+hash_lookup(struct sock *sk)
+{
+  struct sock **skp;
+
+  if (sk->saddr && sk->daddr && sk->dummy_th.dest) {
+	skp = &sk->prot->sock_ehash[sock_ehashfn(sk->saddr, htons(sk->num),
+					sk->daddr, sk->dummy_th.dest)];
+	sk->lookup_head = skp;
+	sk->lookup_next = *skp;
+	*skp = sk;
+	return;
+  }
+
+  /* Sockets bound to an address go before the wildcard ones. */
+  skp = &sk->prot->sock_lhash[sk->num & (SOCK_ARRAY_SIZE - 1)];
+  sk->lookup_head = skp;
+  if (!sk->saddr) {
+	while(*skp != NULL)
+		skp = &(*skp)->lookup_next;
+  }
+  sk->lookup_next = *skp;
+  *skp = sk;
+}
+
+
+/*
+ * Move a socket to the right lookup table after connect() has
+ * filled in the remote end.
+ */
+void
+rehash_sock(struct sock *sk)
+{
+  unsigned long flags;
+
+  save_flags(flags);
+  cli();
+  unhash_lookup(sk);
+  hash_lookup(sk);
+  restore_flags(flags);
+}
+
+
 void
 put_sock(unsigned short num, struct sock *sk)
 {
@@ -226,6 +311,8 @@ put_sock(unsigned short num, struct sock *sk)
 
   /* We can't have an interupt re-enter here. */
   cli();
+  unhash_lookup(sk);
+  hash_lookup(sk);
   if (sk->prot->sock_array[num] == NULL) {
 	sk->prot->sock_array[num] = sk;
 	sti();
@@ -284,6 +371,7 @@ remove_sock(struct sock *sk1)
 
   /* We can't have this changing out from under us. */
   cli();
+  unhash_lookup(sk1);
   sk2 = sk1->prot->sock_array[sk1->num &(SOCK_ARRAY_SIZE -1)];
   if (sk2 == sk1) {
 	sk1->prot->sock_array[sk1->num &(SOCK_ARRAY_SIZE -1)] = sk1->next;
@@ -385,7 +473,7 @@ destroy_sock(struct sock *sk)
 		if (skb->next != NULL) 
 		{
 			IS_SKB(skb);
-			skb_unlink(skb);
+			qdisc_unlink(skb);
 		}
 		skb->dev = NULL;
 		sti();
@@ -430,7 +518,7 @@ destroy_sock(struct sock *sk)
    */
 	  if (sk->rmem_alloc == 0 && sk->wmem_alloc == 0) 
 	  {
-		kfree_s((void *)sk,sizeof(*sk));
+		kmem_cache_free(sock_cachep, sk);
 	  } 
 	  else 
 	  {
@@ -540,8 +628,8 @@ int sock_setsockopt(struct sock *sk, int level, int optname,
 			sk->broadcast=val?1:0;
 			return 0;
 		case SO_SNDBUF:
-			if(val>32767)
-				val=32767;
+			if(val>SK_WMEM_LIMIT)
+				val=SK_WMEM_LIMIT;
 			if(val<256)
 				val=256;
 			sk->sndbuf=val;
@@ -560,11 +648,12 @@ int sock_setsockopt(struct sock *sk, int level, int optname,
 			}
 			return 0;
 		case SO_RCVBUF:
-			if(val>32767)
-				val=32767;
+			if(val>SK_RMEM_LIMIT)
+				val=SK_RMEM_LIMIT;
 			if(val<256)
 				val=256;
 			sk->rcvbuf=val;
+			sk->rcvbuf_lock=1;	/* the user knows best */
 			return(0);
 
 		case SO_REUSEADDR:
@@ -758,7 +847,7 @@ inet_create(struct socket *sock, int protocol)
   struct proto *prot;
   int err;
 
-  sk = (struct sock *) kmalloc(sizeof(*sk), GFP_KERNEL);
+  sk = (struct sock *) kmem_cache_alloc(sock_cachep, GFP_KERNEL);
   if (sk == NULL) 
   	return(-ENOMEM);
   sk->num = 0;
@@ -767,7 +856,7 @@ inet_create(struct socket *sock, int protocol)
 	case SOCK_STREAM:
 	case SOCK_SEQPACKET:
 		if (protocol && protocol != IPPROTO_TCP) {
-			kfree_s((void *)sk, sizeof(*sk));
+			kmem_cache_free(sock_cachep, sk);
 			return(-EPROTONOSUPPORT);
 		}
 		protocol = IPPROTO_TCP;
@@ -777,7 +866,7 @@ inet_create(struct socket *sock, int protocol)
 
 	case SOCK_DGRAM:
 		if (protocol && protocol != IPPROTO_UDP) {
-			kfree_s((void *)sk, sizeof(*sk));
+			kmem_cache_free(sock_cachep, sk);
 			return(-EPROTONOSUPPORT);
 		}
 		protocol = IPPROTO_UDP;
@@ -787,11 +876,11 @@ inet_create(struct socket *sock, int protocol)
       
 	case SOCK_RAW:
 		if (!suser()) {
-			kfree_s((void *)sk, sizeof(*sk));
+			kmem_cache_free(sock_cachep, sk);
 			return(-EPERM);
 		}
 		if (!protocol) {
-			kfree_s((void *)sk, sizeof(*sk));
+			kmem_cache_free(sock_cachep, sk);
 			return(-EPROTONOSUPPORT);
 		}
 		prot = &raw_prot;
@@ -805,11 +894,11 @@ inet_create(struct socket *sock, int protocol)
 
 	case SOCK_PACKET:
 		if (!suser()) {
-			kfree_s((void *)sk, sizeof(*sk));
+			kmem_cache_free(sock_cachep, sk);
 			return(-EPERM);
 		}
 		if (!protocol) {
-			kfree_s((void *)sk, sizeof(*sk));
+			kmem_cache_free(sock_cachep, sk);
 			return(-EPROTONOSUPPORT);
 		}
 		prot = &packet_prot;
@@ -821,7 +910,7 @@ inet_create(struct socket *sock, int protocol)
 		break;
 
 	default:
-		kfree_s((void *)sk, sizeof(*sk));
+		kmem_cache_free(sock_cachep, sk);
 		return(-ESOCKTNOSUPPORT);
   }
   sk->socket = sock;
@@ -836,6 +925,7 @@ inet_create(struct socket *sock, int protocol)
   sk->rmem_alloc = 0;
   sk->sndbuf = SK_WMEM_MAX;
   sk->rcvbuf = SK_RMEM_MAX;
+  sk->rcvbuf_lock = 0;
   sk->pair = NULL;
   sk->opt = NULL;
   sk->write_seq = 0;
@@ -849,6 +939,15 @@ inet_create(struct socket *sock, int protocol)
   sk->rto = TCP_WRITE_TIME;
   sk->mdev = 0;
   sk->backoff = 0;
+  sk->snd_wscale = 0;
+  sk->rcv_wscale = 0;
+  sk->wscale_ok = 0;
+  sk->tstamp_ok = 0;
+  sk->ts_recent = 0;
+  sk->rcv_tsecr = 0;
+  sk->saw_tstamp = 0;
+  sk->rcv_space_seq = 0;
+  sk->rcv_space_time = 0;
   sk->packets_out = 0;
   sk->cong_window = 1; /* start with only sending one packet at a time. */
   sk->cong_count = 0;
@@ -885,6 +984,7 @@ inet_create(struct socket *sock, int protocol)
   sk->wback = NULL;
   sk->wfront = NULL;
   sk->rqueue = NULL;
+  sk->ooo_count = 0;
   sk->mtu = 576;
   sk->prot = prot;
   sk->sleep = sock->wait;
@@ -892,11 +992,15 @@ inet_create(struct socket *sock, int protocol)
   sk->saddr = my_addr();
   sk->err = 0;
   sk->next = NULL;
+  sk->lookup_next = NULL;
+  sk->lookup_head = NULL;
   sk->pair = NULL;
   sk->send_tail = NULL;
   sk->send_head = NULL;
   sk->timeout = 0;
   sk->broadcast = 0;
+  init_timer(&sk->timer);
+  init_timer(&sk->partial_timer);
   sk->timer.data = (unsigned long)sk;
   sk->timer.function = &net_timer;
   sk->back_log = NULL;
@@ -1083,10 +1187,10 @@ outside_loop:
   sti();
 
   remove_sock(sk);
-  put_sock(snum, sk);
-  sk->dummy_th.source = ntohs(sk->num);
   sk->daddr = 0;
   sk->dummy_th.dest = 0;
+  put_sock(snum, sk);
+  sk->dummy_th.source = ntohs(sk->num);
   return(0);
 }
 
@@ -1194,7 +1298,7 @@ inet_accept(struct socket *sock, struct socket *newsock, int flags)
    * We need to free it up because the tcp module creates
    * it's own when it accepts one.
    */
-  if (newsock->data) kfree_s(newsock->data, sizeof(struct sock));
+  if (newsock->data) kmem_cache_free(sock_cachep, newsock->data);
   newsock->data = NULL;
 
   if (sk1->prot->accept == NULL) return(-EOPNOTSUPP);
@@ -1565,6 +1669,8 @@ inet_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 	case SIOCSIFMTU:
 	case SIOCSIFLINK:
 	case SIOCGIFHWADDR:
+	case SIOCGIFQDISC:
+	case SIOCSIFQDISC:
 		return(dev_ioctl(cmd,(void *) arg));
 
 	default:
@@ -1626,7 +1732,7 @@ sock_rspace(struct sock *sk)
 
   if (sk != NULL) {
 	if (sk->rmem_alloc >= sk->rcvbuf-2*MIN_WINDOW) return(0);
-	amt = min((sk->rcvbuf-sk->rmem_alloc)/2-MIN_WINDOW, MAX_WINDOW);
+	amt = ((long) sk->rcvbuf - (long) sk->rmem_alloc)/2 - MIN_WINDOW;
 	if (amt < 0) return(0);
 	return(amt);
   }
@@ -1686,6 +1792,9 @@ sock_rfree(struct sock *sk, void *mem, unsigned long size)
 /*
  * This routine must find a socket given a TCP or UDP header.
  * Everyhting is assumed to be in net order.
+ *
+ * Try the socket the last packet went to, then the connected sockets,
+ * and only then the sockets bound to the port.
  */
 struct sock *get_sock(struct proto *prot, unsigned short num,
 				unsigned long raddr,
@@ -1698,29 +1807,45 @@ struct sock *get_sock(struct proto *prot, unsigned short num,
   DPRINTF((DBG_INET, "get_sock(prot=%X, num=%d, raddr=%X, rnum=%d, laddr=%X)\n",
 	  prot, num, raddr, rnum, laddr));
 
-  /*
-   * SOCK_ARRAY_SIZE must be a power of two.  This will work better
-   * than a prime unless 3 or more sockets end up using the same
-   * array entry.  This should not be a problem because most
-   * well known sockets don't overlap that much, and for
-   * the other ones, we can just be careful about picking our
-   * socket number when we choose an arbitrary one.
-   */
-  for(s = prot->sock_array[hnum & (SOCK_ARRAY_SIZE - 1)];
-      s != NULL; s = s->next) 
+  prot->lookups++;
+  s = prot->last_hit;
+  if (s != NULL && s->num == hnum && s->daddr == raddr &&
+      s->dummy_th.dest == rnum && s->saddr == laddr &&
+      !(s->dead && s->state == TCP_CLOSE)) {
+	prot->cache_hits++;
+	return(s);
+  }
+
+  for(s = prot->sock_ehash[sock_ehashfn(laddr, num, raddr, rnum)];
+      s != NULL; s = s->lookup_next)
+  {
+	if (s->num != hnum || s->dummy_th.dest != rnum ||
+	    s->daddr != raddr || s->saddr != laddr)
+		continue;
+	if(s->dead && (s->state == TCP_CLOSE))
+		continue;
+	prot->ehash_hits++;
+	prot->last_hit = s;
+	return(s);
+  }
+
+  for(s = prot->sock_lhash[hnum & (SOCK_ARRAY_SIZE - 1)];
+      s != NULL; s = s->lookup_next) 
   {
 	if (s->num != hnum) 
 		continue;
 	if(s->dead && (s->state == TCP_CLOSE))
 		continue;
 	if(prot == &udp_prot)
-		return s;
+		goto found;
 	if(ip_addr_match(s->daddr,raddr)==0)
 		continue;
 	if (s->dummy_th.dest != rnum && s->dummy_th.dest != 0) 
 		continue;
 	if(ip_addr_match(s->saddr,laddr) == 0)
 		continue;
+found:
+	prot->lhash_hits++;
 	return(s);
   }
   return(NULL);
@@ -1853,6 +1978,8 @@ static struct proto_ops inet_proto_ops = {
 
 extern unsigned long seq_offset;
 
+struct kmem_cache *sock_cachep = NULL;
+
 /* Called by ddi.c on kernel startup.  */
 void inet_proto_init(struct ddi_proto *pro)
 {
@@ -1872,6 +1999,13 @@ void inet_proto_init(struct ddi_proto *pro)
 
   seq_offset = CURRENT_TIME*250;
 
+  sock_cachep = kmem_cache_create("sock", sizeof(struct sock), 0, NULL);
+  if (sock_cachep == NULL) {
+	printk("%s: cannot create sock cache!\n", pro->name);
+	return;
+  }
+  skb_pool_init();
+
   /* Add all the protocols. */
   for(i = 0; i < SOCK_ARRAY_SIZE; i++) {
 	tcp_prot.sock_array[i] = NULL;
@@ -44,6 +44,18 @@
 #endif
 
 #define SOCK_ARRAY_SIZE	64
+#define SOCK_EHASH_SIZE	256	/* connected sockets, by address/port pair */
+#define TCP_OOO_BLOCKS	16	/* out of order runs tcp_data() keeps track of */
+
+
+/*
+ * A run of contiguous data in the receive queue that is ahead of
+ * acked_seq, from the first skb of the run to the last.
+ */
+struct tcp_ooo_block {
+  unsigned long			start, end;
+  struct sk_buff		*first, *last;
+};
 
 
 /*
@@ -88,6 +100,8 @@ struct sock {
   unsigned long		        lingertime;
   int				proc;
   struct sock			*next;
+  struct sock			*lookup_next;	/* established or listening chain */
+  struct sock			**lookup_head;	/* ... and the bucket we are on */
   struct sock			*pair;
   struct sk_buff		*volatile send_tail;
   struct sk_buff		*volatile send_head;
@@ -98,18 +112,20 @@ struct sock {
   struct sk_buff		*volatile wback,
 				*volatile wfront,
 				*volatile rqueue;
+  struct tcp_ooo_block		ooo[TCP_OOO_BLOCKS];	/* sorted by start */
+  short				ooo_count;	/* -1: lost track, walk rqueue */
   struct proto			*prot;
   struct wait_queue		**sleep;
   unsigned long			daddr;
   unsigned long			saddr;
   unsigned short		max_unacked;
-  unsigned short		window;
-  unsigned short		bytes_rcv;
+  unsigned long			window;		/* window offered, in bytes */
+  unsigned long			bytes_rcv;
 /* mss is min(mtu, max_window) */
   unsigned short		mtu;       /* mss negotiated in the syn's */
   volatile unsigned short	mss;       /* current eff. mss - can change */
   volatile unsigned short	user_mss;  /* mss requested by user in ioctl */
-  volatile unsigned short	max_window;
+  volatile unsigned long	max_window;
   unsigned short		num;
   volatile unsigned short	cong_window;
   volatile unsigned short	cong_count;
@@ -119,6 +135,15 @@ struct sock {
   volatile unsigned long	rtt;
   volatile unsigned long	mdev;
   volatile unsigned long	rto;
+  unsigned char			snd_wscale;	/* RFC 1323 window shifts */
+  unsigned char			rcv_wscale;
+  unsigned char			wscale_ok;
+  unsigned char			tstamp_ok;
+  unsigned char			saw_tstamp;	/* rcv_tsecr is valid */
+  unsigned long			ts_recent;	/* timestamp to echo */
+  unsigned long			rcv_tsecr;	/* echo in this segment */
+  unsigned long			rcv_space_seq;	/* receive buffer autotuning */
+  unsigned long			rcv_space_time;
 /* currently backoff isn't used, but I'm maintaining it in case
  * we want to go back to a backoff formula that needs it
  */
@@ -130,8 +155,9 @@ struct sock {
   unsigned char			max_ack_backlog;
   unsigned char			priority;
   unsigned char			debug;
-  unsigned short		rcvbuf;
-  unsigned short		sndbuf;
+  unsigned long			rcvbuf;
+  unsigned long			sndbuf;
+  unsigned char			rcvbuf_lock;	/* set by SO_RCVBUF: no autotuning */
   unsigned short		type;
 #ifdef CONFIG_IPX
   ipx_address			ipx_source_addr,ipx_dest_addr;
@@ -228,6 +254,12 @@ struct proto {
   unsigned long		retransmits;
   struct sock *		sock_array[SOCK_ARRAY_SIZE];
   char			name[80];
+
+  /* Demultiplexing for get_sock(), see sock.c. */
+  struct sock *		sock_ehash[SOCK_EHASH_SIZE];
+  struct sock *		sock_lhash[SOCK_ARRAY_SIZE];
+  struct sock *		last_hit;
+  unsigned long		lookups, cache_hits, ehash_hits, lhash_hits;
 };
 
 #define TIME_WRITE	1
@@ -245,9 +277,11 @@ struct proto {
 #define SEND_SHUTDOWN	2
 
 
+extern struct kmem_cache	*sock_cachep;
 extern void			destroy_sock(struct sock *sk);
 extern unsigned short		get_new_socknum(struct proto *, unsigned short);
 extern void			put_sock(unsigned short, struct sock *); 
+extern void			rehash_sock(struct sock *sk);
 extern void			release_sock(struct sock *sk);
 extern struct sock		*get_sock(struct proto *, unsigned short,
 					  unsigned long, unsigned short,
@@ -181,7 +181,15 @@ diff(unsigned long seq1, unsigned long seq2)
    
 static int tcp_select_window(struct sock *sk)
 {
-	int new_window = sk->prot->rspace(sk);
+	unsigned long new_window = sk->prot->rspace(sk);
+
+/*
+ * The window goes out shifted right by rcv_wscale, so don't offer more
+ * than the field can say, nor bytes it can't represent.
+ */
+	if (new_window > (65535UL << sk->rcv_wscale))
+		new_window = 65535UL << sk->rcv_wscale;
+	new_window &= ~((1UL << sk->rcv_wscale) - 1);
 
 /*
  * two things are going on here.  First, we don't ever offer a
@@ -198,6 +206,54 @@ static int tcp_select_window(struct sock *sk)
 	return(new_window);
 }
 
+
+/*
+ * Once timestamps are agreed on, every segment after the SYNs carries
+ * one, laid out as RFC 1323 suggests so that the receiver can find it
+ * without parsing the options: NOP, NOP, kind, length, TSval, TSecr.
+ * th->doff must already be set.
+ */
+static int tcp_build_tstamp(struct sock *sk, struct tcphdr *th)
+{
+	unsigned long *ptr;
+
+	if (!sk->tstamp_ok)
+		return(0);
+	ptr = (unsigned long *)(th + 1);
+	ptr[0] = htonl((TCPOPT_NOP << 24) | (TCPOPT_NOP << 16) |
+		       (TCPOPT_TIMESTAMP << 8) | TCPOLEN_TIMESTAMP);
+	ptr[1] = htonl(jiffies);
+	ptr[2] = htonl(sk->ts_recent);
+	th->doff += TCPOLEN_TSTAMP_ALIGNED / 4;
+	return(TCPOLEN_TSTAMP_ALIGNED);
+}
+
+
+/*
+ * Pick up the timestamp of an incoming segment. Only the layout above
+ * is recognised, which is what everybody sends. th->seq must be in
+ * host order.
+ */
+static void tcp_parse_tstamp(struct sock *sk, struct tcphdr *th)
+{
+	unsigned long *ptr;
+
+	sk->saw_tstamp = 0;
+	if (!sk->tstamp_ok ||
+	    th->doff*4 < sizeof(struct tcphdr) + TCPOLEN_TSTAMP_ALIGNED)
+		return;
+	ptr = (unsigned long *)(th + 1);
+	if (ptr[0] != htonl((TCPOPT_NOP << 24) | (TCPOPT_NOP << 16) |
+			    (TCPOPT_TIMESTAMP << 8) | TCPOLEN_TIMESTAMP))
+		return;
+
+	/* Only echo it back if the segment doesn't leave a hole. */
+	if (!after(th->seq, sk->acked_seq))
+		sk->ts_recent = ntohl(ptr[1]);
+	sk->rcv_tsecr = ntohl(ptr[2]);
+	sk->saw_tstamp = 1;
+}
+
 /* Enter the time wait state. */
 
 static void tcp_time_wait(struct sock *sk)
@@ -523,61 +579,10 @@ unsigned short
 tcp_check(struct tcphdr *th, int len,
 	  unsigned long saddr, unsigned long daddr)
 {     
-  unsigned long sum;
-   
   if (saddr == 0) saddr = my_addr();
   print_th(th);
-  __asm__("\t addl %%ecx,%%ebx\n"
-	  "\t adcl %%edx,%%ebx\n"
-	  "\t adcl $0, %%ebx\n"
-	  : "=b"(sum)
-	  : "0"(daddr), "c"(saddr), "d"((ntohs(len) << 16) + IPPROTO_TCP*256)
-	  : "cx","bx","dx" );
-   
-  if (len > 3) {
-	__asm__("\tclc\n"
-		"1:\n"
-		"\t lodsl\n"
-		"\t adcl %%eax, %%ebx\n"
-		"\t loop 1b\n"
-		"\t adcl $0, %%ebx\n"
-		: "=b"(sum) , "=S"(th)
-		: "0"(sum), "c"(len/4) ,"1"(th)
-		: "ax", "cx", "bx", "si" );
-  }
-   
-  /* Convert from 32 bits to 16 bits. */
-  __asm__("\t movl %%ebx, %%ecx\n"
-	  "\t shrl $16,%%ecx\n"
-	  "\t addw %%cx, %%bx\n"
-	  "\t adcw $0, %%bx\n"
-	  : "=b"(sum)
-	  : "0"(sum)
-	  : "bx", "cx");
-   
-  /* Check for an extra word. */
-  if ((len & 2) != 0) {
-	__asm__("\t lodsw\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum), "=S"(th)
-		: "0"(sum) ,"1"(th)
-		: "si", "ax", "bx");
-  }
-   
-  /* Now check for the extra byte. */
-  if ((len & 1) != 0) {
-	__asm__("\t lodsb\n"
-		"\t movb $0,%%ah\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum)
-		: "0"(sum) ,"S"(th)
-		: "si", "ax", "bx");
-  }
-   
-  /* We only want the bottom 16 bits, but we never cleared the top 16. */
-  return((~sum) & 0xffff);
+  return(csum_tcpudp_magic(saddr, daddr, len, IPPROTO_TCP,
+			   csum_partial((unsigned char *) th, len, 0)));
 }
 
 
@@ -589,6 +594,24 @@ void tcp_send_check(struct tcphdr *th, unsigned long saddr,
 	return;
 }
 
+/*
+ * Checksum a segment built by tcp_write(). The data was summed into
+ * skb->csum as it was copied in, so only the header is left to do.
+ */
+static void tcp_send_check_skb(struct sk_buff *skb, struct tcphdr *th,
+		unsigned long saddr, unsigned long daddr, int len)
+{
+	unsigned long sum = 0;
+
+	if (saddr == 0)
+		saddr = my_addr();
+	if (len > th->doff*4)
+		sum = skb->csum;
+	th->check = 0;
+	sum = csum_partial((unsigned char *) th, th->doff*4, sum);
+	th->check = csum_tcpudp_magic(saddr, daddr, len, IPPROTO_TCP, sum);
+}
+
 static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int size;
@@ -606,7 +629,7 @@ static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 	}
 
 	/* If we have queued a header size packet.. */
-	if (size == sizeof(struct tcphdr)) {
+	if (size == th->doff*4) {
 		/* If its got a syn or fin its notionally included in the size..*/
 		if(!th->syn && !th->fin) {
 			printk("tcp_send_skb: attempt to queue a bogon.\n");
@@ -616,7 +639,7 @@ static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 	}
   
 	/* We need to complete and send the packet. */
-	tcp_send_check(th, sk->saddr, sk->daddr, size, sk);
+	tcp_send_check_skb(skb, th, sk->saddr, sk->daddr, size);
 
 	skb->h.seq = ntohl(th->seq) + size - 4*th->doff;
 	if (after(skb->h.seq, sk->window_seq) ||
@@ -746,7 +769,7 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_ack: build_header failed\n");
   t1->seq = ntohl(sequence);
   t1->ack = 1;
   sk->window = tcp_select_window(sk);/*sk->prot->rspace(sk);*/
-  t1->window = ntohs(sk->window);
+  t1->window = ntohs(sk->window >> sk->rcv_wscale);
   t1->res1 = 0;
   t1->res2 = 0;
   t1->rst = 0;
@@ -768,7 +791,9 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_ack: build_header failed\n");
   }
   t1->ack_seq = ntohl(ack);
   t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, daddr, sizeof(*t1), sk);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, daddr, sizeof(*t1) + tmp, sk);
   if (sk->debug)
   	 printk("\rtcp_ack: seq %lx ack %lx\n", sequence, ack);
   sk->prot->queue_xmit(sk, dev, buff, 1);
@@ -792,9 +817,9 @@ tcp_build_header(struct tcphdr *th, struct sock *sk, int push)
   sk->ack_timed = 0;
   th->ack_seq = htonl(sk->acked_seq);
   sk->window = tcp_select_window(sk)/*sk->prot->rspace(sk)*/;
-  th->window = htons(sk->window);
+  th->window = htons(sk->window >> sk->rcv_wscale);
 
-  return(sizeof(*th));
+  return(sizeof(*th) + tcp_build_tstamp(sk, th));
 }
 
 /*
@@ -907,7 +932,7 @@ tcp_write(struct sock *sk, unsigned char *from,
 
 	         /* IP header + TCP header */
 		hdrlen = ((unsigned long)skb->h.th - (unsigned long)skb->data)
-		         + sizeof(struct tcphdr);
+		         + skb->h.th->doff*4;
 
 		/* Add more stuff to the end of skb->len */
 		if (!(flags & MSG_OOB)) {
@@ -918,7 +943,10 @@ tcp_write(struct sock *sk, unsigned char *from,
 			  copy = 0;
 			}
 	  
-			memcpy_fromfs(skb->data + skb->len, from, copy);
+			skb->csum = csum_block_add(skb->csum,
+				csum_partial_copy_fromfs((char *) from,
+					(char *) skb->data + skb->len, copy, 0),
+				skb->len - hdrlen);
 			skb->len += copy;
 			from += copy;
 			copied += copy;
@@ -1036,7 +1064,7 @@ tcp_write(struct sock *sk, unsigned char *from,
 		((struct tcphdr *)buff)->urg_ptr = ntohs(copy);
 	}
 	skb->len += tmp;
-	memcpy_fromfs(buff+tmp, from, copy);
+	skb->csum = csum_partial_copy_fromfs((char *) from, (char *) buff+tmp, copy, 0);
 
 	from += copy;
 	copied += copy;
@@ -1147,14 +1175,53 @@ tcp_read_wakeup(struct sock *sk)
   sk->ack_backlog = 0;
   sk->bytes_rcv = 0;
   sk->window = tcp_select_window(sk);/*sk->prot->rspace(sk);*/
-  t1->window = ntohs(sk->window);
+  t1->window = ntohs(sk->window >> sk->rcv_wscale);
   t1->ack_seq = ntohl(sk->acked_seq);
   t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1) + tmp, sk);
   sk->prot->queue_xmit(sk, dev, buff, 1);
 }
 
 
+/*
+ * Receive buffer autotuning. About once a round trip, look at how much
+ * the reader took. If the buffer isn't at least four times that, it is
+ * the window and not the reader that is holding the sender back, so
+ * grow it: sock_rspace() offers half the buffer, and every segment
+ * carries its sk_buff besides the data. SO_RCVBUF turns this off.
+ */
+static void
+tcp_rcv_space_adjust(struct sock *sk)
+{
+  unsigned long interval, want;
+
+  if (sk->rcvbuf_lock)
+	return;
+  if (sk->rcv_space_time == 0) {
+	sk->rcv_space_time = jiffies;
+	sk->rcv_space_seq = sk->copied_seq;
+	return;
+  }
+  interval = sk->rtt >> 3;
+  if (interval < 2)
+	interval = 2;
+  if (interval > HZ)
+	interval = HZ;
+  if (jiffies - sk->rcv_space_time < interval)
+	return;
+
+  want = (sk->copied_seq - sk->rcv_space_seq) * 4;
+  if (want > SK_RMEM_LIMIT)
+	want = SK_RMEM_LIMIT;
+  if (want > sk->rcvbuf)
+	sk->rcvbuf = want;
+  sk->rcv_space_time = jiffies;
+  sk->rcv_space_seq = sk->copied_seq;
+}
+
+
 /*
  * FIXME:
  * This routine frees used buffers.
@@ -1191,6 +1258,8 @@ cleanup_rbuf(struct sock *sk)
 
   restore_flags(flags);
 
+  tcp_rcv_space_adjust(sk);
+
   /*
    * FIXME:
    * At this point we should send an ack if the difference
@@ -1503,11 +1572,14 @@ tcp_shutdown(struct sock *sk, int how)
   buff->h.seq = sk->write_seq;
   t1->ack = 1;
   t1->ack_seq = ntohl(sk->acked_seq);
-  t1->window = ntohs(sk->window=tcp_select_window(sk)/*sk->prot->rspace(sk)*/);
+  sk->window = tcp_select_window(sk)/*sk->prot->rspace(sk)*/;
+  t1->window = ntohs(sk->window >> sk->rcv_wscale);
   t1->fin = 1;
   t1->rst = 0;
   t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1) + tmp, sk);
 
   /*
    * Can't just queue this up.
@@ -1639,7 +1711,8 @@ tcp_reset(unsigned long saddr, unsigned long daddr, struct tcphdr *th,
 
 
 /*
- *	Look for tcp options. Parses everything but only knows about MSS.
+ *	Look for tcp options. Parses everything but only knows about MSS,
+ *	window scaling and timestamps.
  *      This routine is always called with the packet containing the SYN.
  *      However it may also be called with the ack to the SYN.  So you
  *      can't assume this is always the SYN.  It's always called after
@@ -1652,46 +1725,112 @@ tcp_options(struct sock *sk, struct tcphdr *th)
   unsigned char *ptr;
   int length=(th->doff*4)-sizeof(struct tcphdr);
   int mss_seen = 0;
+  int wscale = -1;
+  int tstamp = 0;
     
   ptr = (unsigned char *)(th + 1);
   
   while(length>0)
   {
   	int opcode=*ptr++;
-  	int opsize=*ptr++;
+  	int opsize;
+
+  	if (opcode == TCPOPT_EOL)
+  		break;
+  	if (opcode == TCPOPT_NOP) {
+  		length--;
+  		continue;
+  	}
+  	opsize=*ptr++;
+  	if(opsize<=2 || opsize>length)	/* Avoid silly options looping forever */
+  		break;
   	switch(opcode)
   	{
-  		case TCPOPT_EOL:
-  			return;
-  		case TCPOPT_NOP:
-  			length-=2;
-  			continue;
-  		
-  		default:
-  			if(opsize<=2)	/* Avoid silly options looping forever */
-  				return;
-  			switch(opcode)
+  		case TCPOPT_MSS:
+  			if(opsize==4 && th->syn)
+  			{
+  				sk->mtu=min(sk->mtu,ntohs(*(unsigned short *)ptr));
+				mss_seen = 1;
+  			}
+  			break;
+  		case TCPOPT_WINDOW:
+  			if(opsize==TCPOLEN_WINDOW && th->syn)
+  				wscale = min(*ptr, TCP_MAX_WSCALE);
+  			break;
+  		case TCPOPT_TIMESTAMP:
+  			if(opsize==TCPOLEN_TIMESTAMP && th->syn)
   			{
-  				case TCPOPT_MSS:
-  					if(opsize==4 && th->syn)
-  					{
-  						sk->mtu=min(sk->mtu,ntohs(*(unsigned short *)ptr));
-						mss_seen = 1;
-  					}
-  					break;
-  				/* Add other options here as people feel the urge to implement stuff like large windows */
+  				sk->ts_recent = ntohl(*(unsigned long *)ptr);
+  				tstamp = 1;
   			}
-  			ptr+=opsize-2;
-  			length-=opsize;
+  			break;
   	}
+  	ptr+=opsize-2;
+  	length-=opsize;
   }
   if (th->syn) {
     if (! mss_seen)
       sk->mtu=min(sk->mtu, 536);  /* default MSS if none sent */
+
+    /* Window scaling only counts if both ends asked for it. */
+    if (wscale >= 0) {
+      sk->wscale_ok = 1;
+      sk->snd_wscale = wscale;
+      sk->rcv_wscale = TCP_RCV_WSCALE;
+    } else {
+      sk->wscale_ok = 0;
+      sk->snd_wscale = 0;
+      sk->rcv_wscale = 0;
+    }
+
+    /* Leave room for the timestamp in every segment. */
+    if (tstamp && !sk->tstamp_ok) {
+      sk->tstamp_ok = 1;
+      sk->mtu -= TCPOLEN_TSTAMP_ALIGNED;
+    }
   }
   sk->mss = min(sk->max_window, sk->mtu);
 }
 
+
+/*
+ * Options for a SYN: the MSS we want, and window scaling and timestamps
+ * if we are offering them or answering a SYN that did. The MSS is what
+ * fits without options, so undo the room tcp_options() kept for ours.
+ */
+static int
+tcp_syn_options(struct sock *sk, unsigned char *ptr, int wscale, int tstamp)
+{
+  int len = 4;
+  int mss = sk->mtu;
+
+  if (sk->tstamp_ok)
+	mss += TCPOLEN_TSTAMP_ALIGNED;
+  ptr[0] = TCPOPT_MSS;
+  ptr[1] = 4;
+  ptr[2] = mss >> 8;
+  ptr[3] = mss & 0xff;
+  ptr += 4;
+  if (wscale) {
+	ptr[0] = TCPOPT_NOP;
+	ptr[1] = TCPOPT_WINDOW;
+	ptr[2] = TCPOLEN_WINDOW;
+	ptr[3] = TCP_RCV_WSCALE;
+	ptr += 4;
+	len += 4;
+  }
+  if (tstamp) {
+	ptr[0] = TCPOPT_NOP;
+	ptr[1] = TCPOPT_NOP;
+	ptr[2] = TCPOPT_TIMESTAMP;
+	ptr[3] = TCPOLEN_TIMESTAMP;
+	*(unsigned long *)(ptr + 4) = htonl(jiffies);
+	*(unsigned long *)(ptr + 8) = htonl(sk->ts_recent);
+	len += TCPOLEN_TSTAMP_ALIGNED;
+  }
+  return(len);
+}
+
 static inline unsigned long default_mask(unsigned long dst)
 {
 	dst = ntohl(dst);
@@ -1753,7 +1892,7 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
    * and if the listening socket is destroyed before this is taken
    * off of the queue, this will take care of it.
    */
-  newsk = (struct sock *) kmalloc(sizeof(struct sock), GFP_ATOMIC);
+  newsk = (struct sock *) kmem_cache_alloc(sock_cachep, GFP_ATOMIC);
   if (newsk == NULL) {
 	/* just ignore the syn.  It will get retransmitted. */
 	kfree_skb(skb, FREE_READ);
@@ -1765,12 +1904,24 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   newsk->wback = NULL;
   newsk->wfront = NULL;
   newsk->rqueue = NULL;
+  newsk->ooo_count = 0;
   newsk->send_head = NULL;
   newsk->send_tail = NULL;
   newsk->back_log = NULL;
+  newsk->lookup_next = NULL;
+  newsk->lookup_head = NULL;
   newsk->rtt = TCP_CONNECT_TIME << 3;
   newsk->rto = TCP_CONNECT_TIME;
   newsk->mdev = 0;
+  newsk->snd_wscale = 0;
+  newsk->rcv_wscale = 0;
+  newsk->wscale_ok = 0;
+  newsk->tstamp_ok = 0;
+  newsk->ts_recent = 0;
+  newsk->rcv_tsecr = 0;
+  newsk->saw_tstamp = 0;
+  newsk->rcv_space_seq = 0;
+  newsk->rcv_space_time = 0;
   newsk->max_window = 0;
   newsk->cong_window = 1;
   newsk->cong_count = 0;
@@ -1801,6 +1952,8 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   newsk->urg_data = 0;
   newsk->retransmits = 0;
   newsk->destroy = 0;
+  init_timer(&newsk->timer);
+  init_timer(&newsk->partial_timer);
   newsk->timer.data = (unsigned long)newsk;
   newsk->timer.function = &net_timer;
   newsk->dummy_th.source = skb->h.th->dest;
@@ -1858,7 +2011,7 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   
   buff->mem_addr = buff;
   buff->mem_len = MAX_SYN_SIZE;
-  buff->len = sizeof(struct tcphdr)+4;
+  buff->len = sizeof(struct tcphdr);
   buff->sk = newsk;
   
   t1 =(struct tcphdr *) buff->data;
@@ -1892,7 +2045,8 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   t1->ack = 1;
   newsk->window = tcp_select_window(newsk);/*newsk->prot->rspace(newsk);*/
   newsk->sent_seq = newsk->write_seq;
-  t1->window = ntohs(newsk->window);
+  /* The window in a SYN is never scaled. */
+  t1->window = ntohs(min(newsk->window, 65535));
   t1->res1 = 0;
   t1->res2 = 0;
   t1->rst = 0;
@@ -1900,15 +2054,13 @@ tcp_conn_request(struct sock *sk, struct sk_buff *skb,
   t1->psh = 0;
   t1->syn = 1;
   t1->ack_seq = ntohl(skb->h.th->seq+1);
-  t1->doff = sizeof(*t1)/4+1;
 
   ptr =(unsigned char *)(t1+1);
-  ptr[0] = 2;
-  ptr[1] = 4;
-  ptr[2] = ((newsk->mtu) >> 8) & 0xff;
-  ptr[3] =(newsk->mtu) & 0xff;
+  tmp = tcp_syn_options(newsk, ptr, newsk->wscale_ok, newsk->tstamp_ok);
+  t1->doff = (sizeof(*t1) + tmp)/4;
+  buff->len += tmp;
 
-  tcp_send_check(t1, daddr, saddr, sizeof(*t1)+4, newsk);
+  tcp_send_check(t1, daddr, saddr, sizeof(*t1)+tmp, newsk);
   newsk->prot->queue_xmit(newsk, dev, buff, 0);
 
   reset_timer(newsk, TIME_WRITE /* -1 ? FIXME ??? */, TCP_CONNECT_TIME);
@@ -2041,11 +2193,14 @@ tcp_close(struct sock *sk, int timeout)
 		/* Ack everything immediately from now on. */
 		sk->delay_acks = 0;
 		t1->ack_seq = ntohl(sk->acked_seq);
-		t1->window = ntohs(sk->window=tcp_select_window(sk)/*sk->prot->rspace(sk)*/);
+		sk->window = tcp_select_window(sk)/*sk->prot->rspace(sk)*/;
+		t1->window = ntohs(sk->window >> sk->rcv_wscale);
 		t1->fin = 1;
 		t1->rst = need_reset;
 		t1->doff = sizeof(*t1)/4;
-		tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+		tmp = need_reset ? 0 : tcp_build_tstamp(sk, t1);
+		buff->len += tmp;
+		tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1) + tmp, sk);
 
 		if (sk->wfront == NULL) {
 			sk->sent_seq = sk->write_seq;
@@ -2159,6 +2314,7 @@ static int
 tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 {
   unsigned long ack;
+  unsigned long window;
   int flag = 0;
   /* 
    * 1 - there was data in packet as well as ack or new data is sent or 
@@ -2171,12 +2327,15 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 	return(1);	/* Dead, cant ack any more so why bother */
 
   ack = ntohl(th->ack_seq);
+  window = ntohs(th->window);
+  if (!th->syn)
+	window <<= sk->snd_wscale;
   DPRINTF((DBG_TCP, "tcp_ack ack=%d, window=%d, "
 	  "sk->rcv_ack_seq=%d, sk->window_seq = %d\n",
-	  ack, ntohs(th->window), sk->rcv_ack_seq, sk->window_seq));
+	  ack, window, sk->rcv_ack_seq, sk->window_seq));
 
-  if (ntohs(th->window) > sk->max_window) {
-  	sk->max_window = ntohs(th->window);
+  if (window > sk->max_window) {
+  	sk->max_window = window;
 	sk->mss = min(sk->max_window, sk->mtu);
   }
 
@@ -2198,7 +2357,7 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
   if (len != th->doff*4) flag |= 1;
 
   /* See if our window has been shrunk. */
-  if (after(sk->window_seq, ack+ntohs(th->window))) {
+  if (after(sk->window_seq, ack+window)) {
 	/*
 	 * We may need to move packets from the send queue
 	 * to the write queue, if the window has been shrunk on us.
@@ -2216,7 +2375,7 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 
 	flag |= 4;
 
-	sk->window_seq = ack + ntohs(th->window);
+	sk->window_seq = ack + window;
 	cli();
 	while (skb2 != NULL) {
 		skb = skb2;
@@ -2226,7 +2385,7 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 			if (sk->packets_out > 0) sk->packets_out--;
 			/* We may need to remove this from the dev send list. */
 			if (skb->next != NULL) {
-				skb_unlink(skb);				
+				qdisc_unlink(skb);				
 			}
 			/* Now add it to the write_queue. */
 			skb->magic = TCP_WRITE_QUEUE_MAGIC;
@@ -2259,7 +2418,7 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 	sk->packets_out= 0;
   }
 
-  sk->window_seq = ack + ntohs(th->window);
+  sk->window_seq = ack + window;
 
   /* We don't want too many packets out there. */
   if (sk->timeout == TIME_WRITE && 
@@ -2364,7 +2523,12 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 
 		oskb = sk->send_head;
 
-		if (!(flag&2)) {
+		/*
+		 * A timestamp echo says which transmission is being
+		 * acked, so with one Karn's rule doesn't apply. Take
+		 * one sample from it per ack.
+		 */
+		if (!(flag&2) || sk->saw_tstamp) {
 		  long m;
 
 		  /* The following amusing code comes from Jacobson's
@@ -2374,7 +2538,11 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 		   * m stands for "measurement".
 		   */
 
-		  m = jiffies - oskb->when;  /* RTT */
+		  if (sk->saw_tstamp) {
+		    m = jiffies - sk->rcv_tsecr;
+		    sk->saw_tstamp = 0;
+		  } else
+		    m = jiffies - oskb->when;  /* RTT */
 		  m -= (sk->rtt >> 3);       /* m is now error in rtt est */
 		  sk->rtt += m;              /* rtt = 7/8 rtt + 1/8 new */
 		  if (m < 0)
@@ -2403,7 +2571,7 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 		}
 
 		/* We may need to remove this from the dev send list. */		
-		skb_unlink(oskb);	/* Much easier! */
+		qdisc_unlink(oskb);	/* Much easier! */
 		sti();
 		oskb->magic = 0;
 		kfree_skb(oskb, FREE_WRITE); /* write. */
@@ -2525,6 +2693,106 @@ tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 }
 
 
+/*
+ * The out of order part of the receive queue is indexed by the runs of
+ * contiguous data it is made of (sk->ooo[]), so that a segment that
+ * fills a hole far back doesn't have to walk every skb queued after
+ * it, and a retransmission of data we already hold can be thrown away
+ * without touching the queue at all. If there are more runs than the
+ * index has room for, or the queue is pruned, sk->ooo_count goes to -1
+ * and we fall back to walking the queue until it is all acked again.
+ */
+
+/* Index of the first run starting after seq. */
+static int
+tcp_ooo_find(struct sock *sk, unsigned long seq)
+{
+  int lo = 0, hi = sk->ooo_count, mid;
+
+  while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (after(sk->ooo[mid].start, seq))
+		hi = mid;
+	else
+		lo = mid + 1;
+  }
+  return(lo);
+}
+
+
+static inline void
+tcp_ooo_remove(struct sock *sk, int i)
+{
+  sk->ooo_count--;
+  memmove(&sk->ooo[i], &sk->ooo[i + 1],
+	  (sk->ooo_count - i) * sizeof(struct tcp_ooo_block));
+}
+
+
+/*
+ * Bring the index up to date after skb went into the queue. dup is
+ * the skb it replaced, if any.
+ */
+static void
+tcp_ooo_update(struct sock *sk, struct sk_buff *skb, struct sk_buff *dup)
+{
+  struct tcp_ooo_block *b = sk->ooo;
+  unsigned long seq = skb->h.th->seq;
+  unsigned long end = skb->h.th->ack_seq;
+  int i;
+
+  if (sk->ooo_count < 0)
+	return;
+
+  if (dup != NULL) {
+	i = tcp_ooo_find(sk, seq) - 1;
+	if (i >= 0) {
+		if (b[i].first == dup) b[i].first = skb;
+		if (b[i].last == dup) b[i].last = skb;
+	}
+  }
+
+  /* Whatever acked_seq has caught up with is no longer out of order. */
+  while (sk->ooo_count > 0 && !after(b[0].start, sk->acked_seq))
+	tcp_ooo_remove(sk, 0);
+  if (sk->ooo_count > 0 && b[0].first->acked) {
+	sk->ooo_count = -1;
+	return;
+  }
+  if (skb->acked)
+	return;
+
+  i = tcp_ooo_find(sk, seq);
+  if (i > 0 && !after(seq, b[i - 1].end)) {
+	i--;
+	if (after(end, b[i].end))
+		b[i].end = end;
+	if (!before(seq, b[i].last->h.th->seq))
+		b[i].last = skb;
+  } else {
+	if (sk->ooo_count == TCP_OOO_BLOCKS) {
+		sk->ooo_count = -1;
+		return;
+	}
+	memmove(&b[i + 1], &b[i],
+		(sk->ooo_count - i) * sizeof(struct tcp_ooo_block));
+	sk->ooo_count++;
+	b[i].start = seq;
+	b[i].end = end;
+	b[i].first = skb;
+	b[i].last = skb;
+  }
+
+  /* The run may now reach the ones after it. */
+  while (i + 1 < sk->ooo_count && !after(b[i + 1].start, b[i].end)) {
+	if (after(b[i + 1].end, b[i].end))
+		b[i].end = b[i + 1].end;
+	b[i].last = b[i + 1].last;
+	tcp_ooo_remove(sk, i + 1);
+  }
+}
+
+
 /*
  * This routine handles the data.  If there is room in the buffer,
  * it will be have already been moved into it.  If there is no
@@ -2534,9 +2802,10 @@ static int
 tcp_data(struct sk_buff *skb, struct sock *sk, 
 	 unsigned long saddr, unsigned short len)
 {
-  struct sk_buff *skb1, *skb2;
+  struct sk_buff *skb1, *skb2, *dup = NULL;
   struct tcphdr *th;
   int dup_dumped=0;
+  int i;
 
   th = skb->h.th;
   print_th(th);
@@ -2573,6 +2842,10 @@ tcp_data(struct sk_buff *skb, struct sock *sk,
    * out of order we will be able to fit things in nicely.
    */
 
+  /* Nothing out of order left, so the index can be trusted again. */
+  if (sk->rqueue == NULL || (sk->ooo_count < 0 && sk->rqueue->prev->acked))
+	sk->ooo_count = 0;
+
   /* This should start at the last one, and then go around forwards. */
   if (sk->rqueue == NULL) {
 	DPRINTF((DBG_TCP, "tcp_data: skb = %X:\n", skb));
@@ -2587,7 +2860,28 @@ tcp_data(struct sk_buff *skb, struct sock *sk,
 	skb1= NULL;
   } else {
 	DPRINTF((DBG_TCP, "tcp_data adding to chain sk = %X:\n", sk));
-	for(skb1=sk->rqueue->prev; ; skb1 =(struct sk_buff *)skb1->prev) {
+	skb1 = sk->rqueue->prev;
+	if (sk->ooo_count > 0) {
+		i = tcp_ooo_find(sk, th->seq);
+
+		/* All of it is already queued: just ack again. */
+		if (i > 0 && !th->syn && !th->fin && !th->urg &&
+		    !after(th->seq + skb->len, sk->ooo[i - 1].end)) {
+			tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
+			sk->ack_backlog++;
+			reset_timer(sk, TIME_WRITE, TCP_ACK_TIME);
+			kfree_skb(skb, FREE_READ);
+			return(0);
+		}
+
+		/* Start the walk just in front of the next run. */
+		if (i < sk->ooo_count) {
+			skb1 = sk->ooo[i].first;
+			if (skb1 != sk->rqueue)
+				skb1 = skb1->prev;
+		}
+	}
+	for(; ; skb1 =(struct sk_buff *)skb1->prev) {
 		if(sk->debug)
 		{
 			printk("skb1=%p :", skb1);
@@ -2620,6 +2914,7 @@ tcp_data(struct sk_buff *skb, struct sock *sk,
 			skb_append(skb1,skb);
 			skb_unlink(skb1);
 			kfree_skb(skb1,FREE_READ);
+			dup = skb1;
 			dup_dumped=1;
 			skb1=NULL;
 			break;
@@ -2717,6 +3012,8 @@ tcp_data(struct sk_buff *skb, struct sock *sk,
 	}
   }
 
+  tcp_ooo_update(sk, skb, dup);
+
   /*
    * If we've missed a packet, send an ack.
    * Also start a timer to send another.
@@ -2741,6 +3038,7 @@ tcp_data(struct sk_buff *skb, struct sock *sk,
 		}
 		
 		skb_unlink(skb1);
+		sk->ooo_count = -1;
 #ifdef OLDWAY		
 		if (skb1->prev == skb1) {
 			sk->rqueue = NULL;
@@ -2976,6 +3274,7 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   sk->rcv_ack_seq = sk->write_seq -1;
   sk->err = 0;
   sk->dummy_th.dest = sin.sin_port;
+  rehash_sock(sk);
   release_sock(sk);
 
   buff = sk->prot->wmalloc(sk,MAX_SYN_SIZE,0, GFP_KERNEL);
@@ -2985,7 +3284,7 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   sk->inuse = 1;
   buff->mem_addr = buff;
   buff->mem_len = MAX_SYN_SIZE;
-  buff->len = 24;
+  buff->len = sizeof(struct tcphdr);
   buff->sk = sk;
   buff->free = 1;
   t1 = (struct tcphdr *) buff->data;
@@ -3015,7 +3314,6 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   t1->psh = 0;
   t1->syn = 1;
   t1->urg_ptr = 0;
-  t1->doff = 6;
 
 /* use 512 or whatever user asked for */
   if (sk->user_mss)
@@ -3033,14 +3331,19 @@ tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
 /* but not bigger than device MTU */
   sk->mtu = min(sk->mtu, dev->mtu - HEADER_SIZE);
 
-  /* Put in the TCP options to say MTU. */
+  /* Put in the TCP options to say MTU, and offer the RFC 1323 ones. */
+  sk->snd_wscale = 0;
+  sk->rcv_wscale = 0;
+  sk->wscale_ok = 0;
+  sk->tstamp_ok = 0;
+  sk->saw_tstamp = 0;
+  sk->ts_recent = 0;
   ptr = (unsigned char *)(t1+1);
-  ptr[0] = 2;
-  ptr[1] = 4;
-  ptr[2] = (sk->mtu) >> 8;
-  ptr[3] = (sk->mtu) & 0xff;
+  tmp = tcp_syn_options(sk, ptr, 1, 1);
+  t1->doff = (sizeof(struct tcphdr) + tmp)/4;
+  buff->len += tmp;
   tcp_send_check(t1, sk->saddr, sk->daddr,
-		  sizeof(struct tcphdr) + 4, sk);
+		  sizeof(struct tcphdr) + tmp, sk);
 
   /* This must go first otherwise a really quick response will get reset. */
   sk->state = TCP_SYN_SENT;
@@ -3264,6 +3567,7 @@ if (inet_debug == DBG_SLIP) printk("\rtcp_rcv: not in seq\n");
 			release_sock(sk);
 			return(0);
 		}
+		tcp_parse_tstamp(sk, th);
 
 		if (th->rst) {
 			sk->zapped=1;
@@ -3594,9 +3898,11 @@ tcp_write_wakeup(struct sock *sk)
   t1->fin = 0;
   t1->syn = 0;
   t1->ack_seq = ntohl(sk->acked_seq);
-  t1->window = ntohs(tcp_select_window(sk)/*sk->prot->rspace(sk)*/);
+  t1->window = ntohs(tcp_select_window(sk) >> sk->rcv_wscale);
   t1->doff = sizeof(*t1)/4;
-  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+  tmp = tcp_build_tstamp(sk, t1);
+  buff->len += tmp;
+  tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1) + tmp, sk);
 
   /* Send it and free it.
    * This will prevent the timer from automatically being restarted.
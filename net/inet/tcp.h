@@ -20,10 +20,10 @@
 
 #include <linux/tcp.h>
 
-#define MAX_SYN_SIZE	44 + sizeof (struct sk_buff) + MAX_HEADER
-#define MAX_FIN_SIZE	40 + sizeof (struct sk_buff) + MAX_HEADER
-#define MAX_ACK_SIZE	40 + sizeof (struct sk_buff) + MAX_HEADER
-#define MAX_RESET_SIZE	40 + sizeof (struct sk_buff) + MAX_HEADER
+#define MAX_SYN_SIZE	60 + sizeof (struct sk_buff) + MAX_HEADER
+#define MAX_FIN_SIZE	52 + sizeof (struct sk_buff) + MAX_HEADER
+#define MAX_ACK_SIZE	52 + sizeof (struct sk_buff) + MAX_HEADER
+#define MAX_RESET_SIZE	52 + sizeof (struct sk_buff) + MAX_HEADER
 #define MAX_WINDOW	4096
 #define MIN_WINDOW	2048
 #define MAX_ACK_BACKLOG	2
@@ -73,6 +73,15 @@
 #define TCPOPT_NOP		1
 #define TCPOPT_EOL		0
 #define TCPOPT_MSS		2
+#define TCPOPT_WINDOW		3	/* RFC 1323 window scale */
+#define TCPOPT_TIMESTAMP	8	/* RFC 1323 timestamps */
+
+#define TCPOLEN_WINDOW		3
+#define TCPOLEN_TIMESTAMP	10
+#define TCPOLEN_TSTAMP_ALIGNED	12	/* with two NOPs in front */
+
+#define TCP_MAX_WSCALE		14
+#define TCP_RCV_WSCALE		2	/* 65535 << 2 covers SK_RMEM_LIMIT/2 */
 
 /*
  * The next routines deal with comparing 32 bit unsigned ints
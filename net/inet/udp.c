@@ -135,79 +135,16 @@ sport=%d,dport=%d", err, header, daddr, saddr, protocol, (int)th->source,(int)th
 }
 
 
-static unsigned short
-udp_check(struct udphdr *uh, int len,
-	  unsigned long saddr, unsigned long daddr)
-{
-  unsigned long sum;
-
-  DPRINTF((DBG_UDP, "UDP: check(uh=%X, len = %d, saddr = %X, daddr = %X)\n",
-	   						uh, len, saddr, daddr));
-
-  print_udp(uh);
-
-  __asm__("\t addl %%ecx,%%ebx\n"
-	  "\t adcl %%edx,%%ebx\n"
-	  "\t adcl $0, %%ebx\n"
-	  : "=b"(sum)
-	  : "0"(daddr), "c"(saddr), "d"((ntohs(len) << 16) + IPPROTO_UDP*256)
-	  : "cx","bx","dx" );
-
-  if (len > 3) {
-	__asm__("\tclc\n"
-		"1:\n"
-		"\t lodsl\n"
-		"\t adcl %%eax, %%ebx\n"
-		"\t loop 1b\n"
-		"\t adcl $0, %%ebx\n"
-		: "=b"(sum) , "=S"(uh)
-		: "0"(sum), "c"(len/4) ,"1"(uh)
-		: "ax", "cx", "bx", "si" );
-  }
-
-  /* Convert from 32 bits to 16 bits. */
-  __asm__("\t movl %%ebx, %%ecx\n"
-	  "\t shrl $16,%%ecx\n"
-	  "\t addw %%cx, %%bx\n"
-	  "\t adcw $0, %%bx\n"
-	  : "=b"(sum)
-	  : "0"(sum)
-	  : "bx", "cx");
-
-  /* Check for an extra word. */
-  if ((len & 2) != 0) {
-	__asm__("\t lodsw\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum), "=S"(uh)
-		: "0"(sum) ,"1"(uh)
-		: "si", "ax", "bx");
-  }
-
-  /* Now check for the extra byte. */
-  if ((len & 1) != 0) {
-	__asm__("\t lodsb\n"
-		"\t movb $0,%%ah\n"
-		"\t addw %%ax,%%bx\n"
-		"\t adcw $0, %%bx\n"
-		: "=b"(sum)
-		: "0"(sum) ,"S"(uh)
-		: "si", "ax", "bx");
-  }
-
-  /* We only want the bottom 16 bits, but we never cleared the top 16. */
-  return((~sum) & 0xffff);
-}
-
-
+/* 'csum' is the partial sum of the data, which follows the header. */
 static void
 udp_send_check(struct udphdr *uh, unsigned long saddr, 
-	       unsigned long daddr, int len, struct sock *sk)
+	       unsigned long daddr, int len, unsigned long csum, struct sock *sk)
 {
   uh->check = 0;
   if (sk && sk->no_check) 
   	return;
-  uh->check = udp_check(uh, len, saddr, daddr);
+  csum = csum_partial((unsigned char *) uh, sizeof(struct udphdr), csum);
+  uh->check = csum_tcpudp_magic(saddr, daddr, len, IPPROTO_UDP, csum);
   if (uh->check == 0) uh->check = 0xffff;
 }
 
@@ -220,7 +157,7 @@ udp_send(struct sock *sk, struct sockaddr_in *sin,
   struct device *dev;
   struct udphdr *uh;
   unsigned char *buff;
-  unsigned long saddr;
+  unsigned long saddr, csum;
   int size, tmp;
   int err;
   
@@ -286,11 +223,9 @@ udp_send(struct sock *sk, struct sockaddr_in *sin,
   uh->dest = sin->sin_port;
   buff = (unsigned char *) (uh + 1);
 
-  /* Copy the user data. */
-  memcpy_fromfs(buff, from, len);
-
-  /* Set up the UDP checksum. */
-  udp_send_check(uh, saddr, sin->sin_addr.s_addr, skb->len - tmp, sk);
+  /* Copy the user data, and set up the UDP checksum as we go. */
+  csum = csum_partial_copy_fromfs((char *) from, (char *) buff, len, 0);
+  udp_send_check(uh, saddr, sin->sin_addr.s_addr, skb->len - tmp, csum, sk);
 
   /* Send the datagram to the interface. */
   sk->prot->queue_xmit(sk, dev, skb, 1);
@@ -473,13 +408,40 @@ udp_recvfrom(struct sock *sk, unsigned char *to, int len,
   er=verify_area(VERIFY_WRITE,to,len);
   if(er)
   	return er;
+retry:
   skb=skb_recv_datagram(sk,flags,noblock,&er);
   if(skb==NULL)
   	return er;
   copied = min(len, skb->len);
 
-  /* FIXME : should use udp header size info value */
-  skb_copy_datagram(skb,sizeof(struct udphdr),to,copied);
+  /*
+   * udp_rcv() left the checksum to us. Check it while copying the data
+   * out, unless we only copy part of it or leave it queued: then check
+   * it first, so that the user never sees a bad datagram twice.
+   */
+  if (skb->csum_unverified) {
+	unsigned char *data = (unsigned char *) (skb->h.uh + 1);
+	unsigned long csum;
+
+	if (copied < skb->len || (flags & MSG_PEEK)) {
+		csum = csum_partial(data, skb->len, skb->csum);
+		if (!csum_fold(csum)) {
+			skb->csum_unverified = 0;
+			skb_copy_datagram(skb,sizeof(struct udphdr),(char *) to,copied);
+		}
+	} else
+		csum = csum_partial_copy_tofs((char *) data, (char *) to,
+					      copied, skb->csum);
+	if (csum_fold(csum)) {
+		DPRINTF((DBG_UDP, "UDP: bad checksum\n"));
+		if (flags & MSG_PEEK)
+			skb_unlink(skb);
+		skb_free_datagram(skb);
+		goto retry;
+	}
+  } else
+	/* FIXME : should use udp header size info value */
+	skb_copy_datagram(skb,sizeof(struct udphdr),(char *) to,copied);
 
   /* Copy the address. */
   if (sin) {
@@ -528,6 +490,7 @@ udp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   sk->daddr = sin.sin_addr.s_addr;
   sk->dummy_th.dest = sin.sin_port;
   sk->state = TCP_ESTABLISHED;
+  rehash_sock(sk);
   return(0);
 }
 
@@ -569,11 +532,15 @@ udp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 	return(0);
   }
 
-  if (uh->check && udp_check(uh, len, saddr, daddr)) {
-	DPRINTF((DBG_UDP, "UDP: bad checksum\n"));
-	skb->sk = NULL;
-	kfree_skb(skb, FREE_WRITE);
-	return(0);
+  /*
+   * Sum the header and pseudo header now; the data is checked by
+   * udp_recvfrom() while it copies it out.
+   */
+  skb->csum_unverified = 0;
+  if (uh->check) {
+	skb->csum = csum_tcpudp_nofold(saddr, daddr, len, IPPROTO_UDP,
+		csum_partial((unsigned char *) uh, sizeof(*uh), 0));
+	skb->csum_unverified = 1;
   }
 
   skb->sk = sk;
@@ -415,6 +415,7 @@ static __unused int parse_open_namei(const char *pathname, int flag, int mode,
             error = dir->i_op->create(dir, basename, namelen, 
                                                  mode, res_inode);
 #endif
+            dir->i_version = ++event;
             up(&dir->i_sem);
             iput(dir);
             return error;
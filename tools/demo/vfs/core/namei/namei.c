@@ -423,6 +423,7 @@ static int do_open_namei(const char *pathname, int flag, int mode,
             dir->i_count++;   /* create eats the dir */
             error = dir->i_op->create(dir, basename, namelen, mode,
                               res_inode);
+            dir->i_version = ++event;
             up(&dir->i_sem);
             iput(dir);
             return error;
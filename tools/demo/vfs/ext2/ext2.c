@@ -2480,11 +2480,94 @@ static __unused int ext2_directory(struct super_block *sb,
     return 0;
 }
 
+/*
+ * EXT2-FS fragmentation report
+ *   A file is laid out well when its blocks are contiguous on disk, so
+ *   that a sequential read doesn't have to seek. The blocks of the file
+ *   are looked up with ext2_bmap() and counted in extents: runs of
+ *   logical blocks that are also consecutive on disk. A file with one
+ *   extent per block group it needs (a group holds at most
+ *   s_blocks_per_group blocks, minus its metadata) is as good as it gets.
+ *
+ *   The free space is measured the same way, from the block bitmap of
+ *   each group: the number of free extents and the largest of them. Many
+ *   small free extents mean the next files will be fragmented too.
+ */
+static __unused int ext2_fragment(struct super_block *sb,
+                                  struct inode *inode)
+{
+    unsigned long nr_blocks, block, prev, extents, run, largest, holes;
+    unsigned long free, free_extents, free_largest, ideal;
+    struct ext2_group_desc *gdp;
+    struct buffer_head *bh;
+    int i, j;
+
+    nr_blocks = (inode->i_size + sb->s_blocksize - 1) / sb->s_blocksize;
+    extents = holes = largest = run = prev = 0;
+    for (i = 0; i < nr_blocks; i++) {
+        block = ext2_bmap(inode, i);
+        if (!block) {
+            holes++;
+            prev = 0;
+            continue;
+        }
+        if (!prev || block != prev + 1) {
+            extents++;
+            run = 0;
+        }
+        if (++run > largest)
+            largest = run;
+        prev = block;
+    }
+    ideal = (nr_blocks - holes + EXT2_BLOCKS_PER_GROUP(sb) - 1) /
+             EXT2_BLOCKS_PER_GROUP(sb);
+    printk("Inode %lu: %lu blocks, %lu holes, %lu extents (ideal %lu), "
+           "largest extent %lu blocks\n", inode->i_ino,
+           nr_blocks - holes, holes, extents, ideal, largest);
+
+    free = free_extents = free_largest = 0;
+    for (i = 0; i < sb->u.ext2_sb.s_groups_count; i++) {
+        unsigned long g_extents = 0, g_largest = 0;
+
+        gdp = get_group_desc(sb, i, NULL);
+        bh = bread(sb->s_dev, gdp->bg_block_bitmap, sb->s_blocksize);
+        if (!bh) {
+            printk(KERN_ERR "Ext2-fs: unable to read block bitmap\n");
+            continue;
+        }
+        run = 0;
+        for (j = 0; j < EXT2_BLOCKS_PER_GROUP(sb); j++) {
+            if (test_bit(j, bh->b_data)) {
+                run = 0;
+                continue;
+            }
+            if (!run++)
+                g_extents++;
+            if (run > g_largest)
+                g_largest = run;
+        }
+        brelse(bh);
+        printk("Group %d: %d free blocks, %lu free extents, "
+               "largest %lu\n", i, gdp->bg_free_blocks_count,
+               g_extents, g_largest);
+        free += gdp->bg_free_blocks_count;
+        free_extents += g_extents;
+        if (g_largest > free_largest)
+            free_largest = g_largest;
+    }
+    printk("Free space: %lu blocks in %lu extents, largest %lu, "
+           "average %lu\n", free, free_extents, free_largest,
+           free_extents ? free / free_extents : 0);
+    return 0;
+}
+
 asmlinkage int sys_vfs_ext2fs(int fd)
 {
     struct super_block *sb, *raw_sb;
     struct file *filp;
     struct inode *inode, *root;
+    unsigned long nr, size;
+    char *p;
 
     filp = current->filp[fd];
     inode = filp->f_inode;
@@ -2505,6 +2588,33 @@ asmlinkage int sys_vfs_ext2fs(int fd)
     memset(raw_sb, 0, sizeof(*raw_sb));
     raw_sb->s_dev = sb->s_dev;
 
+    /*
+     * The bitmap caches are sized when a file system is mounted,
+     * so give the raw super block room for one bitmap per group.
+     */
+    nr = sb->u.ext2_sb.s_groups_count;
+    if (nr < EXT2_MAX_GROUP_LOADED)
+        nr = EXT2_MAX_GROUP_LOADED;
+    size = nr * (sizeof(struct ext2_group_info) +
+                 2 * (sizeof(unsigned long) + sizeof(struct buffer_head *)));
+    p = (char *)kmalloc(size, GFP_KERNEL);
+    if (!p) {
+        printk(KERN_ERR "No free memory to allocate bitmap cache\n");
+        kfree(raw_sb);
+        return -ENOMEM;
+    }
+    memset(p, 0, size);
+    raw_sb->u.ext2_sb.s_group_info = (struct ext2_group_info *)p;
+    p += nr * sizeof(struct ext2_group_info);
+    raw_sb->u.ext2_sb.s_block_bitmap = (struct buffer_head **)p;
+    p += nr * sizeof(struct buffer_head *);
+    raw_sb->u.ext2_sb.s_inode_bitmap = (struct buffer_head **)p;
+    p += nr * sizeof(struct buffer_head *);
+    raw_sb->u.ext2_sb.s_block_bitmap_number = (unsigned long *)p;
+    p += nr * sizeof(unsigned long);
+    raw_sb->u.ext2_sb.s_inode_bitmap_number = (unsigned long *)p;
+    raw_sb->u.ext2_sb.s_max_loaded = nr;
+
 #ifdef CONFIG_DEBUG_EXT2_SUPERBLOCK
     ext2_superblock(raw_sb);
 #endif
@@ -2520,7 +2630,11 @@ asmlinkage int sys_vfs_ext2fs(int fd)
 #ifdef CONFIG_DEBUG_EXT2_DIRECTORY
     ext2_directory(sb, root);
 #endif
+#ifdef CONFIG_DEBUG_EXT2_FRAGMENT
+    ext2_fragment(sb, inode);
+#endif
 
+    kfree(raw_sb->u.ext2_sb.s_group_info);
     kfree(raw_sb);
     iput(root);
     iput(inode);